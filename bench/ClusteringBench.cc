@@ -0,0 +1,150 @@
+/*
+ * Microbenchmark of the Hoshen-Kopelman clustering of a sensor:
+ * full grid scan with FindUnionAlgorithm against SparseFindUnion over the fired pixels only.
+ *
+ * Usage: ClusteringBench [rows] [columns] [iterations]
+ */
+
+#include "FindUnionAlgorithm.h"
+#include "SparseFindUnion.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+using std::vector;
+using bench_clock = std::chrono::steady_clock;
+
+namespace
+{
+    /*
+     * The same scan of HKBaseSensor::buildHits, the status of the pixels is read from a flat grid
+     */
+    size_t FullGridScan(FindUnionAlgorithm& fu_algo, const vector<char>& grid, int rows, int cols, bool hk8_on)
+    {
+        auto is_on = [&](int i, int j)
+        {
+            return i >= 0 && j >= 0 && i < rows && j < cols && grid[i * cols + j] != 0;
+        };
+
+        fu_algo.init();
+        for (int i = 0; i < rows; i++)
+        {
+            for (int j = 0; j < cols; j++)
+            {
+                if (!is_on(i, j))
+                {
+                    fu_algo.invalidate(i, j);
+                    continue;
+                }
+
+                bool N_is_on = is_on(i - 1, j);
+                bool W_is_on = is_on(i, j - 1);
+                bool NW_is_on = hk8_on ? is_on(i - 1, j - 1) : false;
+                bool NE_is_on = hk8_on ? is_on(i - 1, j + 1) : false;
+
+                if (N_is_on and W_is_on)
+                {
+                    fu_algo.merge(i - 1, j, i, j - 1);
+                    fu_algo.merge(i, j - 1, i, j);
+                }
+                else if (W_is_on and NE_is_on)
+                {
+                    fu_algo.merge(i, j - 1, i - 1, j + 1);
+                    fu_algo.merge(i - 1, j + 1, i, j);
+                }
+                else if (NW_is_on and NE_is_on)
+                {
+                    fu_algo.merge(i - 1, j - 1, i - 1, j + 1);
+                    fu_algo.merge(i - 1, j + 1, i, j);
+                }
+                else if (W_is_on)
+                {
+                    fu_algo.merge(i, j - 1, i, j);
+                }
+                else if (N_is_on)
+                {
+                    fu_algo.merge(i - 1, j, i, j);
+                }
+                else if (NW_is_on)
+                {
+                    fu_algo.merge(i - 1, j - 1, i, j);
+                }
+                else if (NE_is_on)
+                {
+                    fu_algo.merge(i - 1, j + 1, i, j);
+                }
+            }
+        }
+        fu_algo.close();
+        return fu_algo.get_clusters().size();
+    }
+
+    size_t SparseScan(SparseFindUnion& sf_algo, const vector<GridCoordinate>& fired)
+    {
+        sf_algo.init();
+        for (const GridCoordinate& g_pos : fired) sf_algo.add(g_pos.row, g_pos.col);
+        sf_algo.close();
+        return sf_algo.get_clusters().size();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int rows = argc > 1 ? std::atoi(argv[1]) : 512;
+    int cols = argc > 2 ? std::atoi(argv[2]) : 512;
+    int n_iter = argc > 3 ? std::atoi(argv[3]) : 20;
+
+    const double occupancy[] = { 1e-5, 1e-4, 1e-3, 1e-2, 5e-2, 1e-1, 3e-1 };
+
+    std::mt19937 rng(12345);
+    FindUnionAlgorithm fu_algo(rows, cols);
+    SparseFindUnion sf_algo(rows, cols, true);
+
+    std::cout << "Grid " << rows << " x " << cols << ", " << n_iter << " iterations, 8-connectivity" << std::endl;
+    std::cout << std::setw(12) << "occupancy" << std::setw(10) << "fired"
+              << std::setw(10) << "clusters" << std::setw(14) << "full (us)"
+              << std::setw(14) << "sparse (us)" << std::setw(10) << "speedup" << std::endl;
+
+    for (double occ : occupancy)
+    {
+        std::bernoulli_distribution fire(occ);
+        vector<char> grid(rows * cols, 0);
+        vector<GridCoordinate> fired;
+        for (int i = 0; i < rows; i++)
+        {
+            for (int j = 0; j < cols; j++)
+            {
+                if (!fire(rng)) continue;
+                grid[i * cols + j] = 1;
+                fired.push_back({ i, j });
+            }
+        }
+        // The agent provides the pixels in arbitrary order
+        std::shuffle(fired.begin(), fired.end(), rng);
+
+        size_t n_full = 0;
+        auto t0 = bench_clock::now();
+        for (int it = 0; it < n_iter; it++) n_full = FullGridScan(fu_algo, grid, rows, cols, true);
+        auto t1 = bench_clock::now();
+
+        size_t n_sparse = 0;
+        for (int it = 0; it < n_iter; it++) n_sparse = SparseScan(sf_algo, fired);
+        auto t2 = bench_clock::now();
+
+        double full_us = std::chrono::duration<double, std::micro>(t1 - t0).count() / n_iter;
+        double sparse_us = std::chrono::duration<double, std::micro>(t2 - t1).count() / n_iter;
+
+        std::cout << std::setw(12) << occ << std::setw(10) << fired.size()
+                  << std::setw(10) << n_sparse << std::setw(14) << std::fixed << std::setprecision(1) << full_us
+                  << std::setw(14) << sparse_us << std::setw(10) << std::setprecision(2) << full_us / sparse_us
+                  << std::defaultfloat << std::setprecision(6);
+        if (n_full != n_sparse) std::cout << "  MISMATCH (" << n_full << ")";
+        std::cout << std::endl;
+    }
+
+    return 0;
+}
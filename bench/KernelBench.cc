@@ -0,0 +1,506 @@
+/*
+ * Benchmark of the digitisation kernels of MuonCVXDRealDigitiser on synthetic hit streams,
+ * without Marlin, geometry or input files: a single ladder is described by a mock planar surface.
+ *
+ * Kernels:
+ *  - fluctuation: G4UniversalFluctuation, energy loss of the segments of each hit
+ *  - charge:      PixelChargeKernel, integration of the signal points over the pixels
+ *  - offload:     PixelOffloadKernel, the same integration in a single batch for each event
+ *  - matrix:      HKBaseSensor (PixelDigiMatrix + FindUnionAlgorithm), charge injected directly
+ *  - trivial:     TypedSlidingWindow + TrivialSensor, the full chain of a ladder
+ *  - hk:          TypedSlidingWindow + HKBaseSensor, the full chain of a ladder
+ *
+ * Usage: KernelBench [occupancy] [time spread (ns)] [incidence angle (deg)] [events] [window size (ns)]
+ * the occupancy is the number of hits per event over the number of pixels of the ladder.
+ */
+
+#include "AbstractSensor.h"
+#include "DetElemSlidingWindow.h"
+#include "G4UniversalFluctuation.h"
+#include "HitTemporalIndexes.h"
+#include "HKBaseSensor.h"
+#include "PixelChargeKernel.h"
+#include "PixelOffloadKernel.h"
+#include "SurfaceCache.h"
+#include "TrivialSensor.h"
+
+#include "DD4hep/DD4hepUnits.h"
+#include "DDRec/Material.h"
+#include "DDRec/Surface.h"
+#include "EVENT/LCIO.h"
+#include "IMPL/LCCollectionVec.h"
+#include "IMPL/SimTrackerHitImpl.h"
+#include "UTIL/BitField64.h"
+#include "UTIL/LCTrackerConf.h"
+#include "marlin/VerbosityLevels.h"
+#include "streamlog/streamlog.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+
+using std::vector;
+using bench_clock = std::chrono::steady_clock;
+using dd4hep::rec::ISurface;
+using dd4hep::rec::IMaterial;
+using dd4hep::rec::MaterialData;
+using dd4hep::rec::SurfaceMap;
+using dd4hep::rec::SurfaceType;
+using dd4hep::rec::Vector2D;
+using dd4hep::rec::Vector3D;
+
+/*
+ * Allocation counter, every heap allocation of the process goes through these operators
+ */
+namespace
+{
+    std::atomic<std::size_t> alloc_count { 0 };
+}
+
+void* operator new(std::size_t size)
+{
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = std::malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+namespace
+{
+    // Geometry of a ladder of the first layer, lengths in mm
+    const float LADDER_LENGTH = 25.6;
+    const float LADDER_WIDTH = 12.8;
+    const float LADDER_THICKNESS = 0.05;
+    const double PIXEL_SIZE = 0.025;
+    const double THRESHOLD = 500.;
+    const double ELECTRONS_PER_KEV = 270.3;
+
+    /*
+     * Planar surface with u along y, v along z and the normal along x, centred in the origin;
+     * the interface of dd4hep::rec::ISurface is in the internal units of DD4hep.
+     */
+    class MockPlaneSurface : public ISurface
+    {
+    public:
+        MockPlaneSurface(long64 surf_id, double half_width, double half_length, double half_thickness) :
+            s_id(surf_id),
+            s_type(SurfaceType::Plane, SurfaceType::Sensitive),
+            s_origin(0., 0., 0.),
+            s_material("Silicon", 14., 28.0855, 2.33, 9.37 * dd4hep::cm, 46.52 * dd4hep::cm),
+            h_width(half_width),
+            h_length(half_length),
+            h_thickness(half_thickness)
+        {}
+
+        long64 id() const override { return s_id; }
+        const SurfaceType& type() const override { return s_type; }
+        Vector3D u(const Vector3D& point = Vector3D()) const override { return Vector3D(0., 1., 0.); }
+        Vector3D v(const Vector3D& point = Vector3D()) const override { return Vector3D(0., 0., 1.); }
+        Vector3D normal(const Vector3D& point = Vector3D()) const override { return Vector3D(1., 0., 0.); }
+        const Vector3D& origin() const override { return s_origin; }
+        Vector2D globalToLocal(const Vector3D& point) const override { return Vector2D(point.y(), point.z()); }
+        Vector3D localToGlobal(const Vector2D& point) const override { return Vector3D(0., point.u(), point.v()); }
+        const IMaterial& innerMaterial() const override { return s_material; }
+        const IMaterial& outerMaterial() const override { return s_material; }
+        double innerThickness() const override { return h_thickness; }
+        double outerThickness() const override { return h_thickness; }
+        double distance(const Vector3D& point) const override { return point.x(); }
+        double length_along_u() const override { return 2 * h_width; }
+        double length_along_v() const override { return 2 * h_length; }
+
+        bool insideBounds(const Vector3D& point, double epsilon = 1.e-4) const override
+        {
+            return std::fabs(point.x()) < h_thickness + epsilon
+                && std::fabs(point.y()) < h_width + epsilon
+                && std::fabs(point.z()) < h_length + epsilon;
+        }
+
+    private:
+        long64 s_id;
+        SurfaceType s_type;
+        Vector3D s_origin;
+        MaterialData s_material;
+        double h_width;
+        double h_length;
+        double h_thickness;
+    };
+
+    struct BenchConfig
+    {
+        double occupancy;
+        float time_spread;
+        float incidence;
+        int n_events;
+        float window_size;
+    };
+
+    inline int HitsPerEvent(const BenchConfig& cfg)
+    {
+        double n_pixels = (LADDER_WIDTH / PIXEL_SIZE) * (LADDER_LENGTH / PIXEL_SIZE);
+        return std::max(1L, std::lround(cfg.occupancy * n_pixels));
+    }
+
+    struct BenchResult
+    {
+        double seconds = 0.;
+        std::size_t hits = 0;
+        std::size_t pixels = 0;
+        std::size_t clusters = 0;
+        std::size_t allocs = 0;
+    };
+
+    /*
+     * Minimum ionising particles on the ladder, uniform in space and time; the direction
+     * has a fixed angle with respect to the normal and a random azimuth.
+     */
+    class HitGenerator
+    {
+    public:
+        HitGenerator(const BenchConfig& cfg, int cell_id, unsigned seed) :
+            config(cfg),
+            cellID(cell_id),
+            rng(seed)
+        {}
+
+        IMPL::LCCollectionVec* Generate(const std::string& enc_str)
+        {
+            IMPL::LCCollectionVec* col = new IMPL::LCCollectionVec(EVENT::LCIO::SIMTRACKERHIT);
+            col->parameters().setValue(EVENT::LCIO::CellIDEncoding, enc_str);
+
+            std::uniform_real_distribution<double> u_pos(-0.49 * LADDER_WIDTH, 0.49 * LADDER_WIDTH);
+            std::uniform_real_distribution<double> v_pos(-0.49 * LADDER_LENGTH, 0.49 * LADDER_LENGTH);
+            std::uniform_real_distribution<float> t_dist(0., config.time_spread);
+            std::uniform_real_distribution<double> phi_dist(0., 2 * M_PI);
+
+            double theta = config.incidence * M_PI / 180.;
+            float path = LADDER_THICKNESS / std::cos(theta);
+            int n_hits = HitsPerEvent(config);
+
+            for (int i = 0; i < n_hits; i++)
+            {
+                double phi = phi_dist(rng);
+                double pos[3] = { 0., u_pos(rng), v_pos(rng) };
+                float mom[3] = {
+                    float(std::cos(theta)),
+                    float(std::sin(theta) * std::cos(phi)),
+                    float(std::sin(theta) * std::sin(phi))
+                };
+
+                IMPL::SimTrackerHitImpl* hit = new IMPL::SimTrackerHitImpl();
+                hit->setCellID0(cellID);
+                hit->setPosition(pos);
+                hit->setMomentum(mom);
+                hit->setTime(t_dist(rng));
+                hit->setPathLength(path);
+                // 280 keV/mm in GeV
+                hit->setEDep(0.28e-3 * path);
+                col->addElement(hit);
+            }
+            return col;
+        }
+
+    private:
+        BenchConfig config;
+        int cellID;
+        std::mt19937 rng;
+    };
+
+    BenchResult RunFluctuation(const BenchConfig& cfg)
+    {
+        G4UniversalFluctuation fluctuate {};
+        std::mt19937 rng(12345);
+        std::uniform_real_distribution<double> p_dist(100., 10000.);
+
+        double path = LADDER_THICKNESS / std::cos(cfg.incidence * M_PI / 180.);
+        int n_seg = std::ceil(path / 0.005);
+        double mean_loss = 0.28 * path / n_seg;
+        int n_hits = HitsPerEvent(cfg);
+        vector<double> losses(n_seg, 0.);
+
+        BenchResult result {};
+        std::size_t a_start = alloc_count.load();
+        auto t0 = bench_clock::now();
+        for (int evt = 0; evt < cfg.n_events; evt++)
+        {
+            for (int i = 0; i < n_hits; i++)
+            {
+                fluctuate.SampleFluctuations(p_dist(rng), 105.66, 0.03, path / n_seg, mean_loss,
+                                             n_seg, losses.data());
+            }
+            result.hits += n_hits;
+        }
+        result.seconds = std::chrono::duration<double>(bench_clock::now() - t0).count();
+        result.allocs = alloc_count.load() - a_start;
+        return result;
+    }
+
+    BenchResult RunChargeKernel(const BenchConfig& cfg)
+    {
+        PixelChargeKernel kernel { GaussCDFMode::exact };
+        std::mt19937 rng(12345);
+        std::uniform_real_distribution<double> c_dist(0., PIXEL_SIZE);
+        std::uniform_real_distribution<double> s_dist(0.5e-3, 3.5e-3);
+
+        int n_hits = HitsPerEvent(cfg);
+        // See DetElemSlidingWindow::UpdatePixels, a box of 3 sigma on each side
+        const int n_points = 10;
+
+        BenchResult result {};
+        std::size_t a_start = alloc_count.load();
+        auto t0 = bench_clock::now();
+        for (int evt = 0; evt < cfg.n_events; evt++)
+        {
+            for (int i = 0; i < n_hits * n_points; i++)
+            {
+                double sigma = s_dist(rng);
+                int n_box = 2 * int(std::ceil(3 * sigma / PIXEL_SIZE)) + 1;
+                double edge = -0.5 * n_box * PIXEL_SIZE;
+                kernel.Deposit(edge, PIXEL_SIZE, n_box, edge, PIXEL_SIZE, n_box,
+                               c_dist(rng), c_dist(rng), sigma, sigma, 100.);
+                result.pixels += n_box * n_box;
+            }
+            result.hits += n_hits;
+        }
+        result.seconds = std::chrono::duration<double>(bench_clock::now() - t0).count();
+        result.allocs = alloc_count.load() - a_start;
+        return result;
+    }
+
+    BenchResult RunOffloadKernel(const BenchConfig& cfg)
+    {
+        PixelOffloadKernel kernel {};
+        std::mt19937 rng(12345);
+        std::uniform_real_distribution<double> c_dist(0., PIXEL_SIZE);
+        std::uniform_real_distribution<double> s_dist(0.5e-3, 3.5e-3);
+
+        int n_hits = HitsPerEvent(cfg);
+        const int n_points = 10;
+
+        BenchResult result {};
+        std::size_t a_start = alloc_count.load();
+        auto t0 = bench_clock::now();
+        for (int evt = 0; evt < cfg.n_events; evt++)
+        {
+            kernel.Clear();
+            for (int i = 0; i < n_hits * n_points; i++)
+            {
+                double sigma = s_dist(rng);
+                int n_box = 2 * int(std::ceil(3 * sigma / PIXEL_SIZE)) + 1;
+                double edge = -0.5 * n_box * PIXEL_SIZE;
+                kernel.AddBox({ edge, edge, c_dist(rng), c_dist(rng), sigma, sigma, 100., n_box, n_box, 0, 0, i });
+                result.pixels += n_box * n_box;
+            }
+            kernel.Deposit(PIXEL_SIZE, PIXEL_SIZE);
+            result.hits += n_hits;
+        }
+        result.seconds = std::chrono::duration<double>(bench_clock::now() - t0).count();
+        result.allocs = alloc_count.load() - a_start;
+        return result;
+    }
+
+    BenchResult RunMatrix(const BenchConfig& cfg, const std::string& enc_str)
+    {
+        HKBaseSensor sensor { 0, 0, 1, 1, LADDER_LENGTH, LADDER_WIDTH, LADDER_THICKNESS,
+                              PIXEL_SIZE, PIXEL_SIZE, enc_str, 1, THRESHOLD, 0.1,
+                              0., cfg.window_size, true, true };
+        std::mt19937 rng(12345);
+        std::uniform_int_distribution<int> r_dist(1, sensor.GetLadderRows() - 2);
+        std::uniform_int_distribution<int> c_dist(1, sensor.GetLadderCols() - 2);
+
+        int n_hits = HitsPerEvent(cfg);
+        int n_steps = std::max(1, int(std::ceil(cfg.time_spread / cfg.window_size)));
+
+        BenchResult result {};
+        SegmentDigiHitList hit_buffer {};
+        std::size_t a_start = alloc_count.load();
+        auto t0 = bench_clock::now();
+        for (int evt = 0; evt < cfg.n_events; evt++)
+        {
+            sensor.Rebind(0, 0.);
+            for (int step = 0; step < n_steps || sensor.IsActive(); step++)
+            {
+                sensor.InitHitRegister();
+                sensor.BeginClockStep();
+                // Blobs of 3 x 3 pixels, the central one above threshold; then the sensor is drained
+                int i_begin = step < n_steps ? step * n_hits / n_steps : n_hits;
+                int i_end = step < n_steps ? (step + 1) * n_hits / n_steps : n_hits;
+                for (int i = i_begin; i < i_end; i++)
+                {
+                    int row = r_dist(rng);
+                    int col = c_dist(rng);
+                    for (int di = -1; di <= 1; di++)
+                    {
+                        for (int dj = -1; dj <= 1; dj++)
+                        {
+                            sensor.UpdatePixel(row + di, col + dj, (di == 0 && dj == 0) ? 4000. : 600.);
+                        }
+                    }
+                    result.pixels += 9;
+                }
+                sensor.EndClockStep();
+
+                hit_buffer.clear();
+                sensor.buildHits(hit_buffer);
+                result.clusters += hit_buffer.size();
+            }
+            result.hits += n_hits;
+        }
+        result.seconds = std::chrono::duration<double>(bench_clock::now() - t0).count();
+        result.allocs = alloc_count.load() - a_start;
+        return result;
+    }
+
+    // The window is specialised for the type of the sensor, as in MuonCVXDRealDigitiser
+    template<class SensorT>
+    BenchResult RunWindow(const BenchConfig& cfg, SensorT& sensor, const std::string& enc_str,
+                          int cell_id, const SurfaceCache& s_cache)
+    {
+        HitGenerator h_gen { cfg, cell_id, 12345 };
+        BenchResult result {};
+        SegmentDigiHitList hit_buffer {};
+
+        for (int evt = 0; evt < cfg.n_events; evt++)
+        {
+            // The generation of the hits is not part of the measurement
+            std::unique_ptr<IMPL::LCCollectionVec> col { h_gen.Generate(enc_str) };
+
+            std::size_t a_start = alloc_count.load();
+            auto t0 = bench_clock::now();
+
+            HitTemporalIndexes t_index { col.get(), false };
+            float m_time = t_index.GetMinTime(0, 0);
+            float nw = std::floor(std::fabs(m_time) / cfg.window_size);
+            float start_time = (m_time >= 0) ? nw * cfg.window_size : -1 * (nw + 1) * cfg.window_size;
+            sensor.Rebind(0, start_time);
+
+            TypedSlidingWindow<SensorT> t_window {
+                t_index, sensor,
+                cfg.window_size, start_time,
+                0.8, 0.,
+                0.03,
+                0.07,
+                ELECTRONS_PER_KEV,
+                0.005,
+                280.,
+                3.0,
+                80.,
+                10.,
+                100.,
+                &s_cache,
+                nullptr,
+                GaussCDFMode::exact,
+                true
+            };
+
+            while (t_window.active())
+            {
+                t_window.process();
+                hit_buffer.clear();
+                sensor.buildHits(hit_buffer);
+                for (const SegmentDigiHit& digiHit : hit_buffer) result.pixels += digiHit.size;
+                result.clusters += hit_buffer.size();
+            }
+
+            result.seconds += std::chrono::duration<double>(bench_clock::now() - t0).count();
+            result.allocs += alloc_count.load() - a_start;
+            result.hits += col->getNumberOfElements();
+        }
+        return result;
+    }
+
+    BenchResult RunLadder(const BenchConfig& cfg, bool hk_sensor, const std::string& enc_str,
+                          int cell_id, const SurfaceCache& s_cache)
+    {
+        if (hk_sensor)
+        {
+            HKBaseSensor sensor { 0, 0, 1, 1, LADDER_LENGTH, LADDER_WIDTH, LADDER_THICKNESS,
+                                  PIXEL_SIZE, PIXEL_SIZE, enc_str, 1, THRESHOLD, 0.1,
+                                  0., cfg.window_size, true, true };
+            return RunWindow(cfg, sensor, enc_str, cell_id, s_cache);
+        }
+
+        TrivialSensor sensor { 0, 0, 1, 1, LADDER_LENGTH, LADDER_WIDTH, LADDER_THICKNESS,
+                               PIXEL_SIZE, PIXEL_SIZE, enc_str, 1, THRESHOLD,
+                               0., cfg.window_size, true, true };
+        return RunWindow(cfg, sensor, enc_str, cell_id, s_cache);
+    }
+
+    void PrintResult(const std::string& name, const BenchResult& result, int n_events)
+    {
+        auto rate = [&result](std::size_t n) { return result.seconds > 0 ? n / result.seconds : 0.; };
+
+        std::cout << std::setw(12) << name
+                  << std::setw(12) << std::fixed << std::setprecision(2) << result.seconds * 1e3
+                  << std::setw(14) << std::scientific << std::setprecision(3) << rate(result.hits)
+                  << std::setw(14) << rate(result.pixels)
+                  << std::setw(14) << rate(result.clusters)
+                  << std::setw(14) << std::fixed << std::setprecision(1) << double(result.allocs) / n_events
+                  << std::defaultfloat << std::setprecision(6) << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    BenchConfig cfg {};
+    cfg.occupancy = argc > 1 ? std::atof(argv[1]) : 1e-3;
+    cfg.time_spread = argc > 2 ? std::atof(argv[2]) : 100.;
+    cfg.incidence = argc > 3 ? std::atof(argv[3]) : 30.;
+    cfg.n_events = argc > 4 ? std::atoi(argv[4]) : 10;
+    cfg.window_size = argc > 5 ? std::atof(argv[5]) : 25.;
+    if (cfg.n_events <= 0) cfg.n_events = 1;
+
+    streamlog::out.init(std::cout, "KernelBench");
+    streamlog::logscope scope(streamlog::out);
+    scope.setLevel<streamlog::WARNING>();
+
+    std::string enc_str = lcio::LCTrackerCellID::encoding_string();
+    UTIL::BitField64 bf_encoder { enc_str };
+    bf_encoder.reset();
+    bf_encoder[lcio::LCTrackerCellID::subdet()] = 1;
+    bf_encoder[lcio::LCTrackerCellID::side()] = 0;
+    bf_encoder[lcio::LCTrackerCellID::layer()] = 0;
+    bf_encoder[lcio::LCTrackerCellID::module()] = 0;
+    bf_encoder[lcio::LCTrackerCellID::sensor()] = 0;
+    int cell_id = bf_encoder.lowWord();
+
+    MockPlaneSurface surface { cell_id,
+                               0.5 * LADDER_WIDTH * dd4hep::mm,
+                               0.5 * LADDER_LENGTH * dd4hep::mm,
+                               0.5 * LADDER_THICKNESS * dd4hep::mm };
+    SurfaceMap s_map {};
+    s_map.emplace((unsigned long)cell_id, &surface);
+    SurfaceCache s_cache {};
+    s_cache.Build(&s_map, enc_str);
+
+    std::cout << "Ladder " << LADDER_WIDTH << " x " << LADDER_LENGTH << " mm, occupancy " << cfg.occupancy
+              << ", time spread " << cfg.time_spread << " ns, incidence " << cfg.incidence
+              << " deg, window " << cfg.window_size << " ns, " << cfg.n_events << " events" << std::endl;
+    std::cout << std::setw(12) << "kernel" << std::setw(12) << "time (ms)"
+              << std::setw(14) << "hits/s" << std::setw(14) << "pixels/s"
+              << std::setw(14) << "clusters/s" << std::setw(14) << "allocs/evt" << std::endl;
+
+    PrintResult("fluctuation", RunFluctuation(cfg), cfg.n_events);
+    PrintResult("charge", RunChargeKernel(cfg), cfg.n_events);
+    PrintResult("offload", RunOffloadKernel(cfg), cfg.n_events);
+    PrintResult("matrix", RunMatrix(cfg, enc_str), cfg.n_events);
+    PrintResult("trivial", RunLadder(cfg, false, enc_str, cell_id, s_cache), cfg.n_events);
+    PrintResult("hk", RunLadder(cfg, true, enc_str, cell_id, s_cache), cfg.n_events);
+
+    return 0;
+}
@@ -3,8 +3,6 @@
 
 #include <string>
 #include <vector>
-#include <unordered_map>
-#include <unordered_set>
 #include <UTIL/BitField64.h>
 #include <UTIL/LCTrackerConf.h>
 #include <EVENT/SimTrackerHit.h>
@@ -37,7 +35,19 @@ struct PixelData
     PixelStatus status;
 };
 
-using SimHitSet = std::unordered_set<SimTrackerHit*>;
+/**
+ * @brief Charge of a pixel, or of a cluster, collected from a simulated hit
+ *
+ * The hit is identified by its position in the input collection.
+ */
+struct SimHitRelation
+{
+    int hit;
+    float charge;
+};
+
+// Relations of a cluster, sorted by hit and without duplicates
+using SimHitRelationList = vector<SimHitRelation>;
 
 struct SegmentDigiHit
 {
@@ -47,7 +57,9 @@ struct SegmentDigiHit
     float time;
     int cellID0;
     int size;
-    SimHitSet sim_hits;
+    SimHitRelationList sim_hits;
+    int size_x = 0;         // extent of the cluster in rows
+    int size_y = 0;         // extent of the cluster in columns
 };
 
 using SegmentDigiHitList = vector<SegmentDigiHit>;
@@ -80,7 +92,49 @@ private:
     int b_size;
 };
 
-using SimHitTable = std::unordered_multimap<LinearPosition, SimTrackerHit*>;
+struct SimHitRecord
+{
+    LinearPosition pos;
+    int hit;
+    float charge;
+};
+
+/**
+ * @class SimHitTable
+ * @brief Flat table of the charges registered for each pixel
+ *
+ * The records are appended without any lookup; before a query the new records are sorted
+ * by pixel and hit and merged with the others, the records of the same pixel and hit are
+ * joined and the released ones are removed. The memory is reused across the clock steps.
+ */
+class SimHitTable
+{
+public:
+    SimHitTable() : records(), n_sorted(0), n_released(0) {}
+
+    inline void Add(LinearPosition pos, int hit, float charge) { records.push_back({ pos, hit, charge }); }
+
+    /**
+     * @brief Add the records of the pixel to the list of relations, optionally releasing them
+     */
+    void Collect(LinearPosition pos, SimHitRelationList& rlist, bool release);
+
+    inline void Clear()
+    {
+        records.clear();
+        n_sorted = 0;
+        n_released = 0;
+    }
+
+    inline std::size_t Size() const { return records.size(); }
+
+private:
+    void Compact();
+
+    vector<SimHitRecord> records;
+    std::size_t n_sorted;
+    std::size_t n_released;
+};
 
 /**
  * @class AbstractSensor
@@ -133,12 +187,52 @@ public:
     virtual double PixelColToY(int iy);
 
     virtual inline string GetCellIDFormatStr() { return cellFmtStr; }
+    virtual inline void SetCellIDFormatStr(const string& enc_str) { cellFmtStr = enc_str; }
 
     virtual inline MatrixStatus GetStatus() { return status; }
 
+    /**
+     * @brief Make the sensor a petal of an endcap disk
+     *
+     * The petal is a trapezoid with the ladder width at the outer edge, the last column,
+     * and inner_width at the inner edge, the first column; the pixels outside the petal
+     * are not sensitive. The hits are encoded with the given disk layer and side.
+     */
+    virtual void SetPetalGeometry(int disk_layer, int side, float inner_width);
+
+    inline bool IsPetal() const { return !p_row_lo.empty(); }
+
+    // False for the pixels outside the shape of the sensor
+    inline bool IsSensitive(int x, int y) const
+    {
+        return p_row_lo.empty() || (x >= p_row_lo[y] && x <= p_row_hi[y]);
+    }
+
+    /**
+     * @brief Cluster the segments of the ladder with concurrent OpenMP tasks
+     *
+     * The tasks are nested in the task that processes the ladder.
+     */
+    inline void SetSegmentTasks(bool on) { segment_tasks = on; }
+
+    inline bool GetSegmentTasks() const { return segment_tasks; }
+
     virtual void InitHitRegister();
 
-    virtual void RegisterHit(int x, int y, SimTrackerHit* hit);
+    /**
+     * @brief Register the charge of a pixel collected from a simulated hit
+     *
+     * The hit is the position in the input collection, see SimHitRelation.
+     */
+    virtual void RegisterHit(int x, int y, int hit, float charge);
+
+    /**
+     * @brief Move the sensor to another ladder of the same layer
+     *
+     * The sensor is brought back to the state of a newly created one,
+     * with the given ladder ID and start time.
+     */
+    virtual void Rebind(int ladder, float starttime);
 
     virtual void Reset() = 0;
 
@@ -148,6 +242,20 @@ public:
 
     virtual void EndClockStep() = 0;
 
+    /**
+     * @brief The number of the following clock steps which, without any charge collected,
+     * would not change the output of the sensor
+     *
+     * Those steps can be replaced by a single call of SkipClockSteps; the default
+     * implementation does not allow any skip.
+     */
+    virtual int GetIdleClockSteps() { return 0; }
+
+    /**
+     * @brief Move the clock forward by n steps without any charge collected
+     */
+    virtual void SkipClockSteps(int n);
+
     virtual PixelData GetPixel(int x, int y) = 0;
 
     virtual bool IsActive() = 0;
@@ -166,12 +274,14 @@ protected:
     virtual PixelData getPixel(int seg_x, int seg_y, int pos_x, int pos_y);
     virtual bool checkStatus(int seg_x, int seg_y, int pos_x, int pos_y, PixelStatus pstat);
     virtual BitField64 getBFEncoder();
-    virtual void fillInHitRelation(SimHitSet& sset, LinearPosition pos);
+    virtual void fillInHitRelation(SimHitRelationList& rlist, LinearPosition pos);
 
     virtual bool check(int x, int y);
 
     int _barrel_id;
     int _layer;
+    int _cell_layer;
+    int _side;
     int _ladder;
     float _thickness;
     double _pixelSizeX;
@@ -192,9 +302,12 @@ protected:
     GridPosition s_locate;
     MatrixStatus status;
     bool reset_simtable_at_once;
+    bool segment_tasks;
 
 private:
     SimHitTable simhit_table;
+    vector<int> p_row_lo;
+    vector<int> p_row_hi;
 };
 
 
@@ -0,0 +1,95 @@
+#ifndef BIBPixelCache_h
+#define BIBPixelCache_h 1
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using std::vector;
+
+/**
+ * Charge collected by a pixel from a single overlay hit in a clock step;
+ * the hit is the ordinal of the sim-hit among the time-ordered overlay hits of the ladder.
+ */
+struct BIBPixelEntry
+{
+    int32_t bin;
+    int32_t row;
+    int32_t col;
+    int32_t hit;
+    float charge;
+};
+
+// Entries of a ladder produced by the digitisation, moved into the cache at the end of the event
+struct BIBLadderCache
+{
+    vector<BIBPixelEntry> entries;
+    int n_hits = 0;
+};
+
+// Read-only range of the entries of a ladder, sorted by clock step
+struct BIBLadderView
+{
+    const BIBPixelEntry* first;
+    const BIBPixelEntry* last;
+    int n_hits;
+};
+
+/**
+ * @class BIBPixelCache
+ * @brief Pixel charges of the overlay hits of a background sample, for all the ladders
+ *
+ * The entries are grouped by ladder (global index over all layers) and sorted by clock step.
+ * The cache is either assembled in memory from the ladder buffers or mapped read-only
+ * from a file written by Save; the key identifies the sample and the digitisation parameters
+ * and it is checked on load together with the number of ladders.
+ */
+class BIBPixelCache
+{
+public:
+    BIBPixelCache(uint64_t key, vector<BIBLadderCache>& l_caches);
+    BIBPixelCache(const BIBPixelCache&) = delete;
+    BIBPixelCache& operator=(const BIBPixelCache&) = delete;
+    virtual ~BIBPixelCache();
+
+    inline uint64_t GetKey() const { return c_key; }
+    inline int GetLadderNumber() const { return n_ladders; }
+    inline std::size_t Size() const { return n_entries; }
+
+    BIBLadderView GetLadder(int l_index) const;
+
+    bool Save(const std::string& filename) const;
+
+    /**
+     * @brief Map a cache file into memory
+     * @return The cache or nullptr if the file is missing or it does not match key and ladders
+     */
+    static BIBPixelCache* Load(const std::string& filename, uint64_t key, int ladders);
+
+    // FNV-1a hash, used for building the keys
+    static uint64_t Hash(uint64_t h, const void* data, std::size_t size);
+    static const uint64_t HASH_SEED = 0xCBF29CE484222325ULL;
+
+private:
+    struct LadderRange
+    {
+        uint64_t first;
+        uint64_t count;
+        int32_t n_hits;
+        int32_t reserved;
+    };
+
+    BIBPixelCache();
+
+    uint64_t c_key;
+    int n_ladders;
+    std::size_t n_entries;
+    vector<LadderRange> l_ranges;
+    vector<BIBPixelEntry> m_entries;
+    const BIBPixelEntry* e_data;
+    void* m_addr;
+    std::size_t m_size;
+};
+
+#endif //BIBPixelCache_h
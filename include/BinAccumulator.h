@@ -0,0 +1,65 @@
+#ifndef BinAccumulator_h
+#define BinAccumulator_h 1
+
+#include <vector>
+
+#include <TH1.h>
+
+/**
+ * @class BinAccumulator
+ * @brief Plain array of the bins of a 1D histogram, with the same binning of TH1
+ *
+ * Bin 0 is the underflow and bin n_bins + 1 the overflow. An accumulator is filled
+ * by a single thread; the accumulators are merged and copied into the ROOT histogram
+ * at the end of the job.
+ */
+class BinAccumulator
+{
+public:
+    BinAccumulator(int nbins = 1, double xmin = 0., double xmax = 1.);
+    BinAccumulator(const TH1* histo);
+    virtual ~BinAccumulator();
+
+    inline void Fill(double x)
+    {
+        if (x != x) return;
+        int bin = 0;
+        if (x >= x_max) bin = n_bins + 1;
+        else if (x >= x_min) bin = 1 + int((x - x_min) * inv_width);
+        if (bin > n_bins) bin = n_bins + 1;
+        bins[bin] += 1.;
+        n_entries += 1.;
+    }
+
+    inline double GetEntries() const { return n_entries; }
+
+    void Merge(const BinAccumulator& other);
+
+    /**
+     * @brief Add the content to the histogram, the statistics are recomputed from the bins
+     */
+    void AddTo(TH1* histo) const;
+
+private:
+    int n_bins;
+    double x_min;
+    double x_max;
+    double inv_width;
+    double n_entries;
+    std::vector<double> bins;
+};
+
+// Cluster histograms of MuonCVXDRealDigitiser, either for signal or for BIB
+struct ClusterStatAccumulator
+{
+    BinAccumulator distance;
+    BinAccumulator c_size;
+    BinAccumulator x_size;
+    BinAccumulator y_size;
+    BinAccumulator z_size;
+    BinAccumulator e_dep;
+
+    void Merge(const ClusterStatAccumulator& other);
+};
+
+#endif //BinAccumulator_h
@@ -0,0 +1,85 @@
+#ifndef ClusterShapeFilter_h
+#define ClusterShapeFilter_h 1
+
+#include "AbstractSensor.h"
+#include "SurfaceCache.h"
+
+// Number of clusters tested by the shape filter and number of incompatible clusters
+struct ShapeFilterStats
+{
+    int n_clusters = 0;
+    int rejected = 0;
+
+    inline int Accepted() const { return n_clusters - rejected; }
+
+    ShapeFilterStats& operator+=(const ShapeFilterStats& other)
+    {
+        n_clusters += other.n_clusters;
+        rejected += other.rejected;
+        return *this;
+    }
+};
+
+enum class ShapeFilterMode
+{
+    off,
+    flag,           // the incompatible clusters are written with the quality bit set
+    drop            // the incompatible clusters are not written
+};
+
+/**
+ * @class ClusterShapeFilter
+ * @brief Compatibility of the size of a cluster with a particle from the interaction point
+ *
+ * A particle from the origin crosses the sensor with the inclination of the line
+ * between the origin and the centre of the cluster, with respect to the normal of the surface;
+ * the expected extent along u (rows) and v (columns) is the projection of the path
+ * in the thickness of the sensor, plus the Lorentz drift, plus one pixel.
+ * The geometry of the layer and the orientation of the ladder are taken from the surface,
+ * so the same test holds for barrel ladders and endcap petals.
+ * The filter does not hold any per-event state and can be shared among threads.
+ */
+class ClusterShapeFilter
+{
+public:
+    /*
+     * Quality bit of the reco-hits of the incompatible clusters in flag mode; the high bits
+     * are set by the tracking (UTIL::ILDTrkHitQualityBit, 30 used in fit, 31 used in track)
+     */
+    static const int QUALITY_BIT = 1;
+
+    /**
+     * @param pitch_x The size of the pixels along u (mm)
+     * @param pitch_y The size of the pixels along v (mm)
+     * @param tan_lorentz_x The tangent of the Lorentz angle along u
+     * @param tan_lorentz_y The tangent of the Lorentz angle along v
+     * @param tolerance_x The accepted difference between measured and expected extent along u (pixels)
+     * @param tolerance_y The accepted difference between measured and expected extent along v (pixels)
+     */
+    ClusterShapeFilter(double pitch_x, double pitch_y, double tan_lorentz_x, double tan_lorentz_y,
+                       float tolerance_x, float tolerance_y);
+    virtual ~ClusterShapeFilter();
+
+    /**
+     * @brief The expected extents of a cluster in pixels
+     * @param g_pos The global position of the cluster (mm)
+     * @param c_surf The surface of the sensor
+     * @param thickness The thickness of the sensor (mm)
+     * @return False if the particle is parallel to the surface, no expectation is given
+     */
+    bool ExpectedSize(const Vector3D& g_pos, const CachedSurface& c_surf, double thickness,
+                      float& size_x, float& size_y) const;
+
+    bool IsCompatible(const SegmentDigiHit& digiHit, const Vector3D& g_pos,
+                      const CachedSurface& c_surf, double thickness) const;
+
+private:
+    double _pitchX;
+    double _pitchY;
+    double _tanLorentzX;
+    double _tanLorentzY;
+    float _toleranceX;
+    float _toleranceY;
+};
+
+#endif //ClusterShapeFilter_h
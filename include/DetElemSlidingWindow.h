@@ -1,17 +1,23 @@
 #ifndef DetElemSlidingWindow_h
 #define DetElemSlidingWindow_h 1
 
+#include <cmath>
 #include <list>
+#include <vector>
 
 #include "HitTemporalIndexes.h"
 #include "AbstractSensor.h"
-#include "DDRec/Surface.h"
-#include "DDRec/SurfaceManager.h"
+#include "SurfaceCache.h"
 #include "G4UniversalFluctuation.h"
+#include "PixelChargeKernel.h"
+#include "PixelOffloadKernel.h"
+#include "BIBPixelCache.h"
+#include "StageProfiler.h"
+#include "PixelNoiseGenerator.h"
+#include "CLHEP/Random/RandomEngine.h"
 
 #include <UTIL/CellIDDecoder.h>
 
-using dd4hep::rec::SurfaceMap;
 using UTIL::CellIDDecoder;
 
 struct TimedSignalPoint
@@ -21,45 +27,211 @@ struct TimedSignalPoint
     double sigmaX;
     double sigmaY;
     double charge;
-    SimTrackerHit* sim_hit;
+    float time;             // time of the hit
+    int hit_index;          // position of the hit in the input collection, see SimHitSnapshot
 };
 
 typedef std::list<TimedSignalPoint> TimedSignalPointList;
 
-class DetElemSlidingWindow
+/**
+ * @brief Pixel grid of a ladder, the conversions of AbstractSensor with the constants hoisted
+ */
+struct PixelGrid
+{
+    int rows;
+    int cols;
+    double pitch_x;
+    double pitch_y;
+    double half_width;
+    double half_length;
+
+    explicit PixelGrid(AbstractSensor& sensor) :
+        rows(sensor.GetLadderRows()),
+        cols(sensor.GetLadderCols()),
+        pitch_x(sensor.GetPixelSizeX()),
+        pitch_y(sensor.GetPixelSizeY()),
+        half_width(sensor.GetHalfWidth()),
+        half_length(sensor.GetHalfLength())
+    {}
+
+    inline int XToPixelRow(double x) const { return int((x + half_width) / pitch_x); }
+    inline int YToPixelCol(double y) const { return int((y + half_length) / pitch_y); }
+    inline double PixelRowToX(int ix) const { return ((0.5 + double(ix)) * pitch_x) - half_width; }
+    inline double PixelColToY(int iy) const { return ((0.5 + double(iy)) * pitch_y) - half_length; }
+};
+
+// Range of rows and columns [lo, hi) of the pixel grid
+struct PixelBox
+{
+    int row_lo;
+    int row_hi;
+    int col_lo;
+    int col_hi;
+};
+
+// Charge of a signal point on a pixel, staged by the per-segment tasks
+struct PixelChargeEntry
+{
+    int row;
+    int col;
+    int hit_index;
+    float charge;
+};
+
+/**
+ * @brief Calls of the hot path of the window, bound at compile time to the given sensor type
+ *
+ * The qualified calls skip the virtual dispatch, so SensorT must be the dynamic type of the sensor;
+ * with AbstractSensor the calls are virtual.
+ */
+template<class SensorT>
+struct SensorCalls
+{
+    static inline void UpdatePixel(SensorT& sensor, int x, int y, float chrg)
+    {
+        sensor.SensorT::UpdatePixel(x, y, chrg);
+    }
+    static inline void RegisterHit(SensorT& sensor, int x, int y, int hit, float chrg)
+    {
+        sensor.SensorT::RegisterHit(x, y, hit, chrg);
+    }
+};
+
+template<>
+struct SensorCalls<AbstractSensor>
+{
+    static inline void UpdatePixel(AbstractSensor& sensor, int x, int y, float chrg)
+    {
+        sensor.UpdatePixel(x, y, chrg);
+    }
+    static inline void RegisterHit(AbstractSensor& sensor, int x, int y, int hit, float chrg)
+    {
+        sensor.RegisterHit(x, y, hit, chrg);
+    }
+};
+
+/**
+ * @class SlidingWindow
+ * @brief Interface of the sliding windows, called once per clock step
+ */
+class SlidingWindow
+{
+public:
+    virtual ~SlidingWindow() {}
+    virtual bool active() = 0;
+    virtual int process() = 0;
+    virtual float get_time() = 0;
+    virtual void BuildCache(BIBLadderCache& l_cache) = 0;
+    virtual bool UseCache(const BIBLadderView& l_view) = 0;
+    virtual void SetProfile(LadderProfile* profile) = 0;
+    virtual void SetNoise(const PixelNoiseGenerator& noise) = 0;
+    virtual void SetSegmentTasks(bool on) = 0;
+    virtual void SetOffload(std::size_t min_points) = 0;
+};
+
+/**
+ * @class TypedSlidingWindow
+ * @brief Sliding window over the hits of a ladder, specialised for the type of the sensor
+ *
+ * The window is instantiated in DetElemSlidingWindow.cc for AbstractSensor, TrivialSensor
+ * and HKBaseSensor; for the concrete types the pixel loops do not contain any virtual call.
+ */
+template<class SensorT>
+class TypedSlidingWindow : public SlidingWindow
 {
 public:
-    DetElemSlidingWindow(HitTemporalIndexes& htable,
-                         AbstractSensor& sensor,
-                         float wsize,
-                         float starttime,
-                         double tanLorentzAngleX,
-                         double tanLorentzAngleY,
-                         double cutOnDeltaRays,
-                         double diffusionCoefficient,
-                         double electronsPerKeV,
-                         double segmentLength,
-                         double energyLoss,
-                         double widthOfCluster,
-                         double electronicNoise,
-                         double maxTrkLen,
-                         double maxEnergyDelta,
-                         const SurfaceMap* s_map);
-    virtual ~DetElemSlidingWindow();
-    bool active();
-    int process();
-    float get_time();
+    TypedSlidingWindow(HitTemporalIndexes& htable,
+                       SensorT& sensor,
+                       float wsize,
+                       float starttime,
+                       double tanLorentzAngleX,
+                       double tanLorentzAngleY,
+                       double cutOnDeltaRays,
+                       double diffusionCoefficient,
+                       double electronsPerKeV,
+                       double segmentLength,
+                       double energyLoss,
+                       double widthOfCluster,
+                       double electronicNoise,
+                       double maxTrkLen,
+                       double maxEnergyDelta,
+                       const SurfaceCache* s_cache,
+                       CLHEP::HepRandomEngine* engine = nullptr,
+                       GaussCDFMode cdf_mode = GaussCDFMode::exact,
+                       bool idle_skip = false);
+    virtual ~TypedSlidingWindow();
+    bool active() override;
+    int process() override;
+    float get_time() override;
+
+    /**
+     * @brief Digitise the overlay hits of the ladder, one clock step for each hit
+     *
+     * The entries are sorted by clock step, the state of the sensor is not changed.
+     */
+    void BuildCache(BIBLadderCache& l_cache) override;
+
+    /**
+     * @brief Superimpose the cached charges of the overlay hits instead of digitising them
+     * @return False if the cache does not match the overlay hits of the ladder
+     */
+    bool UseCache(const BIBLadderView& l_view) override;
+
+    // The stages of the window are measured in the given profile, nullptr disables the measurements
+    inline void SetProfile(LadderProfile* profile) override { _profile = profile; }
+
+    /**
+     * @brief Inject the noisy pixels of the generator at every clock step
+     *
+     * The noisy pixels are added to the sensor as any other charge, without sim-hits;
+     * the idle clock steps are never skipped beyond the next noisy pixel.
+     */
+    void SetNoise(const PixelNoiseGenerator& noise) override;
+
+    /**
+     * @brief Integrate the signal points of a clock step in one task for each segment of the sensor
+     *
+     * Each task deposits the charge clipped to its segment, the charges are then added to
+     * the sensor in segment order; the charge of every pixel is summed in the same order.
+     */
+    inline void SetSegmentTasks(bool on) override { _segmentTasks = on; }
+
+    /**
+     * @brief Integrate the signal points of a clock step in a single batch of PixelOffloadKernel
+     *
+     * Only the clock steps with at least min_points signal points are offloaded, 0 disables
+     * the offload; the charges are then added to the sensor in the order of the points.
+     */
+    inline void SetOffload(std::size_t min_points) override { _offloadMinPoints = min_points; }
 
 private:
-    void StoreSignalPoints(SimTrackerHit* hit);
+    // Below this number of signal points in a clock step the tasks are not worth it
+    static const std::size_t MIN_SEGMENT_POINTS = 32;
+
+    void StoreSignalPoints(int hit_index);
+    void SkipIdleClockSteps();
     void UpdatePixels();
+    void InjectNoise();
+    bool IntegrateSignalPoint(const TimedSignalPoint& spoint, int& ixLo, int& iyLo, int& nx, int& ny);
+    bool IntegrateSignalPoint(const TimedSignalPoint& spoint, PixelChargeKernel& kernel, const PixelBox& bounds,
+                              int& ixLo, int& iyLo, int& nx, int& ny) const;
+    bool SignalBox(const TimedSignalPoint& spoint, const PixelBox& bounds,
+                   int& ixLo, int& iyLo, int& nx, int& ny) const;
+    std::size_t CollectStepPoints(float window_radius);
+    void DepositBySegment();
+    void DepositOffload();
+    void DropOverlayHits();
+    inline int CurrentBin() const { return int(lround(curr_time / time_click - 0.5)); }
     double randomTail( const double qmin, const double qmax );
 
     float curr_time;
     float time_click;
+    bool _idleSkip;
 
-    HitTemporalIndexes& _htable;
-    AbstractSensor& _sensor;
+    SensorT& _sensor;
+    PixelGrid _grid;
+    const SimHitSnapshot& _hits;
+    LadderHitCursor _cursor;
     double _tanLorentzAngleX;
     double _tanLorentzAngleY;
     double _cutOnDeltaRays;
@@ -72,14 +244,27 @@ private:
     double _maxTrkLen;
     double _deltaEne;
     TimedSignalPointList signals;
-    const SurfaceMap* surf_map;
-    CellIDDecoder<SimTrackerHit> cell_decoder;
+    std::vector<double> eloss_buffer;
+    const SurfaceCache* surf_cache;
+    CLHEP::HepRandomEngine* _engine;
     G4UniversalFluctuation* _fluctuate;
+    GaussCDFMode _cdfMode;
+    PixelChargeKernel _kernel;
+    bool _segmentTasks;
+    std::vector<PixelChargeKernel> _segKernels;
+    std::vector<std::vector<PixelChargeEntry>> _segCharges;
+    std::vector<const TimedSignalPoint*> _stepPoints;
+    std::vector<std::vector<const TimedSignalPoint*>> _segLists;
+    std::size_t _offloadMinPoints;
+    PixelOffloadKernel _offload;
+    bool _useCache;
+    BIBLadderView _cache;
+    std::vector<int> _overlayHits;
+    PixelNoiseGenerator _noise;
+    LadderProfile* _profile;
 };
 
-
-
-
-
+// The window of the generic sensors
+using DetElemSlidingWindow = TypedSlidingWindow<AbstractSensor>;
 
 #endif //DetElemSlidingWindow_h
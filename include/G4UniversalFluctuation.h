@@ -35,6 +35,8 @@
 // Modifications:
 //
 // 13-05-20 thread-safety (P.Andreetto)
+// 14-10-26 random engine as argument of the constructor
+// 14-10-26 batch sampling for the segments of a track
 // 09-12-02 remove warnings (V.Ivanchenko)
 // 28-12-02 add method Dispersion (V.Ivanchenko)
 // 07-02-03 change signature (V.Ivanchenko)
@@ -48,10 +50,15 @@
 #ifndef G4UniversalFluctuation_h
 #define G4UniversalFluctuation_h 
 
+#include "CLHEP/Random/RandomEngine.h"
+#include <vector>
+
 class G4UniversalFluctuation {
 public:
 
-    G4UniversalFluctuation();
+    // all the random numbers are drawn from the given engine,
+    // the global CLHEP engine is used if engine is nullptr
+    G4UniversalFluctuation(CLHEP::HepRandomEngine* engine = nullptr);
     ~G4UniversalFluctuation();
 
     // momentum in MeV/c, mass in MeV, tmax (delta cut) in MeV, 
@@ -62,8 +69,39 @@ public:
                               const double length,
                               const double meanLoss);
 
+    // energy loss of n_seg segments with the same mean loss, the constants
+    // are computed once and the random numbers are drawn in the same order
+    // of n_seg calls of the method above; the results are stored in losses.
+    void SampleFluctuations(const double momentum,
+                            const double mass,
+                            const double tmax,
+                            const double length,
+                            const double meanLoss,
+                            const int n_seg,
+                            double* losses);
+
 private:
 
+    // constants of the non gaussian fluctuation for a given step
+    struct StepConstants
+    {
+        double w1;
+        double a1;
+        double a2;
+        double a3;
+        double siga1;
+        double siga2;
+        double siga3;
+        double adacut;
+    };
+
+    int SampleCount(const double mean, const double siga);
+    double SampleSmallStep(const double tmax, const StepConstants& sc);
+    double SampleLargeStep(const double tmax, const StepConstants& sc);
+
+    CLHEP::HepRandomEngine* _engine;
+    std::vector<double> _flatBuffer;
+
     double chargeSquare;
 
     // data members to speed up the fluctuation calculation
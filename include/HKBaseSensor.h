@@ -3,6 +3,7 @@
 
 #include "PixelDigiMatrix.h"
 #include "FindUnionAlgorithm.h"
+#include "SparseFindUnion.h"
 #include <tuple>
 #include <unordered_map>
 
@@ -34,30 +35,57 @@ struct BufferedCluster
 struct ClusterItem
 {
     BufferedCluster buffer;
+    vector<LinearPosition> members;     // all the pixels, incremental mode only
     int size;
 };
 
-using ClusterTable = unordered_map<int, ClusterItem>;
-
 using ReferenceTable = unordered_map<LinearPosition, int>;
 
+/**
+ * @class ClusterHeap
+ * @brief Clusters of a sensor waiting for the readout of all their pixels
+ *
+ * The clusters are stored in a pool of slots reused across the clock steps; a cluster
+ * is moved out of the pool when the last pixel is ready.
+ * In incremental mode a new cluster adjacent to the pending pixels of the buffered clusters
+ * is merged into them, so a cluster grows across the clock steps; the cost of a step depends
+ * on the pixels switched on in the step, plus the pixels of the clusters joined by a new pixel.
+ */
 class ClusterHeap
 {
 public:
-    ClusterHeap(int rows, int cols);
+    ClusterHeap(int rows, int cols, bool incr_on = false, bool hk8_on = true);
     virtual ~ClusterHeap();
-    void AddCluster(ClusterOfPixel& cluster);
+    void AddCluster(const ClusterOfPixel& cluster);
     void SetupPixel(int pos_x, int pos_y, PixelData pix);
-    vector<BufferedCluster> PopClusters();
+
+    // The ready clusters are moved into result, the previous content is cleared
+    void PopClusters(vector<BufferedCluster>& result);
+
+    // The buffers of the popped clusters are given back to the pool
+    void Recycle(vector<BufferedCluster>& popped);
+
+    void Clear();
     void SetLabel(string dlabel) { debug_label = dlabel; }
 
 private:
-    int hash_cnt;
+    int NewSlot();
+    void FreeSlot(int slot);
+    int FindAdjacentCluster(const ClusterOfPixel& cluster);
+    void MergeSlots(int target, int source);
+
+    int rows;
+    int columns;
     GridPosition locate;
+    bool incremental;
+    bool HK8_enabled;
     string debug_label;
-    ClusterTable cluster_table;
+    vector<ClusterItem> c_pool;
+    vector<int> free_slots;
+    vector<vector<ChargePoint>> spare_pixels;
     ReferenceTable ref_table;
-    vector<int>  ready_to_pop;
+    vector<int> ready_to_pop;
+    vector<int> adj_slots;
 };
 
 /* ****************************************************************************
@@ -84,14 +112,34 @@ public:
                           float fe_slope,
                           float starttime,
                           float t_step,
-                          bool hk8_on = true);
+                          bool hk8_on = true,
+                          bool sparse_on = true,
+                          bool incr_on = false);
     virtual ~HKBaseSensor() {}
 
+    void Rebind(int ladder, float starttime) override;
+
     void buildHits(SegmentDigiHitList& output) override;
 
 protected:
+    void SetupHeapLabels();
+
+    // Labelling and readout of the pixels of a segment, it can run concurrently for different segments
+    void ClusterSegment(int h, int k, SparseFindUnion& s_algo, vector<BufferedCluster>& popped);
+
+    // The reco-hits of the popped clusters, the sim-hit relations are collected serially
+    void EmitClusters(int h, int k, BitField64& bf_encoder, vector<BufferedCluster>& popped,
+                      SegmentDigiHitList& output);
+
     vector<ClusterHeap> heap_table;
+    vector<BufferedCluster> pop_buffer;
+    vector<SparseFindUnion> seg_algos;
+    vector<vector<BufferedCluster>> seg_buffers;
     bool HK8_enabled;
+    bool sparse_enabled;
+    bool incremental_enabled;
+    FindUnionAlgorithm fu_algo;
+    SparseFindUnion sf_algo;
 };
 
 #endif //HKBaseSensor_h
@@ -0,0 +1,73 @@
+#ifndef HitPreFilter_h
+#define HitPreFilter_h 1
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "EVENT/SimTrackerHit.h"
+#include "EVENT/LCCollection.h"
+
+using std::vector;
+using EVENT::SimTrackerHit;
+using EVENT::LCCollection;
+
+// Number of hits dropped by each cut, a hit is counted by the first cut it fails
+struct HitFilterStats
+{
+    int n_hits = 0;
+    int time_cut = 0;
+    int edep_cut = 0;
+    int geometry_cut = 0;
+
+    inline int Kept() const { return n_hits - time_cut - edep_cut - geometry_cut; }
+
+    HitFilterStats& operator+=(const HitFilterStats& other)
+    {
+        n_hits += other.n_hits;
+        time_cut += other.time_cut;
+        edep_cut += other.edep_cut;
+        geometry_cut += other.geometry_cut;
+        return *this;
+    }
+};
+
+/**
+ * @class HitPreFilter
+ * @brief Selection of the simulated hits before the construction of the temporal index
+ *
+ * A hit is dropped if its time is outside [min_time, max_time], if its deposited energy
+ * is below min_edep or if its layer or ladder is masked. The cell ID is decoded only if
+ * any geometry mask is defined. The filter does not hold any per-event state.
+ */
+class HitPreFilter
+{
+public:
+    /**
+     * @param min_time Lower edge of the time window (ns)
+     * @param max_time Upper edge of the time window (ns)
+     * @param min_edep Minimum deposited energy (GeV)
+     * @param masked_layers List of layers to be dropped
+     * @param masked_ladders List of (layer, ladder) pairs to be dropped, flattened
+     */
+    HitPreFilter(float min_time, float max_time, float min_edep,
+                 const vector<int>& masked_layers, const vector<int>& masked_ladders);
+    virtual ~HitPreFilter();
+
+    /**
+     * @brief Mark the surviving hits of the collection
+     * @param h_mask Output, one item for each hit of the collection: 1 if the hit is kept
+     */
+    HitFilterStats Apply(const LCCollection* STHcol, vector<char>& h_mask, bool parallel) const;
+
+    bool IsMasked(int layer, int ladder) const;
+
+private:
+    float _minTime;
+    float _maxTime;
+    float _minEDep;
+    vector<int> _maskedLayers;
+    vector<std::pair<int, int>> _maskedLadders;
+};
+
+#endif //HitPreFilter_h
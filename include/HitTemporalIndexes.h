@@ -2,52 +2,108 @@
 #define HitTemporalIndexes_h 1
 
 #include <vector>
-#include <unordered_map>
-#include <queue>
 #include <limits>
 
 #include "EVENT/SimTrackerHit.h"
 #include "EVENT/LCCollection.h"
+#include "SimHitSnapshot.h"
 #include <UTIL/CellIDDecoder.h>
 
-using std::priority_queue;
-using std::unordered_map;
+using std::vector;
 using EVENT::SimTrackerHit;
 using EVENT::LCCollection;
 using UTIL::CellIDDecoder;
 
-class CmpTrackTime
+struct TimedHit
 {
-public:
-    CmpTrackTime(){}
-    bool operator()(SimTrackerHit* &alfa, SimTrackerHit* &beta)
-    {
-        return alfa->getTime() > beta->getTime();
+    float time;
+    int index;              // position of the hit in the input collection
+    SimTrackerHit* hit;
+};
 
-    }
+struct LadderWorkItem
+{
+    int layer;
+    int ladder;
+    int n_hits;
+    float min_time;
+    float max_time;
 };
 
-typedef priority_queue<SimTrackerHit*, std::vector<SimTrackerHit*>, CmpTrackTime> hit_queue;
+/**
+ * @class LadderHitCursor
+ * @brief Forward cursor over the time-ordered hits of a single ladder
+ *
+ * The cursor is a pair of pointers into the contiguous storage of HitTemporalIndexes,
+ * it does not perform any lookup and it is meant to be owned by the agent processing the ladder.
+ */
+class LadderHitCursor
+{
+public:
+    LadderHitCursor() : c_item(nullptr), e_item(nullptr) {}
+    LadderHitCursor(const TimedHit* first, const TimedHit* last) : c_item(first), e_item(last) {}
+
+    inline bool Empty() const { return c_item == e_item; }
+    inline SimTrackerHit* CurrentHit() const { return Empty() ? nullptr : c_item->hit; }
+    inline float CurrentTime() const
+    {
+        return Empty() ? std::numeric_limits<float>::max() : c_item->time;
+    }
+    inline int CurrentIndex() const { return Empty() ? -1 : c_item->index; }
+    inline void DisposeHit() { if (!Empty()) c_item++; }
+    inline int GetHitNumber() const { return e_item - c_item; }
 
+private:
+    const TimedHit* c_item;
+    const TimedHit* e_item;
+};
 
+/**
+ * @class HitTemporalIndexes
+ * @brief Time-ordered index of the simulated hits grouped by ladder
+ *
+ * The fields of the hits are copied in a SimHitSnapshot, the hits are then bucketed by (layer, ladder)
+ * with a single linear pass over the snapshot and stored in a contiguous array; each bucket is
+ * then sorted by time.
+ * The bucket of a ladder is identified by a range of offsets in the array.
+ * If parallel_build is set the cell ID decoding and the sort of the buckets are
+ * distributed among the OpenMP threads. If a mask is given only the hits with
+ * a non-zero item are indexed, see HitPreFilter. If side_layers is positive the hits
+ * of the negative side are indexed with layer + side_layers, as for the disks of the endcaps.
+ */
 class HitTemporalIndexes
 {
 public:
-    HitTemporalIndexes(const LCCollection* STHcol);
+    HitTemporalIndexes(const LCCollection* STHcol, bool parallel_build = false,
+                       const vector<char>* h_mask = nullptr, int side_layers = 0);
     virtual ~HitTemporalIndexes();
     SimTrackerHit* CurrentHit(int layer, int ladder);
     void DisposeHit(int layer, int ladder);
     int GetHitNumber(int layer, int ladder);
     float GetMinTime();
     float GetMinTime(int layer, int ladder);
+    LadderHitCursor GetCursor(int layer, int ladder);
+    vector<LadderWorkItem> GetWorkItems();
+
+    // The hit at the given position of the input collection
+    inline SimTrackerHit* GetHit(int index) const
+    {
+        return index >= 0 && index < h_snapshot.Size() ? h_snapshot.GetHit(index) : nullptr;
+    }
+
+    inline const SimHitSnapshot& GetSnapshot() const { return h_snapshot; }
 
     static float MAXTIME;
 
 private:
     inline int GetKey(int layer, int ladder);
 
-    CellIDDecoder<SimTrackerHit> cellid_decoder;
-    unordered_map<int, hit_queue*> htable;
+    SimHitSnapshot h_snapshot;
+    int l_number;
+    int m_number;
+    vector<TimedHit> h_table;
+    vector<int> offsets;
+    vector<int> cursors;
 };
 
 #endif //HitTemporalIndexes_h
@@ -0,0 +1,75 @@
+#ifndef MemoryBudget_h
+#define MemoryBudget_h 1
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+using std::vector;
+
+// Estimated bytes of the transient data of a work item
+struct WorkItemMemory
+{
+    std::size_t sensor = 0;         // pixels of the sensor
+    std::size_t signals = 0;        // signal points of the window
+    std::size_t hit_tables = 0;     // records of the sim-hits for each pixel
+    std::size_t output = 0;         // reco-hits and relations staged until the merge
+
+    inline std::size_t Total() const { return sensor + signals + hit_tables + output; }
+};
+
+// Resident set size of the process in bytes, 0 if not available
+std::size_t CurrentResidentBytes();
+
+// Peak resident set size of the process since the start, in bytes, 0 if not available
+std::size_t PeakResidentBytes();
+
+/**
+ * @class MemoryBudgetScheduler
+ * @brief Pool of work items with a cap on the estimated memory of the items in flight
+ *
+ * The items are taken in the given order. An item that does not fit in the remaining budget
+ * is deferred and the next fitting item is taken instead; if nothing is in flight the first
+ * pending item is taken anyway, so an item larger than the budget runs alone.
+ * A thread without any fitting item waits for the release of the running items, with a backoff;
+ * the pool is locked again only after a release.
+ * The resident set size is sampled at each release for the high-water mark of the pool.
+ * The methods can be called by any thread of the parallel region.
+ */
+class MemoryBudgetScheduler
+{
+public:
+    /**
+     * @param budget The maximum bytes in flight, 0 for no limit
+     * @param order The positions of the items, in order of priority
+     * @param bytes The estimated bytes of each item, indexed by position
+     */
+    MemoryBudgetScheduler(std::size_t budget, const vector<std::size_t>& order, const vector<std::size_t>& bytes);
+    virtual ~MemoryBudgetScheduler();
+
+    // The position of the next item, -1 when all the items are taken
+    int Take();
+
+    void Release(int item);
+
+    inline std::size_t GetHighWater() const { return s_high_water; }
+    inline std::size_t GetResidentHighWater() const { return s_rss_high_water; }
+    inline int GetDeferred() const { return s_deferred; }
+
+private:
+    bool TryTake(int& item);
+
+    std::size_t s_budget;
+    const vector<std::size_t>& s_order;
+    const vector<std::size_t>& s_bytes;
+    vector<char> s_taken;
+    std::size_t s_first;
+    std::size_t s_in_flight;
+    int s_running;
+    std::size_t s_high_water;
+    std::size_t s_rss_high_water;
+    int s_deferred;
+    std::atomic<unsigned int> s_releases;
+};
+
+#endif //MemoryBudget_h
@@ -1,6 +1,7 @@
 #ifndef MuonCVXDDigitiser_h
 #define MuonCVXDDigitiser_h 1
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -15,6 +16,9 @@
 #include "DDRec/Surface.h"
 #include "DDRec/SurfaceManager.h"
 #include "MyG4UniversalFluctuationForSi.h"
+#include "PixelChargeKernel.h"
+#include "PhiloxRandomEngine.h"
+#include "SurfaceCache.h"
 
 using marlin::Processor;
 
@@ -35,10 +39,91 @@ struct SignalPoint
     double charge;
 };
 
+struct PixelDeposit
+{
+    int pixelID;
+    float charge;
+};
+
+/**
+ * Pixels of a hit as a structure of arrays, in local coordinates
+ */
+struct PixelBuffer
+{
+    std::vector<int> pixelID;
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<float> charge;      // electrons
+    std::vector<float> time;
+
+    inline int size() const { return pixelID.size(); }
+
+    inline void clear()
+    {
+        pixelID.clear();
+        x.clear();
+        y.clear();
+        charge.clear();
+        time.clear();
+    }
+
+    inline void push_back(int p_id, double p_x, double p_y, float p_charge, float p_time)
+    {
+        pixelID.push_back(p_id);
+        x.push_back(p_x);
+        y.push_back(p_y);
+        charge.push_back(p_charge);
+        time.push_back(p_time);
+    }
+};
+
 typedef std::vector<SimTrackerHitImpl*> SimTrackerHitImplVec;
 typedef std::vector<IonisationPoint> IonisationPointVec;
 typedef std::vector<SignalPoint> SignalPointVec;
 
+/**
+ * State of the digitisation of a SimTrackerHit.
+ * Each thread owns a context, with its own fluctuation model, charge kernel and buffers;
+ * the random numbers are drawn from the global CLHEP engine or, in parallel mode,
+ * from the Philox stream of the hit.
+ */
+struct HitContext
+{
+    HitContext(bool own_engine, GaussCDFMode erf_mode, double delta_cut);
+
+    PhiloxRandomEngine hitEngine;
+    CLHEP::HepRandomEngine* engine;
+    MyG4UniversalFluctuationForSi fluctuate;
+    PixelChargeKernel chargeKernel;
+
+    int layer;
+    int ladder;
+    int numberOfSegments;
+    double cutOnDeltaRays;          // delta-ray cut, updated by the fluctuation model
+    double particleMass;
+    double particleMomentum;
+    double phi;
+    double eSum;
+    double segmentDepth;
+    double localPosition[3];
+    double entryPoint[3];
+    double exitPoint[3];
+    IonisationPointVec ionisationPoints;
+    std::vector<double> elossBuffer;
+    SignalPointVec signalPoints;
+    std::vector<PixelDeposit> deposits;
+    PixelBuffer pixels;
+};
+
+/**
+ * Products of a SimTrackerHit, staged until they are moved into the collections in hit order
+ */
+struct HitOutput
+{
+    TrackerHitPlaneImpl* recoHit = nullptr;
+    SimTrackerHitImplVec firedPixels {};
+};
+
 /**  Digitizer for Simulated Hits in the Vertex Detector. <br>
  * Digitization follows the procedure adopted in the CMS software package. 
  * See https://twiki.cern.ch/twiki/bin/view/CMSPublic/SWGuidePixelDigitization
@@ -95,6 +180,15 @@ typedef std::vector<SignalPoint> SignalPointVec;
  * (default parameter value : 100) <br>
   * @param MaxTrackLength Maximum values for track path length inside the ladder (in mm)", <br>
  * (default parameter value : 10) <br> 
+ * @param ErfMode evaluation of the gaussian CDF for the pixel charge: 0 for GSL,
+ * 1 for tabulated with absolute error below 1e-10 <br>
+ * (default parameter value : 0) <br>
+ * @param ParallelHits flag to digitise the hits of an event in parallel; the random numbers of each hit
+ * are drawn from an independent stream, seeded by run number, event number and hit index,
+ * the result does not depend on the number of threads. The loop is serial if debug output is enabled <br>
+ * (default parameter value : 0) <br>
+ * @param RandomSeed seed for the random streams of the hits <br>
+ * (default parameter value : 12345) <br>
  * <br>
  */
 class MuonCVXDDigitiser : public Processor
@@ -168,11 +262,17 @@ protected:
     double _timeSmearingSigma;
     int _electronicEffects;
     int _produceFullPattern;
+    int _erfMode;
+    int _parallelHits;
+    int _randomSeed;
 
-    MyG4UniversalFluctuationForSi *_fluctuate;
+    // one context for each thread
+    std::vector<std::unique_ptr<HitContext>> _hitContexts;
 
     // charge discretization
     std::vector<double> _DigitizedBins{};
+    int _chargeNumBins;
+    int _timeNumBins;
     
     // geometry
     int _numberOfLayers;
@@ -195,47 +295,33 @@ protected:
     std::vector<float> _layerPetalInnerWidth{};
     std::vector<float> _layerPetalOuterWidth{};
     const dd4hep::rec::SurfaceMap* _map ;
+    SurfaceCache _surfCache;
 
-    // internal state
-    int _currentLayer;
-    int _currentLadder;
-    int _numberOfSegments;
-    double _currentParticleMass;
-    double _currentParticleMomentum;
-    double _currentPhi;
-    double _eSum;
-    double _segmentDepth;
-    double _currentLocalPosition[3];
-    double _currentEntryPoint[3];
-    double _currentExitPoint[3];
-    IonisationPointVec _ionisationPoints;
-    SignalPointVec _signalPoints;
+    /* Digitization of a single hit, thread-safe for distinct contexts */
+    void ProcessHit(HitContext &ctx, SimTrackerHit *simTrkHit, int layer, int ladder, HitOutput &output);
 
     /* Charge digitization helpers */
-    void ProduceIonisationPoints(SimTrackerHit *hit);
-    void ProduceSignalPoints();
-    void ProduceHits(SimTrackerHitImplVec &simTrkVec, SimTrackerHit &simHit);
-    void PoissonSmearer(SimTrackerHitImplVec &simTrkVec);
-    void GainSmearer(SimTrackerHitImplVec &simTrkVec);
-    void ApplyThreshold(SimTrackerHitImplVec &simTrkVec);
-    void ChargeDigitizer(SimTrackerHitImplVec &simTrkVec);
+    void ProduceIonisationPoints(HitContext &ctx, SimTrackerHit *hit);
+    void ProduceSignalPoints(HitContext &ctx);
+    void ProduceHits(HitContext &ctx, SimTrackerHit &simHit);
+    void ProcessPixels(HitContext &ctx);
+    float DigitizeCharge(float origCharge) const;
 
     /* Time digitization helpers */
-    void TimeSmearer(SimTrackerHitImplVec &simTrkVec);
-    void TimeDigitizer(SimTrackerHitImplVec &simTrkVec);
+    float DigitizeTime(float origTime) const;
 
     /* Reconstruction of measurement and helpers */
-    TrackerHitPlaneImpl *ReconstructTrackerHit(SimTrackerHitImplVec &simTrkVec);
+    TrackerHitPlaneImpl *ReconstructTrackerHit(HitContext &ctx);
     void TransformToLab(const int cellID, const double *xLoc, double *xLab);
-    void FindLocalPosition(SimTrackerHit *hit, double *localPosition, double *localDirection);
-    void TransformXYToCellID(double x, double y, int & ix, int & iy);
-    void TransformCellIDToXY(int ix, int iy, double & x, double & y);
-    int GetPixelsInaRow();
-    int GetPixelsInaColumn();
+    void FindLocalPosition(HitContext &ctx, SimTrackerHit *hit, double *localPosition, double *localDirection);
+    void TransformXYToCellID(int layer, double x, double y, int & ix, int & iy);
+    void TransformCellIDToXY(int layer, int ix, int iy, double & x, double & y);
+    int GetPixelsInaRow(int layer);
+    int GetPixelsInaColumn(int layer);
 
     void LoadGeometry();
     void PrintGeometryInfo();
-    double randomTail( const double qmin, const double qmax );
+    double randomTail( CLHEP::HepRandomEngine* engine, const double qmin, const double qmax );
 };
 
 #endif
@@ -3,6 +3,9 @@
 
 #include <string>
 #include <vector>
+#include <list>
+#include <memory>
+#include <cstdint>
 
 #include "marlin/Processor.h"
 #include "lcio.h"
@@ -12,9 +15,24 @@
 #include <IMPL/TrackerHitPlaneImpl.h>
 #include "IMPL/SimTrackerHitImpl.h"
 #include <IMPL/LCCollectionVec.h>
+#include <IMPL/LCRelationImpl.h>
 #include "DDRec/Surface.h"
 #include "DDRec/SurfaceManager.h"
+#include "DD4hep/Detector.h"
+#include "HitTemporalIndexes.h"
+#include "AbstractSensor.h"
+#include "DetElemSlidingWindow.h"
+#include "SensorPool.h"
+#include "SurfaceCache.h"
+#include "BIBPixelCache.h"
+#include "HitPreFilter.h"
+#include "ClusterShapeFilter.h"
+#include "MemoryBudget.h"
+#include "StageProfiler.h"
+#include "PixelNoiseGenerator.h"
+#include "BinAccumulator.h"
 
+#include <TFile.h>
 #include <TH1.h>
 
 using marlin::Processor;
@@ -36,6 +54,33 @@ struct SignalPoint
     double charge;
 };
 
+// Options of the parameter OutputMode, they can be summed
+enum class OutputMode : int
+{
+    full = 0,
+    signal_only = 1,
+    per_particle = 2,
+    no_raw_hits = 4
+};
+
+// Objects produced by a ladder, they are moved into the output collections at the end of the event
+struct LadderOutput
+{
+    std::vector<TrackerHitPlaneImpl*> reco_hits;
+    std::vector<LCRelationImpl*> relations;
+    std::vector<std::size_t> rel_histo;
+    BIBLadderCache bib_cache;
+    ShapeFilterStats shape_stats;
+    LadderProfile profile;
+};
+
+// Statistics histograms filled by a thread in the parallel region
+struct ThreadStats
+{
+    ClusterStatAccumulator signal;
+    ClusterStatAccumulator bib;
+};
+
 typedef std::vector<SimTrackerHitImpl*> SimTrackerHitImplVec;
 typedef std::vector<IonisationPoint> IonisationPointVec;
 typedef std::vector<SignalPoint> SignalPointVec;
@@ -50,7 +95,8 @@ typedef std::vector<SignalPoint> SignalPointVec;
  * (default parameter value : "VTXTrackerHits")
  * @param RelationColName name of the LCRelation <br>
  * (default parameter value : "VTXTrackerHitRelations")
- * @param SubDetectorName name of the detector <br>
+ * @param SubDetectorName name of the detector, a barrel (ZPlanarData) or, if the name contains "Endcap",
+ * the disks of an endcap (ZDiskPetalsData); the petals of the disks are processed as the ladders <br>
  * (default parameter value : "VertexBarrel")
  * @param TanLorentz tangent of the Lorentz angle <br>
  * (default parameter value : 0.8) <br>
@@ -80,6 +126,15 @@ typedef std::vector<SignalPoint> SignalPointVec;
  * (default parameter value : 1) <br>
  * @param ElectronicNoise electronic noise in electrons <br>
  * (default parameter value : 100) <br>
+ * @param NoiseInjection flag to inject the pixels fired by the electronic noise; the noisy pixels
+ * of each clock step are sampled from the gaussian tail of ElectronicNoise over Threshold and clustered
+ * with the pixels of the sim-hits, only in the clock steps simulated for the ladder <br>
+ * (default parameter value : 0) <br>
+ * @param OutputMode sum of the options of the truth output: 0 for a relation and a raw hit for each
+ * sim-hit of a cluster, 1 to keep only the sim-hits not from the overlay, 2 for one relation per MC particle,
+ * pointing to its sim-hit with the largest charge and weighted with the charge of all its sim-hits,
+ * 4 to leave the raw hits of the reco-hits empty <br>
+ * (default parameter value : 0) <br>
  * @param StoreFiredPixels flag to store also the fired pixels (collection names: "VTXPixels") <br>
  * (default parameter value : 0) <br>
  * @param EnergyLoss Energy loss in keV/mm <br>
@@ -88,6 +143,83 @@ typedef std::vector<SignalPoint> SignalPointVec;
  * (default parameter value : 100) <br>
   * @param MaxTrackLength Maximum values for track path length inside the ladder (in mm)", <br>
  * (default parameter value : 10) <br> 
+ * @param ParallelIndexBuild flag to distribute the construction of the hit index among the threads <br>
+ * (default parameter value : 1) <br>
+ * @param DeterministicRandom flag to draw the random numbers of each ladder from an independent stream,
+ * seeded by run number, event number, layer and ladder; the result does not depend on the number of threads <br>
+ * (default parameter value : 0) <br>
+ * @param RandomSeed seed for the random streams of the ladders <br>
+ * (default parameter value : 12345) <br>
+ * @param SchedulingMode ladder scheduling: 0 for a parallel loop for each layer,
+ * 1 for a single dynamic pool of the non-empty ladders of all the layers, sorted by estimated cost <br>
+ * (default parameter value : 1) <br>
+ * @param ClockStepCost estimated cost of a clock step with respect to a simulated hit,
+ * used for sorting the work items of the pool <br>
+ * (default parameter value : 1.0) <br>
+ * @param MemoryBudget maximum estimated memory of the work items processed at the same time (in MB);
+ * the sensor, the signal points, the sim-hit tables and the staged output of each item are estimated
+ * from its hits, the items that do not fit are deferred; with SensorPooling the pooled sensors are
+ * charged once per thread instead. Only for SchedulingMode 1, 0 for no limit <br>
+ * (default parameter value : 0) <br>
+ * @param ErfMode evaluation of the gaussian CDF for the pixel charge: 0 for GSL,
+ * 1 for tabulated with absolute error below 1e-10 <br>
+ * (default parameter value : 0) <br>
+ * @param SensorPooling flag to keep the last sensor of each thread and reuse it for the following
+ * ladders of the same layer, across events; a sensor of another layer replaces it <br>
+ * (default parameter value : 0) <br>
+ * @param SparseClustering flag to run the Hoshen-Kopelman clustering over the fired pixels only <br>
+ * (default parameter value : 1) <br>
+ * @param IncrementalClustering flag to merge the pixels switched on in a clock step into the clusters
+ * of the previous steps with pixels still over threshold (chip RD53A only); a cluster is then read out
+ * when all its pixels are ready <br>
+ * (default parameter value : 0) <br>
+ * @param SegmentTasks flag to split the ladders with many hits into one task for each sensor segment,
+ * for the charge deposition and for the clustering (sparse clustering only) <br>
+ * (default parameter value : 0) <br>
+ * @param SegmentTaskMinHits minimum number of simulated hits of a ladder for the segment tasks <br>
+ * (default parameter value : 1000) <br>
+ * @param OffloadMinPoints minimum number of signal points of a clock step for the offload of the charge
+ * deposition to the device, 0 to keep the deposition on the host; only for the builds with OFFLOAD_ENABLED <br>
+ * (default parameter value : 256) <br>
+ * @param IdleClockSkip flag to move the time window straight to the next hit or to the next
+ * expiration of a pixel when nothing happens in between <br>
+ * (default parameter value : 1) <br>
+ * @param BIBCache flag to digitise the overlay hits of a background sample only once; the pixel charges
+ * are cached and superimposed to the signal hits of the following events with the same overlay hits <br>
+ * (default parameter value : 0) <br>
+ * @param BIBCacheDirectory directory for the files of the background cache, shared among jobs;
+ * if empty the cache is kept in memory only <br>
+ * (default parameter value : "") <br>
+ * @param BIBCacheSize maximum number of background samples kept in memory <br>
+ * (default parameter value : 4) <br>
+ * @param HitPreFilter flag to drop the simulated hits out of the time window, below the minimum
+ * energy or on a masked layer or ladder before the construction of the hit index <br>
+ * (default parameter value : 0) <br>
+ * @param FilterMinTime lower edge of the time window of the pre-filter (in ns) <br>
+ * (default parameter value : -1000) <br>
+ * @param FilterMaxTime upper edge of the time window of the pre-filter (in ns) <br>
+ * (default parameter value : 1000) <br>
+ * @param FilterMinEDep minimum deposited energy of the pre-filter (in keV) <br>
+ * (default parameter value : 0) <br>
+ * @param FilterMaskedLayers layers dropped by the pre-filter <br>
+ * (default parameter value : empty) <br>
+ * @param FilterMaskedLadders pairs of layer and ladder dropped by the pre-filter <br>
+ * (default parameter value : empty) <br>
+ * @param ShapeFilter test of the cluster size along u and v against the path of a particle from the origin
+ * through the sensor: 0 for off, 1 to set the quality bit 1 of the incompatible clusters,
+ * 2 to drop them before creating the LCIO objects; the bits from 28 up are left to the tracking <br>
+ * (default parameter value : 0) <br>
+ * @param ShapeToleranceX accepted difference between measured and expected cluster size along u (in pixels) <br>
+ * (default parameter value : 2.0) <br>
+ * @param ShapeToleranceY accepted difference between measured and expected cluster size along v (in pixels) <br>
+ * (default parameter value : 2.0) <br>
+ * @param Profiling flag to measure the wall time of the stages and the counters of each ladder;
+ * the results are written as trees in the statistics file, which is then open for the whole job;
+ * without StatisticsFilename only the trace file is written <br>
+ * (default parameter value : 0) <br>
+ * @param ProfileTraceFile name of the Chrome trace file (JSON) of the profiled ladders,
+ * empty for no trace <br>
+ * (default parameter value : "") <br>
  * <br>
  */
 class MuonCVXDRealDigitiser : public Processor
@@ -120,12 +252,40 @@ public:
 protected:
 
     void PrintGeometryInfo();
+    void ResizeGeometry(int n_layers);
+    void LoadBarrelGeometry(dd4hep::DetElement& vxDetector);
+    void LoadEndcapGeometry(dd4hep::DetElement& vxDetector);
+
+    AbstractSensor* CreateSensor(int layer, int ladder, float start_time, const std::string& encoder_str);
+    SlidingWindow* CreateWindow(HitTemporalIndexes& t_index, AbstractSensor& sensor, float start_time,
+                                CLHEP::HepRandomEngine* engine);
+    template<class SensorT>
+    SlidingWindow* MakeWindow(HitTemporalIndexes& t_index, SensorT& sensor, float start_time,
+                              CLHEP::HepRandomEngine* engine);
+
+    void ProcessLadder(int layer, int ladder,
+                       HitTemporalIndexes& t_index,
+                       const std::string& encoder_str,
+                       uint64_t random_key,
+                       const BIBLadderView* bib_view,
+                       bool build_bib,
+                       LadderOutput& output);
+
+    uint64_t GetOverlayKey(const SimHitSnapshot& h_snapshot);
+    const BIBPixelCache* FindBIBCache(uint64_t key, int ladders);
+    void StoreBIBCache(BIBPixelCache* bib_cache);
+    WorkItemMemory EstimateMemory(const LadderWorkItem& w_item) const;
+
+    ThreadStats BookThreadStats() const;
+    void ResizeThreadStats(int n_threads);
 
     int _nRun;
     int _nEvt;
     int _debug;
     int _totEntries;
     int _barrelID;
+    bool _isEndcap;
+    int _disksPerSide;
     std::string _subDetName;
 
     // input/output collections
@@ -151,8 +311,38 @@ protected:
     float _fe_slope;
     int _PoissonSmearing;
     int _electronicEffects;
+    int _noiseInjection;
     int _produceFullPattern;
+    int _outputMode;
     int sensor_type;
+    int _parallelIndexBuild;
+    int _deterministicRandom;
+    int _randomSeed;
+    int _schedulingMode;
+    float _clockStepCost;
+    float _memoryBudget;
+    int _erfMode;
+    int _sensorPooling;
+    int _sparseClustering;
+    int _incrementalClustering;
+    int _segmentTasks;
+    int _segmentTaskMinHits;
+    int _offloadMinPoints;
+    int _idleClockSkip;
+    int _bibCache;
+    std::string _bibCacheDir;
+    int _bibCacheSize;
+    int _hitPreFilter;
+    float _filterMinTime;
+    float _filterMaxTime;
+    float _filterMinEDep;
+    std::vector<int> _filterMaskedLayers;
+    std::vector<int> _filterMaskedLadders;
+    int _shapeFilterMode;
+    float _shapeToleranceX;
+    float _shapeToleranceY;
+    int _profiling;
+    std::string _profileTrace;
 
     // geometry
     int _numberOfLayers;
@@ -167,7 +357,30 @@ protected:
     std::vector<float> _layerActiveSiOffset{};
     std::vector<float> _layerHalfPhi{};
     std::vector<float> _layerLadderWidth{};
+    std::vector<float> _layerPetalInnerWidth{};
+    std::vector<int>   _layerCellID{};
+    std::vector<int>   _layerSide{};
     const dd4hep::rec::SurfaceMap* _map ;
+    SurfaceCache _surfCache;
+
+    // sensors reused by each thread
+    std::vector<SensorPool> _sensorPools;
+
+    // background samples, the most recently used first
+    std::list<std::unique_ptr<BIBPixelCache>> _bibCaches;
+    uint64_t _bibParamKey;
+
+    std::unique_ptr<HitPreFilter> _preFilter;
+    HitFilterStats _filterTotals;
+
+    std::unique_ptr<ClusterShapeFilter> _shapeFilter;
+    ShapeFilterStats _shapeTotals;
+
+    std::unique_ptr<TFile> _statFile;
+    std::unique_ptr<StageProfiler> _profiler;
+
+    // disabled unless NoiseInjection is set, copied in the window of each ladder
+    PixelNoiseGenerator _noiseGen;
 
     std::string stat_filename;
     bool create_stats;
@@ -184,6 +397,9 @@ protected:
     TH1F* bib_zSizeHisto;
     TH1F* bib_eDepHisto;
 
+    // one set of accumulators per thread, the histograms are filled in end()
+    std::vector<ThreadStats> _threadStats;
+
 };
 
 #endif //MuonCVXDRealDigitiser_h
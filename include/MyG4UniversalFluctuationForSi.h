@@ -34,6 +34,8 @@
 //
 // Modifications:
 //
+// 14-10-26 batch sampling for the segments of a track
+// 14-10-26 random engine as argument of the constructor
 // 09-12-02 remove warnings (V.Ivanchenko)
 // 28-12-02 add method Dispersion (V.Ivanchenko)
 // 07-02-03 change signature (V.Ivanchenko)
@@ -48,11 +50,14 @@
 #define MyG4UniversalFluctuationForSi_h 
 
 //#include "G4VEmFluctuationModel.hh"
+#include "CLHEP/Random/RandomEngine.h"
 
 class MyG4UniversalFluctuationForSi {
 public:
 
-  MyG4UniversalFluctuationForSi();
+  // all the random numbers are drawn from the given engine,
+  // the global CLHEP engine is used if engine is nullptr
+  MyG4UniversalFluctuationForSi(CLHEP::HepRandomEngine* engine = nullptr);
 
   ~MyG4UniversalFluctuationForSi();
 
@@ -63,6 +68,17 @@ public:
                             double& tmax,
                             const double length,
                             const double meanLoss);
+
+  // energy loss of n_seg segments with the same mean loss, equivalent
+  // to n_seg calls of the method above (including the update of tmax);
+  // the constants are recomputed only when tmax changes.
+  void SampleFluctuations(const double momentum,
+                          const double mass,
+                          double& tmax,
+                          const double length,
+                          const double meanLoss,
+                          const int n_seg,
+                          double* losses);
   
   //G4double Dispersion(    const G4Material*,
   //                        const G4DynamicParticle*,
@@ -74,6 +90,21 @@ protected:
 
 private:
 
+  // constants of a step for a given tmax
+  struct StepConstants {
+    bool gaussian;
+    double siga;
+    double w1;
+    double a1;
+    double a2;
+    double a3;
+    double suma;
+  };
+
+  void SetupStep(const double gam2, const double beta2, const double tmax,
+                 const double length, const double meanLoss, StepConstants& sc);
+  double SampleStep(double& tmax, const double meanLoss, const StepConstants& sc);
+
   // hide assignment operator
   //G4UniversalFluctuation & operator=(const  G4UniversalFluctuation &right);
   //G4UniversalFluctuation(const  G4UniversalFluctuation&);
@@ -81,6 +112,8 @@ private:
   //const G4ParticleDefinition* particle;
   //const G4Material* lastMaterial;
 
+  CLHEP::HepRandomEngine* _engine;
+
   double particleMass{};
   double chargeSquare{};
 
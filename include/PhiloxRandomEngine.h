@@ -0,0 +1,53 @@
+#ifndef PhiloxRandomEngine_h
+#define PhiloxRandomEngine_h 1
+
+#include <cstdint>
+#include <string>
+
+#include "CLHEP/Random/RandomEngine.h"
+
+/**
+ * @class PhiloxRandomEngine
+ * @brief Counter-based random engine (Philox4x32-10)
+ *
+ * Implementation of the Philox4x32-10 generator described in
+ * [Salmon et al., SC'11](https://doi.org/10.1145/2063384.2063405).
+ * The output is a pure function of the key, the stream ID and the number of draws,
+ * therefore an engine can be created for any work item without sharing state between threads.
+ * The class implements the CLHEP engine interface and it can be passed to any CLHEP distribution.
+ */
+class PhiloxRandomEngine : public CLHEP::HepRandomEngine
+{
+public:
+    PhiloxRandomEngine(uint64_t key = 0, uint64_t stream = 0);
+    virtual ~PhiloxRandomEngine();
+
+    /**
+     * @brief Select the sequence of the engine and restart it
+     * @param key The key of the generator, see MakeKey
+     * @param stream The identifier of the sequence for the given key, see MakeStreamID
+     */
+    void SetStream(uint64_t key, uint64_t stream);
+
+    static uint64_t MakeKey(long seed, int run, int event);
+    static uint64_t MakeStreamID(int layer, int ladder);
+
+    double flat() override;
+    void flatArray(const int size, double* vect) override;
+    void setSeed(long seed, int) override;
+    void setSeeds(const long* seeds, int) override;
+    void saveStatus(const char filename[] = "Config.conf") const override;
+    void restoreStatus(const char filename[] = "Config.conf") override;
+    void showStatus() const override;
+    std::string name() const override;
+
+private:
+    void generate();
+
+    uint32_t p_key[2];
+    uint32_t p_counter[4];
+    uint32_t p_output[4];
+    int p_used;
+};
+
+#endif //PhiloxRandomEngine_h
@@ -0,0 +1,68 @@
+#ifndef PixelChargeKernel_h
+#define PixelChargeKernel_h 1
+
+#include <vector>
+
+enum class GaussCDFMode
+{
+    exact,          // GSL complementary error function
+    tabulated       // cubic Hermite interpolation, absolute error below 1e-10
+};
+
+/**
+ * @class PixelChargeKernel
+ * @brief Integration of a 2D gaussian charge cloud over a box of pixels
+ *
+ * The gaussian is separable, therefore the fractions of charge along X and Y
+ * are computed once for each row and column of the box, evaluating the CDF
+ * only on the edges of the pixels. The charge of every pixel is the outer
+ * product of the two arrays, stored row by row in a contiguous buffer.
+ * The buffers are owned by the kernel and reused, an instance of the kernel
+ * must not be shared among threads.
+ */
+class PixelChargeKernel
+{
+public:
+    PixelChargeKernel(GaussCDFMode mode = GaussCDFMode::exact);
+    virtual ~PixelChargeKernel();
+
+    /**
+     * @brief Fractions of a gaussian in n adjacent bins
+     * @param first_edge The lower edge of the first bin
+     * @param pitch The width of the bins
+     * @param centre The mean of the gaussian
+     * @param sigma The standard deviation of the gaussian
+     * @param n The number of bins
+     * @param fractions The output array, at least n items
+     */
+    void IntegrateAxis(double first_edge, double pitch, double centre, double sigma,
+                       int n, double* fractions);
+
+    /**
+     * @brief Charge deposited on a box of nx * ny pixels
+     *
+     * The box starts at (x_edge, y_edge), the charge of the pixel (i, j) is then
+     * retrieved with GetCharge(i, j).
+     */
+    void Deposit(double x_edge, double pitch_x, int nx,
+                 double y_edge, double pitch_y, int ny,
+                 double x, double y, double sigmaX, double sigmaY, double charge);
+
+    inline float GetCharge(int i, int j) const { return q_buffer[i * b_ny + j]; }
+    inline const float* GetCharges() const { return q_buffer.data(); }
+
+    double CDF(double x) const;
+
+    static double ExactCDF(double x);
+    static double TabulatedCDF(double x);
+
+private:
+    GaussCDFMode _mode;
+    int b_ny;
+    std::vector<double> cdf_buffer;
+    std::vector<double> wx_buffer;
+    std::vector<double> wy_buffer;
+    std::vector<float> q_buffer;
+};
+
+#endif //PixelChargeKernel_h
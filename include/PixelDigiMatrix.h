@@ -3,13 +3,11 @@
 
 #include <string>
 #include <vector>
-#include <unordered_map>
 
 #include "AbstractSensor.h"
+#include "PixelTileStore.h"
 
 using std::string;
-using std::unordered_map;
-using std::unordered_multimap;
 using std::vector;
 
 struct LocatedPixel
@@ -19,8 +17,6 @@ struct LocatedPixel
     PixelData data;
 };
 
-using ClockTicks = int;
-
 /**
  * @class PixelDigiMatrix
  * @brief Simulation of the chip RD53A
@@ -33,6 +29,7 @@ using ClockTicks = int;
  * Each matrix is identify by a couple of ID: the layer ID and the ladder ID.
  * This class must be operated by an agent which feeds it with the charge and synchronize the actions
  * through a clock.
+ * The pixels are stored in a PixelTileStore, the expiration of the pixels is tracked by an ExpiryWheel.
  */
 class PixelDigiMatrix : public AbstractSensor
 {
@@ -75,6 +72,8 @@ public:
                     float t_step);
     virtual ~PixelDigiMatrix();
 
+    void Rebind(int ladder, float starttime) override;
+
     void Reset() override;
 
     void BeginClockStep() override;
@@ -92,6 +91,13 @@ public:
 
     void EndClockStep() override;
 
+    /**
+     * @brief The steps before the clock reaches the earliest expiration of a pixel
+     */
+    int GetIdleClockSteps() override;
+
+    void SkipClockSteps(int n) override;
+
     PixelData GetPixel(int x, int y) override;
 
     bool IsActive() override;
@@ -104,28 +110,24 @@ protected:
 
     vector<LocatedPixel> GetPixelsFromSensor(int seg_x, int seg_y, PixelStatus pstat);
 
+    /**
+     * @brief The pixels of a sensor switched on in the last clock step, in ladder coordinates
+     */
+    const vector<GridCoordinate>& GetStartPixels(int seg_x, int seg_y);
+
     float delta_c;
     int clock_cnt;
 
 private:
 
-    struct PixelRawData
-    {
-        float charge;
-        ClockTicks t_begin;
-        ClockTicks t_end;
-    };
-
-    using SensorBin = unordered_multimap<LinearPosition, LinearPosition>;
-
-    PixelStatus calc_status(LinearPosition lpos);
+    PixelStatus calc_status(const PixelCell* cell);
     ClockTicks calc_end_clock(float charge);
-    LinearPosition sensor_for_pixel(LinearPosition pos);
+    LinearPosition sensor_for_pixel(int row, int col);
 
-    unordered_map<LinearPosition, PixelRawData> pixels;
-    unordered_map<ClockTicks, SensorBin> expir_table;
-    unordered_map<LinearPosition, float> charge_buffer;
-    SensorBin start_table; 
+    PixelTileStore p_store;
+    ExpiryWheel e_wheel;
+    vector<vector<GridCoordinate>> start_lists;
+    vector<vector<GridCoordinate>> ready_lists;
 };
 
 #endif //PixelDigiMatrix_h
@@ -0,0 +1,73 @@
+#ifndef PixelNoiseGenerator_h
+#define PixelNoiseGenerator_h 1
+
+#include <cstdint>
+
+#include "CLHEP/Random/RandomEngine.h"
+
+/**
+ * @class PixelNoiseGenerator
+ * @brief Sparse sampling of the pixels fired by the electronic noise
+ *
+ * Every pixel of every clock step is over threshold with the tail probability
+ * p = Q(threshold / noise) of the gaussian noise. The pixels of the consecutive
+ * clock steps of a ladder are seen as a single stream and the distance between
+ * two noisy pixels is drawn from the geometric distribution of parameter p,
+ * so the cost is proportional to the number of noise hits, not to the number of pixels.
+ * The charge of a noisy pixel is drawn from the gaussian tail above the threshold.
+ * An instance holds the position in the stream, it must not be shared among threads.
+ */
+class PixelNoiseGenerator
+{
+public:
+    PixelNoiseGenerator(double noise = 0., double threshold = 0.);
+    virtual ~PixelNoiseGenerator() {}
+
+    inline bool Enabled() const { return n_prob > 0.; }
+
+    inline double GetProbability() const { return n_prob; }
+
+    /**
+     * @brief Draw the first noisy pixel of a ladder
+     * @param engine The random engine of the ladder
+     * @param n_pixels The number of pixels of the ladder in a clock step
+     */
+    void Start(CLHEP::HepRandomEngine* engine, int64_t n_pixels);
+
+    // The number of clock steps before the one of the next noisy pixel
+    inline int64_t StepsBeforeNext() const { return n_next / n_step; }
+
+    // Move the stream forward, n_steps must not be greater than StepsBeforeNext()
+    inline void SkipSteps(int64_t n_steps) { n_next -= n_steps * n_step; }
+
+    /**
+     * @brief Sample the noisy pixels of a clock step
+     * @param func The callback for each noisy pixel, with the linear index in the ladder and the charge
+     */
+    template<typename F>
+    inline int Step(F func)
+    {
+        if (!Enabled()) return 0;
+
+        int n_hits = 0;
+        for (; n_next < n_step; n_next += NextSkip() + 1, n_hits++)
+        {
+            func(n_next, NextCharge());
+        }
+        n_next -= n_step;
+        return n_hits;
+    }
+
+private:
+    int64_t NextSkip();
+    float NextCharge();
+
+    double n_noise;
+    double n_prob;
+    double n_logq;
+    int64_t n_step;
+    int64_t n_next;
+    CLHEP::HepRandomEngine* n_engine;
+};
+
+#endif //PixelNoiseGenerator_h
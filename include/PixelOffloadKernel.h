@@ -0,0 +1,85 @@
+#ifndef PixelOffloadKernel_h
+#define PixelOffloadKernel_h 1
+
+#include <vector>
+
+// Box of pixels of a signal point, see PixelChargeKernel::Deposit
+struct OffloadBox
+{
+    double x_edge;
+    double y_edge;
+    double x;
+    double y;
+    double sigma_x;
+    double sigma_y;
+    double charge;
+    int nx;
+    int ny;
+    int row_lo;         // first row of the box in the pixel grid
+    int col_lo;         // first column of the box in the pixel grid
+    int hit_index;      // the sim-hit of the signal point
+};
+
+/**
+ * @class PixelOffloadKernel
+ * @brief Integration of a batch of 2D gaussian charge clouds, offloaded to the device
+ *
+ * All the boxes of a batch are integrated in a single call: the CDF of every edge of
+ * the boxes is computed first, then the charge of every pixel, each row and each pixel
+ * in its own iteration of a flat loop. With OFFLOAD_ENABLED the loops run on the default
+ * device of OpenMP, otherwise, and if no device is available, on the host.
+ * The CDF is the complementary error function of the C library, as ExactCDF of
+ * PixelChargeKernel within rounding. The charges of a box are stored row by row,
+ * in the same layout of PixelChargeKernel. An instance must not be shared among threads.
+ * The device buffers are mapped for the lifetime of the kernel and mapped again only
+ * when the buffers of the host grow; each call copies the boxes in and the charges out.
+ */
+class PixelOffloadKernel
+{
+public:
+    PixelOffloadKernel();
+    PixelOffloadKernel(const PixelOffloadKernel&) = delete;
+    PixelOffloadKernel& operator=(const PixelOffloadKernel&) = delete;
+    virtual ~PixelOffloadKernel();
+
+    void Clear();
+
+    inline void AddBox(const OffloadBox& box) { boxes.push_back(box); }
+
+    // Integrate all the boxes of the batch
+    void Deposit(double pitch_x, double pitch_y);
+
+    inline int GetBoxNumber() const { return int(boxes.size()); }
+    inline const OffloadBox& GetBox(int b) const { return boxes[b]; }
+    inline float GetCharge(int b, int i, int j) const { return q_buffer[q_offsets[b] + i * boxes[b].ny + j]; }
+
+private:
+    // Region of a host buffer mapped to the device
+    struct MappedRegion
+    {
+        const void* data = nullptr;
+        std::size_t capacity = 0;
+    };
+
+    template<class T>
+    static void Grow(std::vector<T>& buffer, std::size_t n);
+
+    static const int N_REGIONS = 7;
+
+    void GetRegions(MappedRegion* regions) const;
+    bool MappingChanged() const;
+    void MapBuffers();
+    void UnmapBuffers();
+
+    std::vector<OffloadBox> boxes;
+    std::vector<int> x_offsets;
+    std::vector<int> y_offsets;
+    std::vector<int> q_offsets;
+    std::vector<double> cdf_x;
+    std::vector<double> cdf_y;
+    std::vector<float> q_buffer;
+    MappedRegion m_regions[N_REGIONS];
+    bool mapped;
+};
+
+#endif //PixelOffloadKernel_h
@@ -0,0 +1,159 @@
+#ifndef PixelTileStore_h
+#define PixelTileStore_h 1
+
+#include <cstdint>
+#include <vector>
+
+using std::vector;
+
+using ClockTicks = int;
+
+struct PixelCell
+{
+    float charge;
+    ClockTicks t_begin;
+    ClockTicks t_end;
+};
+
+/**
+ * @class PixelTileStore
+ * @brief Sparse storage for the pixels of a ladder
+ *
+ * The grid of pixels is divided into square tiles of TILE_SIDE x TILE_SIDE pixels;
+ * the tile is allocated when the first pixel is switched on and it is released when
+ * all its pixels are off. Each tile has a 64-bit occupancy mask, a buffer for the charge
+ * collected during the current clock step and a mask for the buffered pixels.
+ * The released tiles are kept in a pool, so the store can be reused without any allocation.
+ */
+class PixelTileStore
+{
+public:
+    static const int TILE_SHIFT = 3;
+    static const int TILE_SIDE = 1 << TILE_SHIFT;
+    static const int TILE_MASK = TILE_SIDE - 1;
+
+    PixelTileStore(int rows, int cols);
+    virtual ~PixelTileStore();
+
+    void Clear();
+
+    inline int Size() const { return n_pixels; }
+
+    // The bytes of a tile, for the estimates of memory
+    static std::size_t TileBytes() { return sizeof(PixelTile); }
+
+    PixelCell* Find(int row, int col);
+    PixelCell& Insert(int row, int col);
+    void Erase(int row, int col);
+
+    void Accumulate(int row, int col, float chrg);
+    void ClearBuffer();
+
+    /**
+     * @brief Visit the charge collected in the current clock step
+     *
+     * The function is called as func(row, col, charge), tile by tile in order of allocation
+     */
+    template<typename F>
+    void ForEachBuffered(F func)
+    {
+        for (int t_idx : dirty_tiles)
+        {
+            PixelTile& tile = tile_pool[t_idx];
+            int row0 = (tile.tile_id / t_cols) << TILE_SHIFT;
+            int col0 = (tile.tile_id % t_cols) << TILE_SHIFT;
+            for (uint64_t b_mask = tile.buffered; b_mask != 0; b_mask &= b_mask - 1)
+            {
+                int bit = __builtin_ctzll(b_mask);
+                func(row0 + (bit >> TILE_SHIFT), col0 + (bit & TILE_MASK), tile.buffer[bit]);
+            }
+        }
+    }
+
+    /**
+     * @brief Flag a pixel, returns false if the pixel is off or already flagged
+     */
+    bool Mark(int row, int col);
+    void ClearMarks();
+
+private:
+    struct PixelTile
+    {
+        uint64_t occupied;
+        uint64_t buffered;
+        uint64_t marked;
+        int tile_id;
+        PixelCell cells[TILE_SIDE * TILE_SIDE];
+        float buffer[TILE_SIDE * TILE_SIDE];
+    };
+
+    inline int tile_for(int row, int col) const
+    {
+        return (row >> TILE_SHIFT) * t_cols + (col >> TILE_SHIFT);
+    }
+
+    inline int bit_for(int row, int col) const
+    {
+        return ((row & TILE_MASK) << TILE_SHIFT) | (col & TILE_MASK);
+    }
+
+    int get_tile(int row, int col);
+    void release_tile(int t_idx);
+
+    int t_cols;
+    int n_pixels;
+    vector<int> tile_index;
+    vector<PixelTile> tile_pool;
+    vector<int> free_tiles;
+    vector<int> dirty_tiles;
+    vector<int> marked_tiles;
+};
+
+/**
+ * @class ExpiryWheel
+ * @brief Hashed time wheel for the expiration of the pixels
+ *
+ * A pixel expiring at clock t is stored in the bucket t % size together with t itself;
+ * entries are never removed when the expiration of a pixel changes, the agent must validate
+ * each entry against the pixel (lazy deletion).
+ */
+class ExpiryWheel
+{
+public:
+    struct Entry
+    {
+        ClockTicks t_end;
+        int row;
+        int col;
+    };
+
+    ExpiryWheel(int size = 64);
+    virtual ~ExpiryWheel();
+
+    void Clear();
+
+    inline void Schedule(ClockTicks t_end, int row, int col)
+    {
+        buckets[t_end & w_mask].push_back({ t_end, row, col });
+    }
+
+    inline vector<Entry>& Bucket(ClockTicks clock) { return buckets[clock & w_mask]; }
+
+    /**
+     * @brief Visit all the entries of the wheel, including the stale ones
+     */
+    template<typename F>
+    void ForEach(F func) const
+    {
+        for (const vector<Entry>& bucket : buckets)
+        {
+            for (const Entry& entry : bucket) func(entry);
+        }
+    }
+
+private:
+    int w_mask;
+    vector<vector<Entry>> buckets;
+};
+
+#endif //PixelTileStore_h
@@ -0,0 +1,45 @@
+#ifndef SensorPool_h
+#define SensorPool_h 1
+
+#include <memory>
+#include <string>
+
+#include "AbstractSensor.h"
+
+/**
+ * @class SensorPool
+ * @brief The most recently used sensor of a thread, reusable for the ladders of its layer
+ *
+ * All the ladders of a layer share the same geometry, so the sensor can be rebound
+ * to any ladder of the layer; a sensor of another layer replaces it. The pool holds
+ * at most one sensor, as many pixels as a thread has in flight without the pool.
+ * A pool must be owned by a single thread.
+ */
+class SensorPool
+{
+public:
+    SensorPool();
+    SensorPool(SensorPool&&) = default;
+    SensorPool& operator=(SensorPool&&) = default;
+    virtual ~SensorPool();
+
+    /**
+     * @brief Store the sensor for a layer, the previous sensor is deleted;
+     * the pool takes the ownership of the object
+     */
+    void SetSensor(int layer, AbstractSensor* sensor);
+
+    /**
+     * @brief Rebind the sensor of the layer to the given ladder
+     * @return The sensor or nullptr if the pool holds a sensor of another layer, or none
+     */
+    AbstractSensor* GetSensor(int layer, int ladder, float starttime, const std::string& enc_str);
+
+    void Clear();
+
+private:
+    int s_layer;
+    std::unique_ptr<AbstractSensor> sensor;
+};
+
+#endif //SensorPool_h
@@ -0,0 +1,75 @@
+#ifndef SimHitSnapshot_h
+#define SimHitSnapshot_h 1
+
+#include <string>
+#include <vector>
+
+#include "EVENT/SimTrackerHit.h"
+#include "EVENT/LCCollection.h"
+
+using std::vector;
+using EVENT::SimTrackerHit;
+using EVENT::LCCollection;
+
+/**
+ * @class SimHitSnapshot
+ * @brief Structure of arrays with the fields of the simulated hits used by the digitisation
+ *
+ * The arrays are filled with a single pass over the input collection, optionally distributed
+ * among the OpenMP threads, and they are indexed by the position of the hit in the collection.
+ * The momentum and the mass are the ones used for the energy loss: the momentum of the
+ * MC particle (in the units of dd4hep), if available, and at least the mass of the electron.
+ * The cell ID is decoded once; the hits with a zero item in the mask are not decoded
+ * and they have a negative layer.
+ */
+class SimHitSnapshot
+{
+public:
+    SimHitSnapshot(const LCCollection* STHcol, bool parallel_build = false,
+                   const vector<char>* h_mask = nullptr);
+    virtual ~SimHitSnapshot();
+
+    inline int Size() const { return int(h_ptr.size()); }
+
+    inline SimTrackerHit* GetHit(int i) const { return h_ptr[i]; }
+    inline float GetTime(int i) const { return h_time[i]; }
+    inline double GetPosX(int i) const { return h_pos_x[i]; }
+    inline double GetPosY(int i) const { return h_pos_y[i]; }
+    inline double GetPosZ(int i) const { return h_pos_z[i]; }
+    inline double GetMomX(int i) const { return h_mom_x[i]; }
+    inline double GetMomY(int i) const { return h_mom_y[i]; }
+    inline double GetMomZ(int i) const { return h_mom_z[i]; }
+    inline double GetMass(int i) const { return h_mass[i]; }
+    inline float GetEDep(int i) const { return h_edep[i]; }
+    inline int GetCellID0(int i) const { return h_cell_id[i]; }
+    inline int GetLayer(int i) const { return h_layer[i]; }
+    inline int GetLadder(int i) const { return h_ladder[i]; }
+    inline int GetSensor(int i) const { return h_sensor[i]; }
+    inline int GetSide(int i) const { return h_side[i]; }
+    inline bool IsOverlay(int i) const { return h_overlay[i] != 0; }
+
+    inline int GetMaxLayer() const { return max_layer; }
+    inline int GetMaxLadder() const { return max_ladder; }
+
+private:
+    vector<SimTrackerHit*> h_ptr;
+    vector<float> h_time;
+    vector<double> h_pos_x;
+    vector<double> h_pos_y;
+    vector<double> h_pos_z;
+    vector<double> h_mom_x;
+    vector<double> h_mom_y;
+    vector<double> h_mom_z;
+    vector<double> h_mass;
+    vector<float> h_edep;
+    vector<int> h_cell_id;
+    vector<int> h_layer;
+    vector<int> h_ladder;
+    vector<int> h_sensor;
+    vector<int> h_side;
+    vector<char> h_overlay;
+    int max_layer;
+    int max_ladder;
+};
+
+#endif //SimHitSnapshot_h
@@ -0,0 +1,43 @@
+#ifndef SparseFindUnion_h
+#define SparseFindUnion_h 1
+
+#include "FindUnionAlgorithm.h"
+
+/**
+ * @class SparseFindUnion
+ * @brief Connected components of a sparse set of pixels
+ *
+ * The union-find structure is built over the fired pixels only: the positions are sorted
+ * row first and each pixel is merged with the previous one in the row and with the adjacent
+ * pixels of the previous row, found with a cursor moving along the row. The cost depends on
+ * the number of fired pixels and not on the size of the grid.
+ * The 8-connectivity (diagonal neighbours) is enabled by hk8_on, otherwise the 4-connectivity is used.
+ * The clusters are ordered by their first pixel, the pixels of a cluster are in ascending order.
+ */
+class SparseFindUnion
+{
+public:
+    SparseFindUnion(int n_row, int n_col, bool hk8_on = true);
+    virtual ~SparseFindUnion() {}
+    void init();
+    void add(int x, int y);
+    void close();
+    inline int size() const { return f_pixels.size(); }
+    const vector<ClusterOfPixel>& get_clusters() const { return clusters; }
+    vector<ClusterOfCoordinate> list_clusters();
+
+private:
+    int find(int idx);
+    void merge(int idx1, int idx2);
+
+    int rows;
+    int columns;
+    bool HK8_enabled;
+    GridPosition locate;
+    vector<LinearPosition> f_pixels;
+    vector<int> parent;
+    vector<int> c_index;
+    vector<ClusterOfPixel> clusters;
+};
+
+#endif //SparseFindUnion_h
@@ -0,0 +1,154 @@
+#ifndef StageProfiler_h
+#define StageProfiler_h 1
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <TDirectory.h>
+#include <TTree.h>
+
+enum class ProfileStage : int
+{
+    index_build,
+    signal_points,
+    pixel_update,
+    clock_step,
+    clustering,
+    lcio_creation,
+    output_merge,
+    n_stages
+};
+
+enum class ProfileCounter : int
+{
+    sim_hits,
+    clock_steps,
+    skipped_steps,
+    signal_points,
+    fired_pixels,
+    clusters,
+    noise_pixels,
+    n_counters
+};
+
+const int N_PROFILE_STAGES = int(ProfileStage::n_stages);
+const int N_PROFILE_COUNTERS = int(ProfileCounter::n_counters);
+
+// Microseconds since the first call in the process
+inline double ProfileClock()
+{
+    static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+/**
+ * @brief Wall time of the stages and counters of a ladder, or of a whole event
+ *
+ * A profile is written by a single thread; the profiles of the ladders are collected
+ * by StageProfiler after the parallel region.
+ */
+struct LadderProfile
+{
+    int layer = -1;
+    int ladder = -1;
+    int thread = -1;
+    double t_begin = 0.;
+    double t_end = 0.;
+    double stage_begin[N_PROFILE_STAGES] = {};
+    double stage_time[N_PROFILE_STAGES] = {};
+    Long64_t counters[N_PROFILE_COUNTERS] = {};
+
+    void Reset(int l_layer, int l_ladder, int l_thread);
+
+    inline void Count(ProfileCounter counter, Long64_t n = 1) { counters[int(counter)] += n; }
+};
+
+/**
+ * @class StageTimer
+ * @brief Scoped timer of a stage, it does not read the clock if the profile is nullptr
+ */
+class StageTimer
+{
+public:
+    StageTimer(LadderProfile* profile, ProfileStage stage) :
+        t_profile(profile),
+        t_stage(int(stage)),
+        t_start(profile != nullptr ? ProfileClock() : 0.)
+    {
+        if (t_profile != nullptr && t_profile->stage_time[t_stage] == 0.)
+        {
+            t_profile->stage_begin[t_stage] = t_start;
+        }
+    }
+
+    ~StageTimer() { Stop(); }
+
+    inline void Stop()
+    {
+        if (t_profile == nullptr) return;
+        t_profile->stage_time[t_stage] += ProfileClock() - t_start;
+        t_profile = nullptr;
+    }
+
+private:
+    LadderProfile* t_profile;
+    int t_stage;
+    double t_start;
+};
+
+/**
+ * @class StageProfiler
+ * @brief Collection of the profiles of the events
+ *
+ * The profiles are stored in two trees, one entry per ladder and one entry per event;
+ * the event entry holds the event stages and the sums over the ladders.
+ * The trees belong to the given output directory, so the baskets are flushed to the file
+ * while the job runs; without a directory only the trace is written.
+ * If a trace file is given, the ladders and the event stages are also written
+ * as complete events of the Chrome trace format (chrome://tracing, Perfetto).
+ */
+class StageProfiler
+{
+public:
+    /**
+     * @param out_dir The output directory of the trees, nullptr for no trees
+     * @param trace_file The name of the trace file, empty for no trace
+     */
+    StageProfiler(TDirectory* out_dir, const std::string& trace_file);
+    StageProfiler(const StageProfiler&) = delete;
+    StageProfiler& operator=(const StageProfiler&) = delete;
+    virtual ~StageProfiler();
+
+    void BeginEvent(int run, int event);
+
+    inline LadderProfile& GetEventProfile() { return e_profile; }
+
+    void AddLadder(const LadderProfile& l_profile);
+
+    void EndEvent();
+
+    // Write the trees in the current directory, before the file is closed
+    void Write();
+
+    static const char* StageName(int stage);
+    static const char* CounterName(int counter);
+
+private:
+    void SetBranches(TTree* tree);
+    void WriteTraceEvent(const std::string& name, int tid, double t_begin, double t_end,
+                         const LadderProfile* l_profile);
+
+    int b_run;
+    int b_event;
+    LadderProfile b_profile;
+    LadderProfile e_profile;
+    TTree* l_tree;
+    TTree* e_tree;
+    std::ofstream trace_out;
+    bool trace_first;
+};
+
+#endif //StageProfiler_h
@@ -0,0 +1,104 @@
+#ifndef SurfaceCache_h
+#define SurfaceCache_h 1
+
+#include <string>
+#include <vector>
+
+#include "DDRec/Surface.h"
+#include "DDRec/SurfaceManager.h"
+#include "DDRec/Vector3D.h"
+
+using dd4hep::rec::ISurface;
+using dd4hep::rec::SurfaceMap;
+using dd4hep::rec::Vector2D;
+using dd4hep::rec::Vector3D;
+
+/**
+ * @brief The constant quantities of a surface, in the units of the SurfaceManager
+ *
+ * For planar surfaces the transformations are the affine maps of dd4hep::rec::Surface,
+ * computed with the cached vectors; the other surfaces fall back on the virtual methods.
+ */
+struct CachedSurface
+{
+    const ISurface* surface;
+    bool planar;
+    Vector3D u;
+    Vector3D v;
+    Vector3D normal;
+    Vector3D origin;
+    Vector3D u_prime;       // u orthogonalized with respect to v
+    Vector3D v_prime;       // v orthogonalized with respect to u
+    double uup;
+    double vvp;
+    float u_direction[2];   // theta and phi of u
+    float v_direction[2];   // theta and phi of v
+
+    inline Vector2D GlobalToLocal(const Vector3D& point) const
+    {
+        if (!planar) return surface->globalToLocal(point);
+        Vector3D p = point - origin;
+        return Vector2D((p * u_prime) / uup, (p * v_prime) / vvp);
+    }
+
+    inline Vector3D LocalToGlobal(const Vector2D& point) const
+    {
+        if (!planar) return surface->localToGlobal(point);
+        return origin + point[0] * u + point[1] * v;
+    }
+};
+
+/**
+ * @class SurfaceCache
+ * @brief Dense table of the surfaces of a sub-detector
+ *
+ * The table is built once per run from the SurfaceMap; each surface is indexed by the
+ * fields side, layer, module and sensor of its cellID, so that a lookup is a decoding
+ * of the cellID with shifts and masks followed by an array access.
+ * The table is read-only after Build and can be shared among threads.
+ */
+class SurfaceCache
+{
+public:
+    SurfaceCache();
+    virtual ~SurfaceCache();
+
+    void Build(const SurfaceMap* s_map, const std::string& enc_str);
+    void Clear();
+
+    inline int Size() const { return surfaces.size(); }
+
+    /**
+     * @brief The surface for a given cellID, nullptr if it is not available
+     */
+    const CachedSurface* Find(unsigned long cellID) const;
+
+private:
+    struct FieldCoder
+    {
+        int offset;
+        int width;
+        bool is_signed;
+        int min_value;
+        int n_values;
+
+        inline int decode(unsigned long cellID) const
+        {
+            unsigned long raw = (cellID >> offset) & ((1UL << width) - 1);
+            if (is_signed && (raw >> (width - 1)) != 0) return int(raw) - (1 << width);
+            return int(raw);
+        }
+    };
+
+    int DenseIndex(unsigned long cellID) const;
+
+    FieldCoder f_side;
+    FieldCoder f_layer;
+    FieldCoder f_module;
+    FieldCoder f_sensor;
+    std::vector<int> s_index;
+    std::vector<unsigned long> s_keys;
+    std::vector<CachedSurface> surfaces;
+};
+
+#endif //SurfaceCache_h
@@ -2,6 +2,8 @@
 #define TrivialSensor_h 1
 
 #include "AbstractSensor.h"
+#include "FindUnionAlgorithm.h"
+#include "SparseFindUnion.h"
 
 class TrivialSensor : public AbstractSensor
 {
@@ -20,10 +22,13 @@ public:
                     double thr,
                     float starttime,
                     float t_step,
-                    bool hk8_on = true);
+                    bool hk8_on = true,
+                    bool sparse_on = true);
 
     virtual ~TrivialSensor();
 
+    void Rebind(int ladder, float starttime) override;
+
     void Reset() override;
 
     void BeginClockStep() override;
@@ -32,6 +37,10 @@ public:
 
     void EndClockStep() override;
 
+    int GetIdleClockSteps() override;
+
+    void SkipClockSteps(int n) override;
+
     PixelData GetPixel(int x, int y) override;
 
     bool IsActive() override;
@@ -42,11 +51,22 @@ public:
 
 private:
 
+    void LabelSegment(int h, int k, SparseFindUnion& s_algo, vector<ClusterOfCoordinate>& c_list);
+    void EmitClusters(int h, int k, BitField64& bf_encoder, const vector<ClusterOfCoordinate>& c_list,
+                      SegmentDigiHitList& output);
+
     vector<float> pixels;
+    vector<LinearPosition> touched_pix;
     int charged_pix;
     vector<int> charged_on_sensor;
+    vector<vector<GridCoordinate>> fired_on_sensor;
     int clock_cnt;
     bool HK8_enabled;
+    bool sparse_enabled;
+    FindUnionAlgorithm fu_algo;
+    SparseFindUnion sf_algo;
+    vector<SparseFindUnion> seg_algos;
+    vector<vector<ClusterOfCoordinate>> seg_lists;
 };
 
 #endif //TrivialSensor_h
\ No newline at end of file
@@ -0,0 +1,393 @@
+#include "DigiRegressionCheck.h"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+#include <EVENT/LCCollection.h>
+#include <EVENT/TrackerHit.h>
+
+#include "MemoryBudget.h"
+#include "StageProfiler.h"
+
+// ----- include for verbosity dependend logging ---------
+#include "marlin/VerbosityLevels.h"
+
+namespace
+{
+    const double MBYTE = 1024. * 1024.;
+
+    inline bool HitLess(const RegressionHit& a, const RegressionHit& b)
+    {
+        if (a.cell_id != b.cell_id) return a.cell_id < b.cell_id;
+        if (a.x != b.x) return a.x < b.x;
+        if (a.y != b.y) return a.y < b.y;
+        return a.z < b.z;
+    }
+}
+
+double DigiRegressionCheck::_lastMark = 0.;
+
+DigiRegressionCheck aDigiRegressionCheck ;
+
+DigiRegressionCheck::DigiRegressionCheck() :
+    Processor("DigiRegressionCheck"),
+    _refOut(),
+    _refIn(),
+    _stats(),
+    _eventTimes()
+{
+    _description = "DigiRegressionCheck compares the reco-hits of the digitisers with a reference and measures the throughput";
+
+    registerProcessorParameter("TrackerHitCollections",
+                               "Names of the TrackerHitPlane collections to check",
+                               _hitColNames,
+                               std::vector<std::string>(1, "VTXTrackerHits"));
+
+    registerProcessorParameter("RelationCollections",
+                               "Names of the LCRelation collections to check",
+                               _relColNames,
+                               std::vector<std::string>(1, "VTXTrackerHitRelations"));
+
+    registerProcessorParameter("ReferenceFile",
+                               "Name of the reference file, empty for no comparison",
+                               _refFileName,
+                               std::string(""));
+
+    registerProcessorParameter("RecordReference",
+                               "Write the reference file instead of comparing with it",
+                               _recordReference,
+                               int(0));
+
+    registerProcessorParameter("PositionTolerance",
+                               "Maximum difference of each coordinate of a reco-hit (in mm)",
+                               _positionTolerance,
+                               (float)0.001);
+
+    registerProcessorParameter("ChargeTolerance",
+                               "Maximum relative difference of the charge of a reco-hit",
+                               _chargeTolerance,
+                               (float)0.001);
+
+    registerProcessorParameter("TimeTolerance",
+                               "Maximum difference of the time of a reco-hit (in ns)",
+                               _timeTolerance,
+                               (float)0.001);
+
+    registerProcessorParameter("ReportFile",
+                               "Name of the JSON report, empty for no report",
+                               _reportFileName,
+                               std::string(""));
+}
+
+void DigiRegressionCheck::init()
+{
+    streamlog_out(DEBUG) << "   init called  " << std::endl ;
+
+    printParameters() ;
+
+    if (!_refFileName.empty())
+    {
+        if (_recordReference != 0)
+        {
+            _refOut.open(_refFileName, std::ios::out | std::ios::trunc);
+            if (!_refOut) streamlog_out(ERROR) << "Cannot create the reference file " << _refFileName << std::endl;
+        }
+        else
+        {
+            _refIn.open(_refFileName);
+            if (!_refIn) streamlog_out(ERROR) << "Cannot open the reference file " << _refFileName << std::endl;
+        }
+    }
+
+    _lastMark = ProfileClock();
+}
+
+void DigiRegressionCheck::processRunHeader(LCRunHeader* run)
+{}
+
+void DigiRegressionCheck::processEvent(LCEvent * evt)
+{
+    // The checks of the instance are not part of the time of the next one
+    _eventTimes.push_back((ProfileClock() - _lastMark) / 1000.);
+    _stats.events++;
+
+    if (_refOut.is_open() || _refIn.is_open())
+    {
+        RegressionEvent r_event {};
+        FillEvent(evt, r_event);
+
+        if (_refOut.is_open())
+        {
+            WriteEvent(r_event);
+        }
+        else
+        {
+            RegressionEvent r_ref {};
+            if (!ReadEvent(r_ref) || r_ref.run != r_event.run || r_ref.event != r_event.event)
+            {
+                streamlog_out(WARNING) << "No reference for run " << r_event.run
+                                       << " event " << r_event.event << std::endl;
+                _stats.missing_events++;
+            }
+            else
+            {
+                CompareEvent(r_event, r_ref);
+            }
+        }
+    }
+
+    _lastMark = ProfileClock();
+}
+
+void DigiRegressionCheck::FillEvent(LCEvent* evt, RegressionEvent& r_event)
+{
+    r_event.run = evt->getRunNumber();
+    r_event.event = evt->getEventNumber();
+
+    // A missing collection is recorded as empty
+    for (const std::string& col_name : _hitColNames)
+    {
+        std::vector<RegressionHit>& c_hits = r_event.hits[col_name];
+        try
+        {
+            LCCollection* col = evt->getCollection(col_name);
+            int n_hits = col->getNumberOfElements();
+            c_hits.reserve(n_hits);
+            for (int i = 0; i < n_hits; i++)
+            {
+                EVENT::TrackerHit* hit = dynamic_cast<EVENT::TrackerHit*>(col->getElementAt(i));
+                if (hit == nullptr) continue;
+                const double* pos = hit->getPosition();
+                c_hits.push_back({ hit->getCellID0(), pos[0], pos[1], pos[2], hit->getEDep(), hit->getTime() });
+            }
+        }
+        catch( lcio::DataNotAvailableException &ex )
+        {}
+        std::sort(c_hits.begin(), c_hits.end(), HitLess);
+    }
+
+    for (const std::string& col_name : _relColNames)
+    {
+        int& n_rel = r_event.relations[col_name];
+        n_rel = 0;
+        try
+        {
+            n_rel = evt->getCollection(col_name)->getNumberOfElements();
+        }
+        catch( lcio::DataNotAvailableException &ex )
+        {}
+    }
+}
+
+/*
+ * Format of the reference, one block per event:
+ *   event <run> <event>
+ *   hits <collection> <n>
+ *   <cell ID> <x> <y> <z> <charge> <time>    (n lines)
+ *   relations <collection> <n>
+ *   end
+ */
+void DigiRegressionCheck::WriteEvent(const RegressionEvent& r_event)
+{
+    _refOut << "event " << r_event.run << " " << r_event.event << "\n";
+    _refOut << std::setprecision(10);
+    for (const auto& item : r_event.hits)
+    {
+        _refOut << "hits " << item.first << " " << item.second.size() << "\n";
+        for (const RegressionHit& hit : item.second)
+        {
+            _refOut << hit.cell_id << " " << hit.x << " " << hit.y << " " << hit.z << " "
+                    << hit.charge << " " << hit.time << "\n";
+        }
+    }
+    for (const auto& item : r_event.relations)
+    {
+        _refOut << "relations " << item.first << " " << item.second << "\n";
+    }
+    _refOut << "end" << std::endl;
+}
+
+bool DigiRegressionCheck::ReadEvent(RegressionEvent& r_event)
+{
+    std::string tag;
+    if (!(_refIn >> tag) || tag != "event") return false;
+    if (!(_refIn >> r_event.run >> r_event.event)) return false;
+
+    while (_refIn >> tag && tag != "end")
+    {
+        std::string col_name;
+        int n_items = 0;
+        if (!(_refIn >> col_name >> n_items)) return false;
+
+        if (tag == "hits")
+        {
+            std::vector<RegressionHit>& c_hits = r_event.hits[col_name];
+            c_hits.resize(n_items);
+            for (RegressionHit& hit : c_hits)
+            {
+                if (!(_refIn >> hit.cell_id >> hit.x >> hit.y >> hit.z >> hit.charge >> hit.time)) return false;
+            }
+        }
+        else if (tag == "relations")
+        {
+            r_event.relations[col_name] = n_items;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return tag == "end";
+}
+
+void DigiRegressionCheck::CompareEvent(const RegressionEvent& r_event, const RegressionEvent& r_ref)
+{
+    const std::vector<RegressionHit> no_hits;
+    for (const auto& item : r_event.hits)
+    {
+        auto r_item = r_ref.hits.find(item.first);
+        const std::vector<RegressionHit>& e_hits = item.second;
+        const std::vector<RegressionHit>& r_hits = r_item != r_ref.hits.end() ? r_item->second : no_hits;
+        if (e_hits.size() != r_hits.size())
+        {
+            streamlog_out(WARNING) << "Event " << r_event.event << ": " << e_hits.size() << " hits in "
+                                   << item.first << ", " << r_hits.size() << " in the reference" << std::endl;
+            _stats.count_mismatches++;
+        }
+
+        // The cell ID is a segment of a sensor: each hit is paired with the nearest reference
+        // of the same cell ID within the position tolerance, the hits left alone are mismatches
+        std::vector<bool> r_used(r_hits.size(), false);
+        int n_bad = 0;
+        for (const RegressionHit& hit : e_hits)
+        {
+            RegressionHit x_lo = hit;
+            x_lo.x -= _positionTolerance;
+            x_lo.y = -HUGE_VAL;
+            x_lo.z = -HUGE_VAL;
+            auto r_first = std::lower_bound(r_hits.begin(), r_hits.end(), x_lo, HitLess);
+
+            std::size_t r_best = r_hits.size();
+            double d_best = HUGE_VAL;
+            for (auto r_it = r_first; r_it != r_hits.end(); ++r_it)
+            {
+                if (r_it->cell_id != hit.cell_id || r_it->x > hit.x + _positionTolerance) break;
+                std::size_t k = r_it - r_hits.begin();
+                double dx = hit.x - r_it->x;
+                double dy = hit.y - r_it->y;
+                double dz = hit.z - r_it->z;
+                if (r_used[k] || std::fabs(dy) > _positionTolerance || std::fabs(dz) > _positionTolerance) continue;
+                double d2 = dx * dx + dy * dy + dz * dz;
+                if (d2 < d_best)
+                {
+                    d_best = d2;
+                    r_best = k;
+                }
+            }
+
+            if (r_best == r_hits.size())
+            {
+                n_bad++;
+                continue;
+            }
+            r_used[r_best] = true;
+
+            const RegressionHit& ref = r_hits[r_best];
+            bool same = std::fabs(hit.charge - ref.charge) <= _chargeTolerance * std::fabs(ref.charge)
+                        && std::fabs(hit.time - ref.time) <= _timeTolerance;
+            if (!same) n_bad++;
+        }
+        // The references without a hit
+        n_bad += int(std::count(r_used.begin(), r_used.end(), false));
+
+        if (n_bad > 0)
+        {
+            streamlog_out(WARNING) << "Event " << r_event.event << ": " << n_bad << " hits of "
+                                   << item.first << " not matched within the tolerances" << std::endl;
+            _stats.hit_mismatches += n_bad;
+        }
+    }
+
+    for (const auto& item : r_event.relations)
+    {
+        auto r_item = r_ref.relations.find(item.first);
+        int n_ref = r_item != r_ref.relations.end() ? r_item->second : 0;
+        if (item.second != n_ref)
+        {
+            streamlog_out(WARNING) << "Event " << r_event.event << ": " << item.second << " relations in "
+                                   << item.first << ", " << n_ref << " in the reference" << std::endl;
+            _stats.relation_mismatches++;
+        }
+    }
+}
+
+void DigiRegressionCheck::WriteReport()
+{
+    std::ofstream r_out { _reportFileName, std::ios::out | std::ios::trunc };
+    if (!r_out)
+    {
+        streamlog_out(ERROR) << "Cannot create the report file " << _reportFileName << std::endl;
+        return;
+    }
+
+    // The first event is the warm-up, it is not part of the throughput
+    double t_total = 0.;
+    double t_max = 0.;
+    for (std::size_t k = 1; k < _eventTimes.size(); k++)
+    {
+        t_total += _eventTimes[k];
+        t_max = std::max(t_max, _eventTimes[k]);
+    }
+    int n_timed = int(_eventTimes.size()) - 1;
+
+    r_out << std::fixed << std::setprecision(3)
+          << "{\"processor\":\"" << name() << "\""
+          << ",\"mode\":\"" << (_refOut.is_open() ? "record" : (_refIn.is_open() ? "compare" : "timing")) << "\""
+          << ",\"events\":" << _stats.events
+          << ",\"missing_events\":" << _stats.missing_events
+          << ",\"count_mismatches\":" << _stats.count_mismatches
+          << ",\"hit_mismatches\":" << _stats.hit_mismatches
+          << ",\"relation_mismatches\":" << _stats.relation_mismatches
+          << ",\"passed\":" << (_stats.Passed() ? "true" : "false")
+          << ",\"mean_event_time_ms\":" << (n_timed > 0 ? t_total / n_timed : 0.)
+          << ",\"max_event_time_ms\":" << t_max
+          << ",\"events_per_second\":" << (t_total > 0. ? 1000. * n_timed / t_total : 0.)
+          << ",\"peak_rss_mb\":" << PeakResidentBytes() / MBYTE
+          << ",\"event_times_ms\":[";
+    for (std::size_t k = 0; k < _eventTimes.size(); k++)
+    {
+        r_out << (k > 0 ? "," : "") << _eventTimes[k];
+    }
+    r_out << "]}" << std::endl;
+}
+
+void DigiRegressionCheck::check(LCEvent *evt)
+{}
+
+void DigiRegressionCheck::end()
+{
+    streamlog_out(DEBUG) << "   end called  " << std::endl;
+
+    if (_refOut.is_open())
+    {
+        _refOut.close();
+        streamlog_out(MESSAGE) << "Reference of " << _stats.events << " events written in " << _refFileName << std::endl;
+    }
+    else if (_refIn.is_open())
+    {
+        _refIn.close();
+        if (_stats.Passed())
+        {
+            streamlog_out(MESSAGE) << "Regression check passed for " << _stats.events << " events" << std::endl;
+        }
+        else
+        {
+            streamlog_out(ERROR) << "Regression check failed: " << _stats.missing_events << " missing events, "
+                                 << _stats.count_mismatches << " hit counts, "
+                                 << _stats.hit_mismatches << " hits out of tolerance, "
+                                 << _stats.relation_mismatches << " relation counts" << std::endl;
+        }
+    }
+
+    if (!_reportFileName.empty()) WriteReport();
+}
@@ -0,0 +1,126 @@
+#ifndef DigiRegressionCheck_h
+#define DigiRegressionCheck_h 1
+
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "marlin/Processor.h"
+#include "lcio.h"
+#include "EVENT/LCIO.h"
+
+using marlin::Processor;
+
+// Fields of a reco-hit compared against the reference
+struct RegressionHit
+{
+    int cell_id;
+    double x;
+    double y;
+    double z;
+    float charge;
+    float time;
+};
+
+// Reco-hits, sorted by cell ID and position, and relation counts of an event
+struct RegressionEvent
+{
+    int run = -1;
+    int event = -1;
+    std::map<std::string, std::vector<RegressionHit>> hits;
+    std::map<std::string, int> relations;
+};
+
+// Differences between an event and its reference
+struct RegressionStats
+{
+    int events = 0;
+    int missing_events = 0;         // events without a reference, or with a reference of another event
+    int count_mismatches = 0;       // collections with a different number of reco-hits
+    int hit_mismatches = 0;         // reco-hits without a reference within the tolerances, and vice versa
+    int relation_mismatches = 0;    // relation collections with a different number of relations
+
+    inline bool Passed() const
+    {
+        return missing_events + count_mismatches + hit_mismatches + relation_mismatches == 0;
+    }
+};
+
+/** Regression and throughput check of the digitisers. <br>
+ * The reco-hits and the relations of the given collections are either recorded in a reference file
+ * or compared with the records of the same event: positions, charges (EDep) and times within the given
+ * tolerances, relations by count. Each hit is paired with the nearest reference hit of the same cell ID
+ * within the position tolerance, so the order of the ladders in the parallel output does not matter;
+ * the hits without a pair are mismatches.
+ * The reference must be recorded with the same input, geometry and random seeds: MuonCVXDRealDigitiser
+ * with DeterministicRandom, MuonCVXDDigitiser with ParallelHits, both with a fixed RandomSeed.
+ * The processor is built by the option BUILD_REGRESSION, see regression/CMakeLists.txt for the tests.
+ * The processor also measures the wall time from the previous instance of DigiRegressionCheck in the chain,
+ * or from the previous event, so an instance after each digitiser gives the time of each processor;
+ * the per-event times, the throughput and the peak resident memory are written in a JSON report.
+ * The stages of MuonCVXDRealDigitiser are measured by its own Profiling option.
+ *
+ * @param TrackerHitCollections names of the TrackerHitPlane collections to check <br>
+ * (default parameter value : "VTXTrackerHits") <br>
+ * @param RelationCollections names of the LCRelation collections to check <br>
+ * (default parameter value : "VTXTrackerHitRelations") <br>
+ * @param ReferenceFile name of the reference file (text), empty for no comparison <br>
+ * (default parameter value : "") <br>
+ * @param RecordReference flag to write the reference file instead of comparing with it <br>
+ * (default parameter value : 0) <br>
+ * @param PositionTolerance maximum difference of each coordinate of a reco-hit (in mm) <br>
+ * (default parameter value : 0.001) <br>
+ * @param ChargeTolerance maximum relative difference of the charge of a reco-hit <br>
+ * (default parameter value : 0.001) <br>
+ * @param TimeTolerance maximum difference of the time of a reco-hit (in ns) <br>
+ * (default parameter value : 0.001) <br>
+ * @param ReportFile name of the JSON report, empty for no report <br>
+ * (default parameter value : "") <br>
+ * <br>
+ */
+class DigiRegressionCheck : public Processor
+{
+public:
+
+    virtual Processor*  newProcessor() { return new DigiRegressionCheck ; }
+
+    DigiRegressionCheck();
+
+    virtual void init();
+
+    virtual void processRunHeader( LCRunHeader* run );
+
+    virtual void processEvent( LCEvent * evt );
+
+    virtual void check( LCEvent * evt );
+
+    virtual void end();
+
+protected:
+
+    void FillEvent(LCEvent* evt, RegressionEvent& r_event);
+    void WriteEvent(const RegressionEvent& r_event);
+    bool ReadEvent(RegressionEvent& r_event);
+    void CompareEvent(const RegressionEvent& r_event, const RegressionEvent& r_ref);
+    void WriteReport();
+
+    std::vector<std::string> _hitColNames;
+    std::vector<std::string> _relColNames;
+    std::string _refFileName;
+    int _recordReference;
+    float _positionTolerance;
+    float _chargeTolerance;
+    float _timeTolerance;
+    std::string _reportFileName;
+
+    std::ofstream _refOut;
+    std::ifstream _refIn;
+    RegressionStats _stats;
+    std::vector<double> _eventTimes;    // ms
+
+    // The last measure of any instance, the wall time of an instance begins there
+    static double _lastMark;
+};
+
+#endif //DigiRegressionCheck_h
@@ -0,0 +1,24 @@
+# Runs Marlin on a steering file of the regression check,
+# fails if Marlin fails or if the report of DigiRegressionCheck is not the one of a passed check.
+#   cmake -DMARLIN=<Marlin> -DMARLIN_DLL=<plugins> -DSTEERING=<xml> -DREPORT=<json> -DMODE=<compare|record> -P RunCheck.cmake
+
+SET( ENV{MARLIN_DLL} ${MARLIN_DLL} )
+FILE( REMOVE ${REPORT} )
+
+EXECUTE_PROCESS( COMMAND ${MARLIN} ${STEERING} RESULT_VARIABLE marlin_result )
+IF( NOT marlin_result EQUAL 0 )
+    MESSAGE( FATAL_ERROR "Marlin failed on ${STEERING}: ${marlin_result}" )
+ENDIF()
+
+IF( NOT EXISTS ${REPORT} )
+    MESSAGE( FATAL_ERROR "No report in ${REPORT}" )
+ENDIF()
+FILE( READ ${REPORT} report_text )
+
+# a missing reference turns the comparison into a timing run
+IF( NOT report_text MATCHES "\"mode\":\"${MODE}\"" )
+    MESSAGE( FATAL_ERROR "The check did not run in ${MODE} mode, see ${REPORT}" )
+ENDIF()
+IF( NOT report_text MATCHES "\"passed\":true" )
+    MESSAGE( FATAL_ERROR "Regression check failed, see ${REPORT}" )
+ENDIF()
@@ -1,4 +1,5 @@
 #include "AbstractSensor.h"
+#include <algorithm>
 #include <cmath>
 
 #include <UTIL/ILDConf.h>
@@ -21,6 +22,8 @@ AbstractSensor::AbstractSensor( int layer,
                                 float t_step):
     _barrel_id(barrel_id),
     _layer(layer),
+    _cell_layer(layer),
+    _side(ILDDetID::barrel),
     _ladder(ladder),
     _thickness(thickness),
     _pixelSizeX(fabs(pixelSizeX)),
@@ -35,7 +38,10 @@ AbstractSensor::AbstractSensor( int layer,
     s_locate({ 0, 0 }),
     status(MatrixStatus::ok),
     reset_simtable_at_once(true),
-    simhit_table()
+    segment_tasks(false),
+    simhit_table(),
+    p_row_lo(),
+    p_row_hi()
 {
     int lwid = floor(ladderWidth * 1e4);
     int psx = floor(pixelSizeX * 1e4);
@@ -105,34 +111,144 @@ BitField64 AbstractSensor::getBFEncoder()
     BitField64 bf_encoder { cellFmtStr };
     bf_encoder.reset();
     bf_encoder[LCTrackerCellID::subdet()] = _barrel_id;
-    bf_encoder[LCTrackerCellID::side()] = ILDDetID::barrel;
-    bf_encoder[LCTrackerCellID::layer()] = _layer;
+    bf_encoder[LCTrackerCellID::side()] = _side;
+    bf_encoder[LCTrackerCellID::layer()] = _cell_layer;
     bf_encoder[LCTrackerCellID::module()] = _ladder;
     return bf_encoder;
 }
 
 bool AbstractSensor::check(int x, int y)
 {
-    return (0 <= x and x < l_rows) and (0 <= y || y < l_columns);
+    return (0 <= x and x < l_rows) and (0 <= y and y < l_columns);
+}
+
+void AbstractSensor::SetPetalGeometry(int disk_layer, int side, float inner_width)
+{
+    _cell_layer = disk_layer;
+    _side = side;
+
+    p_row_lo.clear();
+    p_row_hi.clear();
+    if (inner_width <= 0 || inner_width >= _ladderWidth || _ladderLength <= 0) return;
+
+    // The rows of a column are sensitive if the center of the pixel is inside the petal
+    p_row_lo.resize(l_columns);
+    p_row_hi.resize(l_columns);
+    for (int col = 0; col < l_columns; col++)
+    {
+        double y_frac = (PixelColToY(col) + _ladderLength / 2) / _ladderLength;
+        double half_width = 0.5 * (inner_width + (_ladderWidth - inner_width) * y_frac);
+        p_row_lo[col] = std::max(XToPixelRow(-half_width + _pixelSizeX / 2), 0);
+        p_row_hi[col] = std::min(XToPixelRow(half_width - _pixelSizeX / 2), l_rows - 1);
+    }
+}
+
+void AbstractSensor::Rebind(int ladder, float starttime)
+{
+    _ladder = ladder;
+    init_time = starttime;
+    simhit_table.Clear();
+    Reset();
+}
+
+void AbstractSensor::SkipClockSteps(int n)
+{
+    for (int k = 0; k < n; k++)
+    {
+        BeginClockStep();
+        EndClockStep();
+    }
 }
 
 void AbstractSensor::InitHitRegister()
 {
-    if (reset_simtable_at_once) simhit_table.clear();
+    if (reset_simtable_at_once) simhit_table.Clear();
+}
+
+void AbstractSensor::RegisterHit(int x, int y, int hit, float charge)
+{
+    simhit_table.Add(l_locate(x, y), hit, charge);
 }
 
-void AbstractSensor::RegisterHit(int x, int y, SimTrackerHit* hit)
+void AbstractSensor::fillInHitRelation(SimHitRelationList& rlist, LinearPosition pos)
 {
-    simhit_table.emplace(l_locate(x, y), hit);
+    simhit_table.Collect(pos, rlist, !reset_simtable_at_once);
 }
 
-void AbstractSensor::fillInHitRelation(SimHitSet& sset, LinearPosition pos)
+namespace
 {
-    auto hit_range = simhit_table.equal_range(pos);
-    for (auto it = hit_range.first; it != hit_range.second; ++it)
+    inline bool RecordLess(const SimHitRecord& a, const SimHitRecord& b)
+    {
+        return a.pos < b.pos || (a.pos == b.pos && a.hit < b.hit);
+    }
+}
+
+void SimHitTable::Compact()
+{
+    if (n_sorted == records.size() && n_released == 0) return;
+
+    // The released records, which have a negative hit, are dropped preserving the order
+    if (n_released > 0)
+    {
+        std::size_t n_out = 0;
+        std::size_t n_prefix = 0;
+        for (std::size_t k = 0; k < records.size(); k++)
+        {
+            if (k == n_sorted) n_prefix = n_out;
+            if (records[k].hit >= 0) records[n_out++] = records[k];
+        }
+        if (n_sorted == records.size()) n_prefix = n_out;
+        records.resize(n_out);
+        n_sorted = n_prefix;
+        n_released = 0;
+    }
+
+    std::sort(records.begin() + n_sorted, records.end(), RecordLess);
+    std::inplace_merge(records.begin(), records.begin() + n_sorted, records.end(), RecordLess);
+
+    // Join the records of the same pixel and hit
+    std::size_t n_out = 0;
+    for (std::size_t k = 0; k < records.size(); k++)
+    {
+        if (n_out > 0 && records[n_out - 1].pos == records[k].pos && records[n_out - 1].hit == records[k].hit)
+        {
+            records[n_out - 1].charge += records[k].charge;
+        }
+        else
+        {
+            records[n_out++] = records[k];
+        }
+    }
+    records.resize(n_out);
+    n_sorted = n_out;
+}
+
+void SimHitTable::Collect(LinearPosition pos, SimHitRelationList& rlist, bool release)
+{
+    // The new records are merged once, at the first query after them
+    if (records.size() > n_sorted) Compact();
+
+    auto add_relation = [&rlist](int hit, float charge)
+    {
+        auto it = std::lower_bound(rlist.begin(), rlist.end(), hit,
+                                   [](const SimHitRelation& r, int h) { return r.hit < h; });
+        if (it != rlist.end() && it->hit == hit) it->charge += charge;
+        else rlist.insert(it, { hit, charge });
+    };
+
+    SimHitRecord key { pos, -1, 0.f };
+    for (auto it = std::lower_bound(records.begin(), records.begin() + n_sorted, key, RecordLess);
+         it != records.begin() + n_sorted && it->pos == pos; ++it)
     {
-        sset.emplace(it->second);
+        if (it->hit < 0) continue;
+        add_relation(it->hit, it->charge);
+        if (release)
+        {
+            it->hit = -1;
+            n_released++;
+        }
     }
 
-    if (!reset_simtable_at_once) simhit_table.erase(pos);
+    // Released records are removed once they are a large part of the table
+    if (n_released > records.size() / 2 + 16) Compact();
 }
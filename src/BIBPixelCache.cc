@@ -0,0 +1,166 @@
+#include "BIBPixelCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    const char CACHE_MAGIC[8] = { 'B', 'I', 'B', 'P', 'X', 'C', 'H', 'E' };
+    const uint32_t CACHE_VERSION = 1;
+
+    /*
+     * Layout of the file: header, table of the ladders, entries.
+     * The sizes of the sections are multiples of 8 bytes, the entries are aligned.
+     */
+    struct CacheHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t n_ladders;
+        uint64_t key;
+        uint64_t n_entries;
+    };
+}
+
+BIBPixelCache::BIBPixelCache() :
+    c_key(0),
+    n_ladders(0),
+    n_entries(0),
+    l_ranges(),
+    m_entries(),
+    e_data(nullptr),
+    m_addr(nullptr),
+    m_size(0)
+{}
+
+BIBPixelCache::BIBPixelCache(uint64_t key, vector<BIBLadderCache>& l_caches) :
+    c_key(key),
+    n_ladders(l_caches.size()),
+    n_entries(0),
+    l_ranges(l_caches.size()),
+    m_entries(),
+    e_data(nullptr),
+    m_addr(nullptr),
+    m_size(0)
+{
+    for (const BIBLadderCache& l_cache : l_caches) n_entries += l_cache.entries.size();
+    m_entries.reserve(n_entries);
+
+    for (int k = 0; k < n_ladders; k++)
+    {
+        l_ranges[k] = { m_entries.size(), l_caches[k].entries.size(), l_caches[k].n_hits, 0 };
+        m_entries.insert(m_entries.end(), l_caches[k].entries.begin(), l_caches[k].entries.end());
+        vector<BIBPixelEntry>().swap(l_caches[k].entries);
+    }
+    e_data = m_entries.data();
+}
+
+BIBPixelCache::~BIBPixelCache()
+{
+    if (m_addr != nullptr) munmap(m_addr, m_size);
+}
+
+BIBLadderView BIBPixelCache::GetLadder(int l_index) const
+{
+    if (l_index < 0 || l_index >= n_ladders) return { nullptr, nullptr, 0 };
+    const LadderRange& l_range = l_ranges[l_index];
+    return { e_data + l_range.first, e_data + l_range.first + l_range.count, l_range.n_hits };
+}
+
+bool BIBPixelCache::Save(const std::string& filename) const
+{
+    // The file is written aside and renamed, a concurrent job never maps a partial file
+    std::string tmp_name = filename + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream outFile(tmp_name, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!outFile) return false;
+
+        CacheHeader header {};
+        std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        header.version = CACHE_VERSION;
+        header.n_ladders = n_ladders;
+        header.key = c_key;
+        header.n_entries = n_entries;
+
+        outFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        outFile.write(reinterpret_cast<const char*>(l_ranges.data()), l_ranges.size() * sizeof(LadderRange));
+        outFile.write(reinterpret_cast<const char*>(e_data), n_entries * sizeof(BIBPixelEntry));
+        if (!outFile)
+        {
+            unlink(tmp_name.c_str());
+            return false;
+        }
+    }
+    return rename(tmp_name.c_str(), filename.c_str()) == 0;
+}
+
+BIBPixelCache* BIBPixelCache::Load(const std::string& filename, uint64_t key, int ladders)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+
+    struct stat f_stat;
+    if (fstat(fd, &f_stat) != 0 || std::size_t(f_stat.st_size) < sizeof(CacheHeader))
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    std::size_t f_size = f_stat.st_size;
+    void* addr = mmap(nullptr, f_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return nullptr;
+
+    const char* base = static_cast<const char*>(addr);
+    const CacheHeader* header = reinterpret_cast<const CacheHeader*>(base);
+    std::size_t t_offset = sizeof(CacheHeader);
+    std::size_t e_offset = t_offset + std::size_t(ladders) * sizeof(LadderRange);
+
+    bool valid = std::memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0
+                 && header->version == CACHE_VERSION
+                 && header->key == key
+                 && int(header->n_ladders) == ladders
+                 && f_size == e_offset + header->n_entries * sizeof(BIBPixelEntry);
+    if (!valid)
+    {
+        munmap(addr, f_size);
+        return nullptr;
+    }
+
+    BIBPixelCache* result = new BIBPixelCache();
+    result->c_key = key;
+    result->n_ladders = ladders;
+    result->n_entries = header->n_entries;
+    result->l_ranges.resize(ladders);
+    std::memcpy(result->l_ranges.data(), base + t_offset, ladders * sizeof(LadderRange));
+    result->e_data = reinterpret_cast<const BIBPixelEntry*>(base + e_offset);
+    result->m_addr = addr;
+    result->m_size = f_size;
+
+    for (const LadderRange& l_range : result->l_ranges)
+    {
+        if (l_range.first + l_range.count > result->n_entries)
+        {
+            delete result;
+            return nullptr;
+        }
+    }
+    return result;
+}
+
+uint64_t BIBPixelCache::Hash(uint64_t h, const void* data, std::size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t k = 0; k < size; k++)
+    {
+        h ^= bytes[k];
+        h *= 0x100000001B3ULL;
+    }
+    return h;
+}
@@ -0,0 +1,50 @@
+#include "BinAccumulator.h"
+
+#include <TAxis.h>
+
+BinAccumulator::BinAccumulator(int nbins, double xmin, double xmax) :
+    n_bins(nbins > 0 ? nbins : 1),
+    x_min(xmin),
+    x_max(xmax > xmin ? xmax : xmin + 1.),
+    inv_width(0.),
+    n_entries(0.),
+    bins()
+{
+    inv_width = n_bins / (x_max - x_min);
+    bins.assign(n_bins + 2, 0.);
+}
+
+BinAccumulator::BinAccumulator(const TH1* histo) :
+    BinAccumulator(histo->GetNbinsX(), histo->GetXaxis()->GetXmin(), histo->GetXaxis()->GetXmax())
+{}
+
+BinAccumulator::~BinAccumulator()
+{}
+
+void BinAccumulator::Merge(const BinAccumulator& other)
+{
+    if (other.bins.size() != bins.size()) return;
+    for (std::size_t k = 0; k < bins.size(); k++) bins[k] += other.bins[k];
+    n_entries += other.n_entries;
+}
+
+void BinAccumulator::AddTo(TH1* histo) const
+{
+    double entries = histo->GetEntries() + n_entries;
+    for (int k = 0; k <= n_bins + 1; k++)
+    {
+        if (bins[k] != 0.) histo->AddBinContent(k, bins[k]);
+    }
+    histo->ResetStats();
+    histo->SetEntries(entries);
+}
+
+void ClusterStatAccumulator::Merge(const ClusterStatAccumulator& other)
+{
+    distance.Merge(other.distance);
+    c_size.Merge(other.c_size);
+    x_size.Merge(other.x_size);
+    y_size.Merge(other.y_size);
+    z_size.Merge(other.z_size);
+    e_dep.Merge(other.e_dep);
+}
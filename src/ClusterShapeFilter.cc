@@ -0,0 +1,50 @@
+#include "ClusterShapeFilter.h"
+
+#include <cmath>
+
+namespace
+{
+    // Below this cosine of the incidence angle the path in the sensor is not predictable
+    const double MIN_COS_INCIDENCE = 1e-3;
+}
+
+ClusterShapeFilter::ClusterShapeFilter(double pitch_x, double pitch_y,
+                                       double tan_lorentz_x, double tan_lorentz_y,
+                                       float tolerance_x, float tolerance_y) :
+    _pitchX(pitch_x),
+    _pitchY(pitch_y),
+    _tanLorentzX(tan_lorentz_x),
+    _tanLorentzY(tan_lorentz_y),
+    _toleranceX(tolerance_x),
+    _toleranceY(tolerance_y)
+{}
+
+ClusterShapeFilter::~ClusterShapeFilter()
+{}
+
+bool ClusterShapeFilter::ExpectedSize(const Vector3D& g_pos, const CachedSurface& c_surf, double thickness,
+                                      float& size_x, float& size_y) const
+{
+    // The vectors of the surface are unit vectors, the position is the direction from the origin
+    double d_norm = g_pos.r();
+    double d_n = g_pos * c_surf.normal;
+    if (d_norm <= 0. || std::fabs(d_n) < MIN_COS_INCIDENCE * d_norm) return false;
+
+    double tan_u = (g_pos * c_surf.u) / d_n;
+    double tan_v = (g_pos * c_surf.v) / d_n;
+
+    size_x = float(thickness * std::fabs(tan_u + _tanLorentzX) / _pitchX + 1.);
+    size_y = float(thickness * std::fabs(tan_v + _tanLorentzY) / _pitchY + 1.);
+    return true;
+}
+
+bool ClusterShapeFilter::IsCompatible(const SegmentDigiHit& digiHit, const Vector3D& g_pos,
+                                      const CachedSurface& c_surf, double thickness) const
+{
+    float e_size_x = 0.;
+    float e_size_y = 0.;
+    if (!ExpectedSize(g_pos, c_surf, thickness, e_size_x, e_size_y)) return true;
+
+    return std::fabs(digiHit.size_x - e_size_x) <= _toleranceX
+           && std::fabs(digiHit.size_y - e_size_y) <= _toleranceY;
+}
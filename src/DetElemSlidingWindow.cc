@@ -1,17 +1,21 @@
 #include "DetElemSlidingWindow.h"
+#include "TrivialSensor.h"
+#include "HKBaseSensor.h"
 #include <EVENT/MCParticle.h>
 #include "DDRec/DetectorData.h"
 #include "DD4hep/DD4hepUnits.h"
 #include "marlin/VerbosityLevels.h"
 #include "streamlog/streamlog.h"
 
-#include "gsl/gsl_sf_erf.h"
 #include "gsl/gsl_math.h"
 #include "CLHEP/Random/RandGauss.h"
 #include "CLHEP/Random/RandPoisson.h"
 #include "CLHEP/Random/RandFlat.h"
+#include "CLHEP/Random/Random.h"
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
 
 using std::max;
 using std::min;
@@ -25,26 +29,33 @@ using CLHEP::RandGauss;
 using CLHEP::RandPoisson;
 using CLHEP::RandFlat;
 
-DetElemSlidingWindow::DetElemSlidingWindow(HitTemporalIndexes& htable,
-                                           AbstractSensor& sensor,
-                                           float wsize,
-                                           float starttime,
-                                           double tanLorentzAngleX,
-                                           double tanLorentzAngleY,
-                                           double cutOnDeltaRays,
-                                           double diffusionCoefficient,
-                                           double electronsPerKeV,
-                                           double segmentLength,
-                                           double energyLoss,
-                                           double widthOfCluster,
-                                           double electronicNoise,
-                                           double maxTrkLen,
-                                           double maxEnergyDelta,
-                                           const SurfaceMap* s_map):
+template<class SensorT>
+TypedSlidingWindow<SensorT>::TypedSlidingWindow(HitTemporalIndexes& htable,
+                                                SensorT& sensor,
+                                                float wsize,
+                                                float starttime,
+                                                double tanLorentzAngleX,
+                                                double tanLorentzAngleY,
+                                                double cutOnDeltaRays,
+                                                double diffusionCoefficient,
+                                                double electronsPerKeV,
+                                                double segmentLength,
+                                                double energyLoss,
+                                                double widthOfCluster,
+                                                double electronicNoise,
+                                                double maxTrkLen,
+                                                double maxEnergyDelta,
+                                                const SurfaceCache* s_cache,
+                                                CLHEP::HepRandomEngine* engine,
+                                                GaussCDFMode cdf_mode,
+                                                bool idle_skip):
     curr_time(starttime + wsize / 2),  // window centered in the middle
     time_click(wsize),
-    _htable(htable),
+    _idleSkip(idle_skip),
     _sensor(sensor),
+    _grid(sensor),
+    _hits(htable.GetSnapshot()),
+    _cursor(htable.GetCursor(sensor.GetLayer(), sensor.GetLadder())),
     _tanLorentzAngleX(tanLorentzAngleX),
     _tanLorentzAngleY(tanLorentzAngleY),
     _cutOnDeltaRays(cutOnDeltaRays),
@@ -57,32 +68,75 @@ DetElemSlidingWindow::DetElemSlidingWindow(HitTemporalIndexes& htable,
     _maxTrkLen(maxTrkLen),
     _deltaEne(maxEnergyDelta),
     signals(),
-    surf_map(s_map),
-    cell_decoder(sensor.GetCellIDFormatStr())
+    eloss_buffer(),
+    surf_cache(s_cache),
+    _engine(engine != nullptr ? engine : CLHEP::HepRandom::getTheEngine()),
+    _cdfMode(cdf_mode),
+    _kernel(cdf_mode),
+    _segmentTasks(false),
+    _segKernels(),
+    _segCharges(),
+    _stepPoints(),
+    _segLists(),
+    _offloadMinPoints(0),
+    _offload(),
+    _useCache(false),
+    _cache({ nullptr, nullptr, 0 }),
+    _overlayHits(),
+    _noise(),
+    _profile(nullptr)
 {
-    _fluctuate = new G4UniversalFluctuation();
+    _fluctuate = new G4UniversalFluctuation(_engine);
 }
 
-DetElemSlidingWindow::~DetElemSlidingWindow()
+template<class SensorT>
+TypedSlidingWindow<SensorT>::~TypedSlidingWindow()
 {
     delete(_fluctuate);
 }
 
 
-bool DetElemSlidingWindow::active()
+template<class SensorT>
+bool TypedSlidingWindow<SensorT>::active()
 {
-    bool hasMoreHits = _htable.GetHitNumber(_sensor.GetLayer(), _sensor.GetLadder()) > 0;
+    bool hasMoreHits = _cursor.GetHitNumber() > 0;
     bool sensorOn = _sensor.IsActive();
-    return hasMoreHits || sensorOn;
+    bool hasMoreCharge = _useCache && _cache.first != _cache.last;
+    return hasMoreHits || sensorOn || hasMoreCharge;
 }
 
-int DetElemSlidingWindow::process()
+template<class SensorT>
+int TypedSlidingWindow<SensorT>::process()
 {
     float window_radius = time_click / 2;
 
-    for (SimTrackerHit* hit = _htable.CurrentHit(_sensor.GetLayer(), _sensor.GetLadder());
-         hit != nullptr && hit->getTime() - curr_time < window_radius;
-         hit = _htable.CurrentHit(_sensor.GetLayer(), _sensor.GetLadder()))
+    /*
+     * The signal points are stored in time order, the new hits cannot be older than the window,
+     * the points of the previous windows are then removed before storing the new ones
+     */
+    if (!signals.empty())
+    {
+        streamlog_out(DEBUG) << "Signal points for " << _sensor.GetLayer() << ":" << _sensor.GetLadder()
+                               << " = " << signals.size() << std::endl;
+
+        for (TimedSignalPoint spoint = signals.front();
+             curr_time - spoint.time > window_radius;
+             spoint = signals.front())
+        {
+            signals.pop_front();
+            if (signals.empty()) break;
+        }
+    }
+
+    if (_idleSkip && signals.empty()) SkipIdleClockSteps();
+
+    StageTimer sp_timer { _profile, ProfileStage::signal_points };
+    std::size_t n_points = signals.size();
+    int n_hits = _cursor.GetHitNumber();
+
+    for (SimTrackerHit* hit = _cursor.CurrentHit();
+         hit != nullptr && _cursor.CurrentTime() - curr_time < window_radius;
+         hit = _cursor.CurrentHit())
     {
         if (streamlog::out.write<streamlog::DEBUG6>())
 #pragma omp critical
@@ -92,13 +146,13 @@ int DetElemSlidingWindow::process()
             float mcp_theta = hit->getPosition()[2] == 0 ? 3.1416/2 : atan(mcp_r / hit->getPosition()[2]);
             double mom_norm = sqrt(pow(hit->getMomentum()[0], 2) + pow(hit->getMomentum()[1], 2)
                                    + pow(hit->getMomentum()[2], 2));
-            int segment_id = cell_decoder(hit)["sensor"];
+            int segment_id = _hits.GetSensor(_cursor.CurrentIndex());
             streamlog::out() << "Processing simHit from layer = " << _sensor.GetLayer()
                              << ", ladder = " << _sensor.GetLadder() 
                              << ", sensor = " << segment_id << std::endl
                              << "Time window centered in " << curr_time
                              << ", Hits available = "
-                             << _htable.GetHitNumber(_sensor.GetLayer(), _sensor.GetLadder())
+                             << _cursor.GetHitNumber()
                              << std::endl
                              << "- EDep = " << hit->getEDep() * dd4hep::GeV / dd4hep::keV
                              << " keV, path length = " << hit->getPathLength() * 1000.
@@ -115,22 +169,17 @@ int DetElemSlidingWindow::process()
                              << "- Quality = " << hit->getQuality() << std::endl;
         }
 
-        StoreSignalPoints(hit);
-        _htable.DisposeHit(_sensor.GetLayer(), _sensor.GetLadder());
+        StoreSignalPoints(_cursor.CurrentIndex());
+        _cursor.DisposeHit();
+        DropOverlayHits();
     }
 
-    if (!signals.empty())
+    sp_timer.Stop();
+    if (_profile != nullptr)
     {
-        streamlog_out(DEBUG) << "Signal points for " << _sensor.GetLayer() << ":" << _sensor.GetLadder()
-                               << " = " << signals.size() << std::endl;
-
-        for (TimedSignalPoint spoint = signals.front();
-             curr_time - spoint.sim_hit->getTime() > window_radius;
-             spoint = signals.front())
-        {
-            signals.pop_front();
-            if (signals.empty()) break;
-        }
+        _profile->Count(ProfileCounter::sim_hits, n_hits - _cursor.GetHitNumber());
+        _profile->Count(ProfileCounter::signal_points, signals.size() - n_points);
+        _profile->Count(ProfileCounter::clock_steps);
     }
 
     UpdatePixels();
@@ -139,69 +188,406 @@ int DetElemSlidingWindow::process()
     return signals.size();
 }
 
-float DetElemSlidingWindow::get_time()
+template<class SensorT>
+void TypedSlidingWindow<SensorT>::SkipIdleClockSteps()
+{
+    int max_steps = _sensor.GetIdleClockSteps();
+    if (max_steps <= 0) return;
+
+    float window_radius = time_click / 2;
+    // Without any further hit an unbounded number of idle steps means that the sensor stops at the next step
+    bool hasMoreHits = _cursor.GetHitNumber() > 0;
+    bool hasMoreCharge = _useCache && _cache.first != _cache.last;
+    if (!hasMoreHits && !hasMoreCharge && max_steps == std::numeric_limits<int>::max()) return;
+
+    if (_noise.Enabled() && _noise.StepsBeforeNext() < max_steps) max_steps = int(_noise.StepsBeforeNext());
+
+    /*
+     * The windows before the one of the next hit, or of the next cached charge, are skipped;
+     * the time is moved forward with the same sums of the step by step evolution
+     */
+    int n_steps = 0;
+    while (n_steps < max_steps
+           && (!hasMoreHits || _cursor.CurrentTime() - curr_time >= window_radius)
+           && (!hasMoreCharge || CurrentBin() < _cache.first->bin))
+    {
+        curr_time += time_click;
+        n_steps++;
+    }
+
+    if (n_steps == 0) return;
+
+    if (streamlog::out.write<streamlog::DEBUG>())
+#pragma omp critical
+    {
+        streamlog::out() << "Skipped " << n_steps << " clock steps for " << _sensor.GetLayer()
+                         << ":" << _sensor.GetLadder() << std::endl;
+    }
+
+    StageTimer cs_timer { _profile, ProfileStage::clock_step };
+    if (_profile != nullptr) _profile->Count(ProfileCounter::skipped_steps, n_steps);
+
+    _sensor.InitHitRegister();
+    _sensor.SkipClockSteps(n_steps);
+    _noise.SkipSteps(n_steps);
+}
+
+template<class SensorT>
+void TypedSlidingWindow<SensorT>::SetNoise(const PixelNoiseGenerator& noise)
+{
+    _noise = noise;
+    _noise.Start(_engine, int64_t(_grid.rows) * _grid.cols);
+}
+
+template<class SensorT>
+void TypedSlidingWindow<SensorT>::InjectNoise()
+{
+    // The charge of a noisy pixel is over threshold by construction, it fires the pixel if sensitive
+    int n_noise = _noise.Step([this](int64_t pos, float charge)
+    {
+        int row = int(pos / _grid.cols);
+        int col = int(pos % _grid.cols);
+        if (!_sensor.IsSensitive(row, col)) return;
+        SensorCalls<SensorT>::UpdatePixel(_sensor, row, col, charge);
+    });
+
+    if (_profile != nullptr) _profile->Count(ProfileCounter::noise_pixels, n_noise);
+}
+
+template<class SensorT>
+float TypedSlidingWindow<SensorT>::get_time()
 {
     return curr_time;
 }
 
-void DetElemSlidingWindow::UpdatePixels()
+template<class SensorT>
+void TypedSlidingWindow<SensorT>::UpdatePixels()
 {
+    StageTimer pu_timer { _profile, ProfileStage::pixel_update };
+
     _sensor.InitHitRegister();
     _sensor.BeginClockStep();
 
     float window_radius = time_click / 2;
 
-    for (auto spoint : signals)
+    // The list holds the points of the following steps too, only the current ones are counted
+    int n_segments = _sensor.GetSegNumX() * _sensor.GetSegNumY();
+    bool use_segments = _segmentTasks && n_segments > 1;
+    bool use_offload = _offloadMinPoints > 0;
+    std::size_t n_step = use_segments || use_offload ? CollectStepPoints(window_radius) : 0;
+
+    if (use_offload && n_step >= _offloadMinPoints)
+    {
+        DepositOffload();
+    }
+    else if (use_segments && n_step >= MIN_SEGMENT_POINTS)
+    {
+        DepositBySegment();
+    }
+    else
+    {
+        int ixLo = 0;
+        int iyLo = 0;
+        int nx = 0;
+        int ny = 0;
+        for (auto spoint : signals)
+        {
+            if (spoint.time > curr_time + window_radius) break;
+
+            if (!IntegrateSignalPoint(spoint, ixLo, iyLo, nx, ny)) continue;
+
+            for (int i = 0; i < nx; ++i)
+            {
+                for (int j = 0; j < ny; ++j)
+                {
+                    if (!_sensor.IsSensitive(ixLo + i, iyLo + j)) continue;
+                    float p_charge = _kernel.GetCharge(i, j);
+                    SensorCalls<SensorT>::UpdatePixel(_sensor, ixLo + i, iyLo + j, p_charge);
+                    SensorCalls<SensorT>::RegisterHit(_sensor, ixLo + i, iyLo + j, spoint.hit_index, p_charge);
+                }
+            }
+        }
+    }
+
+    // The cached charges of the previous steps, if any, are never left behind
+    if (_useCache)
+    {
+        int c_bin = CurrentBin();
+        for (; _cache.first != _cache.last && _cache.first->bin <= c_bin; _cache.first++)
+        {
+            const BIBPixelEntry& entry = *_cache.first;
+            SensorCalls<SensorT>::UpdatePixel(_sensor, entry.row, entry.col, entry.charge);
+            SensorCalls<SensorT>::RegisterHit(_sensor, entry.row, entry.col, _overlayHits[entry.hit], entry.charge);
+        }
+    }
+
+    InjectNoise();
+
+    pu_timer.Stop();
+    StageTimer cs_timer { _profile, ProfileStage::clock_step };
+    _sensor.EndClockStep();
+}
+
+template<class SensorT>
+std::size_t TypedSlidingWindow<SensorT>::CollectStepPoints(float window_radius)
+{
+    _stepPoints.clear();
+    for (const auto& spoint : signals)
+    {
+        if (spoint.time > curr_time + window_radius) break;
+        _stepPoints.push_back(&spoint);
+    }
+    return _stepPoints.size();
+}
+
+template<class SensorT>
+void TypedSlidingWindow<SensorT>::DepositBySegment()
+{
+    int n_seg_x = _sensor.GetSegNumX();
+    int n_seg_y = _sensor.GetSegNumY();
+    int n_segments = n_seg_x * n_seg_y;
+    int s_rows = _sensor.GetSensorRows();
+    int s_cols = _sensor.GetSensorCols();
+
+    if (int(_segKernels.size()) < n_segments) _segKernels.resize(n_segments, PixelChargeKernel(_cdfMode));
+    _segCharges.resize(n_segments);
+    _segLists.resize(n_segments);
+    for (auto& s_list : _segLists) s_list.clear();
+
+    // Each point is routed to the segments overlapped by its box, in the order of the points
+    PixelBox l_bounds { 0, _grid.rows, 0, _grid.cols };
+    int ixLo = 0;
+    int iyLo = 0;
+    int nx = 0;
+    int ny = 0;
+    for (const TimedSignalPoint* spoint : _stepPoints)
     {
-        if (spoint.sim_hit->getTime() > curr_time + window_radius) break;
+        if (!SignalBox(*spoint, l_bounds, ixLo, iyLo, nx, ny)) continue;
 
-        double xHFrame = _widthOfCluster * spoint.sigmaX;
-        double yHFrame = _widthOfCluster * spoint.sigmaY;
-        
-        int ixLo = _sensor.XToPixelRow(spoint.x - xHFrame);
-        int iyLo = _sensor.YToPixelCol(spoint.y - yHFrame);
+        int sx_hi = min((ixLo + nx - 1) / s_rows, n_seg_x - 1);
+        int sy_hi = min((iyLo + ny - 1) / s_cols, n_seg_y - 1);
+        for (int seg_x = ixLo / s_rows; seg_x <= sx_hi; seg_x++)
+        {
+            for (int seg_y = iyLo / s_cols; seg_y <= sy_hi; seg_y++)
+            {
+                _segLists[seg_x * n_seg_y + seg_y].push_back(spoint);
+            }
+        }
+    }
 
-        int ixUp = _sensor.XToPixelRow(spoint.x + xHFrame);
-        int iyUp = _sensor.YToPixelCol(spoint.y + yHFrame);
+#pragma omp taskloop grainsize(1) default(shared)
+    for (int s = 0; s < n_segments; s++)
+    {
+        int seg_x = s / n_seg_y;
+        int seg_y = s % n_seg_y;
+        PixelBox bounds { seg_x * s_rows, min((seg_x + 1) * s_rows, _grid.rows),
+                          seg_y * s_cols, min((seg_y + 1) * s_cols, _grid.cols) };
+        PixelChargeKernel& kernel = _segKernels[s];
+        std::vector<PixelChargeEntry>& s_charges = _segCharges[s];
+        s_charges.clear();
+
+        int ixLo = 0;
+        int iyLo = 0;
+        int nx = 0;
+        int ny = 0;
+        for (const TimedSignalPoint* spoint : _segLists[s])
+        {
+            if (!IntegrateSignalPoint(*spoint, kernel, bounds, ixLo, iyLo, nx, ny)) continue;
 
-        for (int ix = ixLo; ix < ixUp + 1; ++ix)
+            for (int i = 0; i < nx; ++i)
+            {
+                for (int j = 0; j < ny; ++j)
+                {
+                    if (!_sensor.IsSensitive(ixLo + i, iyLo + j)) continue;
+                    s_charges.push_back({ ixLo + i, iyLo + j, spoint->hit_index, kernel.GetCharge(i, j) });
+                }
+            }
+        }
+    }
+
+    // The sensor and the hit register are not thread-safe, the charges are added serially
+    for (const auto& s_charges : _segCharges)
+    {
+        for (const PixelChargeEntry& entry : s_charges)
         {
-            if (ix < 0 || ix >= _sensor.GetLadderRows()) continue;
+            SensorCalls<SensorT>::UpdatePixel(_sensor, entry.row, entry.col, entry.charge);
+            SensorCalls<SensorT>::RegisterHit(_sensor, entry.row, entry.col, entry.hit_index, entry.charge);
+        }
+    }
+}
+
+template<class SensorT>
+void TypedSlidingWindow<SensorT>::DepositOffload()
+{
+    PixelBox bounds { 0, _grid.rows, 0, _grid.cols };
+
+    _offload.Clear();
+    int ixLo = 0;
+    int iyLo = 0;
+    int nx = 0;
+    int ny = 0;
+    for (const TimedSignalPoint* spoint : _stepPoints)
+    {
+        if (!SignalBox(*spoint, bounds, ixLo, iyLo, nx, ny)) continue;
+
+        _offload.AddBox({ _grid.PixelRowToX(ixLo) - 0.5 * _grid.pitch_x,
+                          _grid.PixelColToY(iyLo) - 0.5 * _grid.pitch_y,
+                          spoint->x, spoint->y, spoint->sigmaX, spoint->sigmaY, spoint->charge,
+                          nx, ny, ixLo, iyLo, spoint->hit_index });
+    }
+
+    _offload.Deposit(_grid.pitch_x, _grid.pitch_y);
 
-            for (int iy = iyLo; iy < iyUp + 1; ++iy)
+    for (int b = 0; b < _offload.GetBoxNumber(); b++)
+    {
+        const OffloadBox& box = _offload.GetBox(b);
+        for (int i = 0; i < box.nx; ++i)
+        {
+            for (int j = 0; j < box.ny; ++j)
             {
-                if (iy < 0 || iy >= _sensor.GetLadderCols()) continue;
+                if (!_sensor.IsSensitive(box.row_lo + i, box.col_lo + j)) continue;
+                float p_charge = _offload.GetCharge(b, i, j);
+                SensorCalls<SensorT>::UpdatePixel(_sensor, box.row_lo + i, box.col_lo + j, p_charge);
+                SensorCalls<SensorT>::RegisterHit(_sensor, box.row_lo + i, box.col_lo + j, box.hit_index, p_charge);
+            }
+        }
+    }
+}
+
+template<class SensorT>
+bool TypedSlidingWindow<SensorT>::IntegrateSignalPoint(const TimedSignalPoint& spoint,
+                                                       int& ixLo, int& iyLo, int& nx, int& ny)
+{
+    return IntegrateSignalPoint(spoint, _kernel, { 0, _grid.rows, 0, _grid.cols }, ixLo, iyLo, nx, ny);
+}
+
+template<class SensorT>
+bool TypedSlidingWindow<SensorT>::IntegrateSignalPoint(const TimedSignalPoint& spoint, PixelChargeKernel& kernel,
+                                                       const PixelBox& bounds,
+                                                       int& ixLo, int& iyLo, int& nx, int& ny) const
+{
+    if (!SignalBox(spoint, bounds, ixLo, iyLo, nx, ny)) return false;
+
+    kernel.Deposit(_grid.PixelRowToX(ixLo) - 0.5 * _grid.pitch_x, _grid.pitch_x, nx,
+                   _grid.PixelColToY(iyLo) - 0.5 * _grid.pitch_y, _grid.pitch_y, ny,
+                   spoint.x, spoint.y, spoint.sigmaX, spoint.sigmaY, spoint.charge);
+    return true;
+}
+
+template<class SensorT>
+bool TypedSlidingWindow<SensorT>::SignalBox(const TimedSignalPoint& spoint, const PixelBox& bounds,
+                                            int& ixLo, int& iyLo, int& nx, int& ny) const
+{
+    double xHFrame = _widthOfCluster * spoint.sigmaX;
+    double yHFrame = _widthOfCluster * spoint.sigmaY;
+
+    ixLo = max(_grid.XToPixelRow(spoint.x - xHFrame), bounds.row_lo);
+    iyLo = max(_grid.YToPixelCol(spoint.y - yHFrame), bounds.col_lo);
 
-                double xCurrent = _sensor.PixelRowToX(ix);
-                double yCurrent = _sensor.PixelColToY(iy);
-                
-                gsl_sf_result result;
-                int status = gsl_sf_erf_Q_e((xCurrent - 0.5 * _sensor.GetPixelSizeX() - spoint.x) / spoint.sigmaX, &result);
-                double LowerBound = 1 - result.val;
+    int ixUp = min(_grid.XToPixelRow(spoint.x + xHFrame), bounds.row_hi - 1);
+    int iyUp = min(_grid.YToPixelCol(spoint.y + yHFrame), bounds.col_hi - 1);
 
-                status = gsl_sf_erf_Q_e((xCurrent + 0.5 * _sensor.GetPixelSizeX() - spoint.x) / spoint.sigmaX, &result);
-                double UpperBound = 1 - result.val;
-                double integralX = UpperBound - LowerBound;
+    if (ixUp < ixLo || iyUp < iyLo) return false;
 
-                status = gsl_sf_erf_Q_e((yCurrent - 0.5 * _sensor.GetPixelSizeY() - spoint.y) / spoint.sigmaY, &result);
-                LowerBound = 1 - result.val;
+    nx = ixUp - ixLo + 1;
+    ny = iyUp - iyLo + 1;
+    return true;
+}
+
+template<class SensorT>
+void TypedSlidingWindow<SensorT>::BuildCache(BIBLadderCache& l_cache)
+{
+    l_cache.entries.clear();
+    l_cache.n_hits = 0;
 
-                status = gsl_sf_erf_Q_e((yCurrent + 0.5 * _sensor.GetPixelSizeY() - spoint.y) / spoint.sigmaY, &result);
-                UpperBound = 1 - result.val;
-                double integralY = UpperBound - LowerBound;
+    // Charges of a single hit, summed over the signal points for each pixel
+    vector<BIBPixelEntry> h_buffer {};
 
-                float totCharge = float(spoint.charge * integralX * integralY);
+    LadderHitCursor b_cursor = _cursor;
+    for (; !b_cursor.Empty(); b_cursor.DisposeHit())
+    {
+        int h_index = b_cursor.CurrentIndex();
+        if (!_hits.IsOverlay(h_index)) continue;
+
+        // See process: the points of a hit are integrated in the window that contains the time of the hit
+        int h_bin = int(floor(_hits.GetTime(h_index) / time_click));
+        int h_ord = l_cache.n_hits++;
+
+        signals.clear();
+        StoreSignalPoints(h_index);
+
+        h_buffer.clear();
+        int ixLo = 0;
+        int iyLo = 0;
+        int nx = 0;
+        int ny = 0;
+        for (const TimedSignalPoint& spoint : signals)
+        {
+            if (!IntegrateSignalPoint(spoint, ixLo, iyLo, nx, ny)) continue;
 
-                _sensor.UpdatePixel(ix, iy, totCharge);
-                _sensor.RegisterHit(ix, iy, spoint.sim_hit);
+            for (int i = 0; i < nx; ++i)
+            {
+                for (int j = 0; j < ny; ++j)
+                {
+                    if (!_sensor.IsSensitive(ixLo + i, iyLo + j)) continue;
+                    h_buffer.push_back({ h_bin, ixLo + i, iyLo + j, h_ord, _kernel.GetCharge(i, j) });
+                }
+            }
+        }
+
+        std::stable_sort(h_buffer.begin(), h_buffer.end(),
+                         [](const BIBPixelEntry& a, const BIBPixelEntry& b)
+                         {
+                             return a.row < b.row || (a.row == b.row && a.col < b.col);
+                         });
+
+        for (std::size_t k = 0; k < h_buffer.size(); k++)
+        {
+            if (k > 0 && h_buffer[k].row == h_buffer[k - 1].row && h_buffer[k].col == h_buffer[k - 1].col)
+            {
+                l_cache.entries.back().charge += h_buffer[k].charge;
+            }
+            else
+            {
+                l_cache.entries.push_back(h_buffer[k]);
             }
         }
     }
+    // The hits are time ordered, so the entries are already sorted by clock step
+    signals.clear();
+}
 
-    _sensor.EndClockStep();
+template<class SensorT>
+bool TypedSlidingWindow<SensorT>::UseCache(const BIBLadderView& l_view)
+{
+    _overlayHits.clear();
+    LadderHitCursor o_cursor = _cursor;
+    for (; !o_cursor.Empty(); o_cursor.DisposeHit())
+    {
+        if (_hits.IsOverlay(o_cursor.CurrentIndex())) _overlayHits.push_back(o_cursor.CurrentIndex());
+    }
+
+    if (int(_overlayHits.size()) != l_view.n_hits)
+    {
+        _overlayHits.clear();
+        return false;
+    }
+
+    _cache = l_view;
+    _useCache = true;
+    DropOverlayHits();
+    return true;
 }
 
-void DetElemSlidingWindow::StoreSignalPoints(SimTrackerHit* hit)
+template<class SensorT>
+void TypedSlidingWindow<SensorT>::DropOverlayHits()
+{
+    if (!_useCache) return;
+    while (!_cursor.Empty() && _hits.IsOverlay(_cursor.CurrentIndex())) _cursor.DisposeHit();
+}
+
+template<class SensorT>
+void TypedSlidingWindow<SensorT>::StoreSignalPoints(int hit_index)
 {
     // hit and pos are in mm
     double pos[3] = {0,0,0};
@@ -210,10 +596,19 @@ void DetElemSlidingWindow::StoreSignalPoints(SimTrackerHit* hit)
     double exit[3];
 
     // ************************* Find local position **************************
-    SurfaceMap::const_iterator sI = surf_map->find(hit->getCellID0()) ;
-    const ISurface* surf = sI->second ;
+    const CachedSurface* c_surf = surf_cache->Find(_hits.GetCellID0(hit_index));
+    if (c_surf == nullptr)
+    {
+        if (streamlog::out.write<streamlog::DEBUG6>())
+#pragma omp critical
+        {
+            streamlog::out() << "  no surface for cellID " << _hits.GetCellID0(hit_index) << std::endl;
+        }
+        return;
+    }
+    const ISurface* surf = c_surf->surface;
 
-    Vector3D oldPos( hit->getPosition()[0], hit->getPosition()[1], hit->getPosition()[2] );
+    Vector3D oldPos( _hits.GetPosX(hit_index), _hits.GetPosY(hit_index), _hits.GetPosZ(hit_index) );
 
     if (!surf->insideBounds(dd4hep::mm * oldPos))
     {
@@ -227,13 +622,13 @@ void DetElemSlidingWindow::StoreSignalPoints(SimTrackerHit* hit)
     }    
 
 
-    Vector2D lv = surf->globalToLocal( dd4hep::mm * oldPos  ) ;
+    Vector2D lv = c_surf->GlobalToLocal( dd4hep::mm * oldPos  ) ;
     // Store local position in mm
     pos[0] = lv[0] / dd4hep::mm;
     pos[1] = lv[1] / dd4hep::mm;
 #ifdef ZSEGMENTED
     // See MuonCVXDDigitiser::processEvent
-    int segment_id = cell_decoder(hit)["sensor"];
+    int segment_id = _hits.GetSensor(hit_index);
 
     float s_offset = _sensor.GetSensorCols() * _sensor.GetPixelSizeY() * (float(segment_id) + 0.5);
     s_offset -= _sensor.GetHalfLength();
@@ -241,26 +636,17 @@ void DetElemSlidingWindow::StoreSignalPoints(SimTrackerHit* hit)
 #endif
 
     // Add also z ccordinate
-    Vector3D origin( surf->origin()[0], surf->origin()[1], surf->origin()[2]);
-    pos[2] = ( dd4hep::mm * oldPos - dd4hep::cm * origin ).dot( surf->normal() ) / dd4hep::mm;
-
-    double Momentum[3];
-    for (int j = 0; j < 3; ++j) 
-      if (hit->getMCParticle())
-        Momentum[j] = hit->getMCParticle()->getMomentum()[j] * dd4hep::GeV;
-      else
-        Momentum[j] = hit->getMomentum()[j];
+    pos[2] = ( dd4hep::mm * oldPos - dd4hep::cm * c_surf->origin ).dot( c_surf->normal ) / dd4hep::mm;
 
-    // as default put electron's mass
-    double particleMass = 0.510e-3 * dd4hep::GeV;
-    if (hit->getMCParticle())
-        particleMass = max(hit->getMCParticle()->getMass() * dd4hep::GeV, particleMass);
+    // The momentum of the MC particle and the mass, at least the electron's one, see SimHitSnapshot
+    double Momentum[3] = { _hits.GetMomX(hit_index), _hits.GetMomY(hit_index), _hits.GetMomZ(hit_index) };
+    double particleMass = _hits.GetMass(hit_index);
 
     double particleMomentum = sqrt(pow(Momentum[0], 2) + pow(Momentum[1], 2) + pow(Momentum[2], 2));                   
                          
-    dir[0] = Momentum * surf->u();
-    dir[1] = Momentum * surf->v();
-    dir[2] = Momentum * surf->normal();
+    dir[0] = Momentum * c_surf->u;
+    dir[1] = Momentum * c_surf->v;
+    dir[2] = Momentum * c_surf->normal;
 
     // ************************************************************************
 
@@ -290,19 +676,24 @@ void DetElemSlidingWindow::StoreSignalPoints(SimTrackerHit* hit)
     double eSum = 0.0;
     vector<TimedSignalPoint> signal_buffer;
 
+    // momentum in MeV/c, mass in MeV, tmax (delta cut) in MeV, 
+    // length in mm, meanLoss eloss in MeV.
+    eloss_buffer.resize(_numberOfSegments);
+    _fluctuate->SampleFluctuations(particleMomentum * dd4hep::keV / dd4hep::MeV,
+                                   particleMass * dd4hep::keV / dd4hep::MeV,
+                                   _cutOnDeltaRays,
+                                   segmentLength,
+                                   dEmean / dd4hep::MeV,
+                                   _numberOfSegments,
+                                   eloss_buffer.data());
+
     for (int i = 0; i < _numberOfSegments; ++i)
     {
         // ionization point
         z += _segmentDepth;
         double x = pos[0] + tanx * (z - pos[2]);
         double y = pos[1] + tany * (z - pos[2]);
-        // momentum in MeV/c, mass in MeV, tmax (delta cut) in MeV, 
-        // length in mm, meanLoss eloss in MeV.
-        double eloss = _fluctuate->SampleFluctuations(particleMomentum * dd4hep::keV / dd4hep::MeV,
-                                                      particleMass * dd4hep::keV / dd4hep::MeV,
-                                                      _cutOnDeltaRays,
-                                                      segmentLength,
-                                                      dEmean / dd4hep::MeV) * dd4hep::MeV;
+        double eloss = eloss_buffer[i] * dd4hep::MeV;
 
         double DistanceToPlane = _sensor.GetHalfThickness() - z;
         double xOnPlane = x + _tanLorentzAngleX * DistanceToPlane;
@@ -334,20 +725,21 @@ void DetElemSlidingWindow::StoreSignalPoints(SimTrackerHit* hit)
             SigmaX,
             SigmaY,
             charge,
-            hit
+            _hits.GetTime(hit_index),
+            hit_index
         });
 
         eSum += eloss;
     }
 
-    double hEdep = hit->getEDep() / dd4hep::GeV;
+    double hEdep = _hits.GetEDep(hit_index) / dd4hep::GeV;
     // deltaEne is a charge??
     const double thr = _deltaEne / _electronsPerKeV * dd4hep::keV;
     while (hEdep > eSum + thr)
     {
         // Add additional charge sampled from an 1 / n^2 distribution.
         const double       q = randomTail( thr, hEdep - eSum );
-        const unsigned int h = floor(RandFlat::shoot(0.0, (double)_numberOfSegments));
+        const unsigned int h = floor(RandFlat::shoot(_engine, 0.0, (double)_numberOfSegments));
         signal_buffer[h].charge += q * _electronsPerKeV / dd4hep::keV;
         eSum += q;
     }
@@ -382,12 +774,15 @@ void DetElemSlidingWindow::StoreSignalPoints(SimTrackerHit* hit)
 //=============================================================================
 // Sample charge from 1 / n^2 distribution.
 //=============================================================================
-double DetElemSlidingWindow::randomTail( const double qmin, const double qmax )
+template<class SensorT>
+double TypedSlidingWindow<SensorT>::randomTail( const double qmin, const double qmax )
 {
     const double offset = 1. / qmax;
     const double range  = ( 1. / qmin ) - offset;
-    const double u      = offset + RandFlat::shoot() * range;
+    const double u      = offset + RandFlat::shoot(_engine) * range;
     return 1. / u;
 }
 
-
+template class TypedSlidingWindow<AbstractSensor>;
+template class TypedSlidingWindow<TrivialSensor>;
+template class TypedSlidingWindow<HKBaseSensor>;
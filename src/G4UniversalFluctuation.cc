@@ -34,6 +34,8 @@
 // Modifications: 
 //
 // 13-05-20 thread-safety (P.Andreetto)
+// 14-10-26 random engine as argument of the constructor
+// 14-10-26 batch sampling for the segments of a track
 // 28-12-02 add method Dispersion (V.Ivanchenko)
 // 07-02-03 change signature (V.Ivanchenko)
 // 13-02-03 Add name (V.Ivanchenko)
@@ -48,6 +50,7 @@
 #include "CLHEP/Random/RandGaussQ.h"
 #include "CLHEP/Random/RandPoisson.h"
 #include "CLHEP/Random/RandFlat.h"
+#include "CLHEP/Random/Random.h"
 #include <cmath>
 
 using std::max;
@@ -62,7 +65,9 @@ using CLHEP::proton_mass_c2;
 
 // The constructor setups various constants pluc eloss parameters
 // for silicon.   
-G4UniversalFluctuation::G4UniversalFluctuation():
+G4UniversalFluctuation::G4UniversalFluctuation(CLHEP::HepRandomEngine* engine):
+    _engine(engine != nullptr ? engine : CLHEP::HepRandom::getTheEngine()),
+    _flatBuffer(),
     chargeSquare(1.),           //Assume all particles have charge 1
     ipotFluct(0.0001736),       //GEANT4 (for Silicon): material->GetIonisation()->GetMeanExcitationEnergy();
     electronDensity(6.797E+20), //GEANT4 (for Silicon): material->GetElectronDensity();
@@ -96,189 +101,200 @@ double G4UniversalFluctuation::SampleFluctuations(const double momentum,
                                                   const double tmax,
                                                   const double length,
                                                   const double meanLoss)
+{
+    double loss;
+    SampleFluctuations(momentum, mass, tmax, length, meanLoss, 1, &loss);
+    return loss;
+}
+
+void G4UniversalFluctuation::SampleFluctuations(const double momentum,
+                                                const double mass,
+                                                const double tmax,
+                                                const double length,
+                                                const double meanLoss,
+                                                const int n_seg,
+                                                double* losses)
 {
     //  calculate actual loss from the mean loss
     //  The model used to get the fluctuation is essentially the same
     // as in Glandz in Geant3.
 
     // shortcut for very very small loss 
-    if(meanLoss < minLoss) return meanLoss;
+    if (meanLoss < minLoss)
+    {
+        for (int k = 0; k < n_seg; k++) losses[k] = meanLoss;
+        return;
+    }
 
     double gam2 = pow(momentum, 2) / pow(mass, 2) + 1.0;
     double beta2 = 1.0 - 1.0 / gam2;
 
-    // Validity range for delta electron cross section
-    double loss, siga;
-
     // Gaussian fluctuation 
     if (meanLoss >= minNumberInteractionsBohr * tmax || tmax <= ipotFluct * minNumberInteractionsBohr)
     {
-        siga = (1.0 / beta2 - 0.5) * twopi_mc2_rcl2 * tmax * length * electronDensity * chargeSquare ;
+        double siga = (1.0 / beta2 - 0.5) * twopi_mc2_rcl2 * tmax * length * electronDensity * chargeSquare ;
         siga = sqrt(siga);
-        do
+        for (int k = 0; k < n_seg; k++)
         {
-            loss = RandGaussQ::shoot(meanLoss, siga);
+            double loss;
+            do
+            {
+                loss = RandGaussQ::shoot(_engine, meanLoss, siga);
+            }
+            while (loss < 0. || loss > 2. * meanLoss);
+            losses[k] = loss;
         }
-        while (loss < 0. || loss > 2. * meanLoss);
-
-        return loss;
+        return;
     }
 
     // Non Gaussian fluctuation 
-    double w1 = tmax / ipotFluct;
+    StepConstants sc;
+    sc.w1 = tmax / ipotFluct;
     double w2 = log(2. * electron_mass_c2 * (gam2 - 1.0));
 
     double C = meanLoss * (1. - rateFluct) / (w2 - ipotLogFluct - beta2);
 
-    double a1 = C * f1Fluct * (w2 - e1LogFluct - beta2) / e1Fluct;
-    double a2 = C * f2Fluct * (w2 - e2LogFluct - beta2) / e2Fluct;
-    double a3 = rateFluct * meanLoss * (tmax - ipotFluct) / (ipotFluct * tmax * log(w1));
-    if (a1 < 0.) a1 = 0.;
-    if (a2 < 0.) a2 = 0.;
-    if (a3 < 0.) a3 = 0.;
-
-    double suma = a1 + a2 + a3;
+    sc.a1 = C * f1Fluct * (w2 - e1LogFluct - beta2) / e1Fluct;
+    sc.a2 = C * f2Fluct * (w2 - e2LogFluct - beta2) / e2Fluct;
+    sc.a3 = rateFluct * meanLoss * (tmax - ipotFluct) / (ipotFluct * tmax * log(sc.w1));
+    if (sc.a1 < 0.) sc.a1 = 0.;
+    if (sc.a2 < 0.) sc.a2 = 0.;
+    if (sc.a3 < 0.) sc.a3 = 0.;
 
-    loss = 0. ;
-    int p3 = 0;
+    double suma = sc.a1 + sc.a2 + sc.a3;
+    bool small_step = suma < sumalim;
+    sc.adacut = 0.;
 
-    if (suma < sumalim)             // very small Step
+    if (small_step)
     {
-        if(tmax == ipotFluct)
+        if (tmax == ipotFluct)
         {
-            a3 = meanLoss / e0;
-
-            if (a3 > alim)
-            {
-                siga = sqrt(a3) ;
-                p3 = max(0, int(RandGaussQ::shoot(a3, siga) + 0.5));
-            }
-            else
-            {
-                p3 = RandPoisson::shoot(a3);
-            }
-            loss = p3 * e0;
-
-            if (p3 > 0)
-            {
-                loss += (1. - 2. * RandFlat::shoot()) * e0;
-            }
+            sc.a3 = meanLoss / e0;
         }
         else
         {
-            double adacut = tmax - ipotFluct + e0;
-            a3 = meanLoss * (adacut - e0) / (adacut * e0 * log(adacut / e0));
+            sc.adacut = tmax - ipotFluct + e0;
+            sc.a3 = meanLoss * (sc.adacut - e0) / (sc.adacut * e0 * log(sc.adacut / e0));
+        }
+    }
 
-            if (a3 > alim)
-            {
-                siga = sqrt(a3);
-                p3 = max(0, int(RandGaussQ::shoot(a3, siga) + 0.5));
-            }
-            else
-            {
-                p3 = RandPoisson::shoot(a3);
-            }
+    sc.siga1 = sqrt(sc.a1);
+    sc.siga2 = sqrt(sc.a2);
+    sc.siga3 = sqrt(sc.a3);
 
-            if (p3 > 0)
-            {
-                double w = (adacut - e0) / adacut;
-                double corrfac = 1.;
-                if (p3 > nmaxCont2)
-                {
-                    corrfac = double(p3) / double(nmaxCont2);
-                    p3 = nmaxCont2;
-                }
+    for (int k = 0; k < n_seg; k++)
+    {
+        losses[k] = small_step ? SampleSmallStep(tmax, sc) : SampleLargeStep(tmax, sc);
+    }
+}
 
-                for (int i = 0; i < p3; i++)
-                {
-                    loss += 1. / (1. - w * RandFlat::shoot());
-                }
-                loss *= e0 * corrfac;  
-            }        
-        }
+// number of collisions, gaussian approximation of the poisson distribution for large mean
+int G4UniversalFluctuation::SampleCount(const double mean, const double siga)
+{
+    if (mean > alim)
+    {
+        return max(0, int(RandGaussQ::shoot(_engine, mean, siga) + 0.5));
     }
-    else                              // not so small Step
+    return RandPoisson::shoot(_engine, mean);
+}
+
+// very small Step
+double G4UniversalFluctuation::SampleSmallStep(const double tmax, const StepConstants& sc)
+{
+    double loss = 0.;
+    int p3 = SampleCount(sc.a3, sc.siga3);
+
+    if (tmax == ipotFluct)
     {
-        // excitation type 1
-        int p1 = 0;
-        if (a1 > alim)
-        {
-            siga = sqrt(a1) ;
-            p1 = max(0, int(RandGaussQ::shoot(a1, siga) + 0.5));
-        }
-        else
-        {
-            p1 = RandPoisson::shoot(a1);
-        }
+        loss = p3 * e0;
 
-        // excitation type 2
-        int p2 = 0;
-        if (a2 > alim)
+        if (p3 > 0)
         {
-            siga = sqrt(a2) ;
-            p2 = max(0, int(RandGaussQ::shoot(a2, siga) + 0.5));
+            loss += (1. - 2. * RandFlat::shoot(_engine)) * e0;
         }
-        else
+        return loss;
+    }
+
+    if (p3 > 0)
+    {
+        double w = (sc.adacut - e0) / sc.adacut;
+        double corrfac = 1.;
+        if (p3 > nmaxCont2)
         {
-            p2 = RandPoisson::shoot(a2);
+            corrfac = double(p3) / double(nmaxCont2);
+            p3 = nmaxCont2;
         }
-        loss = p1 * e1Fluct + p2 * e2Fluct;
 
-        // smearing to avoid unphysical peaks
-        if (p2 > 0)
+        _flatBuffer.resize(p3);
+        _engine->flatArray(p3, _flatBuffer.data());
+        for (int i = 0; i < p3; i++)
         {
-            loss += (1. - 2. * RandFlat::shoot()) * e2Fluct;   
+            loss += 1. / (1. - w * _flatBuffer[i]);
         }
-        else if (loss > 0.)
-        {
-            loss += (1. - 2. * RandFlat::shoot()) * e1Fluct;
-        }   
+        loss *= e0 * corrfac;  
+    }
+    return loss;
+}
 
-        // ionisation .......................................
-        if(a3 > 0.)
-        {
-            if (a3 > alim)
-            {
-                siga = sqrt(a3) ;
-                p3 = max(0, int(RandGaussQ::shoot(a3, siga) + 0.5));
-            }
-            else
-            {
-                p3 = RandPoisson::shoot(a3);
-            }
+// not so small Step
+double G4UniversalFluctuation::SampleLargeStep(const double tmax, const StepConstants& sc)
+{
+    // excitation type 1
+    int p1 = SampleCount(sc.a1, sc.siga1);
+
+    // excitation type 2
+    int p2 = SampleCount(sc.a2, sc.siga2);
+
+    double loss = p1 * e1Fluct + p2 * e2Fluct;
+
+    // smearing to avoid unphysical peaks
+    if (p2 > 0)
+    {
+        loss += (1. - 2. * RandFlat::shoot(_engine)) * e2Fluct;   
+    }
+    else if (loss > 0.)
+    {
+        loss += (1. - 2. * RandFlat::shoot(_engine)) * e1Fluct;
+    }   
+
+    // ionisation .......................................
+    if (sc.a3 > 0.)
+    {
+        int p3 = SampleCount(sc.a3, sc.siga3);
 
-            if (p3 > 0)
+        if (p3 > 0)
+        {
+            double na = 0.; 
+            double alfa = 1.;
+            double d_p3 = double(p3);
+            if (p3 > nmaxCont2)
             {
-                double na = 0.; 
-                double alfa = 1.;
-                double d_p3 = double(p3);
-                if (p3 > nmaxCont2)
+                double rfac = d_p3 / (double(nmaxCont2 + p3));
+                na = RandGaussQ::shoot(_engine, d_p3 * rfac, double(nmaxCont1) * rfac);
+                if (na > 0.)
                 {
-                    double rfac = d_p3 / (double(nmaxCont2 + p3));
-                    na = RandGaussQ::shoot(d_p3 * rfac, double(nmaxCont1) * rfac);
-                    if (na > 0.)
-                    {
-                        alfa = w1 * double(nmaxCont2 + p3) / (w1 * double(nmaxCont2) + d_p3);
-                        double alfa1 = alfa * log(alfa ) / (alfa - 1.);
-                        double ea = na * ipotFluct * alfa1;
-                        double sea = ipotFluct * sqrt(na * (alfa - pow(alfa1, 2)));
-                        loss += RandGaussQ::shoot(ea,sea);
-                    }
+                    alfa = sc.w1 * double(nmaxCont2 + p3) / (sc.w1 * double(nmaxCont2) + d_p3);
+                    double alfa1 = alfa * log(alfa ) / (alfa - 1.);
+                    double ea = na * ipotFluct * alfa1;
+                    double sea = ipotFluct * sqrt(na * (alfa - pow(alfa1, 2)));
+                    loss += RandGaussQ::shoot(_engine, ea,sea);
                 }
+            }
 
-                int nb = int(d_p3 - na);
-                if (nb > 0)
+            int nb = int(d_p3 - na);
+            if (nb > 0)
+            {
+                double w2 = alfa * ipotFluct;
+                double w  = (tmax - w2) / tmax;      
+                _flatBuffer.resize(nb);
+                _engine->flatArray(nb, _flatBuffer.data());
+                for (int k = 0; k < nb; k++)
                 {
-                    w2 = alfa * ipotFluct;
-                    double w  = (tmax - w2) / tmax;      
-                    for (int k = 0; k < nb; k++)
-                    {
-                        loss +=  w2 / (1. - w * RandFlat::shoot());
-                    }
+                    loss +=  w2 / (1. - w * _flatBuffer[k]);
                 }
             }
         }
-    } 
+    }
 
     return loss;
 }
@@ -34,26 +34,127 @@ tuple<int, int, int, int> GetBound(const ClusterOfPixel& cluster, GridPosition l
 
    ************************************************************************* */
 
-ClusterHeap::ClusterHeap(int rows, int cols) :
-    hash_cnt(0),
+ClusterHeap::ClusterHeap(int rows, int cols, bool incr_on, bool hk8_on) :
+    rows(rows),
+    columns(cols),
     locate(rows, cols),
+    incremental(incr_on),
+    HK8_enabled(hk8_on),
     debug_label("Undefined"),
-    cluster_table(),
+    c_pool(),
+    free_slots(),
+    spare_pixels(),
     ref_table(),
-    ready_to_pop()
+    ready_to_pop(),
+    adj_slots()
 {}
 
 ClusterHeap::~ClusterHeap()
 {}
 
-void ClusterHeap::AddCluster(ClusterOfPixel& cluster)
+int ClusterHeap::NewSlot()
 {
+    int slot = 0;
+    if (free_slots.empty())
+    {
+        slot = c_pool.size();
+        c_pool.push_back({ {}, {}, 0 });
+    }
+    else
+    {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    }
+
+    ClusterItem& c_item = c_pool[slot];
+    if (c_item.buffer.pixels.capacity() == 0 && !spare_pixels.empty())
+    {
+        c_item.buffer.pixels.swap(spare_pixels.back());
+        spare_pixels.pop_back();
+    }
+    c_item.buffer.time = 0.;
+    c_item.size = 0;
+    return slot;
+}
+
+void ClusterHeap::FreeSlot(int slot)
+{
+    c_pool[slot].buffer.pixels.clear();
+    c_pool[slot].members.clear();
+    c_pool[slot].size = 0;
+    free_slots.push_back(slot);
+}
+
+int ClusterHeap::FindAdjacentCluster(const ClusterOfPixel& cluster)
+{
+    // Only the pending pixels are in the reference table, the neighbours are searched in any direction
+    adj_slots.clear();
+    for (LinearPosition curr_pos : cluster)
+    {
+        GridCoordinate g_pos = locate(curr_pos);
+        for (int d_row = -1; d_row <= 1; d_row++)
+        {
+            int n_row = g_pos.row + d_row;
+            if (n_row < 0 || n_row >= rows) continue;
+
+            for (int d_col = -1; d_col <= 1; d_col++)
+            {
+                int n_col = g_pos.col + d_col;
+                if (n_col < 0 || n_col >= columns) continue;
+                if (d_row == 0 && d_col == 0) continue;
+                if (!HK8_enabled && d_row != 0 && d_col != 0) continue;
+
+                auto ref_item = ref_table.find(locate(n_row, n_col));
+                if (ref_item == ref_table.end()) continue;
+                if (std::find(adj_slots.begin(), adj_slots.end(), ref_item->second) == adj_slots.end())
+                {
+                    adj_slots.push_back(ref_item->second);
+                }
+            }
+        }
+    }
+
+    if (adj_slots.empty()) return -1;
+
+    // A new cluster between two buffered clusters joins them
+    for (std::size_t k = 1; k < adj_slots.size(); k++) MergeSlots(adj_slots[0], adj_slots[k]);
+    return adj_slots[0];
+}
+
+void ClusterHeap::MergeSlots(int target, int source)
+{
+    ClusterItem& t_item = c_pool[target];
+    ClusterItem& s_item = c_pool[source];
+
+    for (LinearPosition s_pos : s_item.members)
+    {
+        auto ref_item = ref_table.find(s_pos);
+        if (ref_item != ref_table.end() && ref_item->second == source) ref_item->second = target;
+    }
+
+    t_item.members.insert(t_item.members.end(), s_item.members.begin(), s_item.members.end());
+    t_item.buffer.pixels.insert(t_item.buffer.pixels.end(),
+                                s_item.buffer.pixels.begin(), s_item.buffer.pixels.end());
+    t_item.buffer.time = std::max(t_item.buffer.time, s_item.buffer.time);
+    t_item.size += s_item.size;
+
+    FreeSlot(source);
+}
+
+void ClusterHeap::AddCluster(const ClusterOfPixel& cluster)
+{
+    int slot = incremental ? FindAdjacentCluster(cluster) : -1;
+    if (slot < 0) slot = NewSlot();
+    ClusterItem& c_item = c_pool[slot];
+
     for (LinearPosition curr_pos : cluster)
     {
         auto ref_item = ref_table.find(curr_pos);
         if (ref_item == ref_table.end())
         {
-            ref_table.emplace(curr_pos, hash_cnt);
+            ref_table.emplace(curr_pos, slot);
+            c_item.size++;
+            if (incremental) c_item.members.push_back(curr_pos);
         }
         else if (streamlog::out.write<streamlog::ERROR>())
 #pragma omp critical
@@ -64,14 +165,7 @@ void ClusterHeap::AddCluster(ClusterOfPixel& cluster)
         }
     }
 
-    ClusterItem cl_item { {}, cluster.size() };
-    cluster_table.emplace(hash_cnt, cl_item);
-
-    hash_cnt++;
-    if (hash_cnt == int_limits::max())
-    {
-        hash_cnt = 0;
-    }
+    if (c_item.size == 0) FreeSlot(slot);
 }
 
 void ClusterHeap::SetupPixel(int pos_x, int pos_y, PixelData pix)
@@ -81,18 +175,18 @@ void ClusterHeap::SetupPixel(int pos_x, int pos_y, PixelData pix)
     if (r_item != ref_table.end())
     {
         int cluster_id = r_item->second;
-        ClusterItem& c_item = cluster_table[cluster_id];
+        ClusterItem& c_item = c_pool[cluster_id];
 
         ChargePoint c_pix { pos_x, pos_y, pix.charge };
         c_item.buffer.pixels.push_back(c_pix);
         c_item.buffer.time = pix.time;
 
-        if (c_item.buffer.pixels.size() == c_item.size)
+        if (int(c_item.buffer.pixels.size()) == c_item.size)
         {
             ready_to_pop.push_back(cluster_id);
         }
 
-        ref_table.erase(pos);
+        ref_table.erase(r_item);
     }
     else if (streamlog::out.write<streamlog::ERROR>())
 #pragma omp critical
@@ -102,17 +196,41 @@ void ClusterHeap::SetupPixel(int pos_x, int pos_y, PixelData pix)
     }
 }
 
-vector<BufferedCluster> ClusterHeap::PopClusters()
+void ClusterHeap::PopClusters(vector<BufferedCluster>& result)
 {
-    vector<BufferedCluster> result;
-    for (auto cluster_id : ready_to_pop)
+    result.clear();
+    for (int cluster_id : ready_to_pop)
     {
-        result.push_back(cluster_table[cluster_id].buffer);
-        cluster_table.erase(cluster_id);
+        result.push_back(std::move(c_pool[cluster_id].buffer));
+        FreeSlot(cluster_id);
     }
 
     ready_to_pop.clear();
-    return result;
+}
+
+void ClusterHeap::Recycle(vector<BufferedCluster>& popped)
+{
+    for (BufferedCluster& c_item : popped)
+    {
+        c_item.pixels.clear();
+        spare_pixels.push_back(std::move(c_item.pixels));
+    }
+    popped.clear();
+}
+
+void ClusterHeap::Clear()
+{
+    // The buffers are kept for the next ladder
+    for (ClusterItem& c_item : c_pool)
+    {
+        if (c_item.buffer.pixels.capacity() == 0) continue;
+        c_item.buffer.pixels.clear();
+        spare_pixels.push_back(std::move(c_item.buffer.pixels));
+    }
+    c_pool.clear();
+    free_slots.clear();
+    ref_table.clear();
+    ready_to_pop.clear();
 }
 
 /* ****************************************************************************
@@ -136,7 +254,9 @@ HKBaseSensor::HKBaseSensor(int layer,
                             float fe_slope,
                             float starttime,
                             float t_step,
-                            bool hk8_on) :
+                            bool hk8_on,
+                            bool sparse_on,
+                            bool incr_on) :
     PixelDigiMatrix(layer,
                     ladder,
                     xsegmentNumber,
@@ -153,147 +273,236 @@ HKBaseSensor::HKBaseSensor(int layer,
                     starttime,
                     t_step),
     heap_table(0, { 0, 0 }),
-    HK8_enabled(hk8_on)
+    pop_buffer(),
+    seg_algos(),
+    seg_buffers(),
+    HK8_enabled(hk8_on),
+    sparse_enabled(sparse_on),
+    incremental_enabled(incr_on),
+    fu_algo(s_rows, s_colums),
+    sf_algo(s_rows, s_colums, hk8_on)
 {
     if (GetStatus() == MatrixStatus::ok)
     {
-        heap_table.resize(GetSegNumX() * GetSegNumY(), { GetSensorRows(), GetSensorCols() });
+        heap_table.resize(GetSegNumX() * GetSegNumY(),
+                          { GetSensorRows(), GetSensorCols(), incr_on, hk8_on });
+        SetupHeapLabels();
+    }
 
-        for (int h = 0; h < this->GetSegNumX(); h++)
+    reset_simtable_at_once = false;
+}
+
+void HKBaseSensor::Rebind(int ladder, float starttime)
+{
+    PixelDigiMatrix::Rebind(ladder, starttime);
+
+    for (ClusterHeap& c_heap : heap_table) c_heap.Clear();
+    SetupHeapLabels();
+}
+
+void HKBaseSensor::SetupHeapLabels()
+{
+    if (heap_table.empty()) return;
+
+    for (int h = 0; h < this->GetSegNumX(); h++)
+    {
+        for (int k = 0; k < this->GetSegNumY(); k++)
         {
-            for (int k = 0; k < this->GetSegNumY(); k++)
-            {
-                stringstream d_label;
-                d_label << "[" << GetLayer() << ":" << GetLadder() << ":" << h << ":" << k << "]";
-                heap_table[s_locate(h, k)].SetLabel(d_label.str());
-            }
+            stringstream d_label;
+            d_label << "[" << GetLayer() << ":" << GetLadder() << ":" << h << ":" << k << "]";
+            heap_table[s_locate(h, k)].SetLabel(d_label.str());
         }
     }
-
-    reset_simtable_at_once = false;
 }
 
 void HKBaseSensor::buildHits(SegmentDigiHitList& output)
 {
-    FindUnionAlgorithm  fu_algo { s_rows, s_colums };
     BitField64 bf_encoder = getBFEncoder();
 
     if (!IsActive()) return;
 
+    int n_segments = GetSegNumX() * GetSegNumY();
+    if (segment_tasks && sparse_enabled && n_segments > 1)
+    {
+        /*
+         * The segments are clustered by concurrent tasks, each with its own algorithm and buffer;
+         * the clusters are then emitted in segment order, since the sim-hit table is shared
+         */
+        if (int(seg_algos.size()) < n_segments)
+        {
+            seg_algos.resize(n_segments, sf_algo);
+            seg_buffers.resize(n_segments);
+        }
+
+#pragma omp taskloop grainsize(1) default(shared)
+        for (int s_idx = 0; s_idx < n_segments; s_idx++)
+        {
+            ClusterSegment(s_idx / GetSegNumY(), s_idx % GetSegNumY(), seg_algos[s_idx], seg_buffers[s_idx]);
+        }
+
+        for (int s_idx = 0; s_idx < n_segments; s_idx++)
+        {
+            EmitClusters(s_idx / GetSegNumY(), s_idx % GetSegNumY(), bf_encoder, seg_buffers[s_idx], output);
+        }
+        return;
+    }
+
     for (int h = 0; h < this->GetSegNumX(); h++)
     {
         for (int k = 0; k < this->GetSegNumY(); k++)
         {
+            ClusterSegment(h, k, sf_algo, pop_buffer);
+            EmitClusters(h, k, bf_encoder, pop_buffer, output);
+        }
+    }
+}
 
-            //Sensor segments ordered row first
-            LinearPosition sens_id = s_locate(h, k);
-            bf_encoder[LCTrackerCellID::sensor()] = sens_id;
+void HKBaseSensor::ClusterSegment(int h, int k, SparseFindUnion& s_algo, vector<BufferedCluster>& popped)
+{
+    ClusterHeap& c_heap = heap_table[s_locate(h, k)];
 
-            ClusterHeap& c_heap = heap_table[sens_id];
+    if (CheckStatusOnSensor(h, k, PixelStatus::start))
+    {
+        /* ****************************************************************
+           Hoshen-Kopelman Algorithm:
+           https://www.ocf.berkeley.edu/~fricke/projects/hoshenkopelman/hoshenkopelman.html
+           ************************************************************** */
 
-            if (CheckStatusOnSensor(h, k, PixelStatus::start))
+        if (sparse_enabled)
+        {
+            // Only the pixels switched on are visited
+            s_algo.init();
+            for (const GridCoordinate& g_pos : GetStartPixels(h, k))
             {
-                /* ****************************************************************
-                   Hoshen-Kopelman Algorithm:
-                   https://www.ocf.berkeley.edu/~fricke/projects/hoshenkopelman/hoshenkopelman.html
-                   ************************************************************** */
+                s_algo.add(LadderRowToSensorRow(g_pos.row, h), LadderColToSensorCol(g_pos.col, k));
+            }
+            s_algo.close();
 
-                fu_algo.init();
+            for (const ClusterOfPixel& c_item : s_algo.get_clusters())
+            {
+                c_heap.AddCluster(c_item);
+            }
+        }
+        else
+        {
+            fu_algo.init();
 
-                for (int i = 0; i < this->GetSensorRows(); i++)
+            for (int i = 0; i < this->GetSensorRows(); i++)
+            {
+                for (int j = 0; j < this->GetSensorCols(); j++)
                 {
-                    for (int j = 0; j < this->GetSensorCols(); j++)
+                    if (!checkStatus(h, k, i, j, PixelStatus::start))
                     {
-                        if (!checkStatus(h, k, i, j, PixelStatus::start))
-                        {
-                            fu_algo.invalidate(i, j);
-                            continue;
-                        }
-
-                        bool N_is_on = checkStatus(h, k, i - 1, j, PixelStatus::start);
-                        bool W_is_on = checkStatus(h, k, i, j - 1, PixelStatus::start);
-                        bool NW_is_on = HK8_enabled ? checkStatus(h, k, i - 1, j - 1, PixelStatus::start) : false;
-                        bool NE_is_on = HK8_enabled ? checkStatus(h, k, i - 1, j + 1, PixelStatus::start) : false;
-
-                        if (N_is_on and W_is_on)
-                        {
-                            fu_algo.merge(i - 1, j, i, j - 1);
-                            fu_algo.merge(i, j - 1, i, j);
-                        }
-                        else if (W_is_on and NE_is_on)
-                        {
-                            fu_algo.merge(i, j - 1, i - 1, j + 1);
-                            fu_algo.merge(i - 1, j + 1, i, j);
-                        }
-                        else if (NW_is_on and NE_is_on)
-                        {
-                            fu_algo.merge(i - 1, j - 1, i - 1, j + 1);
-                            fu_algo.merge(i - 1, j + 1, i, j);
-                        }
-                        else if (W_is_on)
-                        {
-                            fu_algo.merge(i, j - 1, i, j);
-                        }
-                        else if (N_is_on)
-                        {
-                            fu_algo.merge(i - 1, j, i, j);
-                        }
-                        else if (NW_is_on)
-                        {
-                            fu_algo.merge(i - 1, j - 1, i, j);
-                        }
-                        else if (NE_is_on)
-                        {
-                            fu_algo.merge(i - 1, j + 1, i, j);
-                        }
+                        fu_algo.invalidate(i, j);
+                        continue;
                     }
-                }
-
-                fu_algo.close();
 
-                /* ****************************************************************
-                   Cluster buffering
-                   ************************************************************** */
+                    bool N_is_on = checkStatus(h, k, i - 1, j, PixelStatus::start);
+                    bool W_is_on = checkStatus(h, k, i, j - 1, PixelStatus::start);
+                    bool NW_is_on = HK8_enabled ? checkStatus(h, k, i - 1, j - 1, PixelStatus::start) : false;
+                    bool NE_is_on = HK8_enabled ? checkStatus(h, k, i - 1, j + 1, PixelStatus::start) : false;
 
-                for (ClusterOfPixel c_item : fu_algo.get_clusters())
-                {
-                    c_heap.AddCluster(c_item);
+                    if (N_is_on and W_is_on)
+                    {
+                        fu_algo.merge(i - 1, j, i, j - 1);
+                        fu_algo.merge(i, j - 1, i, j);
+                    }
+                    else if (W_is_on and NE_is_on)
+                    {
+                        fu_algo.merge(i, j - 1, i - 1, j + 1);
+                        fu_algo.merge(i - 1, j + 1, i, j);
+                    }
+                    else if (NW_is_on and NE_is_on)
+                    {
+                        fu_algo.merge(i - 1, j - 1, i - 1, j + 1);
+                        fu_algo.merge(i - 1, j + 1, i, j);
+                    }
+                    else if (W_is_on)
+                    {
+                        fu_algo.merge(i, j - 1, i, j);
+                    }
+                    else if (N_is_on)
+                    {
+                        fu_algo.merge(i - 1, j, i, j);
+                    }
+                    else if (NW_is_on)
+                    {
+                        fu_algo.merge(i - 1, j - 1, i, j);
+                    }
+                    else if (NE_is_on)
+                    {
+                        fu_algo.merge(i - 1, j + 1, i, j);
+                    }
                 }
             }
 
-            for (auto p_item : GetPixelsFromSensor(h, k, PixelStatus::ready))
+            fu_algo.close();
+
+            /* ****************************************************************
+               Cluster buffering
+               ************************************************************** */
+
+            for (const ClusterOfPixel& c_item : fu_algo.get_clusters())
             {
-                c_heap.SetupPixel(p_item.row, p_item.col, p_item.data);
+                c_heap.AddCluster(c_item);
             }
+        }
+    }
 
-            for (BufferedCluster c_item : c_heap.PopClusters())
-            {
-                // Very simple implementation: geometric mean
-                SegmentDigiHit digiHit = {
-                    0., 0., 0.,
-                    c_item.time,
-                    bf_encoder.lowWord(),
-                    {}
-                };
-
-                for (ChargePoint c_point : c_item.pixels)
-                {
-                    int global_row = SensorRowToLadderRow(h, c_point.row);
-                    int global_col = SensorColToLadderCol(k, c_point.col);
+    for (auto p_item : GetPixelsFromSensor(h, k, PixelStatus::ready))
+    {
+        c_heap.SetupPixel(p_item.row, p_item.col, p_item.data);
+    }
 
-                    digiHit.x += PixelRowToX(global_row);
-                    digiHit.y += PixelColToY(global_col);
+    c_heap.PopClusters(popped);
+}
 
-                    digiHit.charge += c_point.charge;
+void HKBaseSensor::EmitClusters(int h, int k, BitField64& bf_encoder, vector<BufferedCluster>& popped,
+                                SegmentDigiHitList& output)
+{
+    //Sensor segments ordered row first
+    LinearPosition sens_id = s_locate(h, k);
+    bf_encoder[LCTrackerCellID::sensor()] = sens_id;
 
-                    fillInHitRelation(digiHit.sim_hits, l_locate(global_row, global_col));
-                }
+    for (const BufferedCluster& c_item : popped)
+    {
+        // Very simple implementation: geometric mean
+        SegmentDigiHit digiHit = {
+            0., 0., 0.,
+            c_item.time,
+            bf_encoder.lowWord(),
+            {}
+        };
+        int row_min = int_limits::max();
+        int row_max = -1;
+        int col_min = int_limits::max();
+        int col_max = -1;
+
+        for (const ChargePoint& c_point : c_item.pixels)
+        {
+            int global_row = SensorRowToLadderRow(h, c_point.row);
+            int global_col = SensorColToLadderCol(k, c_point.col);
+            row_min = std::min(row_min, global_row);
+            row_max = std::max(row_max, global_row);
+            col_min = std::min(col_min, global_col);
+            col_max = std::max(col_max, global_col);
 
-                digiHit.x /= c_item.pixels.size();
-                digiHit.y /= c_item.pixels.size();
+            digiHit.x += PixelRowToX(global_row);
+            digiHit.y += PixelColToY(global_col);
 
-                output.push_back(std::move(digiHit));
-            }
+            digiHit.charge += c_point.charge;
+
+            fillInHitRelation(digiHit.sim_hits, l_locate(global_row, global_col));
         }
+
+        digiHit.x /= c_item.pixels.size();
+        digiHit.y /= c_item.pixels.size();
+
+        digiHit.size = c_item.pixels.size();
+        digiHit.size_x = row_max - row_min + 1;
+        digiHit.size_y = col_max - col_min + 1;
+
+        output.push_back(std::move(digiHit));
     }
+    heap_table[sens_id].Recycle(popped);
 }
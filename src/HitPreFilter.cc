@@ -0,0 +1,87 @@
+#include "HitPreFilter.h"
+
+#include <algorithm>
+#include "EVENT/LCIO.h"
+#include <UTIL/CellIDDecoder.h>
+
+using std::string;
+using UTIL::CellIDDecoder;
+
+HitPreFilter::HitPreFilter(float min_time, float max_time, float min_edep,
+                           const vector<int>& masked_layers, const vector<int>& masked_ladders) :
+    _minTime(min_time),
+    _maxTime(max_time),
+    _minEDep(min_edep),
+    _maskedLayers(masked_layers),
+    _maskedLadders()
+{
+    for (std::size_t k = 0; k + 1 < masked_ladders.size(); k += 2)
+    {
+        _maskedLadders.emplace_back(masked_ladders[k], masked_ladders[k + 1]);
+    }
+}
+
+HitPreFilter::~HitPreFilter()
+{}
+
+bool HitPreFilter::IsMasked(int layer, int ladder) const
+{
+    if (std::find(_maskedLayers.begin(), _maskedLayers.end(), layer) != _maskedLayers.end()) return true;
+    return std::find(_maskedLadders.begin(), _maskedLadders.end(),
+                     std::make_pair(layer, ladder)) != _maskedLadders.end();
+}
+
+HitFilterStats HitPreFilter::Apply(const LCCollection* STHcol, vector<char>& h_mask, bool parallel) const
+{
+    int n_hits = STHcol->getNumberOfElements();
+    string enc_str { STHcol->getParameters().getStringVal(EVENT::LCIO::CellIDEncoding) };
+    bool use_geometry = !_maskedLayers.empty() || !_maskedLadders.empty();
+
+    h_mask.assign(n_hits, 1);
+    int time_cut = 0;
+    int edep_cut = 0;
+    int geometry_cut = 0;
+
+#pragma omp parallel if(parallel) reduction(+:time_cut,edep_cut,geometry_cut)
+    {
+        CellIDDecoder<SimTrackerHit> cellid_decoder { enc_str };
+
+#pragma omp for schedule(static)
+        for (int i = 0; i < n_hits; ++i)
+        {
+            SimTrackerHit* simTrkHit = static_cast<SimTrackerHit*>(STHcol->getElementAt(i));
+
+            float h_time = simTrkHit->getTime();
+            if (h_time < _minTime || h_time > _maxTime)
+            {
+                h_mask[i] = 0;
+                time_cut++;
+                continue;
+            }
+
+            if (simTrkHit->getEDep() < _minEDep)
+            {
+                h_mask[i] = 0;
+                edep_cut++;
+                continue;
+            }
+
+            if (use_geometry)
+            {
+                auto& cell_id = cellid_decoder(simTrkHit);
+                if (IsMasked(cell_id["layer"], cell_id["module"]))
+                {
+                    h_mask[i] = 0;
+                    geometry_cut++;
+                }
+            }
+        }
+    }
+
+    HitFilterStats result {};
+    result.n_hits = n_hits;
+    result.time_cut = time_cut;
+    result.edep_cut = edep_cut;
+    result.geometry_cut = geometry_cut;
+    return result;
+}
@@ -1,47 +1,92 @@
+
 #include "HitTemporalIndexes.h"
 
+#include <algorithm>
+#include <string>
+#include "EVENT/LCIO.h"
+
 using std::min;
+using std::max;
+using std::string;
 
-HitTemporalIndexes::HitTemporalIndexes(const LCCollection* STHcol):
-    cellid_decoder(STHcol),
-    htable()
+HitTemporalIndexes::HitTemporalIndexes(const LCCollection* STHcol, bool parallel_build,
+                                       const vector<char>* h_mask, int side_layers):
+    h_snapshot(STHcol, parallel_build, h_mask),
+    l_number(0),
+    m_number(0),
+    h_table(),
+    offsets(),
+    cursors()
 {
-    for (int i = 0; i < STHcol->getNumberOfElements(); ++i)
-    {
-        SimTrackerHit* simTrkHit = dynamic_cast<SimTrackerHit*>(STHcol->getElementAt(i));
-        int layer = cellid_decoder(simTrkHit)["layer"];
-        int ladder = cellid_decoder(simTrkHit)["module"];
-        int tkey = GetKey(layer, ladder);
+    int n_hits = h_snapshot.Size();
 
-        auto item = htable.find(tkey);
-        if (item == htable.end())
-        {
-            hit_queue* n_queue = new hit_queue();
-            n_queue->push(simTrkHit);
-            htable.emplace(tkey, n_queue);
-        }
-        else
+    // The cell IDs are decoded in the snapshot, the masked hits have a negative layer
+    vector<int> layers(n_hits, 0);
+    vector<int> ladders(n_hits, 0);
+    int max_layer = h_snapshot.GetMaxLayer();
+    int max_ladder = h_snapshot.GetMaxLadder();
+    for (int i = 0; i < n_hits; ++i)
+    {
+        layers[i] = h_snapshot.GetLayer(i);
+        ladders[i] = h_snapshot.GetLadder(i);
+        if (side_layers > 0 && layers[i] >= 0 && h_snapshot.GetSide(i) < 0)
         {
-            item->second->push(simTrkHit);
+            layers[i] += side_layers;
+            max_layer = max(max_layer, layers[i]);
         }
     }
-}
 
-HitTemporalIndexes::~HitTemporalIndexes()
-{
-    for (auto item : htable)
+    l_number = max_layer + 1;
+    m_number = max_ladder + 1;
+    offsets.assign(l_number * m_number + 1, 0);
+
+    /*
+     * Bucket sizes and offsets
+     */
+    for (int i = 0; i < n_hits; ++i)
+    {
+        if (layers[i] < 0 || ladders[i] < 0) continue;
+        offsets[GetKey(layers[i], ladders[i]) + 1]++;
+    }
+    for (size_t k = 1; k < offsets.size(); k++)
+    {
+        offsets[k] += offsets[k - 1];
+    }
+
+    /*
+     * Scatter the hits into the buckets, the order of the collection is preserved
+     */
+    cursors.assign(offsets.begin(), offsets.end() - 1);
+    h_table.resize(offsets.back());
+    for (int i = 0; i < n_hits; ++i)
+    {
+        if (layers[i] < 0 || ladders[i] < 0) continue;
+        h_table[cursors[GetKey(layers[i], ladders[i])]++] = { h_snapshot.GetTime(i), i, h_snapshot.GetHit(i) };
+    }
+
+    /*
+     * Time ordering within each bucket
+     */
+    int n_keys = offsets.size() - 1;
+#pragma omp parallel for schedule(dynamic) if(parallel_build)
+    for (int k = 0; k < n_keys; k++)
     {
-        delete(item.second);
+        std::stable_sort(h_table.begin() + offsets[k], h_table.begin() + offsets[k + 1],
+                         [](const TimedHit& a, const TimedHit& b) { return a.time < b.time; });
     }
+
+    cursors.assign(offsets.begin(), offsets.end() - 1);
 }
 
+HitTemporalIndexes::~HitTemporalIndexes()
+{}
+
 SimTrackerHit* HitTemporalIndexes::CurrentHit(int layer, int ladder)
 {
     int tkey = GetKey(layer, ladder);
-    auto item = htable.find(tkey);
-    if (item != htable.end() && !item->second->empty())
+    if (tkey >= 0 && cursors[tkey] < offsets[tkey + 1])
     {
-        return item->second->top();
+        return h_table[cursors[tkey]].hit;
     }
     return nullptr;
 }
@@ -49,26 +94,28 @@ SimTrackerHit* HitTemporalIndexes::CurrentHit(int layer, int ladder)
 void HitTemporalIndexes::DisposeHit(int layer, int ladder)
 {
     int tkey = GetKey(layer, ladder);
-    auto item = htable.find(tkey);
-    if (item != htable.end() && !item->second->empty())
+    if (tkey >= 0 && cursors[tkey] < offsets[tkey + 1])
     {
-        item->second->pop();
+        cursors[tkey]++;
     }
 }
 
 int HitTemporalIndexes::GetHitNumber(int layer, int ladder)
 {
     int tkey = GetKey(layer, ladder);
-    auto item = htable.find(tkey);
-    return item != htable.end() ? item->second->size() : -1;
+    if (tkey < 0 || offsets[tkey] == offsets[tkey + 1]) return -1;
+    return offsets[tkey + 1] - cursors[tkey];
 }
 
 float HitTemporalIndexes::GetMinTime()
 {
     float min_time { MAXTIME };
-    for (auto item : htable)
+    for (size_t k = 0; k < cursors.size(); k++)
     {
-        min_time = min(min_time, item.second->top()->getTime());
+        if (cursors[k] < offsets[k + 1])
+        {
+            min_time = min(min_time, h_table[cursors[k]].time);
+        }
     }
     return min_time;
 }
@@ -76,15 +123,38 @@ float HitTemporalIndexes::GetMinTime()
 float HitTemporalIndexes::GetMinTime(int layer, int ladder)
 {
     int tkey = GetKey(layer, ladder);
-    auto item = htable.find(tkey);
-    if (item != htable.end()) return item->second->top()->getTime();
+    if (tkey >= 0 && cursors[tkey] < offsets[tkey + 1]) return h_table[cursors[tkey]].time;
     return MAXTIME;
 }
 
+LadderHitCursor HitTemporalIndexes::GetCursor(int layer, int ladder)
+{
+    int tkey = GetKey(layer, ladder);
+    if (tkey < 0) return LadderHitCursor();
+    return LadderHitCursor(h_table.data() + cursors[tkey], h_table.data() + offsets[tkey + 1]);
+}
+
+vector<LadderWorkItem> HitTemporalIndexes::GetWorkItems()
+{
+    vector<LadderWorkItem> result {};
+    for (int k = 0; k < l_number * m_number; k++)
+    {
+        if (cursors[k] == offsets[k + 1]) continue;
+        result.push_back({
+            k / m_number,
+            k % m_number,
+            offsets[k + 1] - cursors[k],
+            h_table[cursors[k]].time,
+            h_table[offsets[k + 1] - 1].time
+        });
+    }
+    return result;
+}
+
 int HitTemporalIndexes::GetKey(int layer, int ladder)
 {
-    // TODO use cellID0 and/or cellID1
-    return layer * 1000 + ladder;
+    if (layer < 0 || layer >= l_number || ladder < 0 || ladder >= m_number) return -1;
+    return layer * m_number + ladder;
 }
 
 float HitTemporalIndexes::MAXTIME { std::numeric_limits<float>::max() };
@@ -0,0 +1,122 @@
+#include "MemoryBudget.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <thread>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace
+{
+    // Upper bound of the backoff of a waiting thread, an item takes much longer
+    const int MAX_WAIT_US = 1000;
+}
+
+std::size_t CurrentResidentBytes()
+{
+    // The second field of statm is the number of resident pages
+    std::ifstream statm { "/proc/self/statm" };
+    std::size_t n_pages = 0;
+    std::size_t n_resident = 0;
+    if (!(statm >> n_pages >> n_resident)) return 0;
+    return n_resident * std::size_t(sysconf(_SC_PAGESIZE));
+}
+
+std::size_t PeakResidentBytes()
+{
+    struct rusage r_usage;
+    if (getrusage(RUSAGE_SELF, &r_usage) != 0) return 0;
+#ifdef __APPLE__
+    return std::size_t(r_usage.ru_maxrss);
+#else
+    return std::size_t(r_usage.ru_maxrss) * 1024;
+#endif
+}
+
+MemoryBudgetScheduler::MemoryBudgetScheduler(std::size_t budget, const vector<std::size_t>& order,
+                                             const vector<std::size_t>& bytes) :
+    s_budget(budget),
+    s_order(order),
+    s_bytes(bytes),
+    s_taken(order.size(), 0),
+    s_first(0),
+    s_in_flight(0),
+    s_running(0),
+    s_high_water(0),
+    s_rss_high_water(CurrentResidentBytes()),
+    s_deferred(0),
+    s_releases(0)
+{}
+
+MemoryBudgetScheduler::~MemoryBudgetScheduler()
+{}
+
+int MemoryBudgetScheduler::Take()
+{
+    int item = -1;
+    if (TryTake(item)) return item;
+
+    // Nothing changes until a release, the lock is taken again only after one
+    unsigned int seen = s_releases.load(std::memory_order_acquire);
+    int wait_us = 1;
+    while (true)
+    {
+        // The waiting thread runs the pending tasks of the other items, if any
+#pragma omp taskyield
+        unsigned int current = s_releases.load(std::memory_order_acquire);
+        if (current != seen)
+        {
+            seen = current;
+            wait_us = 1;
+            if (TryTake(item)) return item;
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(wait_us));
+            wait_us = std::min(2 * wait_us, MAX_WAIT_US);
+        }
+    }
+}
+
+bool MemoryBudgetScheduler::TryTake(int& item)
+{
+    bool result = true;
+#pragma omp critical(memory_budget)
+    {
+        while (s_first < s_order.size() && s_taken[s_first]) s_first++;
+
+        item = -1;
+        for (std::size_t k = s_first; k < s_order.size() && item < 0; k++)
+        {
+            if (s_taken[k]) continue;
+            std::size_t i_bytes = s_bytes[s_order[k]];
+            if (s_budget == 0 || s_running == 0 || s_in_flight + i_bytes <= s_budget)
+            {
+                s_taken[k] = 1;
+                s_in_flight += i_bytes;
+                s_running++;
+                s_high_water = std::max(s_high_water, s_in_flight);
+                item = s_order[k];
+                if (k != s_first) s_deferred++;
+            }
+        }
+
+        // Nothing fits: wait unless all the items are taken
+        if (item < 0 && s_first < s_order.size()) result = false;
+    }
+    return result;
+}
+
+void MemoryBudgetScheduler::Release(int item)
+{
+    std::size_t rss = CurrentResidentBytes();
+#pragma omp critical(memory_budget)
+    {
+        s_in_flight -= s_bytes[item];
+        s_running--;
+        s_rss_high_water = std::max(s_rss_high_water, rss);
+    }
+    s_releases.fetch_add(1, std::memory_order_release);
+}
@@ -11,14 +11,19 @@
 #include "DD4hep/Detector.h"
 #include "DDRec/DetectorData.h"
 #include "DD4hep/DD4hepUnits.h"
-#include "gsl/gsl_sf_erf.h"
 #include "gsl/gsl_math.h"
 #include "CLHEP/Random/RandGauss.h"
 #include "CLHEP/Random/RandPoisson.h" 
 #include "CLHEP/Random/RandFlat.h" 
+#include "CLHEP/Random/Random.h"
     
 // ----- include for verbosity dependend logging ---------
 #include "marlin/VerbosityLevels.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 using CLHEP::RandGauss;
 using CLHEP::RandPoisson;
 using CLHEP::RandFlat;
@@ -31,13 +36,58 @@ using dd4hep::rec::SurfaceMap;
 using dd4hep::rec::ISurface;
 using dd4hep::rec::Vector2D;
 using dd4hep::rec::Vector3D;
+
+namespace
+{
+    inline int GetThreadID()
+    {
+#ifdef _OPENMP
+        return omp_get_thread_num();
+#else
+        return 0;
+#endif
+    }
+
+    inline int GetMaxThreads()
+    {
+#ifdef _OPENMP
+        return omp_get_max_threads();
+#else
+        return 1;
+#endif
+    }
+}
+
+HitContext::HitContext(bool own_engine, GaussCDFMode erf_mode, double delta_cut) :
+    hitEngine(),
+    engine(own_engine ? &hitEngine : CLHEP::HepRandom::getTheEngine()),
+    fluctuate(engine),
+    chargeKernel(erf_mode),
+    layer(0),
+    ladder(0),
+    numberOfSegments(0),
+    cutOnDeltaRays(delta_cut),
+    particleMass(0),
+    particleMomentum(0),
+    phi(0),
+    eSum(0),
+    segmentDepth(0),
+    localPosition(),
+    entryPoint(),
+    exitPoint(),
+    ionisationPoints(),
+    elossBuffer(),
+    signalPoints(),
+    deposits(),
+    pixels()
+{}
+
 MuonCVXDDigitiser aMuonCVXDDigitiser ;
 MuonCVXDDigitiser::MuonCVXDDigitiser() :
     Processor("MuonCVXDDigitiser"),
     _nRun(0),
     _nEvt(0),
     _totEntries(0),
-    _currentLayer(0),
     _map(nullptr)
 {
     _description = "MuonCVXDDigitiser should create VTX TrackerHits from SimTrackerHits";
@@ -175,6 +225,18 @@ MuonCVXDDigitiser::MuonCVXDDigitiser() :
                                "Maximum values for track length (in mm)",
                                _maxTrkLen,
                                10.0); 
+    registerProcessorParameter("ErfMode",
+                               "Evaluation of the gaussian CDF for the pixel charge (0 : GSL, 1 : tabulated)",
+                               _erfMode,
+                               int(0));
+    registerProcessorParameter("ParallelHits",
+                               "Digitise the hits in parallel, with a random stream for each hit",
+                               _parallelHits,
+                               int(0));
+    registerProcessorParameter("RandomSeed",
+                               "Seed for the random streams of the hits",
+                               _randomSeed,
+                               int(12345));
 }
 void MuonCVXDDigitiser::init()
 { 
@@ -205,7 +267,10 @@ void MuonCVXDDigitiser::init()
     _nRun = 0 ;
     _nEvt = 0 ;
     _totEntries = 0;
-    _fluctuate = new MyG4UniversalFluctuationForSi();
+    _hitContexts.clear();
+    // number of bins of the uniform discretization
+    _chargeNumBins = pow(2, _ChargeDigitizeNumBits)-1;
+    _timeNumBins = pow(2, _TimeDigitizeNumBits)-1;
 }
 void MuonCVXDDigitiser::processRunHeader(LCRunHeader* run)
 { 
@@ -249,6 +314,7 @@ void MuonCVXDDigitiser::LoadGeometry()
                                  << _subDetName << " in SurfaceManager " ;
       throw Exception( err.str() ) ;
     }
+    _surfCache.Build(_map, lcio::LCTrackerCellID::encoding_string());
     _laddersInLayer.resize(_numberOfLayers);
 #ifdef ZSEGMENTED
     _sensorsPerLadder.resize(_numberOfLayers);
@@ -396,164 +462,60 @@ void MuonCVXDDigitiser::processEvent(LCEvent * evt)
         }
         int nSimHits = STHcol->getNumberOfElements();
         streamlog_out( DEBUG9 ) << "Processing collection " << _colName  << " with " <<  nSimHits  << " hits ... " << std::endl ;
+        // The decoder is not thread-safe, the layer and ladder numbers are decoded in advance
+        std::vector<SimTrackerHit*> simHits(nSimHits, nullptr);
+        std::vector<int> hitLayers(nSimHits, 0);
+        std::vector<int> hitLadders(nSimHits, 0);
         for (int i=0; i < nSimHits; ++i)
         {
-            SimTrackerHit * simTrkHit = 
-                dynamic_cast<SimTrackerHit*>(STHcol->getElementAt(i));
+            simHits[i] = dynamic_cast<SimTrackerHit*>(STHcol->getElementAt(i));
             // use CellID to set layer and ladder numbers
-            _currentLayer  = cellid_decoder( simTrkHit )["layer"];
-            _currentLadder = cellid_decoder( simTrkHit )["module"];
-            streamlog_out( DEBUG7 ) << "Processing simHit #" << i << ", from layer=" << _currentLayer << ", module=" << _currentLadder << std::endl;
-            streamlog_out (DEBUG6) << "- EDep = " << simTrkHit->getEDep() *dd4hep::GeV / dd4hep::keV << " keV, path length = " << simTrkHit->getPathLength() * 1000. << " um" << std::endl;
-            float mcp_r = std::sqrt(simTrkHit->getPosition()[0]*simTrkHit->getPosition()[0]+simTrkHit->getPosition()[1]*simTrkHit->getPosition()[1]);
-            float mcp_phi = std::atan(simTrkHit->getPosition()[1]/simTrkHit->getPosition()[0]);
-            float mcp_theta = simTrkHit->getPosition()[2] == 0 ? 3.1416/2 : std::atan(mcp_r/simTrkHit->getPosition()[2]);
-            streamlog_out (DEBUG6) << "- Position (mm) x,y,z,t = " << simTrkHit->getPosition()[0] << ", " << simTrkHit->getPosition()[1] << ", " << simTrkHit->getPosition()[2] << ", " << simTrkHit->getTime() << std::endl;
-            streamlog_out (DEBUG6) << "- Position r(mm),phi,theta = " << mcp_r << ", " << mcp_phi << ", " << mcp_theta << std::endl;
-            streamlog_out (DEBUG6) << "- MC particle pdg = ";
-            EVENT::MCParticle *mcp = simTrkHit->getMCParticle();
-            if (mcp) {
-                streamlog_out (DEBUG6) << simTrkHit->getMCParticle()->getPDG();
-            } else {
-                streamlog_out (DEBUG6) << " N.A.";
-            }
-            streamlog_out (DEBUG6) << std::endl;
-            streamlog_out (DEBUG6) << "- MC particle p (GeV) = " << std::sqrt(simTrkHit->getMomentum()[0]*simTrkHit->getMomentum()[0]+simTrkHit->getMomentum()[1]*simTrkHit->getMomentum()[1]+simTrkHit->getMomentum()[2]*simTrkHit->getMomentum()[2]) << std::endl;
-            streamlog_out (DEBUG6) << "- isSecondary = " << simTrkHit->isProducedBySecondary() << ", isOverlay = " << simTrkHit->isOverlay() << std::endl;
-            streamlog_out (DEBUG6) << "- Quality = " << simTrkHit->getQuality() << std::endl;
-            ProduceIonisationPoints( simTrkHit );       
-            if (_currentLayer == -1)
-              continue;
-            ProduceSignalPoints();
-            SimTrackerHitImplVec simTrkHitVec;
-            ProduceHits(simTrkHitVec, *simTrkHit);
-            if (_PoissonSmearing != 0) PoissonSmearer(simTrkHitVec);
-            if (_electronicEffects != 0) GainSmearer(simTrkHitVec);
-	        ApplyThreshold(simTrkHitVec);
-	        if (_DigitizeCharge != 0) ChargeDigitizer(simTrkHitVec);
-            if (_timeSmearingSigma > 0) TimeSmearer(simTrkHitVec);
-            if (_DigitizeTime != 0) TimeDigitizer(simTrkHitVec);
-	    
-            //**************************************************************************
-            // Create reconstructed cluster object (TrackerHitImpl)
-            //**************************************************************************
-            TrackerHitPlaneImpl *recoHit = ReconstructTrackerHit(simTrkHitVec);
-            if (recoHit == nullptr)
-            {
-                streamlog_out(DEBUG) << "Skip hit" << std::endl;
-                continue;
-            }       
-            // hit's layer/ladder/petal position does not change
-            const int cellid0 = simTrkHit->getCellID0();
-            const int cellid1 = simTrkHit->getCellID1();
-            recoHit->setCellID0( cellid0 );
-            recoHit->setCellID1( cellid1 );
-            
-            double localPos[3];
-            double localIdx[3];
-            double localDir[3];
-            FindLocalPosition(simTrkHit, localPos, localDir);
-            localIdx[0] = localPos[0] / _pixelSizeX;
-            localIdx[1] = localPos[1] / _pixelSizeY;
-            float incidentPhi = std::atan(localDir[0] / localDir[2]);
-            float incidentTheta = std::atan(localDir[1] / localDir[2]);
+            hitLayers[i]  = cellid_decoder( simHits[i] )["layer"];
+            hitLadders[i] = cellid_decoder( simHits[i] )["module"];
+            streamlog_out( DEBUG7 ) << "Processing simHit #" << i << ", from layer=" << hitLayers[i] << ", module=" << hitLadders[i] << std::endl;
+        }
+
+        int nContexts = _parallelHits != 0 ? GetMaxThreads() : 1;
+        while (int(_hitContexts.size()) < nContexts)
+        {
+            _hitContexts.emplace_back(new HitContext(_parallelHits != 0,
+                                                     _erfMode == 1 ? GaussCDFMode::tabulated : GaussCDFMode::exact,
+                                                     _cutOnDeltaRays));
+        }
 
-            // Debug messages to check if reconstruction went correctly
-            // true global
-            streamlog_out (DEBUG9) << "- TRUE GLOBAL position (mm) x,y,z,t = " << simTrkHit->getPosition()[0] << ", " << simTrkHit->getPosition()[1] << ", " << simTrkHit->getPosition()[2] << ", " << simTrkHit->getTime() << std::endl;
-            // true local (compare two verions)
-            streamlog_out (DEBUG9) << "- TRUE LOCAL position (localPos) (mm) x,y,z,t = " << localPos[0] << ", " << localPos[1] << ", " << localPos[2] << std::endl;
-            // reco local 
-            streamlog_out (DEBUG9) << "- RECO LOCAL position (mm) x,y,z,t = " << recoHit->getPosition()[0] << ", " << recoHit->getPosition()[1] << ", " << recoHit->getPosition()[2] << std::endl;
-            
-            double xLab[3];
-            TransformToLab( cellid0, recoHit->getPosition(), xLab);
-            recoHit->setPosition( xLab );
+        // The log stream is not thread-safe, the loop is serial if debug output is enabled
+        bool runParallel = _parallelHits != 0 && !streamlog::out.write<streamlog::DEBUG9>();
+        uint64_t randomKey = PhiloxRandomEngine::MakeKey(_randomSeed, evt->getRunNumber(), evt->getEventNumber());
+        std::vector<HitOutput> hitOutputs(nSimHits);
 
-            // reco global
-            streamlog_out (DEBUG9) << "- RECO GLOBAL position (mm) x,y,z,t = " << recoHit->getPosition()[0] << ", " << recoHit->getPosition()[1] << ", " << recoHit->getPosition()[2] << std::endl;
-            
-            SurfaceMap::const_iterator sI = _map->find( cellid0 ) ;
-            const dd4hep::rec::ISurface* surf = sI->second ;
-            dd4hep::rec::Vector3D u = surf->u() ;
-            dd4hep::rec::Vector3D v = surf->v() ;
-            
-            
-            float u_direction[2] ;
-            //TODO HACK: Store incidence angle of particle instead!
-            u_direction[0] = u.theta();
-            u_direction[1] = u.phi();
-            float v_direction[2] ;
-            v_direction[0] = v.theta();
-            v_direction[1] = v.phi();
-            recoHit->setU( u_direction ) ;
-            recoHit->setV( v_direction ) ;
-            
+#pragma omp parallel for schedule(dynamic, 16) if(runParallel)
+        for (int i=0; i < nSimHits; ++i)
+        {
+            HitContext &ctx = *_hitContexts[GetThreadID()];
+            if (_parallelHits != 0)
+            {
+                // each hit starts from the nominal delta-ray cut with its own random stream
+                ctx.hitEngine.SetStream(randomKey, uint64_t(i));
+                ctx.cutOnDeltaRays = _cutOnDeltaRays;
+            }
+            ProcessHit(ctx, simHits[i], hitLayers[i], hitLadders[i], hitOutputs[i]);
+        }
+
+        // Products are moved into the collections in hit order
+        for (int i=0; i < nSimHits; ++i)
+        {
+            HitOutput &output = hitOutputs[i];
+            if (output.recoHit == nullptr) continue;
             //**************************************************************************
             // Set Relation to SimTrackerHit
             //**************************************************************************    
             LCRelationImpl* rel = new LCRelationImpl;
-            rel->setFrom (recoHit);
-            rel->setTo (simTrkHit);
+            rel->setFrom (output.recoHit);
+            rel->setTo (simHits[i]);
             rel->setWeight( 1.0 );
             relCol->addElement(rel);
-            streamlog_out (DEBUG7) << "Reconstructed pixel cluster:" << std::endl;
-            streamlog_out (DEBUG7) << "- local position (x,y) = " << localPos[0] << "(Idx: " << localIdx[0] << "), " << localPos[1] << "(Idy: " << localIdx[1] << ")" << std::endl;
-            streamlog_out( DEBUG5 ) << "(reco local) - (true local) (x,y,z): " << localPos[0] - _currentLocalPosition[0] << ", " << localPos[1] - _currentLocalPosition[1] << ", " << localPos[2] - _currentLocalPosition[2] << std::endl;
-            streamlog_out (DEBUG7) << "- global position (x,y,z, t) = " << recoHit->getPosition()[0] << ", " << recoHit->getPosition()[1] << ", " << recoHit->getPosition()[2] << ", " << recoHit->getTime() << std::endl;
-            streamlog_out (DEBUG7) << "- (reco global (x,y,z,t)) - (true global) = " << recoHit->getPosition()[0] - simTrkHit->getPosition()[0]<< ", " << recoHit->getPosition()[1] - simTrkHit->getPosition()[1] << ", " << recoHit->getPosition()[2] - simTrkHit->getPosition()[2]<< ", " << recoHit->getTime() - simTrkHit->getTime()<< std::endl;
-            streamlog_out (DEBUG7) << "- charge = " << recoHit->getEDep() << "(True: " << simTrkHit->getEDep() << ")"  << std::endl;
-            streamlog_out (DEBUG7) << "- incidence angles: theta = " << incidentTheta << ", phi = " << incidentPhi << std::endl;
-            if (_produceFullPattern != 0)
-            {
-              // Store all the fired points
-              for (int iS = 0; iS < (int)simTrkHitVec.size(); ++iS)
-              {
-                SimTrackerHitImpl *sth = simTrkHitVec[iS];
-                float charge = sth->getEDep();
-                //store hits that are above threshold. In case of _ChargeDiscretization, just check for a small non-zero value                
-                if ( ((_DigitizeCharge > 0) and (charge >1.0)) or
-                    (charge > _threshold) )
-                {
-                   SimTrackerHitImpl *newsth = new SimTrackerHitImpl();
-                   // hit's layer/ladder position is the same for all fired points 
-                   newsth->setCellID0( cellid0 );
-                   newsth->setCellID1( cellid1 );
-                   //Store local position in units of pixels instead
-                   const double *sLab;
-                   //TransformToLab(cellid0, sth->getPosition(), sLab);
-                   sLab = sth->getPosition();
-                   double pixelPos[3];
-                   pixelPos[0] = sLab[0] / _pixelSizeX;
-                   pixelPos[1] = sLab[1] / _pixelSizeY;
-                   newsth->setPosition(pixelPos);
-                   newsth->setEDep(charge); // in unit of electrons
-                   newsth->setTime(sth->getTime());
-                   newsth->setPathLength(simTrkHit->getPathLength());
-                   newsth->setMCParticle(simTrkHit->getMCParticle());
-                   newsth->setMomentum(simTrkHit->getMomentum());
-                   newsth->setProducedBySecondary(simTrkHit->isProducedBySecondary());
-                   newsth->setOverlay(simTrkHit->isOverlay());
-                   STHLocCol->addElement(newsth);
-                   recoHit->rawHits().push_back(newsth);
-                }
-              }
-            }
-            streamlog_out (DEBUG7) << "- number of pixels: " << recoHit->getRawHits().size() << std::endl;
-            streamlog_out (DEBUG7) << "- MC particle p=" << std::sqrt(simTrkHit->getMomentum()[0]*simTrkHit->getMomentum()[0]+simTrkHit->getMomentum()[1]*simTrkHit->getMomentum()[1]+simTrkHit->getMomentum()[2]*simTrkHit->getMomentum()[2]) << std::endl;
-            streamlog_out (DEBUG7) << "- isSecondary = " << simTrkHit->isProducedBySecondary() << ", isOverlay = " << simTrkHit->isOverlay() << std::endl;
-            streamlog_out (DEBUG6) << "- List of constituents (pixels/strips):" << std::endl;
-            for (size_t iH = 0; iH < recoHit->rawHits().size(); ++iH) {
-                SimTrackerHit *hit = dynamic_cast<SimTrackerHit*>(recoHit->rawHits().at(iH));
-                streamlog_out (DEBUG6) << "  - " << iH << ": Edep (e-) = " << hit->getEDep() << ", t (ns) =" << hit->getTime() << std::endl;
-            }
-            streamlog_out (DEBUG7) << "--------------------------------" << std::endl;
-            THcol->addElement(recoHit);
-            for (int k=0; k < int(simTrkHitVec.size()); ++k)
-            {
-                SimTrackerHit *hit = simTrkHitVec[k];
-                delete hit;
-            }
+            for (SimTrackerHitImpl *sth : output.firedPixels) STHLocCol->addElement(sth);
+            THcol->addElement(output.recoHit);
         }
         streamlog_out(DEBUG) << "Number of produced hits: " << THcol->getNumberOfElements()  << std::endl;
         //**************************************************************************
@@ -574,12 +536,139 @@ void MuonCVXDDigitiser::processEvent(LCEvent * evt)
         << "   in run:  " << evt->getRunNumber() << std::endl ;
     _nEvt ++ ;
 }
+/**
+ * Digitisation of a SimTrackerHit: the reconstructed hit and the fired pixels
+ * are staged in the output, the relation is created when the output is merged.
+ */
+void MuonCVXDDigitiser::ProcessHit(HitContext &ctx, SimTrackerHit *simTrkHit,
+                                   int layer, int ladder, HitOutput &output)
+{
+    ctx.layer = layer;
+    ctx.ladder = ladder;
+    streamlog_out (DEBUG6) << "- EDep = " << simTrkHit->getEDep() *dd4hep::GeV / dd4hep::keV << " keV, path length = " << simTrkHit->getPathLength() * 1000. << " um" << std::endl;
+    float mcp_r = std::sqrt(simTrkHit->getPosition()[0]*simTrkHit->getPosition()[0]+simTrkHit->getPosition()[1]*simTrkHit->getPosition()[1]);
+    float mcp_phi = std::atan(simTrkHit->getPosition()[1]/simTrkHit->getPosition()[0]);
+    float mcp_theta = simTrkHit->getPosition()[2] == 0 ? 3.1416/2 : std::atan(mcp_r/simTrkHit->getPosition()[2]);
+    streamlog_out (DEBUG6) << "- Position (mm) x,y,z,t = " << simTrkHit->getPosition()[0] << ", " << simTrkHit->getPosition()[1] << ", " << simTrkHit->getPosition()[2] << ", " << simTrkHit->getTime() << std::endl;
+    streamlog_out (DEBUG6) << "- Position r(mm),phi,theta = " << mcp_r << ", " << mcp_phi << ", " << mcp_theta << std::endl;
+    streamlog_out (DEBUG6) << "- MC particle pdg = ";
+    EVENT::MCParticle *mcp = simTrkHit->getMCParticle();
+    if (mcp) {
+        streamlog_out (DEBUG6) << simTrkHit->getMCParticle()->getPDG();
+    } else {
+        streamlog_out (DEBUG6) << " N.A.";
+    }
+    streamlog_out (DEBUG6) << std::endl;
+    streamlog_out (DEBUG6) << "- MC particle p (GeV) = " << std::sqrt(simTrkHit->getMomentum()[0]*simTrkHit->getMomentum()[0]+simTrkHit->getMomentum()[1]*simTrkHit->getMomentum()[1]+simTrkHit->getMomentum()[2]*simTrkHit->getMomentum()[2]) << std::endl;
+    streamlog_out (DEBUG6) << "- isSecondary = " << simTrkHit->isProducedBySecondary() << ", isOverlay = " << simTrkHit->isOverlay() << std::endl;
+    streamlog_out (DEBUG6) << "- Quality = " << simTrkHit->getQuality() << std::endl;
+    ProduceIonisationPoints( ctx, simTrkHit );       
+    if (ctx.layer == -1)
+      return;
+    ProduceSignalPoints( ctx );
+    ProduceHits(ctx, *simTrkHit);
+    ProcessPixels(ctx);
+    
+    //**************************************************************************
+    // Create reconstructed cluster object (TrackerHitImpl)
+    //**************************************************************************
+    TrackerHitPlaneImpl *recoHit = ReconstructTrackerHit(ctx);
+    if (recoHit == nullptr)
+    {
+        streamlog_out(DEBUG) << "Skip hit" << std::endl;
+        return;
+    }       
+    // hit's layer/ladder/petal position does not change
+    const int cellid0 = simTrkHit->getCellID0();
+    const int cellid1 = simTrkHit->getCellID1();
+    recoHit->setCellID0( cellid0 );
+    recoHit->setCellID1( cellid1 );
+    
+    double localPos[3];
+    double localIdx[3];
+    double localDir[3];
+    FindLocalPosition(ctx, simTrkHit, localPos, localDir);
+    localIdx[0] = localPos[0] / _pixelSizeX;
+    localIdx[1] = localPos[1] / _pixelSizeY;
+    float incidentPhi = std::atan(localDir[0] / localDir[2]);
+    float incidentTheta = std::atan(localDir[1] / localDir[2]);
+
+    // Debug messages to check if reconstruction went correctly
+    // true global
+    streamlog_out (DEBUG9) << "- TRUE GLOBAL position (mm) x,y,z,t = " << simTrkHit->getPosition()[0] << ", " << simTrkHit->getPosition()[1] << ", " << simTrkHit->getPosition()[2] << ", " << simTrkHit->getTime() << std::endl;
+    // true local (compare two verions)
+    streamlog_out (DEBUG9) << "- TRUE LOCAL position (localPos) (mm) x,y,z,t = " << localPos[0] << ", " << localPos[1] << ", " << localPos[2] << std::endl;
+    // reco local 
+    streamlog_out (DEBUG9) << "- RECO LOCAL position (mm) x,y,z,t = " << recoHit->getPosition()[0] << ", " << recoHit->getPosition()[1] << ", " << recoHit->getPosition()[2] << std::endl;
+    
+    double xLab[3];
+    TransformToLab( cellid0, recoHit->getPosition(), xLab);
+    recoHit->setPosition( xLab );
+
+    // reco global
+    streamlog_out (DEBUG9) << "- RECO GLOBAL position (mm) x,y,z,t = " << recoHit->getPosition()[0] << ", " << recoHit->getPosition()[1] << ", " << recoHit->getPosition()[2] << std::endl;
+    
+    //TODO HACK: Store incidence angle of particle instead!
+    const CachedSurface* c_surf = _surfCache.Find( cellid0 ) ;
+    recoHit->setU( c_surf->u_direction ) ;
+    recoHit->setV( c_surf->v_direction ) ;
+    
+    streamlog_out (DEBUG7) << "Reconstructed pixel cluster:" << std::endl;
+    streamlog_out (DEBUG7) << "- local position (x,y) = " << localPos[0] << "(Idx: " << localIdx[0] << "), " << localPos[1] << "(Idy: " << localIdx[1] << ")" << std::endl;
+    streamlog_out( DEBUG5 ) << "(reco local) - (true local) (x,y,z): " << localPos[0] - ctx.localPosition[0] << ", " << localPos[1] - ctx.localPosition[1] << ", " << localPos[2] - ctx.localPosition[2] << std::endl;
+    streamlog_out (DEBUG7) << "- global position (x,y,z, t) = " << recoHit->getPosition()[0] << ", " << recoHit->getPosition()[1] << ", " << recoHit->getPosition()[2] << ", " << recoHit->getTime() << std::endl;
+    streamlog_out (DEBUG7) << "- (reco global (x,y,z,t)) - (true global) = " << recoHit->getPosition()[0] - simTrkHit->getPosition()[0]<< ", " << recoHit->getPosition()[1] - simTrkHit->getPosition()[1] << ", " << recoHit->getPosition()[2] - simTrkHit->getPosition()[2]<< ", " << recoHit->getTime() - simTrkHit->getTime()<< std::endl;
+    streamlog_out (DEBUG7) << "- charge = " << recoHit->getEDep() << "(True: " << simTrkHit->getEDep() << ")"  << std::endl;
+    streamlog_out (DEBUG7) << "- incidence angles: theta = " << incidentTheta << ", phi = " << incidentPhi << std::endl;
+    if (_produceFullPattern != 0)
+    {
+      // Store all the fired points
+      const PixelBuffer &pixels = ctx.pixels;
+      for (int iS = 0; iS < pixels.size(); ++iS)
+      {
+        float charge = pixels.charge[iS];
+        //store hits that are above threshold. In case of _ChargeDiscretization, just check for a small non-zero value                
+        if ( ((_DigitizeCharge > 0) and (charge >1.0)) or
+            (charge > _threshold) )
+        {
+           SimTrackerHitImpl *newsth = new SimTrackerHitImpl();
+           // hit's layer/ladder position is the same for all fired points 
+           newsth->setCellID0( cellid0 );
+           newsth->setCellID1( cellid1 );
+           //Store local position in units of pixels instead
+           double pixelPos[3];
+           pixelPos[0] = pixels.x[iS] / _pixelSizeX;
+           pixelPos[1] = pixels.y[iS] / _pixelSizeY;
+           newsth->setPosition(pixelPos);
+           newsth->setEDep(charge); // in unit of electrons
+           newsth->setTime(pixels.time[iS]);
+           newsth->setPathLength(simTrkHit->getPathLength());
+           newsth->setMCParticle(simTrkHit->getMCParticle());
+           newsth->setMomentum(simTrkHit->getMomentum());
+           newsth->setProducedBySecondary(simTrkHit->isProducedBySecondary());
+           newsth->setOverlay(simTrkHit->isOverlay());
+           output.firedPixels.push_back(newsth);
+           recoHit->rawHits().push_back(newsth);
+        }
+      }
+    }
+    streamlog_out (DEBUG7) << "- number of pixels: " << recoHit->getRawHits().size() << std::endl;
+    streamlog_out (DEBUG7) << "- MC particle p=" << std::sqrt(simTrkHit->getMomentum()[0]*simTrkHit->getMomentum()[0]+simTrkHit->getMomentum()[1]*simTrkHit->getMomentum()[1]+simTrkHit->getMomentum()[2]*simTrkHit->getMomentum()[2]) << std::endl;
+    streamlog_out (DEBUG7) << "- isSecondary = " << simTrkHit->isProducedBySecondary() << ", isOverlay = " << simTrkHit->isOverlay() << std::endl;
+    streamlog_out (DEBUG6) << "- List of constituents (pixels/strips):" << std::endl;
+    for (size_t iH = 0; iH < recoHit->rawHits().size(); ++iH) {
+        SimTrackerHit *hit = dynamic_cast<SimTrackerHit*>(recoHit->rawHits().at(iH));
+        streamlog_out (DEBUG6) << "  - " << iH << ": Edep (e-) = " << hit->getEDep() << ", t (ns) =" << hit->getTime() << std::endl;
+    }
+    streamlog_out (DEBUG7) << "--------------------------------" << std::endl;
+    output.recoHit = recoHit;
+}
 void MuonCVXDDigitiser::check(LCEvent *evt)
 {}
 void MuonCVXDDigitiser::end()
 {
     streamlog_out(DEBUG) << "   end called  " << std::endl;
-    delete _fluctuate;
+    _hitContexts.clear();
 }
 /** Function calculates local coordinates of the sim hit 
  * in the given ladder and local momentum of particle. 
@@ -591,15 +680,21 @@ void MuonCVXDDigitiser::end()
  *    - z axis is perpendicular to the ladder plane <br>
  * 
  */
-void MuonCVXDDigitiser::FindLocalPosition(SimTrackerHit *hit, 
+void MuonCVXDDigitiser::FindLocalPosition(HitContext &ctx,
+                                          SimTrackerHit *hit, 
                                           double *localPosition,
                                           double *localDirection)
 {
     // Use SurfaceManager to calculate local coordinates
     const int cellID0 = hit->getCellID0() ;
     streamlog_out( DEBUG3 ) << "Cell ID of Sim Hit: " << cellID0 << std::endl;
-    SurfaceMap::const_iterator sI = _map->find( cellID0 ) ;
-    const dd4hep::rec::ISurface* surf = sI->second ;
+    const CachedSurface* c_surf = _surfCache.Find( cellID0 ) ;
+    if ( c_surf == nullptr ) {
+        streamlog_out( DEBUG3 ) << "  no surface for cellID " << cellID0 << std::endl;
+      ctx.layer = -1;
+      return;
+    }
+    const dd4hep::rec::ISurface* surf = c_surf->surface ;
     Vector3D oldPos( hit->getPosition()[0], hit->getPosition()[1], hit->getPosition()[2] );
     // We need it?
     if ( ! surf->insideBounds( dd4hep::mm * oldPos ) ) {
@@ -608,18 +703,17 @@ void MuonCVXDDigitiser::FindLocalPosition(SimTrackerHit *hit,
                                 << *surf
                                 << " distance: " << surf->distance(  dd4hep::mm * oldPos )
                                 << std::endl;
-      _currentLayer = -1;
+      ctx.layer = -1;
       return;
     }    
     
     
-    Vector2D lv = surf->globalToLocal( dd4hep::mm * oldPos  ) ;
+    Vector2D lv = c_surf->GlobalToLocal( dd4hep::mm * oldPos  ) ;
     // Store local position in mm
     localPosition[0] = lv[0] / dd4hep::mm ;
     localPosition[1] = lv[1] / dd4hep::mm ;
     // Add also z ccordinate
-    Vector3D origin( surf->origin()[0], surf->origin()[1], surf->origin()[2]);
-    localPosition[2] = ( dd4hep::mm * oldPos - dd4hep::cm * origin ).dot( surf->normal() ) / dd4hep::mm;
+    localPosition[2] = ( dd4hep::mm * oldPos - dd4hep::cm * c_surf->origin ).dot( c_surf->normal ) / dd4hep::mm;
     double Momentum[3];
     EVENT::MCParticle *mcp = hit->getMCParticle();
     for (int j = 0; j < 3; ++j) {
@@ -630,20 +724,20 @@ void MuonCVXDDigitiser::FindLocalPosition(SimTrackerHit *hit,
       }
     }
     // as default put electron's mass
-    _currentParticleMass = 0.510e-3 * dd4hep::GeV;
+    ctx.particleMass = 0.510e-3 * dd4hep::GeV;
     if (hit->getMCParticle())
-        _currentParticleMass = std::max(hit->getMCParticle()->getMass() * dd4hep::GeV, _currentParticleMass);
-    _currentParticleMomentum = sqrt(pow(Momentum[0], 2) + pow(Momentum[1], 2) 
+        ctx.particleMass = std::max(hit->getMCParticle()->getMass() * dd4hep::GeV, ctx.particleMass);
+    ctx.particleMomentum = sqrt(pow(Momentum[0], 2) + pow(Momentum[1], 2) 
                                     + pow(Momentum[2], 2));                   
                          
-    localDirection[0] = Momentum * surf->u();
-    localDirection[1] = Momentum * surf->v();
-    localDirection[2] = Momentum * surf->normal();
+    localDirection[0] = Momentum * c_surf->u;
+    localDirection[1] = Momentum * c_surf->v;
+    localDirection[2] = Momentum * c_surf->normal;
     if (isBarrel){
-    _currentPhi = _currentLadder * 2.0 * _layerHalfPhi[_currentLayer] + _layerPhiOffset[_currentLayer];
+    ctx.phi = ctx.ladder * 2.0 * _layerHalfPhi[ctx.layer] + _layerPhiOffset[ctx.layer];
     }
 }
-void MuonCVXDDigitiser::ProduceIonisationPoints(SimTrackerHit *hit)
+void MuonCVXDDigitiser::ProduceIonisationPoints(HitContext &ctx, SimTrackerHit *hit)
 {
     streamlog_out( DEBUG6 ) << "Creating Ionization Points" << std::endl;
     double pos[3] = {0,0,0};
@@ -651,92 +745,96 @@ void MuonCVXDDigitiser::ProduceIonisationPoints(SimTrackerHit *hit)
     double entry[3];
     double exit[3];
     // hit and pos are in mm
-    FindLocalPosition(hit, pos, dir);
-    if ( _currentLayer == -1)
+    FindLocalPosition(ctx, hit, pos, dir);
+    if ( ctx.layer == -1)
       return;
  
-    entry[2] = -_layerHalfThickness[_currentLayer]; 
-    exit[2] = _layerHalfThickness[_currentLayer];
+    entry[2] = -_layerHalfThickness[ctx.layer]; 
+    exit[2] = _layerHalfThickness[ctx.layer];
     // entry points: hit position is in middle of layer. ex: entry_x = x - (z distance to bottom of layer) * px/pz
     for (int i = 0; i < 2; ++i) {
         entry[i] = pos[i] + dir[i] * (entry[2] - pos[2]) / dir[2];
         exit[i]= pos[i] + dir[i] * (exit[2] - pos[2]) / dir[2];
     }
     for (int i = 0; i < 3; ++i) {
-        _currentLocalPosition[i] = pos[i];
-        _currentEntryPoint[i] = entry[i];
-        _currentExitPoint[i] = exit[i];
+        ctx.localPosition[i] = pos[i];
+        ctx.entryPoint[i] = entry[i];
+        ctx.exitPoint[i] = exit[i];
     }
-    streamlog_out( DEBUG5 ) << "local position: " << _currentLocalPosition[0] << ", " << _currentLocalPosition[1] << ", " << _currentLocalPosition[2] << std::endl;
+    streamlog_out( DEBUG5 ) << "local position: " << ctx.localPosition[0] << ", " << ctx.localPosition[1] << ", " << ctx.localPosition[2] << std::endl;
     double tanx = dir[0] / dir[2];
     double tany = dir[1] / dir[2];  
     
     // trackLength is in mm -> limit length at 1cm
     double trackLength = std::min(_maxTrkLen,
-         _layerThickness[_currentLayer] * sqrt(1.0 + pow(tanx, 2) + pow(tany, 2)));
+         _layerThickness[ctx.layer] * sqrt(1.0 + pow(tanx, 2) + pow(tany, 2)));
   
-    _numberOfSegments = ceil(trackLength / _segmentLength );
-    double dEmean = (dd4hep::keV * _energyLoss * trackLength) / ((double)_numberOfSegments);
-    _ionisationPoints.resize(_numberOfSegments);
-    streamlog_out( DEBUG6 ) <<  "Track path length: " << trackLength << ", calculated dEmean * N_segment = " << dEmean << " * " << _numberOfSegments << " = " << dEmean*_numberOfSegments << std::endl;
-    _eSum = 0.0;
+    ctx.numberOfSegments = ceil(trackLength / _segmentLength );
+    double dEmean = (dd4hep::keV * _energyLoss * trackLength) / ((double)ctx.numberOfSegments);
+    ctx.ionisationPoints.resize(ctx.numberOfSegments);
+    streamlog_out( DEBUG6 ) <<  "Track path length: " << trackLength << ", calculated dEmean * N_segment = " << dEmean << " * " << ctx.numberOfSegments << " = " << dEmean*ctx.numberOfSegments << std::endl;
+    ctx.eSum = 0.0;
     // TODO _segmentLength may be different from segmentLength, is it ok?
-    double segmentLength = trackLength / ((double)_numberOfSegments);
-    _segmentDepth = _layerThickness[_currentLayer] / ((double)_numberOfSegments);
-    double z = -_layerHalfThickness[_currentLayer] - 0.5 * _segmentDepth;
+    double segmentLength = trackLength / ((double)ctx.numberOfSegments);
+    ctx.segmentDepth = _layerThickness[ctx.layer] / ((double)ctx.numberOfSegments);
+    double z = -_layerHalfThickness[ctx.layer] - 0.5 * ctx.segmentDepth;
     
     double hcharge = ( hit->getEDep() / dd4hep::GeV ); 	
-    streamlog_out (DEBUG5) << "Number of ionization points: " << _numberOfSegments << ", G4 EDep = "  << hcharge << std::endl;
-    for (int i = 0; i < _numberOfSegments; ++i)
+    streamlog_out (DEBUG5) << "Number of ionization points: " << ctx.numberOfSegments << ", G4 EDep = "  << hcharge << std::endl;
+    // momentum in MeV/c, mass in MeV, tmax (delta cut) in MeV, 
+    // length in mm, meanLoss eloss in MeV.
+    ctx.elossBuffer.resize(ctx.numberOfSegments);
+    ctx.fluctuate.SampleFluctuations(double(ctx.particleMomentum * dd4hep::keV / dd4hep::MeV),
+                                     double(ctx.particleMass * dd4hep::keV / dd4hep::MeV),
+                                     ctx.cutOnDeltaRays,
+                                     segmentLength,
+                                     double(dEmean / dd4hep::MeV),
+                                     ctx.numberOfSegments,
+                                     ctx.elossBuffer.data());
+    for (int i = 0; i < ctx.numberOfSegments; ++i)
     {
-        z += _segmentDepth;
+        z += ctx.segmentDepth;
         double x = pos[0] + tanx * (z - pos[2]);
         double y = pos[1] + tany * (z - pos[2]);
-        // momentum in MeV/c, mass in MeV, tmax (delta cut) in MeV, 
-        // length in mm, meanLoss eloss in MeV.
-        double de = _fluctuate->SampleFluctuations(double(_currentParticleMomentum * dd4hep::keV / dd4hep::MeV),
-                                                   double(_currentParticleMass * dd4hep::keV / dd4hep::MeV),
-                                                   _cutOnDeltaRays,
-                                                   segmentLength,
-                                                   double(dEmean / dd4hep::MeV)) * dd4hep::MeV;
-        _eSum = _eSum + de;
+        double de = ctx.elossBuffer[i] * dd4hep::MeV;
+        ctx.eSum = ctx.eSum + de;
         IonisationPoint ipoint;
         ipoint.eloss = de;
         ipoint.x = x;
         ipoint.y = y;
         ipoint.z = z;
-        _ionisationPoints[i] = ipoint;
-        streamlog_out (DEBUG2) << " " << i << ": z=" << z << ", eloss = " << de << "(total so far: " << _eSum << "), x=" << x << ", y=" << y << std::endl;
+        ctx.ionisationPoints[i] = ipoint;
+        streamlog_out (DEBUG2) << " " << i << ": z=" << z << ", eloss = " << de << "(total so far: " << ctx.eSum << "), x=" << x << ", y=" << y << std::endl;
     }
    
     const double thr = _deltaEne/_electronsPerKeV * dd4hep::keV;
-    while ( hcharge > _eSum + thr ) {
+    while ( hcharge > ctx.eSum + thr ) {
       // Add additional charge sampled from an 1 / n^2 distribution.
       // Adjust charge to match expectations
-      const double       q = randomTail( thr, hcharge - _eSum );
-      const unsigned int h = floor(RandFlat::shoot(0.0, (double)_numberOfSegments ));
-      _ionisationPoints[h].eloss += q;
-      _eSum += q;
+      const double       q = randomTail( ctx.engine, thr, hcharge - ctx.eSum );
+      const unsigned int h = floor(RandFlat::shoot(ctx.engine, 0.0, (double)ctx.numberOfSegments ));
+      ctx.ionisationPoints[h].eloss += q;
+      ctx.eSum += q;
     }
-    streamlog_out (DEBUG5) << "Padding each segment charge (1/n^2 pdf) until total below " << _deltaEne << "e- threshold. New total energy: " << _eSum << std::endl;
+    streamlog_out (DEBUG5) << "Padding each segment charge (1/n^2 pdf) until total below " << _deltaEne << "e- threshold. New total energy: " << ctx.eSum << std::endl;
     streamlog_out (DEBUG3) << "List of ionization points:" << std::endl;
-    for (int i =0; i < _numberOfSegments; ++i) {
-        streamlog_out (DEBUG3) << "- " << i << ": E=" << _ionisationPoints[i].eloss 
-            << ", x=" << _ionisationPoints[i].x << ", y=" << _ionisationPoints[i].y << ", z=" << _ionisationPoints[i].z << std::endl;
+    for (int i =0; i < ctx.numberOfSegments; ++i) {
+        streamlog_out (DEBUG3) << "- " << i << ": E=" << ctx.ionisationPoints[i].eloss 
+            << ", x=" << ctx.ionisationPoints[i].x << ", y=" << ctx.ionisationPoints[i].y << ", z=" << ctx.ionisationPoints[i].z << std::endl;
     }
 }
-void MuonCVXDDigitiser::ProduceSignalPoints()
+void MuonCVXDDigitiser::ProduceSignalPoints(HitContext &ctx)
 {
-    _signalPoints.resize(_numberOfSegments);
+    ctx.signalPoints.resize(ctx.numberOfSegments);
     // run over ionisation points
     streamlog_out (DEBUG6) << "Creating signal points" << std::endl;
-    for (int i = 0; i < _numberOfSegments; ++i)
+    for (int i = 0; i < ctx.numberOfSegments; ++i)
     {
-        IonisationPoint ipoint = _ionisationPoints[i]; // still local coords
+        IonisationPoint ipoint = ctx.ionisationPoints[i]; // still local coords
         double z = ipoint.z;
         double x = ipoint.x;
         double y = ipoint.y;
-        double DistanceToPlane = _layerHalfThickness[_currentLayer] - z;
+        double DistanceToPlane = _layerHalfThickness[ctx.layer] - z;
         double xOnPlane = x + _tanLorentzAngleX * DistanceToPlane;
         double yOnPlane = y + _tanLorentzAngleY * DistanceToPlane;
         // For diffusion-coeffieint calculation, see e.g. https://www.slac.stanford.edu/econf/C060717/papers/L008.PDF
@@ -761,7 +859,7 @@ void MuonCVXDDigitiser::ProduceSignalPoints()
         spoint.sigmaX = SigmaX;
         spoint.sigmaY = SigmaY;
         spoint.charge = charge; // electrons x keV
-        _signalPoints[i] = spoint;
+        ctx.signalPoints[i] = spoint;
 	    streamlog_out (DEBUG3) << "- " << i << ": charge=" << charge 
             << ", x="<<xOnPlane << "(delta=" << xOnPlane - x << ")"
             << ", y="<<yOnPlane << "(delta=" << yOnPlane - y << ")"
@@ -769,14 +867,16 @@ void MuonCVXDDigitiser::ProduceSignalPoints()
             << ", sigmaX="<<SigmaX <<", sigmay="<<SigmaY << std::endl;
     }
 }
-void MuonCVXDDigitiser::ProduceHits(SimTrackerHitImplVec &simTrkVec, SimTrackerHit &simHit)
+void MuonCVXDDigitiser::ProduceHits(HitContext &ctx, SimTrackerHit &simHit)
 {  
-    simTrkVec.clear();
-    std::map<int, SimTrackerHitImpl*> hit_Dict;
+    ctx.deposits.clear();
+    ctx.pixels.clear();
     streamlog_out (DEBUG6) << "Creating hits" << std::endl;
-    for (int i=0; i<_numberOfSegments; ++i)
+    int nRows = GetPixelsInaRow(ctx.layer);
+    int nColumns = GetPixelsInaColumn(ctx.layer);
+    for (int i=0; i<ctx.numberOfSegments; ++i)
     {
-        SignalPoint spoint = _signalPoints[i];
+        SignalPoint spoint = ctx.signalPoints[i];
         double xCentre = spoint.x;
         double yCentre = spoint.y;
         double sigmaX = spoint.sigmaX;
@@ -787,240 +887,178 @@ void MuonCVXDDigitiser::ProduceHits(SimTrackerHitImplVec &simTrkVec, SimTrackerH
         double yUp = spoint.y + 3 * spoint.sigmaY;
         
         int ixLo, ixUp, iyLo, iyUp;
-        TransformXYToCellID(xLo, yLo, ixLo, iyLo);
-        TransformXYToCellID(xUp, yUp, ixUp, iyUp);
+        TransformXYToCellID(ctx.layer, xLo, yLo, ixLo, iyLo);
+        TransformXYToCellID(ctx.layer, xUp, yUp, ixUp, iyUp);
         streamlog_out (DEBUG5) << i << ": Pixel idx boundaries: ixLo=" << ixLo << ", iyLo=" << iyLo  
             <<  ", ixUp=" << ixUp << ", iyUp=" << iyUp << std::endl;
-        for (int ix = ixLo; ix< ixUp + 1; ++ix)
-        {   
-            if ( (ix < 0) or (ix >= GetPixelsInaColumn()) ) {
-                streamlog_out (DEBUG3) << "Pixels in a column: " << GetPixelsInaColumn() << std::endl;
-                streamlog_out (DEBUG3) << "Skipping pixels with ix =" << ix << std::endl;
-                continue;
-            }
+        ixLo = std::max(ixLo, 0);
+        iyLo = std::max(iyLo, 0);
+        ixUp = std::min(ixUp, nColumns - 1);
+        iyUp = std::min(iyUp, nRows - 1);
+        if (ixUp < ixLo or iyUp < iyLo) continue;
+
+        int nx = ixUp - ixLo + 1;
+        int ny = iyUp - iyLo + 1;
+        double xEdge, yEdge;
+        TransformCellIDToXY(ctx.layer, ixLo, iyLo, xEdge, yEdge);
+        ctx.chargeKernel.Deposit(xEdge - 0.5 * _pixelSizeX, _pixelSizeX, nx,
+                                 yEdge - 0.5 * _pixelSizeY, _pixelSizeY, ny,
+                                 xCentre, yCentre, sigmaX, sigmaY, spoint.charge);
+
+        for (int ix = ixLo; ix < ixUp + 1; ++ix)
+        {
             for (int iy = iyLo; iy < iyUp + 1; ++iy)
             {
-                if ( (iy < 0) or (iy >= GetPixelsInaRow()) ) {
-                    streamlog_out (DEBUG3) << "Pixels in a row: " << GetPixelsInaRow() << std::endl;
-                     streamlog_out (DEBUG3) << "Skipping pixels with iy =" << iy << std::endl;
-                    continue;
-                }
-                double xCurrent, yCurrent;
-                TransformCellIDToXY(ix, iy, xCurrent, yCurrent);
-                
-                gsl_sf_result result;
-                /*int status = */gsl_sf_erf_Q_e((xCurrent - 0.5 * _pixelSizeX - xCentre)/sigmaX, &result);
-                double LowerBound = 1 - result.val;
-                /*status = */gsl_sf_erf_Q_e((xCurrent + 0.5 * _pixelSizeX - xCentre)/sigmaX, &result);
-                double UpperBound = 1 - result.val;
-                double integralX = UpperBound - LowerBound;
-                /*status = */gsl_sf_erf_Q_e((yCurrent - 0.5 * _pixelSizeY - yCentre)/sigmaY, &result);
-                LowerBound = 1 - result.val;
-                /*status = */gsl_sf_erf_Q_e((yCurrent + 0.5 * _pixelSizeY - yCentre)/sigmaY, &result);
-                UpperBound = 1 - result.val;
-                double integralY = UpperBound - LowerBound;
-                streamlog_out (DEBUG1) << "Integral x=" << integralX << ", Integral y=" << integralY << ", signal pt charge=" << spoint.charge << std::endl;
-                float totCharge = float(spoint.charge * integralX * integralY);
-                int pixelID = GetPixelsInaRow() * ix + iy;
-              
-                auto item = hit_Dict.find(pixelID);
-                if (item == hit_Dict.end())
-                {
-                    SimTrackerHitImpl *tmp_hit = new SimTrackerHitImpl();
-                    double pos[3] = {
-                        xCurrent,
-                        yCurrent,
-                        _layerHalfThickness[_currentLayer]
-                    };
-                    tmp_hit->setPosition(pos); // still in local coordinates
-                    tmp_hit->setCellID0(pixelID);                   // workaround: cellID used for pixel index
-                    tmp_hit->setEDep(totCharge);
-                    tmp_hit->setTime(simHit.getTime()); //usual true timing as starting point
-                  
-                    hit_Dict.emplace(pixelID, tmp_hit);
-                    streamlog_out (DEBUG2) << "Created new pixel hit at idx=" << ix << ", idy=" << iy << ", charge=" << totCharge << std::endl;
-                }
-                else
-                {
-                    float edep = item->second->getEDep();
-                    edep += totCharge;
-                    item->second->setEDep(edep);
-                    //TODO: handle multiple times. For now not needed since all deposits arrive at the same true time.
-                    streamlog_out (DEBUG2) << "Updating pixel hit at idx=" << ix << ", idy=" << iy << ", total charge=" << edep << "(delta = " << totCharge << ")" << std::endl;
-                }
+                float totCharge = ctx.chargeKernel.GetCharge(ix - ixLo, iy - iyLo);
+                streamlog_out (DEBUG1) << "Pixel charge=" << totCharge << ", signal pt charge=" << spoint.charge << std::endl;
+                ctx.deposits.push_back({ nRows * ix + iy, totCharge });
             }
         }
     }
+
+    // The deposits of a pixel are summed in order of segment, the pixels are sorted by index
+    std::stable_sort(ctx.deposits.begin(), ctx.deposits.end(),
+                     [](const PixelDeposit &a, const PixelDeposit &b) { return a.pixelID < b.pixelID; });
+    PixelBuffer &pixels = ctx.pixels;
+    for (const PixelDeposit &deposit : ctx.deposits)
+    {
+        if (pixels.size() > 0 && pixels.pixelID.back() == deposit.pixelID)
+        {
+            pixels.charge.back() += deposit.charge;
+            continue;
+        }
+        double xCurrent, yCurrent;
+        TransformCellIDToXY(ctx.layer, deposit.pixelID / nRows, deposit.pixelID % nRows, xCurrent, yCurrent);
+        pixels.push_back(deposit.pixelID, xCurrent, yCurrent, deposit.charge, simHit.getTime());
+    }
+
     streamlog_out (DEBUG4) << "List of pixel hits created:" << std::endl; // still in local coords
-    int idx=0;
-    for(auto item : hit_Dict)
+    for (int i = 0; i < pixels.size(); ++i)
     {
-        simTrkVec.push_back(item.second);       
-        streamlog_out (DEBUG4) << idx++ << ": x=" << item.second->getPosition()[0] << ", y=" << item.second->getPosition()[1] << ", z=" << item.second->getPosition()[2] << ", EDep = " << item.second->getEDep() << std::endl;
+        streamlog_out (DEBUG4) << i << ": x=" << pixels.x[i] << ", y=" << pixels.y[i] << ", EDep = " << pixels.charge[i] << std::endl;
     }
 }
 /**
- * Function that fluctuates charge (in units of electrons)
- * deposited on the fired pixels according to the Poisson
- * distribution...
+ * Response of the pixels of a hit, all the steps are applied to a pixel in a single pass:
+ * - the charge (in units of electrons) fluctuates according to the Poisson distribution,
+ *   gaussian above 1000 electrons
+ * - simulation of the electronic noise
+ * - threshold: the charge is set to 0 if less than the threshold,
+ *   the threshold is smeared by a Gaussian if sigma > 0
+ * - digitization of the charge
+ * - effective resolution of the time measurement
+ * - digitization of the time
+ * TODO: Right now assuming completely uncorrelated time resolution across pixels, will need to divide into:
+ * - correlated across pixels, uncorrelated across clusters
+ * - correlated within the event, un-correlate 
  */
-void MuonCVXDDigitiser::PoissonSmearer(SimTrackerHitImplVec &simTrkVec)
+void MuonCVXDDigitiser::ProcessPixels(HitContext &ctx)
 {
-    streamlog_out (DEBUG6) << "Adding Poisson smear to charge" << std::endl;
-    for (int ihit = 0; ihit < int(simTrkVec.size()); ++ihit)
+    streamlog_out (DEBUG6) << "Applying smearing, threshold and digitization to pixels" << std::endl;
+    PixelBuffer &pixels = ctx.pixels;
+    float actualThreshold = _threshold;
+    for (int i = 0; i < pixels.size(); ++i)
     {
-        SimTrackerHitImpl *hit = simTrkVec[ihit];
-        float charge = hit->getEDep();
-        float rng;
-        if (charge > 1e+03) // assume Gaussian
+        float origCharge = pixels.charge[i];
+        float charge = origCharge;
+        if (_PoissonSmearing != 0)
         {
-            rng = float(RandGauss::shoot(charge, sqrt(charge)));
+            if (charge > 1e+03) // assume Gaussian
+            {
+                charge = float(RandGauss::shoot(ctx.engine, charge, sqrt(charge)));
+            }
+            else // assume Poisson
+            {
+                charge = float(RandPoisson::shoot(ctx.engine, charge));
+            }
         }
-        else // assume Poisson
+        if (_electronicEffects != 0)
         {
-            rng = float(RandPoisson::shoot(charge));
+            double Noise = RandGauss::shoot(ctx.engine, 0., _electronicNoise);
+            charge = charge + float(Noise);
         }
-        hit->setEDep(rng);
-        streamlog_out (DEBUG4) << ihit << ": x=" << hit->getPosition()[0] << ", y=" << hit->getPosition()[1] << ", z=" << hit->getPosition()[2] 
-            << ", charge = " << rng << "(delta = " << charge-rng << ")" << std::endl;
-    }  
-}
-/**
- * Simulation of electronic noise.
- */
-void MuonCVXDDigitiser::GainSmearer(SimTrackerHitImplVec &simTrkVec)
-{
-    streamlog_out (DEBUG6) << "Adding FE noise smear to charge" << std::endl;
-    for (int i = 0; i < (int)simTrkVec.size(); ++i)
-    {
-        double Noise = RandGauss::shoot(0., _electronicNoise);
-        SimTrackerHitImpl *hit = simTrkVec[i];
-        hit->setEDep(hit->getEDep() + float(Noise));
-        streamlog_out (DEBUG4) << i << ": x=" << hit->getPosition()[0] << ", y=" << hit->getPosition()[1] << ", z=" << hit->getPosition()[2] 
-            << ", charge = " << hit->getEDep() << "(delta = " << Noise << ")" << std::endl;
+
+        // the smeared threshold is carried from pixel to pixel
+        double smear = 0;
+        if (_thresholdSmearSigma > 0) smear = RandGauss::shoot(ctx.engine, 0., _thresholdSmearSigma);
+        actualThreshold = actualThreshold + smear;
+        if (charge <= actualThreshold) charge = 0.0;
+
+        if (_DigitizeCharge != 0) charge = DigitizeCharge(charge);
+
+        float origTime = pixels.time[i];
+        float time = origTime;
+        if (_timeSmearingSigma > 0)
+        {
+            float delta = RandGauss::shoot(ctx.engine, 0., _timeSmearingSigma);
+            time = time + delta;
+        }
+        if (_DigitizeTime != 0) time = DigitizeTime(time);
+
+        pixels.charge[i] = charge;
+        pixels.time[i] = time;
+        streamlog_out (DEBUG4) << i << ": x=" << pixels.x[i] << ", y=" << pixels.y[i]
+            << ", charge = " << charge << ", previous charge = " << origCharge
+            << ", smeared threshold = " << actualThreshold
+            << ", time = " << time << ", previous time = " << origTime << std::endl;
     }
 }
-/**
- * Apply threshold.  
- * Sets the charge to 0 if less than the threshold
- * Smears the threshold by a Gaussian if sigma > 0
- */
-void MuonCVXDDigitiser::ApplyThreshold(SimTrackerHitImplVec &simTrkVec)
-{
-   streamlog_out (DEBUG6) << "Applying threshold" << std::endl;
-   float actualThreshold = _threshold;
-   
-   for (int i = 0; i < (int)simTrkVec.size(); ++i)
-   {
-     SimTrackerHitImpl *hit = simTrkVec[i];
-     
-     double smear = 0;
-     float origCharge = hit->getEDep();
-     if (_thresholdSmearSigma > 0) smear = RandGauss::shoot(0., _thresholdSmearSigma);
-     actualThreshold = actualThreshold + smear;
-     if (hit->getEDep() <= actualThreshold) hit->setEDep(0.0);
-     
-     streamlog_out (DEBUG4) << i << ": x=" << hit->getPosition()[0] << ", y=" << hit->getPosition()[1] << ", z=" << hit->getPosition()[2]
-			   << ", new charge = " << hit->getEDep() << ", previous charge = " << origCharge
-			   << " smeared threshold = " << actualThreshold << "(delta = " << smear << ")" << std::endl;
-   }
-}
 /**
  * Digitizes the charge.
  * Discretization based on number of bits and bin width scheme.
  */
-void MuonCVXDDigitiser::ChargeDigitizer(SimTrackerHitImplVec &simTrkVec)
+float MuonCVXDDigitiser::DigitizeCharge(float origCharge) const
 {
-  streamlog_out (DEBUG6) << "Charge discretization" << std::endl;
-  
   float minThreshold = _threshold;
   float maxThreshold = _chargeMax;
   //int split = 0.3; -- future use
-  int numBins = pow(2, _ChargeDigitizeNumBits)-1;
-  double discCharge=-999; 
-  for (int i = 0; i < (int)simTrkVec.size(); ++i) {
-    SimTrackerHitImpl *hit = simTrkVec[i];
-    float origCharge =	hit->getEDep();
-    discCharge = origCharge;
+  double discCharge = origCharge;
      
-    switch(_ChargeDigitizeBinning) {
-        case 0: { // uniform binning
-            if (origCharge < 1.0) break;
-    	    float binWidth = (maxThreshold-minThreshold)/(numBins);
-	        if (origCharge < binWidth) discCharge = (minThreshold+binWidth)/2;
-	        else if (origCharge > maxThreshold) discCharge = (maxThreshold-binWidth/2);
-            else discCharge = ((ceil((origCharge-binWidth)/binWidth)*binWidth)*2+binWidth)/2;
-	        break;
-        }
-        case 1: { // variable binning
-	        if (origCharge < 1.0) break;
-	        int binVal=-1;
-	        for(unsigned int idx = 0; idx < _DigitizedBins.size()-1; idx++) {
-	            if (_DigitizedBins[idx+1] > origCharge) {
-		            binVal = idx;
-		            break;
-	            }
-            }
-	        if (binVal < 0) discCharge = (_DigitizedBins[_DigitizedBins.size()-2] + _DigitizedBins[_DigitizedBins.size()-1]) / 2;
-	        else discCharge = (_DigitizedBins[binVal] + _DigitizedBins[binVal+1]) / 2;
-	        break;
-	    }
-    }
-    hit->setEDep(discCharge);
-    streamlog_out (DEBUG4) << i << ": x=" << hit->getPosition()[0] << ", y=" << hit->getPosition()[1] << ", z=" << hit->getPosition()[2]
-                        << ", new charge = " << hit->getEDep() << ", previous charge = " << origCharge
-			            << ", number of bits = " << _ChargeDigitizeNumBits
-			            << ", binning scheme = " << _ChargeDigitizeBinning << std::endl;
-    }
-}
-/**
- * Apply effective measurement resolution.
- * TODO: Right now assuming completely uncorrelated resolution across pixels, will need to divide into:
- * - correlated across pixels, uncorrelated across clusters
- * - correlated within the event, un-correlate 
-*/
-void MuonCVXDDigitiser::TimeSmearer(SimTrackerHitImplVec &simTrkVec)
-{
-    streamlog_out (DEBUG6) << "Adding resolution effect to timing measurements" << std::endl;
-    for (int i = 0; i < (int)simTrkVec.size(); ++i)
-    {
-        float delta = RandGauss::shoot(0., _timeSmearingSigma);
-        SimTrackerHitImpl *hit = simTrkVec[i];
-        hit->setTime(hit->getTime() + delta);
-        streamlog_out (DEBUG4) << i << ": x=" << hit->getPosition()[0] << ", y=" << hit->getPosition()[1] << ", z=" << hit->getPosition()[2] 
-            << ", time = " << hit->getTime() << "(delta = " << delta << ")" << std::endl;
-    }
+  switch(_ChargeDigitizeBinning) {
+      case 0: { // uniform binning
+          if (origCharge < 1.0) break;
+          float binWidth = (maxThreshold-minThreshold)/(_chargeNumBins);
+          if (origCharge < binWidth) discCharge = (minThreshold+binWidth)/2;
+          else if (origCharge > maxThreshold) discCharge = (maxThreshold-binWidth/2);
+          else discCharge = ((ceil((origCharge-binWidth)/binWidth)*binWidth)*2+binWidth)/2;
+          break;
+      }
+      case 1: { // variable binning
+          if (origCharge < 1.0) break;
+          int binVal=-1;
+          for(unsigned int idx = 0; idx < _DigitizedBins.size()-1; idx++) {
+              if (_DigitizedBins[idx+1] > origCharge) {
+                  binVal = idx;
+                  break;
+              }
+          }
+          if (binVal < 0) discCharge = (_DigitizedBins[_DigitizedBins.size()-2] + _DigitizedBins[_DigitizedBins.size()-1]) / 2;
+          else discCharge = (_DigitizedBins[binVal] + _DigitizedBins[binVal+1]) / 2;
+          break;
+      }
+  }
+  return discCharge;
 }
 /**
  * Digitizes the time information.
  * Discretization based on number of bits and bin width scheme.
  */
-void MuonCVXDDigitiser::TimeDigitizer(SimTrackerHitImplVec &simTrkVec)
+float MuonCVXDDigitiser::DigitizeTime(float origTime) const
 {
-    streamlog_out (DEBUG6) << "Time discretization" << std::endl;
-  
-    static const int numBins = pow(2, _TimeDigitizeNumBits)-1;
-    double discTime;
-    for (int i = 0; i < (int)simTrkVec.size(); ++i)
-    {
-        SimTrackerHitImpl *hit = simTrkVec[i];
-        float origTime = hit->getTime();
-        discTime = origTime;
-     
-        switch(_TimeDigitizeBinning) {
-        case 0: // uniform binning
-	        static const float binWidth = _timeMax/numBins;
-	        if (origTime < binWidth) discTime = binWidth/2;
-	        else if (origTime > _timeMax) discTime = _timeMax - binWidth/2;
-            else discTime = ((ceil((origTime-binWidth)/binWidth)*binWidth)*2+binWidth)/2;
-	        break;
-        default:
-            streamlog_out(ERROR) << "Invalid setting for pixel time digitization binning. Retaining original time." << std::endl;
-        }
-        hit->setTime(discTime);
-        streamlog_out (DEBUG4) << i << ": x=" << hit->getPosition()[0] << ", y=" << hit->getPosition()[1] << ", z=" << hit->getPosition()[2]
-                << ", new time = " << hit->getTime() << ", previous time = " << origTime << std::endl;
-    } //end loop over pixel cells
+    double discTime = origTime;
+    switch(_TimeDigitizeBinning) {
+    case 0: { // uniform binning
+        float binWidth = _timeMax/_timeNumBins;
+        if (origTime < binWidth) discTime = binWidth/2;
+        else if (origTime > _timeMax) discTime = _timeMax - binWidth/2;
+        else discTime = ((ceil((origTime-binWidth)/binWidth)*binWidth)*2+binWidth)/2;
+        break;
+    }
+    default:
+#pragma omp critical
+        streamlog_out(ERROR) << "Invalid setting for pixel time digitization binning. Retaining original time." << std::endl;
+    }
+    return discTime;
 }
 /**
  * Emulates reconstruction of Tracker Hit 
@@ -1028,8 +1066,9 @@ void MuonCVXDDigitiser::TimeDigitizer(SimTrackerHitImplVec &simTrkVec)
  * The position is corrected for Lorentz shift.
  * Time is the arithmetic average of constituents.
  */
-TrackerHitPlaneImpl *MuonCVXDDigitiser::ReconstructTrackerHit(SimTrackerHitImplVec &simTrkVec)
+TrackerHitPlaneImpl *MuonCVXDDigitiser::ReconstructTrackerHit(HitContext &ctx)
 {
+    const PixelBuffer &pixels = ctx.pixels;
     double pos[3] = {0, 0, 0};
 
     double minX = 99999999;
@@ -1049,41 +1088,39 @@ TrackerHitPlaneImpl *MuonCVXDDigitiser::ReconstructTrackerHit(SimTrackerHitImplV
 
     /* Get extreme positions, currently only implemented for barrel */
     /* Calculate the mean */
-    for (size_t iHit=0; iHit < simTrkVec.size(); ++iHit)
+    for (int iHit=0; iHit < pixels.size(); ++iHit)
     {
-        SimTrackerHit *hit = simTrkVec[iHit];
         //check for non-zero value (pixels below threshold have already been set to zero)
-	    if (hit->getEDep() < 1.0) continue;
+	    if (pixels.charge[iHit] < 1.0) continue;
 	
         size += 1;
-        time += hit->getTime();
-        charge += hit->getEDep();
-        streamlog_out (DEBUG0) << iHit << ": Averaging position, x=" << hit->getPosition()[0] << ", y=" << hit->getPosition()[1] << ", weight(EDep)=" << hit->getEDep() << std::endl;
+        time += pixels.time[iHit];
+        charge += pixels.charge[iHit];
+        streamlog_out (DEBUG0) << iHit << ": Averaging position, x=" << pixels.x[iHit] << ", y=" << pixels.y[iHit] << ", weight(EDep)=" << pixels.charge[iHit] << std::endl;
 
         // calculate min x, min y, max x, max y
-        if (hit->getPosition()[0] < minX) {
-	        minX = hit->getPosition()[0];
+        if (pixels.x[iHit] < minX) {
+	        minX = pixels.x[iHit];
 	    }
-        if (hit->getPosition()[1] < minY) {
-	        minY = hit->getPosition()[1];
+        if (pixels.y[iHit] < minY) {
+	        minY = pixels.y[iHit];
 	    }
-	    if (hit->getPosition()[0] > maxX) {
-          maxX = hit->getPosition()[0];
+	    if (pixels.x[iHit] > maxX) {
+          maxX = pixels.x[iHit];
 	    }
-        if (hit->getPosition()[1] > maxY) {
-          maxY = hit->getPosition()[1];
+        if (pixels.y[iHit] > maxY) {
+          maxY = pixels.y[iHit];
 	    }
     }
 
     // Loop over all pixel hits again, find the pixels on the 4 extreme edges
-    for (size_t iHit=0; iHit < simTrkVec.size(); ++iHit){
-        SimTrackerHit *hit = simTrkVec[iHit];
-	    if (hit->getEDep() < 1.0) continue; // ignore pixels below threshold
+    for (int iHit=0; iHit < pixels.size(); ++iHit){
+	    if (pixels.charge[iHit] < 1.0) continue; // ignore pixels below threshold
 
-        if (hit->getPosition()[0] == minX) edge_size_minx += 1;
-        if (hit->getPosition()[1] == minY) edge_size_miny += 1;
-        if (hit->getPosition()[0] == maxX) edge_size_maxx += 1;
-        if (hit->getPosition()[1] == maxY) edge_size_maxy += 1;
+        if (pixels.x[iHit] == minX) edge_size_minx += 1;
+        if (pixels.y[iHit] == minY) edge_size_miny += 1;
+        if (pixels.x[iHit] == maxX) edge_size_maxx += 1;
+        if (pixels.y[iHit] == maxY) edge_size_maxy += 1;
     }
 
     /* Calculate mean x and y by weighted ave: 
@@ -1098,12 +1135,12 @@ TrackerHitPlaneImpl *MuonCVXDDigitiser::ReconstructTrackerHit(SimTrackerHitImplV
 
     streamlog_out(DEBUG1) << "Edge sizes, minx, maxx, miny, maxy: " << edge_size_minx << ", " << edge_size_maxx << ", " << edge_size_miny << ", " << edge_size_maxy << std::endl;
 
-    streamlog_out (DEBUG1) << "Position: x = " << pos[0] << " + " << _layerHalfThickness[_currentLayer] * _tanLorentzAngleX << "(LA-correction)";
-    pos[0] -= _layerHalfThickness[_currentLayer] * _tanLorentzAngleX;
+    streamlog_out (DEBUG1) << "Position: x = " << pos[0] << " + " << _layerHalfThickness[ctx.layer] * _tanLorentzAngleX << "(LA-correction)";
+    pos[0] -= _layerHalfThickness[ctx.layer] * _tanLorentzAngleX;
     streamlog_out (DEBUG1) << " = " << pos[0];
 
-    streamlog_out (DEBUG1) << "; y = " << pos[1] << " + " << _layerHalfThickness[_currentLayer] * _tanLorentzAngleY << "(LA-correction)";
-    pos[1] -= _layerHalfThickness[_currentLayer] * _tanLorentzAngleY;
+    streamlog_out (DEBUG1) << "; y = " << pos[1] << " + " << _layerHalfThickness[ctx.layer] * _tanLorentzAngleY << "(LA-correction)";
+    pos[1] -= _layerHalfThickness[ctx.layer] * _tanLorentzAngleY;
     streamlog_out (DEBUG1) << " = " << pos[1];
 
     recoHit->setPosition(pos);
@@ -1122,10 +1159,9 @@ void MuonCVXDDigitiser::TransformToLab(const int cellID, const double *xLoc, dou
 {
     // Use SurfaceManager to calculate global coordinates
     streamlog_out( DEBUG3 ) << "Cell ID of Hit (used for transforming to lab coords)" << cellID << std::endl;
-    SurfaceMap::const_iterator sI = _map->find( cellID ) ;
-    const dd4hep::rec::ISurface* surf = sI->second ;
+    const CachedSurface* c_surf = _surfCache.Find( cellID ) ;
     Vector2D oldPos( xLoc[0] * dd4hep::mm, xLoc[1] * dd4hep::mm );
-    Vector3D lv = surf->localToGlobal( oldPos ) ;
+    Vector3D lv = c_surf->LocalToGlobal( oldPos ) ;
     // Store local position in mm
     for ( int i = 0; i < 3; i++ )
       xLab[i] = lv[i] / dd4hep::mm;
@@ -1134,9 +1170,8 @@ void MuonCVXDDigitiser::TransformToLab(const int cellID, const double *xLoc, dou
  * Function calculates position in pixel matrix based on the 
  * local coordinates of point in the ladder.
  */
-void MuonCVXDDigitiser::TransformXYToCellID(double x, double y, int & ix, int & iy)
+void MuonCVXDDigitiser::TransformXYToCellID(int layer, double x, double y, int & ix, int & iy)
 {
-    int layer = _currentLayer;
     // Shift all of L/2 so that all numbers are positive
     if (isBarrel){
         double yInLadder = y + _layerLadderLength[layer] / 2;
@@ -1156,9 +1191,8 @@ void MuonCVXDDigitiser::TransformXYToCellID(double x, double y, int & ix, int &
  Function calculates position in the local frame 
  based on the index of pixel in the ladder.
 */
-void MuonCVXDDigitiser::TransformCellIDToXY(int ix, int iy, double & x, double & y)
+void MuonCVXDDigitiser::TransformCellIDToXY(int layer, int ix, int iy, double & x, double & y)
 {
-    int layer = _currentLayer;
     // Put the point in the cell center
     if (isBarrel){
         y = ((0.5 + double(iy)) * _pixelSizeY) - _layerLadderLength[layer] / 2;
@@ -1169,22 +1203,22 @@ void MuonCVXDDigitiser::TransformCellIDToXY(int ix, int iy, double & x, double &
         x = ((0.5 + double(ix)) * _pixelSizeX) - _layerPetalOuterWidth[layer] /2;
     }
 }
-int MuonCVXDDigitiser::GetPixelsInaColumn() //SP: why columns!?! I would have guess row..
+int MuonCVXDDigitiser::GetPixelsInaColumn(int layer) //SP: why columns!?! I would have guess row..
 {
     if (isBarrel){
-        return ceil(_layerLadderWidth[_currentLayer] / _pixelSizeX);
+        return ceil(_layerLadderWidth[layer] / _pixelSizeX);
     }
     else{
-        return ceil(_layerPetalOuterWidth[_currentLayer]/ _pixelSizeX);
+        return ceil(_layerPetalOuterWidth[layer]/ _pixelSizeX);
     }
 }
-int MuonCVXDDigitiser::GetPixelsInaRow()
+int MuonCVXDDigitiser::GetPixelsInaRow(int layer)
 {
     if (isBarrel){
-        return ceil(_layerLadderLength[_currentLayer] / _pixelSizeY);
+        return ceil(_layerLadderLength[layer] / _pixelSizeY);
     }
     else {
-        return ceil(_layerPetalLength[_currentLayer] / _pixelSizeY);
+        return ceil(_layerPetalLength[layer] / _pixelSizeY);
     }
 }
 void MuonCVXDDigitiser::PrintGeometryInfo()
@@ -1193,7 +1227,6 @@ void MuonCVXDDigitiser::PrintGeometryInfo()
     streamlog_out(MESSAGE) << "Pixel size X: " << _pixelSizeX << std::endl;
     streamlog_out(MESSAGE) << "Pixel size Y: " << _pixelSizeY << std::endl;
     streamlog_out(MESSAGE) << "Electrons per KeV: " << _electronsPerKeV << std::endl;
-    streamlog_out(MESSAGE) << "Segment depth: " << _segmentDepth << std::endl;
     for (int i = 0; i < _numberOfLayers; ++i) 
     {
         streamlog_out(MESSAGE) << "Layer " << i << std::endl;
@@ -1216,9 +1249,9 @@ void MuonCVXDDigitiser::PrintGeometryInfo()
 //=============================================================================
 // Sample charge from 1 / n^2 distribution.
 //=============================================================================
-double MuonCVXDDigitiser::randomTail( const double qmin, const double qmax ) {
+double MuonCVXDDigitiser::randomTail( CLHEP::HepRandomEngine* engine, const double qmin, const double qmax ) {
   const double offset = 1. / qmax;
   const double range  = ( 1. / qmin ) - offset;
-  const double u      = offset + RandFlat::shoot() * range;
+  const double u      = offset + RandFlat::shoot(engine) * range;
   return 1. / u;
 }
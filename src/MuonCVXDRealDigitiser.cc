@@ -1,6 +1,7 @@
 #include "MuonCVXDRealDigitiser.h"
 #include <iostream>
 #include <algorithm>
+#include <chrono>
 #include <math.h>
 
 #include <EVENT/LCIO.h>
@@ -27,12 +28,18 @@
 #include "DetElemSlidingWindow.h"
 #include "TrivialSensor.h"
 #include "HKBaseSensor.h"
+#include "PhiloxRandomEngine.h"
+#include "SensorPool.h"
     
 // ----- include for verbosity dependend logging ---------
 #include "marlin/VerbosityLevels.h"
 
 #include <TFile.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 using CLHEP::RandGauss;
 using CLHEP::RandPoisson;
 using CLHEP::RandFlat;
@@ -40,12 +47,45 @@ using CLHEP::RandFlat;
 using dd4hep::Detector;
 using dd4hep::DetElement;
 using dd4hep::rec::ZPlanarData;
+using dd4hep::rec::ZDiskPetalsData;
 using dd4hep::rec::SurfaceManager;
 using dd4hep::rec::SurfaceMap;
 using dd4hep::rec::ISurface;
 using dd4hep::rec::Vector2D;
 using dd4hep::rec::Vector3D;
 
+namespace
+{
+    inline int GetThreadID()
+    {
+#ifdef _OPENMP
+        return omp_get_thread_num();
+#else
+        return 0;
+#endif
+    }
+
+    inline int GetMaxThreads()
+    {
+#ifdef _OPENMP
+        return omp_get_max_threads();
+#else
+        return 1;
+#endif
+    }
+
+    const double MBYTE = 1024. * 1024.;
+
+    // Sum of the relations of a reco-hit with the sim-hits of a MC particle
+    struct ParticleRelation
+    {
+        const EVENT::MCParticle* particle;
+        SimTrackerHit* best_hit;
+        float best_charge;
+        float charge;
+    };
+}
+
 MuonCVXDRealDigitiser aMuonCVXDRealDigitiser ;
 
 MuonCVXDRealDigitiser::MuonCVXDRealDigitiser() :
@@ -54,6 +94,17 @@ MuonCVXDRealDigitiser::MuonCVXDRealDigitiser() :
     _nEvt(0),
     _totEntries(0),
     _barrelID(0),
+    _isEndcap(false),
+    _disksPerSide(0),
+    _bibCaches(),
+    _bibParamKey(0),
+    _preFilter(),
+    _filterTotals(),
+    _shapeFilter(),
+    _shapeTotals(),
+    _statFile(),
+    _profiler(),
+    _noiseGen(),
     create_stats(false),
     signal_dHisto(nullptr),
     bib_dHisto(nullptr),
@@ -66,7 +117,8 @@ MuonCVXDRealDigitiser::MuonCVXDRealDigitiser() :
     bib_xSizeHisto(nullptr),
     bib_ySizeHisto(nullptr),
     bib_zSizeHisto(nullptr),
-    bib_eDepHisto(nullptr)
+    bib_eDepHisto(nullptr),
+    _threadStats()
 {
     _description = "MuonCVXDRealDigitiser should create VTX TrackerHits from SimTrackerHits";
 
@@ -160,6 +212,17 @@ MuonCVXDRealDigitiser::MuonCVXDRealDigitiser() :
                                _electronicNoise,
                                100.);
 
+    registerProcessorParameter("NoiseInjection",
+                               "Inject the pixels fired by the electronic noise, sampled from the gaussian tail over threshold",
+                               _noiseInjection,
+                               int(0));
+
+    registerProcessorParameter("OutputMode",
+                               "Sum of the options of the truth output (0 : full, 1 : signal relations only, "
+                               "2 : one relation per MC particle, 4 : no raw hits)",
+                               _outputMode,
+                               int(0));
+
     registerProcessorParameter("StoreFiredPixels",
                                "Store fired pixels",
                                _produceFullPattern,
@@ -194,6 +257,147 @@ MuonCVXDRealDigitiser::MuonCVXDRealDigitiser() :
                                "Sensor model to be used (0 : ChipRD53A, 1 : Trivial)",
                                sensor_type,
                                int(1));
+
+    registerProcessorParameter("ParallelIndexBuild",
+                               "Distribute the construction of the hit index among the threads",
+                               _parallelIndexBuild,
+                               int(1));
+
+    registerProcessorParameter("DeterministicRandom",
+                               "Use an independent random stream for each ladder (reproducible with any number of threads)",
+                               _deterministicRandom,
+                               int(0));
+
+    registerProcessorParameter("RandomSeed",
+                               "Seed for the random streams of the ladders",
+                               _randomSeed,
+                               int(12345));
+
+    registerProcessorParameter("SchedulingMode",
+                               "Ladder scheduling (0 : one parallel loop per layer, 1 : single pool of work items sorted by cost)",
+                               _schedulingMode,
+                               int(1));
+
+    registerProcessorParameter("MemoryBudget",
+                               "Maximum estimated memory of the work items in flight (in MB, 0 for no limit, SchedulingMode 1 only)",
+                               _memoryBudget,
+                               (float)0.0);
+
+    registerProcessorParameter("ClockStepCost",
+                               "Estimated cost of a clock step with respect to a simulated hit, for the work item ordering",
+                               _clockStepCost,
+                               (float)1.0);
+
+    registerProcessorParameter("ErfMode",
+                               "Evaluation of the gaussian CDF for the pixel charge (0 : GSL, 1 : tabulated)",
+                               _erfMode,
+                               int(0));
+
+    registerProcessorParameter("SensorPooling",
+                               "Reuse the last sensor of each thread for the following ladders of the same layer",
+                               _sensorPooling,
+                               int(0));
+
+    registerProcessorParameter("SparseClustering",
+                               "Cluster only the fired pixels of a sensor instead of scanning the full grid",
+                               _sparseClustering,
+                               int(1));
+
+    registerProcessorParameter("IncrementalClustering",
+                               "Merge the pixels switched on in a clock step into the pending clusters of the previous steps",
+                               _incrementalClustering,
+                               int(0));
+
+    registerProcessorParameter("SegmentTasks",
+                               "Split the hot ladders into one task for each sensor segment",
+                               _segmentTasks,
+                               int(0));
+
+    registerProcessorParameter("SegmentTaskMinHits",
+                               "Minimum number of simulated hits of a ladder for the segment tasks",
+                               _segmentTaskMinHits,
+                               int(1000));
+
+    registerProcessorParameter("OffloadMinPoints",
+                               "Minimum number of signal points of a clock step offloaded to the device (builds with OFFLOAD_ENABLED only)",
+                               _offloadMinPoints,
+                               int(256));
+
+    registerProcessorParameter("IdleClockSkip",
+                               "Jump over the clock steps without signals and without changes of the sensor",
+                               _idleClockSkip,
+                               int(1));
+
+    registerProcessorParameter("BIBCache",
+                               "Digitise the overlay hits of a background sample once and reuse the pixel charges",
+                               _bibCache,
+                               int(0));
+
+    registerProcessorParameter("BIBCacheDirectory",
+                               "Directory for the files of the background cache (empty for memory only)",
+                               _bibCacheDir,
+                               std::string(""));
+
+    registerProcessorParameter("BIBCacheSize",
+                               "Maximum number of background samples kept in memory",
+                               _bibCacheSize,
+                               int(4));
+
+    registerProcessorParameter("HitPreFilter",
+                               "Drop the simulated hits that cannot produce a signal before indexing them",
+                               _hitPreFilter,
+                               int(0));
+
+    registerProcessorParameter("FilterMinTime",
+                               "Lower edge of the time window of the pre-filter (in ns)",
+                               _filterMinTime,
+                               (float)-1000.0);
+
+    registerProcessorParameter("FilterMaxTime",
+                               "Upper edge of the time window of the pre-filter (in ns)",
+                               _filterMaxTime,
+                               (float)1000.0);
+
+    registerProcessorParameter("FilterMinEDep",
+                               "Minimum deposited energy of the pre-filter (in keV)",
+                               _filterMinEDep,
+                               (float)0.0);
+
+    registerProcessorParameter("FilterMaskedLayers",
+                               "Layers dropped by the pre-filter",
+                               _filterMaskedLayers,
+                               std::vector<int>());
+
+    registerProcessorParameter("FilterMaskedLadders",
+                               "Pairs of layer and ladder dropped by the pre-filter",
+                               _filterMaskedLadders,
+                               std::vector<int>());
+
+    registerProcessorParameter("ShapeFilter",
+                               "Test the cluster size against a particle from the IP (0 : off, 1 : flag with quality bit 1, 2 : drop)",
+                               _shapeFilterMode,
+                               int(0));
+
+    registerProcessorParameter("ShapeToleranceX",
+                               "Accepted difference between measured and expected cluster size along u (in pixels)",
+                               _shapeToleranceX,
+                               (float)2.0);
+
+    registerProcessorParameter("ShapeToleranceY",
+                               "Accepted difference between measured and expected cluster size along v (in pixels)",
+                               _shapeToleranceY,
+                               (float)2.0);
+
+    registerProcessorParameter("Profiling",
+                               "Measure the wall time of the stages and the counters of each ladder",
+                               _profiling,
+                               int(0));
+
+    registerProcessorParameter("ProfileTraceFile",
+                               "Chrome trace file (JSON) of the profiled ladders (empty for no trace)",
+                               _profileTrace,
+                               std::string(""));
+
     registerProcessorParameter("StatisticsFilename",
                                "File name for statistics (None for disabling the feature)",
                                stat_filename,
@@ -213,6 +417,41 @@ void MuonCVXDRealDigitiser::init()
 
     create_stats = stat_filename.compare(std::string { "None" }) != 0;
 
+    // The cached charges depend on all the parameters of the digitisation before the threshold
+    const double bib_params[] = {
+        _tanLorentzAngleX, _tanLorentzAngleY, _cutOnDeltaRays, _diffusionCoefficient,
+        _pixelSizeX, _pixelSizeY, _electronsPerKeV, _segmentLength, _energyLoss,
+        _deltaEne, _maxTrkLen, double(_window_size), double(_erfMode)
+    };
+    _bibParamKey = BIBPixelCache::Hash(BIBPixelCache::HASH_SEED, bib_params, sizeof(bib_params));
+
+    if (_shapeFilterMode != int(ShapeFilterMode::off))
+    {
+        _shapeFilter.reset(new ClusterShapeFilter(_pixelSizeX, _pixelSizeY, _tanLorentzAngleX, _tanLorentzAngleY,
+                                                  _shapeToleranceX, _shapeToleranceY));
+    }
+
+    if (_noiseInjection != 0)
+    {
+        _noiseGen = PixelNoiseGenerator(_electronicNoise, _threshold);
+        streamlog_out(MESSAGE) << "Noise probability per pixel and clock step: " << _noiseGen.GetProbability() << std::endl;
+    }
+
+    if (_hitPreFilter != 0)
+    {
+        _preFilter.reset(new HitPreFilter(_filterMinTime, _filterMaxTime,
+                                          _filterMinEDep * dd4hep::keV / dd4hep::GeV,
+                                          _filterMaskedLayers, _filterMaskedLadders));
+
+        // The dropped overlay hits are not part of the cached charges
+        const float f_params[] = { _filterMinTime, _filterMaxTime, _filterMinEDep };
+        _bibParamKey = BIBPixelCache::Hash(_bibParamKey, f_params, sizeof(f_params));
+        _bibParamKey = BIBPixelCache::Hash(_bibParamKey, _filterMaskedLayers.data(),
+                                           _filterMaskedLayers.size() * sizeof(int));
+        _bibParamKey = BIBPixelCache::Hash(_bibParamKey, _filterMaskedLadders.data(),
+                                           _filterMaskedLadders.size() * sizeof(int));
+    }
+
     if (create_stats)
     {
         double max_histox = std::max(_pixelSizeX, _pixelSizeY) * 10;
@@ -228,6 +467,26 @@ void MuonCVXDRealDigitiser::init()
         bib_ySizeHisto = new TH1F("BIBClusterSizeinY", "BIB Cluster Size in y", 1000, 0., 20);
         bib_zSizeHisto = new TH1F("BIBClusterSizeinZ", "BIB Cluster Size in z", 1000, 0., 20);
         bib_eDepHisto = new TH1F("BIBClusterSizeinZ", "BIB Cluster Energy (MeV)", 1000, 0., 10e-1);
+
+        _threadStats.clear();
+        ResizeThreadStats(GetMaxThreads());
+    }
+
+    if (_profiling != 0)
+    {
+        if (create_stats)
+        {
+            // The profile trees are flushed to the statistics file while the job runs
+            TDirectory::TContext d_context {};
+            _statFile.reset(new TFile(stat_filename.c_str(), "recreate"));
+        }
+        else
+        {
+            streamlog_out(WARNING) << "Profiling without StatisticsFilename: the profile trees are not stored"
+                                   << (_profileTrace.empty() ? ", no output at all" : ", only the trace is written")
+                                   << std::endl;
+        }
+        _profiler.reset(new StageProfiler(_statFile.get(), _profileTrace));
     }
 }
 
@@ -237,32 +496,64 @@ void MuonCVXDRealDigitiser::processRunHeader(LCRunHeader* run)
     _nRun++ ;
 
     Detector& theDetector = Detector::getInstance();
-    DetElement vxBarrel = theDetector.detector(_subDetName);              // TODO check missing barrel
-    ZPlanarData&  zPlanarData = *vxBarrel.extension<ZPlanarData>();       // TODO check missing extension
-    std::vector<ZPlanarData::LayerLayout> vx_layers = zPlanarData.layers;
-    _numberOfLayers  = vx_layers.size();
+    DetElement vxDetector = theDetector.detector(_subDetName);              // TODO check missing detector
+
+    // The endcaps are identified by name, as in MuonCVXDDigitiser
+    _isEndcap = _subDetName.find("Endcap") != std::string::npos;
 
     SurfaceManager& surfMan = *theDetector.extension<SurfaceManager>();
-    _map = surfMan.map( vxBarrel.name() ) ;
+    _map = surfMan.map( vxDetector.name() ) ;
     if( ! _map ) 
     {
       std::stringstream err  ; err << " Could not find surface map for detector: "
                                  << _subDetName << " in SurfaceManager " ;
       throw Exception( err.str() ) ;
     }
+    _surfCache.Build(_map, lcio::LCTrackerCellID::encoding_string());
+    streamlog_out(DEBUG) << "Surfaces cached: " << _surfCache.Size() << std::endl;
 
-    _barrelID = vxBarrel.id();
-    _laddersInLayer.resize(_numberOfLayers);
-    _sensorsPerLadder.resize(_numberOfLayers);
-    _layerHalfPhi.resize(_numberOfLayers);
-    _layerHalfThickness.resize(_numberOfLayers);
-    _layerThickness.resize(_numberOfLayers);
-    _layerRadius.resize(_numberOfLayers);
-    _layerLadderLength.resize(_numberOfLayers);
-    _layerLadderWidth.resize(_numberOfLayers);
-    _layerLadderHalfWidth.resize(_numberOfLayers);
-    _layerActiveSiOffset.resize(_numberOfLayers);
-    _layerPhiOffset.resize(_numberOfLayers);
+    _barrelID = vxDetector.id();
+
+    if (_isEndcap)
+    {
+        LoadEndcapGeometry(vxDetector);
+    }
+    else
+    {
+        LoadBarrelGeometry(vxDetector);
+    }
+
+    PrintGeometryInfo();
+
+    // The sensors of the previous geometry are dropped, the pools are filled on first use
+    _sensorPools.clear();
+    if (_sensorPooling != 0) _sensorPools.resize(GetMaxThreads());
+}
+
+void MuonCVXDRealDigitiser::ResizeGeometry(int n_layers)
+{
+    _numberOfLayers = n_layers;
+    _laddersInLayer.assign(_numberOfLayers, 0);
+    _sensorsPerLadder.assign(_numberOfLayers, 1);
+    _layerHalfPhi.assign(_numberOfLayers, 0.);
+    _layerHalfThickness.assign(_numberOfLayers, 0.);
+    _layerThickness.assign(_numberOfLayers, 0.);
+    _layerRadius.assign(_numberOfLayers, 0.);
+    _layerLadderLength.assign(_numberOfLayers, 0.);
+    _layerLadderWidth.assign(_numberOfLayers, 0.);
+    _layerLadderHalfWidth.assign(_numberOfLayers, 0.);
+    _layerActiveSiOffset.assign(_numberOfLayers, 0.);
+    _layerPhiOffset.assign(_numberOfLayers, 0.);
+    _layerPetalInnerWidth.assign(_numberOfLayers, 0.);
+    _layerCellID.assign(_numberOfLayers, 0);
+    _layerSide.assign(_numberOfLayers, 0);
+}
+
+void MuonCVXDRealDigitiser::LoadBarrelGeometry(DetElement& vxDetector)
+{
+    ZPlanarData&  zPlanarData = *vxDetector.extension<ZPlanarData>();       // TODO check missing extension
+    std::vector<ZPlanarData::LayerLayout> vx_layers = zPlanarData.layers;
+    ResizeGeometry(vx_layers.size());
 
     int curr_layer = 0;
     for(ZPlanarData::LayerLayout z_layout : vx_layers)
@@ -290,11 +581,138 @@ void MuonCVXDRealDigitiser::processRunHeader(LCRunHeader* run)
 
         _layerPhiOffset[curr_layer] = z_layout.phi0;
 
+        _layerCellID[curr_layer] = curr_layer;
+
         curr_layer++;
     }
+}
 
-    PrintGeometryInfo();
-} 
+void MuonCVXDRealDigitiser::LoadEndcapGeometry(DetElement& vxDetector)
+{
+    ZDiskPetalsData* zDiskPetalData = vxDetector.extension<ZDiskPetalsData>();
+    if (zDiskPetalData == nullptr)
+    {
+        std::stringstream err  ; err << " Could not find surface of type ZDiskPetalsData for subdetector: "
+                                     << _subDetName;
+        throw Exception ( err.str() );
+    }
+    std::vector<ZDiskPetalsData::LayerLayout> vx_disks = zDiskPetalData->layers;
+    _disksPerSide = vx_disks.size();
+
+    /*
+     * The disks of the positive side are followed by the ones of the negative side,
+     * the petals of a disk are scheduled as the ladders of a barrel layer
+     */
+    ResizeGeometry(2 * _disksPerSide);
+
+    for (int curr_layer = 0; curr_layer < _numberOfLayers; curr_layer++)
+    {
+        const ZDiskPetalsData::LayerLayout& z_layout = vx_disks[curr_layer % _disksPerSide];
+
+        _layerCellID[curr_layer] = curr_layer % _disksPerSide;
+        // The side in the cell ID is +1 for the disks at positive z, -1 for the others
+        _layerSide[curr_layer] = curr_layer < _disksPerSide ? 1 : -1;
+
+        _laddersInLayer[curr_layer] = z_layout.petalNumber;
+
+        _layerHalfPhi[curr_layer] = M_PI / ((double)_laddersInLayer[curr_layer]) ;
+
+        _layerThickness[curr_layer] = z_layout.thicknessSensitive * dd4hep::cm / dd4hep::mm ;
+
+        _layerHalfThickness[curr_layer] = 0.5 * _layerThickness[curr_layer];
+
+        // Inner radius of the petals
+        _layerRadius[curr_layer] = z_layout.distanceSensitive * dd4hep::cm / dd4hep::mm ;
+
+        _sensorsPerLadder[curr_layer] = std::max(z_layout.sensorsPerPetal, 1);
+
+        _layerLadderLength[curr_layer] = z_layout.lengthSensitive * dd4hep::cm / dd4hep::mm ;
+
+        // The sensor is the rectangle of the outer width, see AbstractSensor::SetPetalGeometry
+        _layerPetalInnerWidth[curr_layer] = z_layout.widthInnerSensitive * dd4hep::cm / dd4hep::mm ;
+
+        _layerLadderWidth[curr_layer] = z_layout.widthOuterSensitive * dd4hep::cm / dd4hep::mm ;
+        if (_layerLadderWidth[curr_layer] <= 0)
+        {
+            float outer_radius = _layerRadius[curr_layer] + _layerLadderLength[curr_layer];
+            _layerLadderWidth[curr_layer] = 2 * outer_radius * std::tan(_layerHalfPhi[curr_layer]);
+        }
+
+        _layerLadderHalfWidth[curr_layer] = _layerLadderWidth[curr_layer] / 2.;
+
+        _layerActiveSiOffset[curr_layer] = z_layout.zOffsetSensitive * dd4hep::cm / dd4hep::mm ;
+
+        _layerPhiOffset[curr_layer] = z_layout.phi0;
+    }
+}
+
+AbstractSensor* MuonCVXDRealDigitiser::CreateSensor(int layer, int ladder, float start_time,
+                                                    const std::string& encoder_str)
+{
+    int num_segment_x = 1;
+    int nun_segment_y = _sensorsPerLadder[layer];
+
+    AbstractSensor* sensor = nullptr;
+    if (sensor_type == 1)
+    {
+        sensor = new TrivialSensor(layer, ladder, num_segment_x, nun_segment_y,
+                                   _layerLadderLength[layer], _layerLadderWidth[layer],
+                                   _layerThickness[layer], _pixelSizeX, _pixelSizeY,
+                                   encoder_str, _barrelID, _threshold,
+                                   start_time, _window_size, true, _sparseClustering != 0);
+    }
+    else
+    {
+        sensor = new HKBaseSensor(layer, ladder, num_segment_x, nun_segment_y, 
+                                  _layerLadderLength[layer], _layerLadderWidth[layer],
+                                  _layerThickness[layer], _pixelSizeX, _pixelSizeY,
+                                  encoder_str, _barrelID, _threshold, _fe_slope,
+                                  start_time, _window_size, true, _sparseClustering != 0,
+                                  _incrementalClustering != 0);
+    }
+
+    if (_isEndcap)
+    {
+        sensor->SetPetalGeometry(_layerCellID[layer], _layerSide[layer], _layerPetalInnerWidth[layer]);
+    }
+    return sensor;
+}
+
+
+template<class SensorT>
+SlidingWindow* MuonCVXDRealDigitiser::MakeWindow(HitTemporalIndexes& t_index, SensorT& sensor, float start_time,
+                                                 CLHEP::HepRandomEngine* engine)
+{
+    return new TypedSlidingWindow<SensorT> {
+        t_index, sensor,
+        _window_size, start_time,
+        _tanLorentzAngleX, _tanLorentzAngleY,
+        _cutOnDeltaRays,
+        _diffusionCoefficient,
+        _electronsPerKeV,
+        _segmentLength,
+        _energyLoss,
+        3.0,
+        _electronicNoise,
+        _maxTrkLen,
+        _deltaEne,
+        &_surfCache,
+        engine,
+        _erfMode == 1 ? GaussCDFMode::tabulated : GaussCDFMode::exact,
+        _idleClockSkip != 0
+    };
+}
+
+SlidingWindow* MuonCVXDRealDigitiser::CreateWindow(HitTemporalIndexes& t_index, AbstractSensor& sensor,
+                                                   float start_time, CLHEP::HepRandomEngine* engine)
+{
+    // The sensors are created by CreateSensor, the type is given by sensor_type
+    if (sensor_type == 1)
+    {
+        return MakeWindow(t_index, static_cast<TrivialSensor&>(sensor), start_time, engine);
+    }
+    return MakeWindow(t_index, static_cast<HKBaseSensor&>(sensor), start_time, engine);
+}
 
 
 void MuonCVXDRealDigitiser::processEvent(LCEvent * evt)
@@ -331,280 +749,705 @@ void MuonCVXDRealDigitiser::processEvent(LCEvent * evt)
     }
 
     std::string encoder_str { STHcol->getParameters().getStringVal(lcio::LCIO::CellIDEncoding) };
-    CellIDDecoder<TrackerHitPlaneImpl> cellid_decoder { encoder_str };
 
     std::size_t RELHISTOSIZE { 10 };
     vector<std::size_t> relHisto {};
     relHisto.assign(RELHISTOSIZE, 0);
 
-    HitTemporalIndexes t_index { STHcol };
+    if (_profiler) _profiler->BeginEvent(evt->getRunNumber(), evt->getEventNumber());
+    LadderProfile* e_profile = _profiler ? &_profiler->GetEventProfile() : nullptr;
+
+    StageTimer ib_timer { e_profile, ProfileStage::index_build };
+    vector<char> h_mask {};
+    if (_preFilter)
+    {
+        HitFilterStats f_stats = _preFilter->Apply(STHcol, h_mask, _parallelIndexBuild != 0);
+        _filterTotals += f_stats;
+        streamlog_out(MESSAGE) << "Pre-filter: " << f_stats.Kept() << " of " << f_stats.n_hits
+                               << " hits kept, dropped by time = " << f_stats.time_cut
+                               << ", by energy = " << f_stats.edep_cut
+                               << ", by geometry = " << f_stats.geometry_cut << std::endl;
+    }
+
+    HitTemporalIndexes t_index { STHcol, _parallelIndexBuild != 0, _preFilter ? &h_mask : nullptr,
+                                 _isEndcap ? _disksPerSide : 0 };
+    ib_timer.Stop();
 
+    // One output buffer for each ladder, merged after the parallel region
+    vector<int> ladder_offsets(_numberOfLayers + 1, 0);
     for (int layer = 0; layer < _numberOfLayers; layer++)
     {
+        ladder_offsets[layer + 1] = ladder_offsets[layer] + _laddersInLayer[layer];
+    }
+    vector<LadderOutput> l_outputs(ladder_offsets.back());
+    for (LadderOutput& l_output : l_outputs)
+    {
+        l_output.rel_histo.assign(RELHISTOSIZE, 0);
+    }
+
+    uint64_t random_key = PhiloxRandomEngine::MakeKey(_randomSeed, evt->getRunNumber(), evt->getEventNumber());
+
+    /*
+     * The overlay hits of a known background sample are not digitised, the pixel charges
+     * are taken from the cache; for a new sample the cache is built by the ladders
+     */
+    const BIBPixelCache* bib_cache = nullptr;
+    uint64_t bib_key = 0;
+    if (_bibCache != 0)
+    {
+        bib_key = GetOverlayKey(t_index.GetSnapshot());
+        if (bib_key != 0) bib_cache = FindBIBCache(bib_key, ladder_offsets.back());
+    }
+    bool build_bib = bib_key != 0 && bib_cache == nullptr;
+    streamlog_out(DEBUG) << "Background cache: key = " << std::hex << bib_key << std::dec
+                         << ", " << (bib_cache != nullptr ? "found" : (build_bib ? "building" : "disabled"))
+                         << std::endl;
+
+    // The number of threads can be changed between events by omp_set_num_threads
+    if (create_stats) ResizeThreadStats(GetMaxThreads());
+
+    auto loop_start = std::chrono::steady_clock::now();
+
+    if (_schedulingMode == 0)
+    {
+        for (int layer = 0; layer < _numberOfLayers; layer++)
+        {
 #pragma omp parallel for
-        for (int ladder = 0; ladder < _laddersInLayer[layer]; ladder++)
+            for (int ladder = 0; ladder < _laddersInLayer[layer]; ladder++)
+            {
+                int l_index = ladder_offsets[layer] + ladder;
+                BIBLadderView l_view = bib_cache != nullptr ? bib_cache->GetLadder(l_index) : BIBLadderView {};
+                ProcessLadder(layer, ladder, t_index, encoder_str, random_key,
+                              bib_cache != nullptr ? &l_view : nullptr, build_bib,
+                              l_outputs[l_index]);
+            }
+        }
+    }
+    else
+    {
+        // Work items of all the layers in a single pool, the most expensive ones first (LPT order)
+        vector<LadderWorkItem> w_items {};
+        for (const LadderWorkItem& w_item : t_index.GetWorkItems())
+        {
+            if (w_item.layer >= _numberOfLayers || w_item.ladder >= _laddersInLayer[w_item.layer]) continue;
+            w_items.push_back(w_item);
+        }
+
+        vector<double> w_cost(w_items.size(), 0.);
+        vector<std::size_t> w_order(w_items.size(), 0);
+        for (std::size_t k = 0; k < w_items.size(); k++)
+        {
+            float n_steps = (w_items[k].max_time - w_items[k].min_time) / _window_size + 1;
+            w_cost[k] = w_items[k].n_hits + _clockStepCost * n_steps;
+            w_order[k] = k;
+        }
+        std::stable_sort(w_order.begin(), w_order.end(),
+                         [&w_cost](std::size_t a, std::size_t b) { return w_cost[a] > w_cost[b]; });
+
+        vector<double> w_timing(w_items.size(), 0.);
+        int n_items = w_items.size();
+
+        auto run_item = [&](std::size_t k)
         {
-            int num_segment_x = 1;
-            int nun_segment_y = _sensorsPerLadder[layer];
+            const LadderWorkItem& w_item = w_items[k];
+            auto item_start = std::chrono::steady_clock::now();
 
-            float m_time = t_index.GetMinTime(layer, ladder);
-            if (m_time == HitTemporalIndexes::MAXTIME)
+            int l_index = ladder_offsets[w_item.layer] + w_item.ladder;
+            BIBLadderView l_view = bib_cache != nullptr ? bib_cache->GetLadder(l_index) : BIBLadderView {};
+            ProcessLadder(w_item.layer, w_item.ladder, t_index, encoder_str, random_key,
+                          bib_cache != nullptr ? &l_view : nullptr, build_bib,
+                          l_outputs[l_index]);
+
+            std::chrono::duration<double, std::milli> item_time = std::chrono::steady_clock::now() - item_start;
+            w_timing[k] = item_time.count();
+        };
+
+        if (_memoryBudget > 0.)
+        {
+            // The large items are deferred while the estimated memory in flight exceeds the budget
+            /*
+             * The pooled sensors are not released at the end of an item: they are charged once
+             * per thread, out of the budget, and not in the cost of the items
+             */
+            bool pooled = !_sensorPools.empty();
+            vector<std::size_t> w_bytes(w_items.size(), 0);
+            std::size_t max_sensor = 0;
+            for (std::size_t k = 0; k < w_items.size(); k++)
             {
-                if (streamlog::out.write<streamlog::DEBUG6>())
-#pragma omp critical
+                WorkItemMemory w_memory = EstimateMemory(w_items[k]);
+                w_bytes[k] = pooled ? w_memory.Total() - w_memory.sensor : w_memory.Total();
+                max_sensor = std::max(max_sensor, w_memory.sensor);
+            }
+
+            std::size_t budget = std::size_t(_memoryBudget * MBYTE);
+            std::size_t pool_bytes = 0;
+            if (pooled)
+            {
+                pool_bytes = max_sensor * _sensorPools.size();
+                if (pool_bytes >= budget)
                 {
-                    streamlog::out() << "Undefined min time for layer " << layer
-                        << " ladder " << ladder << std::endl;
+                    streamlog_out(WARNING) << "The pooled sensors (" << double(pool_bytes) / MBYTE
+                                           << " MB) exceed the memory budget, the items run one at a time" << std::endl;
                 }
-                continue;
+                // The budget is never 0 here, that would remove the limit
+                budget = pool_bytes < budget ? budget - pool_bytes : 1;
             }
-            //clock time centered at 0
-            float nw = floor(fabs(m_time) / _window_size);
-            float start_time = (m_time >= 0) ? nw * _window_size : -1 * (nw + 1) * _window_size;
 
-            AbstractSensor* sensor = nullptr;
-            if (sensor_type == 1)
+            MemoryBudgetScheduler m_sched { budget, w_order, w_bytes };
+
+#pragma omp parallel
             {
-                sensor = new TrivialSensor(layer, ladder, num_segment_x, nun_segment_y,
-                                            _layerLadderLength[layer], _layerLadderWidth[layer],
-                                            _layerThickness[layer], _pixelSizeX, _pixelSizeY,
-                                            encoder_str, _barrelID, _threshold,
-                                            start_time, _window_size);
+                for (int k = m_sched.Take(); k >= 0; k = m_sched.Take())
+                {
+                    run_item(k);
+                    m_sched.Release(k);
+                }
             }
-            else
+
+            streamlog_out(MESSAGE) << "Memory budget " << _memoryBudget << " MB: pooled sensors = "
+                                   << double(pool_bytes) / MBYTE << " MB, estimated peak in flight = "
+                                   << double(m_sched.GetHighWater()) / MBYTE << " MB, sampled peak RSS = "
+                                   << double(m_sched.GetResidentHighWater()) / MBYTE << " MB, deferred items = "
+                                   << m_sched.GetDeferred() << std::endl;
+        }
+        else
+        {
+#pragma omp parallel for schedule(dynamic, 1)
+            for (int i = 0; i < n_items; i++) run_item(w_order[i]);
+        }
+
+        if (streamlog::out.write<streamlog::DEBUG>())
+        {
+            streamlog::out() << "Work item timing (layer, ladder, hits, time span, cost, ms):" << std::endl;
+            for (std::size_t k : w_order)
             {
-                sensor = new HKBaseSensor(layer, ladder, num_segment_x, nun_segment_y, 
-                                            _layerLadderLength[layer], _layerLadderWidth[layer],
-                                            _layerThickness[layer], _pixelSizeX, _pixelSizeY,
-                                            encoder_str, _barrelID, _threshold, _fe_slope,
-                                            start_time, _window_size);
+                streamlog::out() << w_items[k].layer << " " << w_items[k].ladder << " "
+                                 << w_items[k].n_hits << " "
+                                 << w_items[k].max_time - w_items[k].min_time << " "
+                                 << w_cost[k] << " " << w_timing[k] << std::endl;
             }
+        }
+    }
+
+    std::chrono::duration<double, std::milli> loop_time = std::chrono::steady_clock::now() - loop_start;
+    streamlog_out(DEBUG) << "Ladder processing time: " << loop_time.count() << " ms" << std::endl;
+
+    if (build_bib)
+    {
+        vector<BIBLadderCache> l_caches(l_outputs.size());
+        for (std::size_t k = 0; k < l_outputs.size(); k++)
+        {
+            l_caches[k] = std::move(l_outputs[k].bib_cache);
+        }
+        StoreBIBCache(new BIBPixelCache(bib_key, l_caches));
+    }
 
-            if (sensor->GetStatus() != MatrixStatus::ok and streamlog::out.write<streamlog::ERROR>())
+    /*
+     * Output merge in (layer, ladder, time) order
+     */
+    StageTimer om_timer { e_profile, ProfileStage::output_merge };
+    std::size_t n_reco = 0;
+    std::size_t n_rel = 0;
+    for (LadderOutput& l_output : l_outputs)
+    {
+        n_reco += l_output.reco_hits.size();
+        n_rel += l_output.relations.size();
+    }
+    THcol->reserve(n_reco);
+    relCol->reserve(n_rel);
+
+    CellIDDecoder<TrackerHitPlaneImpl> cellid_decoder { encoder_str };
+
+    for (int layer = 0; layer < _numberOfLayers; layer++)
+    {
+        for (int ladder = 0; ladder < _laddersInLayer[layer]; ladder++)
+        {
+            LadderOutput& l_output = l_outputs[ladder_offsets[layer] + ladder];
+
+            for (TrackerHitPlaneImpl* recoHit : l_output.reco_hits)
             {
-                if (sensor->GetStatus() == MatrixStatus::pixel_number_error)
-#pragma omp critical
-                {
-                    streamlog::out() << "Pixel number error for layer " << layer
-                                        << " ladder " << ladder << std::endl;
-                }
-                else
-#pragma omp critical
+                THcol->addElement(recoHit);
+
+                if (streamlog::out.write<streamlog::DEBUG7>())
                 {
-                    streamlog::out() << "Segment number error for layer " << layer
-                                        << " ladder " << ladder << std::endl;
+                    streamlog::out() << "Reconstructed pixel cluster for " 
+                                     << layer << ":" << ladder
+                                     << ":" << cellid_decoder(recoHit)["sensor"] << std::endl
+                                     << "- global position (x,y,z,t) = " << recoHit->getPosition()[0] 
+                                     << ", " << recoHit->getPosition()[1] 
+                                     << ", " << recoHit->getPosition()[2] 
+                                     << ", " << recoHit->getTime() << std::endl
+                                     << "- charge = " << recoHit->getEDep() << std::endl;
                 }
-                continue;
             }
 
-            DetElemSlidingWindow t_window {
-                t_index, *sensor,
-                _window_size, start_time,
-                _tanLorentzAngleX, _tanLorentzAngleY,
-                _cutOnDeltaRays,
-                _diffusionCoefficient,
-                _electronsPerKeV,
-                _segmentLength,
-                _energyLoss,
-                3.0,
-                _electronicNoise,
-                _maxTrkLen,
-                _deltaEne,
-                _map
-            };
-
-            vector<std::size_t> histo_buffer {};
+            for (LCRelationImpl* rel_item : l_output.relations)
+            {
+                relCol->addElement(rel_item);
+            }
 
-            while(t_window.active())
+            for (std::size_t k = 0; k < RELHISTOSIZE; k++)
             {
-                t_window.process();
+                relHisto[k] += l_output.rel_histo[k];
+            }
+        }
+    }
+    om_timer.Stop();
 
-                SegmentDigiHitList hit_buffer {};
-                sensor->buildHits(hit_buffer);
-                if (hit_buffer.size() == 0) continue;
+    streamlog_out(DEBUG) << "Peak RSS of the process: " << double(PeakResidentBytes()) / MBYTE << " MB" << std::endl;
 
-                vector<TrackerHitPlaneImpl*> reco_buffer;
-                reco_buffer.assign(hit_buffer.size(), nullptr);
+    if (_shapeFilter)
+    {
+        ShapeFilterStats s_stats {};
+        for (const LadderOutput& l_output : l_outputs) s_stats += l_output.shape_stats;
+        _shapeTotals += s_stats;
+        streamlog_out(MESSAGE) << "Shape filter: " << s_stats.Accepted() << " of " << s_stats.n_clusters
+                               << " clusters accepted, " << s_stats.rejected << " rejected" << std::endl;
+    }
 
-                vector<LCRelationImpl*> rel_buffer;
-                histo_buffer.assign(RELHISTOSIZE, 0);
+    if (_profiler)
+    {
+        for (LadderOutput& l_output : l_outputs)
+        {
+            if (l_output.profile.layer >= 0) _profiler->AddLadder(l_output.profile);
+        }
+        _profiler->EndEvent();
 
-                int idx = 0;
-                for (SegmentDigiHit& digiHit : hit_buffer)
-                {
-                    TrackerHitPlaneImpl *recoHit = new TrackerHitPlaneImpl();
-                    recoHit->setEDep((digiHit.charge / _electronsPerKeV) * dd4hep::keV);
-
-                    bool sig = false;
-                    double minx = 999;
-                    double maxx = -999;
-                    double miny = 999;
-                    double maxy = -999;
-                    double minz = 999;
-                    double maxz = -999;
-
-                    double loc_pos[3] = { 
-                        digiHit.x - _layerHalfThickness[layer] * _tanLorentzAngleX,
-                        digiHit.y - _layerHalfThickness[layer] * _tanLorentzAngleY,
-                        0
-                    };
-
-                    recoHit->setCellID0(digiHit.cellID0);
-                    recoHit->setCellID1(0);
-
-                    SurfaceMap::const_iterator sI = _map->find(digiHit.cellID0);
-                    const ISurface* surf = sI->second;
-
-                    // See DetElemSlidingWindow::StoreSignalPoints
-                    int segment_id = cellid_decoder(recoHit)["sensor"];
-                    float s_offset = sensor->GetSensorCols() * sensor->GetPixelSizeY();
-                    s_offset *= (float(segment_id) + 0.5);
-                    s_offset -= sensor->GetHalfLength();
-
-                    Vector2D oldPos(loc_pos[0] * dd4hep::mm, (loc_pos[1] - s_offset)* dd4hep::mm);
-                    Vector3D lv = surf->localToGlobal(oldPos);
-
-                    double xLab[3];
-                    for ( int i = 0; i < 3; i++ )
-                    {
-                        xLab[i] = lv[i] / dd4hep::mm;
-                    }
+        streamlog_out(DEBUG) << "Stage times (us):";
+        for (int k = 0; k < N_PROFILE_STAGES; k++)
+        {
+            streamlog_out(DEBUG) << " " << StageProfiler::StageName(k) << " = " << e_profile->stage_time[k];
+        }
+        streamlog_out(DEBUG) << std::endl;
+    }
 
-                    recoHit->setPosition(xLab);
+    streamlog_out(MESSAGE) << "Number of produced hits: " << THcol->getNumberOfElements()  << std::endl;
+    int count = 0;
+      streamlog_out(DEBUG) << "Hit relation histogram:" << std::endl;
+      for (std::size_t k = 0; k < RELHISTOSIZE; k++)
+      {
+        streamlog_out(DEBUG) << k << " " << relHisto[k] << std::endl;
+        count += relHisto[k];
+      }
+      streamlog_out(DEBUG) << "> " << THcol->getNumberOfElements() - count << std::endl;
+}
 
-                    recoHit->setTime(digiHit.time);
+WorkItemMemory MuonCVXDRealDigitiser::EstimateMemory(const LadderWorkItem& w_item) const
+{
+    int layer = w_item.layer;
+    std::size_t n_hits = w_item.n_hits;
+    std::size_t l_rows = std::size_t(_layerLadderWidth[layer] / _pixelSizeX) + 1;
+    std::size_t l_cols = std::size_t(_layerLadderLength[layer] / _pixelSizeY) + 1;
 
-                    Vector3D u = surf->u() ;
-                    Vector3D v = surf->v() ;
+    WorkItemMemory result {};
 
-                    float u_direction[2] = { u.theta(), u.phi() };
-                    float v_direction[2] = { v.theta(), v.phi() };
+    // The trivial sensor holds the full grid, the tiles of the RD53A are allocated around the hits
+    if (sensor_type == 1)
+    {
+        result.sensor = l_rows * l_cols * sizeof(float);
+    }
+    else
+    {
+        std::size_t n_tiles = (l_rows / PixelTileStore::TILE_SIDE + 1) * (l_cols / PixelTileStore::TILE_SIDE + 1);
+        result.sensor = n_tiles * sizeof(int) + n_hits * PixelTileStore::TileBytes();
+    }
 
-                    recoHit->setU( u_direction ) ;
-                    recoHit->setV( v_direction ) ;
+    // All the points of the hits are counted, as if they were in the same window
+    std::size_t n_points = std::size_t(_layerThickness[layer] / _segmentLength) + 1;
+    result.signals = n_hits * n_points * (sizeof(TimedSignalPoint) + 2 * sizeof(void*));
 
-                    // ALE Does this make sense??? TO CHECK
-                    recoHit->setdU( _pixelSizeX / sqrt(12) );
-                    recoHit->setdV( _pixelSizeY / sqrt(12) );  
+    // A signal point covers a box of pixels of +-3 sigma, a few pixels on average
+    const std::size_t PIXELS_PER_HIT = 9;
+    result.hit_tables = n_hits * PIXELS_PER_HIT * sizeof(SimHitRecord);
 
-                    //All the sim-hits are registered for a given reco-hit
-                    for (SimTrackerHit* st_item : digiHit.sim_hits)
-                    {
-                      if (create_stats)
-                      {
-                        if (!st_item->isOverlay()) sig = true;
-                        if ( st_item->getPosition()[0] < minx ) minx = st_item->getPosition()[0];
-                        else if ( st_item->getPosition()[0] > maxx ) maxx = st_item->getPosition()[0];
-                        if ( st_item->getPosition()[1] < miny ) miny = st_item->getPosition()[1];
-                        else if ( st_item->getPosition()[1] > maxy ) maxy = st_item->getPosition()[1];
-                        if ( st_item->getPosition()[2] < minz ) minz = st_item->getPosition()[2];
-                        else if ( st_item->getPosition()[2] > maxz ) maxz = st_item->getPosition()[2];
-                      }
-                        recoHit->rawHits().push_back( st_item );
-                        LCRelationImpl* t_rel = new LCRelationImpl {};
-                        t_rel->setFrom(recoHit);
-                        t_rel->setTo(st_item);
-                        t_rel->setWeight( 1.0 );
-                        rel_buffer.push_back(t_rel);
-                    }
+    result.output = n_hits * (sizeof(TrackerHitPlaneImpl) + sizeof(LCRelationImpl) + 2 * sizeof(void*));
+    return result;
+}
 
-                    if (digiHit.sim_hits.size() < RELHISTOSIZE)
-                    {
-                        histo_buffer[digiHit.sim_hits.size()]++;
-                    }
+void MuonCVXDRealDigitiser::ProcessLadder(int layer, int ladder,
+                                          HitTemporalIndexes& t_index,
+                                          const std::string& encoder_str,
+                                          uint64_t random_key,
+                                          const BIBLadderView* bib_view,
+                                          bool build_bib,
+                                          LadderOutput& output)
+{
+    // The decoder keeps the last decoded value, it cannot be shared among threads
+    UTIL::BitField64 cell_decoder { encoder_str };
 
-                    reco_buffer[idx] = recoHit;
-                    idx++;
+    float m_time = t_index.GetMinTime(layer, ladder);
+    if (m_time == HitTemporalIndexes::MAXTIME)
+    {
+        if (streamlog::out.write<streamlog::DEBUG6>())
+#pragma omp critical
+        {
+            streamlog::out() << "Undefined min time for layer " << layer
+                << " ladder " << ladder << std::endl;
+        }
+        return;
+    }
+    LadderProfile* profile = nullptr;
+    if (_profiler)
+    {
+        profile = &output.profile;
+        profile->Reset(layer, ladder, GetThreadID());
+    }
 
-                    if (create_stats)
-                    {
-                      // cluster size histograms
-                      if ( !sig )
-                      {
-                        //bib_cSizeHisto->Fill(recoHit->getRawHits().size());
-                        bib_cSizeHisto->Fill(digiHit.size);
-                        bib_xSizeHisto->Fill(maxx-minx);
-                        bib_ySizeHisto->Fill(maxy-miny);
-                        bib_zSizeHisto->Fill(maxz-minz);
-                        bib_eDepHisto->Fill(1000*recoHit->getEDep());
-                      } else {
-                        //signal_cSizeHisto->Fill(recoHit->getRawHits().size());
-                        signal_cSizeHisto->Fill(digiHit.size);
-                        signal_xSizeHisto->Fill(maxx-minx);
-                        signal_ySizeHisto->Fill(maxy-miny);
-                        signal_zSizeHisto->Fill(maxz-minz);
-                        signal_eDepHisto->Fill(1000*recoHit->getEDep());
-                      }
-                   }
-                }
+    //clock time centered at 0
+    float nw = floor(fabs(m_time) / _window_size);
+    float start_time = (m_time >= 0) ? nw * _window_size : -1 * (nw + 1) * _window_size;
+
+    // The sensor is taken from the pool of the thread, a sensor of another layer is replaced
+    AbstractSensor* sensor = nullptr;
+    std::unique_ptr<AbstractSensor> l_sensor {};
+    int thread_id = GetThreadID();
+    bool use_pool = thread_id < int(_sensorPools.size());
+    if (use_pool)
+    {
+        sensor = _sensorPools[thread_id].GetSensor(layer, ladder, start_time, encoder_str);
+    }
+
+    // Histogram bins of the thread, merged in end()
+    ThreadStats* l_stats = nullptr;
+    if (create_stats && thread_id < int(_threadStats.size())) l_stats = &_threadStats[thread_id];
+    if (sensor == nullptr && use_pool)
+    {
+        // The old sensor is freed before the allocation of the new one
+        _sensorPools[thread_id].Clear();
+        sensor = CreateSensor(layer, ladder, start_time, encoder_str);
+        _sensorPools[thread_id].SetSensor(layer, sensor);
+    }
+    else if (sensor == nullptr)
+    {
+        l_sensor.reset(CreateSensor(layer, ladder, start_time, encoder_str));
+        sensor = l_sensor.get();
+    }
+
+    if (sensor->GetStatus() != MatrixStatus::ok and streamlog::out.write<streamlog::ERROR>())
+    {
+        if (sensor->GetStatus() == MatrixStatus::pixel_number_error)
+#pragma omp critical
+        {
+            streamlog::out() << "Pixel number error for layer " << layer
+                                << " ladder " << ladder << std::endl;
+        }
+        else
+#pragma omp critical
+        {
+            streamlog::out() << "Segment number error for layer " << layer
+                                << " ladder " << ladder << std::endl;
+        }
+        if (profile != nullptr) profile->t_end = ProfileClock();
+        return;
+    }
+
+    const SimHitSnapshot& h_snapshot = t_index.GetSnapshot();
+
+    PhiloxRandomEngine ladder_engine { random_key, PhiloxRandomEngine::MakeStreamID(layer, ladder) };
+    CLHEP::HepRandomEngine* engine = nullptr;
+    if (_deterministicRandom != 0) engine = &ladder_engine;
+
+    std::unique_ptr<SlidingWindow> t_window { CreateWindow(t_index, *sensor, start_time, engine) };
+
+    t_window->SetProfile(profile);
+    if (_noiseGen.Enabled()) t_window->SetNoise(_noiseGen);
+
+    // The tasks of the segments run on the threads of the ladder loop
+    bool seg_tasks = _segmentTasks != 0 && t_index.GetHitNumber(layer, ladder) >= _segmentTaskMinHits;
+    sensor->SetSegmentTasks(seg_tasks);
+    t_window->SetSegmentTasks(seg_tasks);
+#ifdef OFFLOAD_ENABLED
+    if (_offloadMinPoints > 0) t_window->SetOffload(std::size_t(_offloadMinPoints));
+#endif
+
+    if (build_bib)
+    {
+        t_window->BuildCache(output.bib_cache);
+        const BIBPixelEntry* e_data = output.bib_cache.entries.data();
+        t_window->UseCache({ e_data, e_data + output.bib_cache.entries.size(), output.bib_cache.n_hits });
+    }
+    else if (bib_view != nullptr && !t_window->UseCache(*bib_view))
+    {
+        if (streamlog::out.write<streamlog::WARNING>())
+#pragma omp critical
+        {
+            streamlog::out() << "Background cache mismatch for layer " << layer
+                             << " ladder " << ladder << ", overlay hits digitised" << std::endl;
+        }
+    }
+
+    bool signal_only = (_outputMode & int(OutputMode::signal_only)) != 0;
+    bool per_particle = (_outputMode & int(OutputMode::per_particle)) != 0;
+    bool store_raw = (_outputMode & int(OutputMode::no_raw_hits)) == 0;
+    vector<ParticleRelation> p_relations {};
+
+    while(t_window->active())
+    {
+        t_window->process();
+
+        StageTimer cl_timer { profile, ProfileStage::clustering };
+        SegmentDigiHitList hit_buffer {};
+        sensor->buildHits(hit_buffer);
+        cl_timer.Stop();
+        if (hit_buffer.size() == 0) continue;
 
-                if (reco_buffer.size() > 0)
-#pragma omp critical               
+        StageTimer lc_timer { profile, ProfileStage::lcio_creation };
+        if (profile != nullptr)
+        {
+            profile->Count(ProfileCounter::clusters, hit_buffer.size());
+            for (SegmentDigiHit& digiHit : hit_buffer) profile->Count(ProfileCounter::fired_pixels, digiHit.size);
+        }
+
+        output.reco_hits.reserve(output.reco_hits.size() + hit_buffer.size());
+
+        for (SegmentDigiHit& digiHit : hit_buffer)
+        {
+            double loc_pos[3] = { 
+                digiHit.x - _layerHalfThickness[layer] * _tanLorentzAngleX,
+                digiHit.y - _layerHalfThickness[layer] * _tanLorentzAngleY,
+                0
+            };
+
+            const CachedSurface* c_surf = _surfCache.Find(digiHit.cellID0);
+            if (c_surf == nullptr)
+            {
+                if (streamlog::out.write<streamlog::ERROR>())
+#pragma omp critical
                 {
-                    for(TrackerHitPlaneImpl* recoHit : reco_buffer)
-                    {
-                        if (recoHit == nullptr) continue;
-                        THcol->addElement(recoHit);
+                    streamlog::out() << "Missing surface for cellID " << digiHit.cellID0 << std::endl;
+                }
+                continue;
+            }
 
-                        if (streamlog::out.write<streamlog::DEBUG7>())
-                        {
-                            streamlog::out() << "Reconstructed pixel cluster for " 
-                                             << sensor->GetLayer() << ":" << sensor->GetLadder() 
-                                             << ":" << cellid_decoder(recoHit)["sensor"] << std::endl
-                                             << "- global position (x,y,z,t) = " << recoHit->getPosition()[0] 
-                                             << ", " << recoHit->getPosition()[1] 
-                                             << ", " << recoHit->getPosition()[2] 
-                                             << ", " << recoHit->getTime() << std::endl
-                                             << "- charge = " << recoHit->getEDep() << std::endl;
-                        }
-                    }
+            // See DetElemSlidingWindow::StoreSignalPoints
+            cell_decoder.setValue((unsigned int)digiHit.cellID0);
+            int segment_id = cell_decoder[lcio::LCTrackerCellID::sensor()];
+            float s_offset = sensor->GetSensorCols() * sensor->GetPixelSizeY();
+            s_offset *= (float(segment_id) + 0.5);
+            s_offset -= sensor->GetHalfLength();
+
+            Vector2D oldPos(loc_pos[0] * dd4hep::mm, (loc_pos[1] - s_offset)* dd4hep::mm);
+            Vector3D lv = c_surf->LocalToGlobal(oldPos);
+
+            double xLab[3];
+            for ( int i = 0; i < 3; i++ )
+            {
+                xLab[i] = lv[i] / dd4hep::mm;
+            }
+
+            // The shape is tested before any LCIO object is created
+            bool shape_ok = true;
+            if (_shapeFilter)
+            {
+                Vector3D g_pos(xLab[0], xLab[1], xLab[2]);
+                shape_ok = _shapeFilter->IsCompatible(digiHit, g_pos, *c_surf, _layerThickness[layer]);
+                output.shape_stats.n_clusters++;
+                if (!shape_ok) output.shape_stats.rejected++;
+                if (!shape_ok && _shapeFilterMode == int(ShapeFilterMode::drop)) continue;
+            }
+
+            TrackerHitPlaneImpl *recoHit = new TrackerHitPlaneImpl();
+            recoHit->setEDep((digiHit.charge / _electronsPerKeV) * dd4hep::keV);
+            if (!shape_ok) recoHit->setQualityBit(ClusterShapeFilter::QUALITY_BIT);
+
+            bool sig = false;
+            double minx = 999;
+            double maxx = -999;
+            double miny = 999;
+            double maxy = -999;
+            double minz = 999;
+            double maxz = -999;
 
-                    for (LCRelationImpl* rel_item : rel_buffer)
+            recoHit->setCellID0(digiHit.cellID0);
+            recoHit->setCellID1(0);
+
+            recoHit->setPosition(xLab);
+
+            recoHit->setTime(digiHit.time);
+
+            recoHit->setU( c_surf->u_direction ) ;
+            recoHit->setV( c_surf->v_direction ) ;
+
+            // ALE Does this make sense??? TO CHECK
+            recoHit->setdU( _pixelSizeX / sqrt(12) );
+            recoHit->setdV( _pixelSizeY / sqrt(12) );  
+
+            // The weight of a relation is the fraction of the cluster charge collected from the sim-hit
+            float rel_charge = 0.;
+            for (const SimHitRelation& r_item : digiHit.sim_hits) rel_charge += r_item.charge;
+
+            // The sim-hits are registered for a given reco-hit according to OutputMode
+            p_relations.clear();
+            for (const SimHitRelation& r_item : digiHit.sim_hits)
+            {
+              SimTrackerHit* st_item = t_index.GetHit(r_item.hit);
+              if (st_item == nullptr) continue;
+
+              bool h_overlay = h_snapshot.IsOverlay(r_item.hit);
+              if (l_stats != nullptr)
+              {
+                const double h_pos[3] = {
+                    h_snapshot.GetPosX(r_item.hit), h_snapshot.GetPosY(r_item.hit), h_snapshot.GetPosZ(r_item.hit)
+                };
+                if (!h_overlay) sig = true;
+                if ( h_pos[0] < minx ) minx = h_pos[0];
+                else if ( h_pos[0] > maxx ) maxx = h_pos[0];
+                if ( h_pos[1] < miny ) miny = h_pos[1];
+                else if ( h_pos[1] > maxy ) maxy = h_pos[1];
+                if ( h_pos[2] < minz ) minz = h_pos[2];
+                else if ( h_pos[2] > maxz ) maxz = h_pos[2];
+
+                double d2 = 0.;
+                for (int i = 0; i < 3; i++) d2 += pow(xLab[i] - h_pos[i], 2);
+                if (h_overlay) l_stats->bib.distance.Fill(sqrt(d2));
+                else l_stats->signal.distance.Fill(sqrt(d2));
+              }
+
+                if (h_overlay && signal_only) continue;
+                if (store_raw) recoHit->rawHits().push_back( st_item );
+
+                if (per_particle)
+                {
+                    // A cluster has few particles, the search is linear
+                    const EVENT::MCParticle* mcp = st_item->getMCParticle();
+                    auto p_item = std::find_if(p_relations.begin(), p_relations.end(),
+                                               [mcp](const ParticleRelation& p_rel) { return p_rel.particle == mcp; });
+                    if (p_item == p_relations.end())
                     {
-                        relCol->addElement(rel_item);
+                        p_relations.push_back({ mcp, st_item, r_item.charge, r_item.charge });
                     }
-                    for (std::size_t k = 0; k < RELHISTOSIZE; k++)
+                    else
                     {
-                        relHisto[k] += histo_buffer[k];
+                        p_item->charge += r_item.charge;
+                        if (r_item.charge > p_item->best_charge)
+                        {
+                            p_item->best_hit = st_item;
+                            p_item->best_charge = r_item.charge;
+                        }
                     }
+                    continue;
                 }
+
+                LCRelationImpl* t_rel = new LCRelationImpl {};
+                t_rel->setFrom(recoHit);
+                t_rel->setTo(st_item);
+                t_rel->setWeight(rel_charge > 0. ? r_item.charge / rel_charge : 1.0);
+                output.relations.push_back(t_rel);
             }
 
-            delete sensor;
-        }
-    }
-    streamlog_out(MESSAGE) << "Number of produced hits: " << THcol->getNumberOfElements()  << std::endl;
-    int count = 0;
-      streamlog_out(DEBUG) << "Hit relation histogram:" << std::endl;
-      for (std::size_t k = 0; k < RELHISTOSIZE; k++)
-      {
-        streamlog_out(DEBUG) << k << " " << relHisto[k] << std::endl;
-        count += relHisto[k];
-      }
-      streamlog_out(DEBUG) << "> " << THcol->getNumberOfElements() - count << std::endl;
+            // The relation of a particle points to its sim-hit with the largest charge
+            for (const ParticleRelation& p_rel : p_relations)
+            {
+                LCRelationImpl* t_rel = new LCRelationImpl {};
+                t_rel->setFrom(recoHit);
+                t_rel->setTo(p_rel.best_hit);
+                t_rel->setWeight(rel_charge > 0. ? p_rel.charge / rel_charge : 1.0);
+                output.relations.push_back(t_rel);
+            }
 
-    if (create_stats)
-    {
-        for (int i = 0; i < relCol->getNumberOfElements(); ++i)
-        {
-            LCRelationImpl* hitRel = dynamic_cast<LCRelationImpl*>(relCol->getElementAt(i));
-            TrackerHitPlaneImpl* recoHit = dynamic_cast<TrackerHitPlaneImpl*>(hitRel->getFrom());
-            SimTrackerHit* simTrkHit = dynamic_cast<SimTrackerHit*>(hitRel->getTo());
-
-            float tmpf = pow(recoHit->getPosition()[0] - simTrkHit->getPosition()[0], 2);
-            tmpf += pow(recoHit->getPosition()[1] - simTrkHit->getPosition()[1], 2);
-            tmpf += pow(recoHit->getPosition()[2] - simTrkHit->getPosition()[2], 2);
-            
-            if (simTrkHit->isOverlay())
+            if (digiHit.sim_hits.size() < output.rel_histo.size())
             {
-                bib_dHisto->Fill(sqrt(tmpf));
+                output.rel_histo[digiHit.sim_hits.size()]++;
             }
-            else
+
+            output.reco_hits.push_back(recoHit);
+
+            // The clusters of noisy pixels only do not have any sim-hit for the statistics
+            if (l_stats != nullptr && !digiHit.sim_hits.empty())
             {
-                signal_dHisto->Fill(sqrt(tmpf));
+              // cluster size histograms
+              ClusterStatAccumulator& c_stats = sig ? l_stats->signal : l_stats->bib;
+              c_stats.c_size.Fill(digiHit.size);
+              c_stats.x_size.Fill(maxx-minx);
+              c_stats.y_size.Fill(maxy-miny);
+              c_stats.z_size.Fill(maxz-minz);
+              c_stats.e_dep.Fill(1000*recoHit->getEDep());
             }
         }
     }
+
+    if (profile != nullptr) profile->t_end = ProfileClock();
+}
+
+uint64_t MuonCVXDRealDigitiser::GetOverlayKey(const SimHitSnapshot& h_snapshot)
+{
+    /*
+     * LCIO does not label the overlaid sample, the overlay hits are identified by their content;
+     * the fields are the ones of the snapshot, the hits dropped by the pre-filter are not part
+     * of the key, the parameters of the filter are
+     */
+    uint64_t result = _bibParamKey;
+    int n_overlay = 0;
+    for (int i = 0; i < h_snapshot.Size(); i++)
+    {
+        if (!h_snapshot.IsOverlay(i)) continue;
+
+        const int cell_id = h_snapshot.GetCellID0(i);
+        const float h_data[] = { h_snapshot.GetTime(i), h_snapshot.GetEDep(i) };
+        const double h_pos[] = { h_snapshot.GetPosX(i), h_snapshot.GetPosY(i), h_snapshot.GetPosZ(i) };
+        result = BIBPixelCache::Hash(result, &cell_id, sizeof(cell_id));
+        result = BIBPixelCache::Hash(result, h_data, sizeof(h_data));
+        result = BIBPixelCache::Hash(result, h_pos, sizeof(h_pos));
+        n_overlay++;
+    }
+    return n_overlay > 0 ? result : 0;
+}
+
+const BIBPixelCache* MuonCVXDRealDigitiser::FindBIBCache(uint64_t key, int ladders)
+{
+    for (auto c_item = _bibCaches.begin(); c_item != _bibCaches.end(); c_item++)
+    {
+        if ((*c_item)->GetKey() != key || (*c_item)->GetLadderNumber() != ladders) continue;
+        _bibCaches.splice(_bibCaches.begin(), _bibCaches, c_item);
+        return _bibCaches.front().get();
+    }
+
+    if (_bibCacheDir.empty()) return nullptr;
+
+    std::stringstream f_name;
+    f_name << _bibCacheDir << "/bib_" << std::hex << key << ".cache";
+    BIBPixelCache* bib_cache = BIBPixelCache::Load(f_name.str(), key, ladders);
+    if (bib_cache == nullptr) return nullptr;
+
+    streamlog_out(MESSAGE) << "Background cache mapped from " << f_name.str()
+                           << ", entries: " << bib_cache->Size() << std::endl;
+    _bibCaches.emplace_front(bib_cache);
+    while (int(_bibCaches.size()) > std::max(_bibCacheSize, 1)) _bibCaches.pop_back();
+    return bib_cache;
+}
+
+void MuonCVXDRealDigitiser::StoreBIBCache(BIBPixelCache* bib_cache)
+{
+    streamlog_out(MESSAGE) << "Background cache built, entries: " << bib_cache->Size() << std::endl;
+
+    if (!_bibCacheDir.empty())
+    {
+        std::stringstream f_name;
+        f_name << _bibCacheDir << "/bib_" << std::hex << bib_cache->GetKey() << ".cache";
+        if (!bib_cache->Save(f_name.str()))
+        {
+            streamlog_out(WARNING) << "Cannot write the background cache " << f_name.str() << std::endl;
+        }
+    }
+
+    _bibCaches.emplace_front(bib_cache);
+    while (int(_bibCaches.size()) > std::max(_bibCacheSize, 1)) _bibCaches.pop_back();
+}
+
+ThreadStats MuonCVXDRealDigitiser::BookThreadStats() const
+{
+    ThreadStats result {
+        { BinAccumulator(signal_dHisto), BinAccumulator(signal_cSizeHisto), BinAccumulator(signal_xSizeHisto),
+          BinAccumulator(signal_ySizeHisto), BinAccumulator(signal_zSizeHisto), BinAccumulator(signal_eDepHisto) },
+        { BinAccumulator(bib_dHisto), BinAccumulator(bib_cSizeHisto), BinAccumulator(bib_xSizeHisto),
+          BinAccumulator(bib_ySizeHisto), BinAccumulator(bib_zSizeHisto), BinAccumulator(bib_eDepHisto) }
+    };
+    return result;
+}
+
+void MuonCVXDRealDigitiser::ResizeThreadStats(int n_threads)
+{
+    while (int(_threadStats.size()) < n_threads) _threadStats.push_back(BookThreadStats());
 }
 
 void MuonCVXDRealDigitiser::check(LCEvent *evt)
@@ -614,25 +1457,73 @@ void MuonCVXDRealDigitiser::end()
 {
     streamlog_out(DEBUG) << "   end called  " << std::endl;
 
+    _bibCaches.clear();
+
+    if (_preFilter)
+    {
+        streamlog_out(MESSAGE) << "Pre-filter totals: " << _filterTotals.Kept() << " of " << _filterTotals.n_hits
+                               << " hits kept, dropped by time = " << _filterTotals.time_cut
+                               << ", by energy = " << _filterTotals.edep_cut
+                               << ", by geometry = " << _filterTotals.geometry_cut << std::endl;
+    }
+
+    if (_shapeFilter)
+    {
+        streamlog_out(MESSAGE) << "Shape filter totals: " << _shapeTotals.Accepted() << " of "
+                               << _shapeTotals.n_clusters << " clusters accepted, "
+                               << _shapeTotals.rejected << " rejected" << std::endl;
+    }
+
     if (create_stats)
     {
-        TFile statFile = TFile(stat_filename.c_str(), "recreate");
-        statFile.WriteObject(signal_dHisto, "Signal offset");
-        statFile.WriteObject(bib_dHisto, "BIB offset");
-        statFile.WriteObject(signal_cSizeHisto, "Signal cluster size");
-        statFile.WriteObject(signal_xSizeHisto, "Signal cluster size in x");
-        statFile.WriteObject(signal_ySizeHisto, "Signal cluster size in y");
-        statFile.WriteObject(signal_zSizeHisto, "Signal cluster size in z");
-        statFile.WriteObject(signal_eDepHisto, "Signal energy");
-        statFile.WriteObject(bib_cSizeHisto, "BIB cluster size");
-        statFile.WriteObject(bib_xSizeHisto, "BIB cluster size in x");
-        statFile.WriteObject(bib_ySizeHisto, "BIB cluster size in y");
-        statFile.WriteObject(bib_zSizeHisto, "BIB cluster size in z");
-        statFile.WriteObject(bib_eDepHisto, "BIB energy");
-        statFile.Flush();
-        statFile.Close();
+        // The histograms are filled only here, after merging the accumulators of the threads
+        ThreadStats t_stats = BookThreadStats();
+        for (const ThreadStats& item : _threadStats)
+        {
+            t_stats.signal.Merge(item.signal);
+            t_stats.bib.Merge(item.bib);
+        }
+        t_stats.signal.distance.AddTo(signal_dHisto);
+        t_stats.signal.c_size.AddTo(signal_cSizeHisto);
+        t_stats.signal.x_size.AddTo(signal_xSizeHisto);
+        t_stats.signal.y_size.AddTo(signal_ySizeHisto);
+        t_stats.signal.z_size.AddTo(signal_zSizeHisto);
+        t_stats.signal.e_dep.AddTo(signal_eDepHisto);
+        t_stats.bib.distance.AddTo(bib_dHisto);
+        t_stats.bib.c_size.AddTo(bib_cSizeHisto);
+        t_stats.bib.x_size.AddTo(bib_xSizeHisto);
+        t_stats.bib.y_size.AddTo(bib_ySizeHisto);
+        t_stats.bib.z_size.AddTo(bib_zSizeHisto);
+        t_stats.bib.e_dep.AddTo(bib_eDepHisto);
+        _threadStats.clear();
+
+        if (!_statFile) _statFile.reset(new TFile(stat_filename.c_str(), "recreate"));
+        TFile* statFile = _statFile.get();
+        statFile->WriteObject(signal_dHisto, "Signal offset");
+        statFile->WriteObject(bib_dHisto, "BIB offset");
+        statFile->WriteObject(signal_cSizeHisto, "Signal cluster size");
+        statFile->WriteObject(signal_xSizeHisto, "Signal cluster size in x");
+        statFile->WriteObject(signal_ySizeHisto, "Signal cluster size in y");
+        statFile->WriteObject(signal_zSizeHisto, "Signal cluster size in z");
+        statFile->WriteObject(signal_eDepHisto, "Signal energy");
+        statFile->WriteObject(bib_cSizeHisto, "BIB cluster size");
+        statFile->WriteObject(bib_xSizeHisto, "BIB cluster size in x");
+        statFile->WriteObject(bib_ySizeHisto, "BIB cluster size in y");
+        statFile->WriteObject(bib_zSizeHisto, "BIB cluster size in z");
+        statFile->WriteObject(bib_eDepHisto, "BIB energy");
+        if (_profiler)
+        {
+            // The trees are written in the current directory
+            TDirectory::TContext d_context { statFile };
+            _profiler->Write();
+        }
+        statFile->Flush();
+        statFile->Close();
     }
 
+    _profiler.reset();
+    _statFile.reset();
+
     if (signal_dHisto != nullptr) delete(signal_dHisto);
     if (bib_dHisto != nullptr) delete(bib_dHisto);
     if (signal_cSizeHisto != nullptr) delete(signal_cSizeHisto);
@@ -657,6 +1548,11 @@ void MuonCVXDRealDigitiser::PrintGeometryInfo()
     for (int i = 0; i < _numberOfLayers; ++i) 
     {
         streamlog_out(MESSAGE) << "Layer " << i << std::endl;
+        if (_isEndcap)
+        {
+            streamlog_out(MESSAGE) << "  Disk " << _layerCellID[i] << ", side " << _layerSide[i] << std::endl;
+            streamlog_out(MESSAGE) << "  Petal inner width: " << _layerPetalInnerWidth[i] << std::endl;
+        }
         streamlog_out(MESSAGE) << "  Number of ladders: " << _laddersInLayer[i] << std::endl;
         streamlog_out(MESSAGE) << "  Radius: " << _layerRadius[i] << std::endl;
         streamlog_out(MESSAGE) << "  Ladder length: " << _layerLadderLength[i] << std::endl;
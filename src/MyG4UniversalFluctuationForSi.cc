@@ -33,6 +33,8 @@
 //
 // Modifications: 
 //
+// 14-10-26 batch sampling for the segments of a track
+// 14-10-26 random engine as argument of the constructor
 // 28-12-02 add method Dispersion (V.Ivanchenko)
 // 07-02-03 change signature (V.Ivanchenko)
 // 13-02-03 Add name (V.Ivanchenko)
@@ -47,6 +49,7 @@
 #include "CLHEP/Random/RandGaussQ.h"
 #include "CLHEP/Random/RandPoisson.h"
 #include "CLHEP/Random/RandFlat.h"
+#include "CLHEP/Random/Random.h"
 #include <cmath>
 
 namespace CLHEP{}    // declare namespace CLHEP for backward compatibility
@@ -63,8 +66,9 @@ using namespace CLHEP ;
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo....
 // The constructor setups various constants pluc eloss parameters
 // for silicon.   
-MyG4UniversalFluctuationForSi::MyG4UniversalFluctuationForSi()
- :minNumberInteractionsBohr(10.0),
+MyG4UniversalFluctuationForSi::MyG4UniversalFluctuationForSi(HepRandomEngine* engine)
+ :_engine(engine != nullptr ? engine : HepRandom::getTheEngine()),
+  minNumberInteractionsBohr(10.0),
   theBohrBeta2(50.0*keV/proton_mass_c2),
   minLoss(0.000001*eV),
   problim(0.01),
@@ -101,13 +105,29 @@ double MyG4UniversalFluctuationForSi::SampleFluctuations(const double momentum,
                                                          double& tmax,
                                                          const double length,
                                                          const double meanLoss)
+{
+  double loss;
+  SampleFluctuations(momentum, mass, tmax, length, meanLoss, 1, &loss);
+  return loss;
+}
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo....
+void MyG4UniversalFluctuationForSi::SampleFluctuations(const double momentum,
+                                                       const double mass,
+                                                       double& tmax,
+                                                       const double length,
+                                                       const double meanLoss,
+                                                       const int n_seg,
+                                                       double* losses)
 {
 //  calculate actual loss from the mean loss
 //  The model used to get the fluctuation is essentially the same
 // as in Glandz in Geant3.
   
   // shortcut for very very small loss 
-  if(meanLoss < minLoss) return meanLoss;
+  if(meanLoss < minLoss) {
+    for(int k=0; k<n_seg; k++) losses[k] = meanLoss;
+    return;
+  }
 
   //if(dp->GetDefinition() != particle) {
   particleMass   = mass; // dp->GetMass();
@@ -119,46 +139,82 @@ double MyG4UniversalFluctuationForSi::SampleFluctuations(const double momentum,
   //double gam2  = gam*gam; 
   double gam2   = (momentum*momentum)/(particleMass*particleMass) + 1.0;
   double beta2 = 1.0 - 1.0/gam2;
- 
+
+  // a very small step modifies tmax, the constants must be updated
+  StepConstants sc;
+  double stepTmax = tmax;
+  SetupStep(gam2, beta2, tmax, length, meanLoss, sc);
+
+  for(int k=0; k<n_seg; k++)
+  {
+    if(tmax != stepTmax)
+    {
+      stepTmax = tmax;
+      SetupStep(gam2, beta2, tmax, length, meanLoss, sc);
+    }
+    losses[k] = SampleStep(tmax, meanLoss, sc);
+  }
+}
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo....
+void MyG4UniversalFluctuationForSi::SetupStep(const double gam2,
+                                              const double beta2,
+                                              const double tmax,
+                                              const double length,
+                                              const double meanLoss,
+                                              StepConstants& sc)
+{
   // Validity range for delta electron cross section
-  double loss, siga;
   // Gaussian fluctuation 
-  if(meanLoss >= minNumberInteractionsBohr*tmax || 
-     tmax <= ipotFluct*minNumberInteractionsBohr)
+  sc.gaussian = meanLoss >= minNumberInteractionsBohr*tmax || 
+                tmax <= ipotFluct*minNumberInteractionsBohr;
+  if(sc.gaussian)
+  {
+    sc.siga  = (1.0/beta2 - 0.5) * twopi_mc2_rcl2 * tmax * length 
+                                 * electronDensity * chargeSquare ;
+    sc.siga = sqrt(sc.siga);
+    return;
+  }
+
+  // Non Gaussian fluctuation 
+  double w2,C;
+
+  sc.w1 = tmax/ipotFluct;
+  w2 = log(2.*electron_mass_c2*(gam2 - 1.0));
+
+  C = meanLoss*(1.-rateFluct)/(w2-ipotLogFluct-beta2);
+
+  sc.a1 = C*f1Fluct*(w2-e1LogFluct-beta2)/e1Fluct;
+  sc.a2 = C*f2Fluct*(w2-e2LogFluct-beta2)/e2Fluct;
+  sc.a3 = rateFluct*meanLoss*(tmax-ipotFluct)/(ipotFluct*tmax*log(sc.w1));
+  if(sc.a1 < 0.) sc.a1 = 0.;
+  if(sc.a2 < 0.) sc.a2 = 0.;
+  if(sc.a3 < 0.) sc.a3 = 0.;
+
+  sc.suma = sc.a1+sc.a2+sc.a3;
+}
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo....
+double MyG4UniversalFluctuationForSi::SampleStep(double& tmax,
+                                                 const double meanLoss,
+                                                 const StepConstants& sc)
+{
+  double loss, siga;
+  if(sc.gaussian)
   {
-    siga  = (1.0/beta2 - 0.5) * twopi_mc2_rcl2 * tmax * length 
-                              * electronDensity * chargeSquare ;
-    siga = sqrt(siga);
     do {
      //loss = G4RandGauss::shoot(meanLoss,siga);
-     loss = RandGaussQ::shoot(meanLoss,siga);
+     loss = RandGaussQ::shoot(_engine, meanLoss,sc.siga);
     } while (loss < 0. || loss > 2.*meanLoss);
 
     return loss;
   }
 
-  // Non Gaussian fluctuation 
-  double suma,w1,w2,C,lossc,w;
-  double a1,a2,a3;
+  double suma = sc.suma,w1 = sc.w1,w2,lossc,w;
+  double a1 = sc.a1,a2 = sc.a2,a3 = sc.a3;
   int p1,p2,p3;
   int nb;
   double corrfac, na,alfa,rfac,namean,sa,alfa1,ea,sea;
   double dp3;
 
-  w1 = tmax/ipotFluct;
-  w2 = log(2.*electron_mass_c2*(gam2 - 1.0));
-
-  C = meanLoss*(1.-rateFluct)/(w2-ipotLogFluct-beta2);
-
-  a1 = C*f1Fluct*(w2-e1LogFluct-beta2)/e1Fluct;
-  a2 = C*f2Fluct*(w2-e2LogFluct-beta2)/e2Fluct;
-  a3 = rateFluct*meanLoss*(tmax-ipotFluct)/(ipotFluct*tmax*log(w1));
-  if(a1 < 0.) a1 = 0.;
-  if(a2 < 0.) a2 = 0.;
-  if(a3 < 0.) a3 = 0.;
-
-  suma = a1+a2+a3;
-
   loss = 0. ;
 
   if(suma < sumalim)             // very small Step
@@ -172,17 +228,17 @@ double MyG4UniversalFluctuationForSi::SampleFluctuations(const double momentum,
         {
           siga=sqrt(a3) ;
           //p3 = G4std::max(0,int(G4RandGauss::shoot(a3,siga)+0.5));
-          p3 = std::max(0,int(RandGaussQ::shoot(a3,siga)+0.5));
+          p3 = std::max(0,int(RandGaussQ::shoot(_engine, a3,siga)+0.5));
         }
         else
-          p3 = RandPoisson::shoot(a3);
+          p3 = RandPoisson::shoot(_engine, a3);
         //p3 = G4Poisson(a3);
 
         loss = p3*e0 ;
 
         if(p3 > 0)
           //loss += (1.-2.*G4UniformRand())*e0 ;
-          loss += (1.-2.*RandFlat::shoot())*e0 ;
+          loss += (1.-2.*RandFlat::shoot(_engine))*e0 ;
 
       }
       else
@@ -194,10 +250,10 @@ double MyG4UniversalFluctuationForSi::SampleFluctuations(const double momentum,
         {
           siga=sqrt(a3) ;
           //p3 = G4std::max(0,int(G4RandGauss::shoot(a3,siga)+0.5));
-          p3 = std::max(0,int(RandGaussQ::shoot(a3,siga)+0.5));
+          p3 = std::max(0,int(RandGaussQ::shoot(_engine, a3,siga)+0.5));
         }
         else
-          p3 = RandPoisson::shoot(a3);
+          p3 = RandPoisson::shoot(_engine, a3);
         //p3 = G4Poisson(a3);
 
         if(p3 > 0)
@@ -213,7 +269,7 @@ double MyG4UniversalFluctuationForSi::SampleFluctuations(const double momentum,
             corrfac = 1. ;
 
           //for(int i=0; i<p3; i++) loss += 1./(1.-w*G4UniformRand()) ;
-          for(int i=0; i<p3; i++) loss += 1./(1.-w*RandFlat::shoot()) ;
+          for(int i=0; i<p3; i++) loss += 1./(1.-w*RandFlat::shoot(_engine)) ;
           loss *= e0*corrfac ;  
         }        
       }
@@ -226,10 +282,10 @@ double MyG4UniversalFluctuationForSi::SampleFluctuations(const double momentum,
       {
         siga=sqrt(a1) ;
         //p1 = std::max(0,int(G4RandGauss::shoot(a1,siga)+0.5));
-        p1 = std::max(0,int(RandGaussQ::shoot(a1,siga)+0.5));
+        p1 = std::max(0,int(RandGaussQ::shoot(_engine, a1,siga)+0.5));
       }
       else
-       p1 = RandPoisson::shoot(a1);
+       p1 = RandPoisson::shoot(_engine, a1);
       //p1 = G4Poisson(a1);
 
       // excitation type 2
@@ -237,10 +293,10 @@ double MyG4UniversalFluctuationForSi::SampleFluctuations(const double momentum,
       {
         siga=sqrt(a2) ;
         //p2 = std::max(0,int(G4RandGauss::shoot(a2,siga)+0.5));
-        p2 = std::max(0,int(RandGaussQ::shoot(a2,siga)+0.5));
+        p2 = std::max(0,int(RandGaussQ::shoot(_engine, a2,siga)+0.5));
       }
       else
-        p2 = RandPoisson::shoot(a2);
+        p2 = RandPoisson::shoot(_engine, a2);
       //p2 = G4Poisson(a2);
 
       loss = p1*e1Fluct+p2*e2Fluct;
@@ -248,9 +304,9 @@ double MyG4UniversalFluctuationForSi::SampleFluctuations(const double momentum,
       // smearing to avoid unphysical peaks
       if(p2 > 0)
         //loss += (1.-2.*G4UniformRand())*e2Fluct;   
-        loss += (1.-2.*RandFlat::shoot())*e2Fluct;   
+        loss += (1.-2.*RandFlat::shoot(_engine))*e2Fluct;   
       else if (loss>0.)
-        loss += (1.-2.*RandFlat::shoot())*e1Fluct;   
+        loss += (1.-2.*RandFlat::shoot(_engine))*e1Fluct;   
 
       // ionisation .......................................
      if(a3 > 0.)
@@ -258,10 +314,10 @@ double MyG4UniversalFluctuationForSi::SampleFluctuations(const double momentum,
       if(a3>alim)
       {
         siga=sqrt(a3) ;
-        p3 = std::max(0,int(RandGaussQ::shoot(a3,siga)+0.5));
+        p3 = std::max(0,int(RandGaussQ::shoot(_engine, a3,siga)+0.5));
       }
       else
-        p3 = RandPoisson::shoot(a3);
+        p3 = RandPoisson::shoot(_engine, a3);
 
       lossc = 0.;
       if(p3 > 0)
@@ -274,7 +330,7 @@ double MyG4UniversalFluctuationForSi::SampleFluctuations(const double momentum,
           rfac       = dp3/(float(nmaxCont2)+dp3);
           namean     = float(p3)*rfac;
           sa         = float(nmaxCont1)*rfac;
-          na         = RandGaussQ::shoot(namean,sa);
+          na         = RandGaussQ::shoot(_engine, namean,sa);
           if (na > 0.)
           {
             alfa   = w1*float(nmaxCont2+p3)/
@@ -282,7 +338,7 @@ double MyG4UniversalFluctuationForSi::SampleFluctuations(const double momentum,
             alfa1  = alfa*log(alfa)/(alfa-1.);
             ea     = na*ipotFluct*alfa1;
             sea    = ipotFluct*sqrt(na*(alfa-alfa1*alfa1));
-            lossc += RandGaussQ::shoot(ea,sea);
+            lossc += RandGaussQ::shoot(_engine, ea,sea);
           }
         }
 
@@ -291,7 +347,7 @@ double MyG4UniversalFluctuationForSi::SampleFluctuations(const double momentum,
         {
           w2 = alfa*ipotFluct;
           w  = (tmax-w2)/tmax;      
-          for (int k=0; k<nb; k++) lossc += w2/(1.-w*RandFlat::shoot());
+          for (int k=0; k<nb; k++) lossc += w2/(1.-w*RandFlat::shoot(_engine));
         }
       }        
       loss += lossc;  
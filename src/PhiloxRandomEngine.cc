@@ -0,0 +1,169 @@
+#include "PhiloxRandomEngine.h"
+
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+    const uint32_t PHILOX_M0 = 0xD2511F53;
+    const uint32_t PHILOX_M1 = 0xCD9E8D57;
+    const uint32_t PHILOX_W0 = 0x9E3779B9;
+    const uint32_t PHILOX_W1 = 0xBB67AE85;
+    const int PHILOX_ROUNDS = 10;
+
+    inline uint64_t splitmix64(uint64_t x)
+    {
+        x += 0x9E3779B97F4A7C15ULL;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+}
+
+PhiloxRandomEngine::PhiloxRandomEngine(uint64_t key, uint64_t stream) :
+    CLHEP::HepRandomEngine(),
+    p_key(),
+    p_counter(),
+    p_output(),
+    p_used(4)
+{
+    SetStream(key, stream);
+}
+
+PhiloxRandomEngine::~PhiloxRandomEngine()
+{}
+
+void PhiloxRandomEngine::SetStream(uint64_t key, uint64_t stream)
+{
+    p_key[0] = uint32_t(key);
+    p_key[1] = uint32_t(key >> 32);
+    p_counter[0] = 0;
+    p_counter[1] = 0;
+    p_counter[2] = uint32_t(stream);
+    p_counter[3] = uint32_t(stream >> 32);
+    p_used = 4;
+}
+
+uint64_t PhiloxRandomEngine::MakeKey(long seed, int run, int event)
+{
+    uint64_t result = splitmix64(uint64_t(seed));
+    result = splitmix64(result ^ uint64_t(uint32_t(run)));
+    return splitmix64(result ^ uint64_t(uint32_t(event)));
+}
+
+uint64_t PhiloxRandomEngine::MakeStreamID(int layer, int ladder)
+{
+    return (uint64_t(uint32_t(layer)) << 32) | uint64_t(uint32_t(ladder));
+}
+
+void PhiloxRandomEngine::generate()
+{
+    uint32_t ctr[4] = { p_counter[0], p_counter[1], p_counter[2], p_counter[3] };
+    uint32_t key[2] = { p_key[0], p_key[1] };
+
+    for (int r = 0; r < PHILOX_ROUNDS; r++)
+    {
+        uint64_t prod0 = uint64_t(PHILOX_M0) * ctr[0];
+        uint64_t prod1 = uint64_t(PHILOX_M1) * ctr[2];
+        uint32_t hi0 = uint32_t(prod0 >> 32);
+        uint32_t lo0 = uint32_t(prod0);
+        uint32_t hi1 = uint32_t(prod1 >> 32);
+        uint32_t lo1 = uint32_t(prod1);
+
+        ctr[0] = hi1 ^ ctr[1] ^ key[0];
+        ctr[1] = lo1;
+        ctr[2] = hi0 ^ ctr[3] ^ key[1];
+        ctr[3] = lo0;
+
+        key[0] += PHILOX_W0;
+        key[1] += PHILOX_W1;
+    }
+
+    for (int k = 0; k < 4; k++) p_output[k] = ctr[k];
+    p_used = 0;
+
+    // 64 bit counter for the draws, the upper half of the counter holds the stream ID
+    if (++p_counter[0] == 0) ++p_counter[1];
+}
+
+double PhiloxRandomEngine::flat()
+{
+    if (p_used > 2) generate();
+
+    uint64_t bits = (uint64_t(p_output[p_used]) << 32) | p_output[p_used + 1];
+    p_used += 2;
+
+    // 53 random bits, the result lies in the open interval (0, 1) as in CLHEP engines
+    return (double(bits >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+void PhiloxRandomEngine::flatArray(const int size, double* vect)
+{
+    for (int i = 0; i < size; i++) vect[i] = flat();
+}
+
+void PhiloxRandomEngine::setSeed(long seed, int)
+{
+    SetStream(uint64_t(seed), 0);
+}
+
+void PhiloxRandomEngine::setSeeds(const long* seeds, int)
+{
+    if (seeds == nullptr || seeds[0] == 0)
+    {
+        SetStream(0, 0);
+        return;
+    }
+    SetStream(uint64_t(seeds[0]), uint64_t(seeds[1]));
+}
+
+void PhiloxRandomEngine::saveStatus(const char filename[]) const
+{
+    std::ofstream outFile(filename, std::ios::out);
+    if (!outFile.bad())
+    {
+        outFile << name() << std::endl;
+        outFile << p_key[0] << " " << p_key[1] << std::endl;
+        outFile << p_counter[0] << " " << p_counter[1] << " "
+                << p_counter[2] << " " << p_counter[3] << std::endl;
+        outFile << p_used << std::endl;
+    }
+}
+
+void PhiloxRandomEngine::restoreStatus(const char filename[])
+{
+    std::ifstream inFile(filename, std::ios::in);
+    std::string e_name;
+    if (!(inFile >> e_name) || e_name != name())
+    {
+        std::cerr << "  -- Engine state not found in " << filename << std::endl;
+        return;
+    }
+
+    inFile >> p_key[0] >> p_key[1];
+    inFile >> p_counter[0] >> p_counter[1] >> p_counter[2] >> p_counter[3];
+    inFile >> p_used;
+
+    // The output block is recomputed from the previous value of the counter
+    if (p_used < 4)
+    {
+        int used = p_used;
+        if (p_counter[0]-- == 0) p_counter[1]--;
+        generate();
+        p_used = used;
+    }
+}
+
+void PhiloxRandomEngine::showStatus() const
+{
+    std::cout << "--------- " << name() << " engine status ---------" << std::endl;
+    std::cout << " Key = " << p_key[0] << " " << p_key[1] << std::endl;
+    std::cout << " Counter = " << p_counter[0] << " " << p_counter[1] << " "
+              << p_counter[2] << " " << p_counter[3] << std::endl;
+    std::cout << "----------------------------------------" << std::endl;
+}
+
+std::string PhiloxRandomEngine::name() const
+{
+    return "PhiloxRandomEngine";
+}
@@ -0,0 +1,128 @@
+#include "PixelChargeKernel.h"
+
+#include "gsl/gsl_sf_erf.h"
+
+namespace
+{
+    /*
+     * Table of the standard normal CDF and PDF on [-CDF_RANGE, CDF_RANGE] with step 1/CDF_STEPS.
+     * The error of the cubic Hermite interpolation is bounded by h^4 / 384 * max|phi'''|,
+     * that is 1.55e-10 * 0.55 < 1e-10 for h = 1/64; beyond the range the CDF differs
+     * from 0 or 1 by less than 1e-15.
+     */
+    const double CDF_RANGE = 8.;
+    const int CDF_STEPS = 64;
+    const int CDF_NODES = 2 * int(CDF_RANGE) * CDF_STEPS + 1;
+
+    struct CDFTable
+    {
+        CDFTable() : cdf(CDF_NODES, 0.), pdf(CDF_NODES, 0.)
+        {
+            for (int k = 0; k < CDF_NODES; k++)
+            {
+                double x = -CDF_RANGE + double(k) / CDF_STEPS;
+                cdf[k] = 1. - gsl_sf_erf_Q(x);
+                pdf[k] = gsl_sf_erf_Z(x);
+            }
+        }
+
+        std::vector<double> cdf;
+        std::vector<double> pdf;
+    };
+
+    const CDFTable& GetCDFTable()
+    {
+        static const CDFTable table {};
+        return table;
+    }
+}
+
+PixelChargeKernel::PixelChargeKernel(GaussCDFMode mode) :
+    _mode(mode),
+    b_ny(0),
+    cdf_buffer(),
+    wx_buffer(),
+    wy_buffer(),
+    q_buffer()
+{
+    if (_mode == GaussCDFMode::tabulated) GetCDFTable();
+}
+
+PixelChargeKernel::~PixelChargeKernel()
+{}
+
+double PixelChargeKernel::ExactCDF(double x)
+{
+    gsl_sf_result result;
+    gsl_sf_erf_Q_e(x, &result);
+    return 1 - result.val;
+}
+
+double PixelChargeKernel::TabulatedCDF(double x)
+{
+    if (x <= -CDF_RANGE) return 0.;
+    if (x >= CDF_RANGE) return 1.;
+
+    const CDFTable& table = GetCDFTable();
+    double t = (x + CDF_RANGE) * CDF_STEPS;
+    int k = int(t);
+    if (k > CDF_NODES - 2) k = CDF_NODES - 2;
+    double u = t - k;
+    double u2 = u * u;
+    double u3 = u2 * u;
+
+    const double h = 1. / CDF_STEPS;
+    return (2 * u3 - 3 * u2 + 1) * table.cdf[k]
+         + (u3 - 2 * u2 + u) * h * table.pdf[k]
+         + (-2 * u3 + 3 * u2) * table.cdf[k + 1]
+         + (u3 - u2) * h * table.pdf[k + 1];
+}
+
+double PixelChargeKernel::CDF(double x) const
+{
+    return _mode == GaussCDFMode::tabulated ? TabulatedCDF(x) : ExactCDF(x);
+}
+
+void PixelChargeKernel::IntegrateAxis(double first_edge, double pitch, double centre, double sigma,
+                                      int n, double* fractions)
+{
+    if (n <= 0) return;
+
+    cdf_buffer.resize(n + 1);
+    for (int k = 0; k <= n; k++)
+    {
+        cdf_buffer[k] = CDF((first_edge + k * pitch - centre) / sigma);
+    }
+
+    for (int k = 0; k < n; k++)
+    {
+        fractions[k] = cdf_buffer[k + 1] - cdf_buffer[k];
+    }
+}
+
+void PixelChargeKernel::Deposit(double x_edge, double pitch_x, int nx,
+                                double y_edge, double pitch_y, int ny,
+                                double x, double y, double sigmaX, double sigmaY, double charge)
+{
+    b_ny = ny;
+    if (nx <= 0 || ny <= 0) return;
+
+    wx_buffer.resize(nx);
+    wy_buffer.resize(ny);
+    q_buffer.resize(nx * ny);
+
+    IntegrateAxis(x_edge, pitch_x, x, sigmaX, nx, wx_buffer.data());
+    IntegrateAxis(y_edge, pitch_y, y, sigmaY, ny, wy_buffer.data());
+
+    const double* wy = wy_buffer.data();
+    for (int i = 0; i < nx; i++)
+    {
+        double cx = charge * wx_buffer[i];
+        float* q_row = q_buffer.data() + i * ny;
+#pragma omp simd
+        for (int j = 0; j < ny; j++)
+        {
+            q_row[j] = float(cx * wy[j]);
+        }
+    }
+}
@@ -1,7 +1,10 @@
 #include "PixelDigiMatrix.h"
 #include <cmath>
+#include <limits>
 #include "streamlog/streamlog.h"
 
+using int_limits = std::numeric_limits<int>;
+
 PixelDigiMatrix::PixelDigiMatrix(int layer,
                                  int ladder,
                                  int xsegmentNumber,
@@ -33,109 +36,137 @@ PixelDigiMatrix::PixelDigiMatrix(int layer,
                     t_step),
     delta_c(t_step * fe_slope),
     clock_cnt(0),
-    pixels(),
-    expir_table(),
-    charge_buffer(),
-    start_table()
+    p_store(l_rows, l_columns),
+    e_wheel(),
+    start_lists(x_segnum * y_segnum),
+    ready_lists(x_segnum * y_segnum)
 {}
 
 PixelDigiMatrix::~PixelDigiMatrix()
 {}
 
+void PixelDigiMatrix::Rebind(int ladder, float starttime)
+{
+    AbstractSensor::Rebind(ladder, starttime);
+    clock_cnt = 0;
+}
+
 void PixelDigiMatrix::Reset()
 {
-    pixels.clear();
+    p_store.Clear();
+    e_wheel.Clear();
+    for (auto& s_list : start_lists) s_list.clear();
+    for (auto& r_list : ready_lists) r_list.clear();
 }
 
 void PixelDigiMatrix::BeginClockStep()
 {
-    if (expir_table.find(clock_cnt) != expir_table.end())
+    p_store.ClearBuffer();
+
+    // Entries not matching the current clock belong to a further turn of the wheel
+    vector<ExpiryWheel::Entry>& bucket = e_wheel.Bucket(clock_cnt);
+    std::size_t n_kept = 0;
+    for (std::size_t k = 0; k < bucket.size(); k++)
     {
-        for (auto pixpos : expir_table[clock_cnt])
+        ExpiryWheel::Entry entry = bucket[k];
+        if (entry.t_end == clock_cnt)
         {
-            pixels.erase(pixpos.second);
+            PixelCell* cell = p_store.Find(entry.row, entry.col);
+            if (cell != nullptr && cell->t_end == clock_cnt) p_store.Erase(entry.row, entry.col);
+        }
+        else if (entry.t_end > clock_cnt)
+        {
+            bucket[n_kept++] = entry;
         }
-        expir_table.erase(clock_cnt);
     }
+    bucket.resize(n_kept);
 
-    charge_buffer.clear();
-    start_table.clear();
+    for (auto& s_list : start_lists) s_list.clear();
+    for (auto& r_list : ready_lists) r_list.clear();
 }
 
 void PixelDigiMatrix::UpdatePixel(int x, int y, float chrg)
 {
     if (!check(x, y)) return;
 
-    LinearPosition lpos = l_locate(x, y);
-    auto cb_iter = charge_buffer.find(lpos);
-    if (cb_iter == charge_buffer.end())
-    {
-        charge_buffer.emplace(lpos, chrg);
-    }
-    else
-    {
-        charge_buffer[lpos] = cb_iter->second + chrg;
-    }
+    p_store.Accumulate(x, y, chrg);
 }
 
 void PixelDigiMatrix::EndClockStep()
 {
     clock_cnt += 1;
 
-    if (charge_buffer.size() == 0) return;
-
-    for (auto chrg_item : charge_buffer)
+    p_store.ForEachBuffered([this](int row, int col, float chrg)
     {
-        LinearPosition lpos = chrg_item.first;
-        float chrg = chrg_item.second;
-
-        LinearPosition s_pos = sensor_for_pixel(lpos);
-        ClockTicks pix_expir = 0;
-
-        auto pix = pixels.find(lpos);
-        if (pix == pixels.end())
+        PixelCell* cell = p_store.Find(row, col);
+        if (cell == nullptr)
         {
-            pix_expir = calc_end_clock(chrg);
-            if (pix_expir == 0) continue;
+            ClockTicks pix_expir = calc_end_clock(chrg);
+            if (pix_expir == 0) return;
 
             pix_expir += clock_cnt;
-            PixelRawData p_data { chrg, clock_cnt, pix_expir };
-            pixels.emplace(lpos, p_data);
+            p_store.Insert(row, col) = { chrg, clock_cnt, pix_expir };
+            e_wheel.Schedule(pix_expir, row, col);
 
-            start_table.emplace(s_pos, lpos);
+            start_lists[sensor_for_pixel(row, col)].push_back({ row, col });
         }
         else
         {
             // Pixel pile-up
-            float new_chrg = (pix->second).charge + chrg;
-            pixels[lpos].charge = new_chrg;
+            cell->charge += chrg;
 
-            pix_expir = calc_end_clock(new_chrg);
-            if (pix_expir == 0) continue;
+            ClockTicks pix_expir = calc_end_clock(cell->charge);
+            if (pix_expir == 0) return;
 
-            pix_expir += pixels[lpos].t_begin;
-            ClockTicks prev_expir = pixels[lpos].t_end;
-            auto d_range = expir_table[prev_expir].equal_range(s_pos);
-            for (auto it = d_range.first; it != d_range.second; it++)
+            pix_expir += cell->t_begin;
+            if (pix_expir != cell->t_end)
             {
-                if (it->second == lpos)
-                {
-                    expir_table[prev_expir].erase(it);
-                    break;
-                }
+                // the previous entry in the wheel becomes stale
+                cell->t_end = pix_expir;
+                e_wheel.Schedule(pix_expir, row, col);
             }
+        }
+    });
 
-            pixels[lpos].t_end = pix_expir;
+    /*
+     * Pixels ready for the readout in the current clock, grouped by sensor
+     */
+    for (ExpiryWheel::Entry& entry : e_wheel.Bucket(clock_cnt))
+    {
+        if (entry.t_end != clock_cnt) continue;
 
-        }
+        PixelCell* cell = p_store.Find(entry.row, entry.col);
+        if (cell == nullptr || cell->t_end != clock_cnt) continue;
+        if (!p_store.Mark(entry.row, entry.col)) continue;
 
-        if (expir_table.find(pix_expir) == expir_table.end())
-        {
-            SensorBin sBin {};
-            expir_table.emplace(pix_expir, sBin);
-        }
-        expir_table[pix_expir].emplace(s_pos, lpos);
+        ready_lists[sensor_for_pixel(entry.row, entry.col)].push_back({ entry.row, entry.col });
     }
+    p_store.ClearMarks();
+}
+
+int PixelDigiMatrix::GetIdleClockSteps()
+{
+    // The pixels expiring in the current clock are removed by the next step without any output
+    ClockTicks next_end = int_limits::max();
+    e_wheel.ForEach([this, &next_end](const ExpiryWheel::Entry& entry)
+    {
+        if (entry.t_end <= clock_cnt || entry.t_end >= next_end) return;
+
+        PixelCell* cell = p_store.Find(entry.row, entry.col);
+        if (cell != nullptr && cell->t_end == entry.t_end) next_end = entry.t_end;
+    });
+
+    if (next_end == int_limits::max()) return int_limits::max();
+    return next_end - clock_cnt - 1;
+}
+
+void PixelDigiMatrix::SkipClockSteps(int n)
+{
+    if (n <= 0) return;
+
+    // No pixel becomes ready in the skipped steps, the expirations of the current clock are processed
+    BeginClockStep();
+    clock_cnt += n;
 }
 
 PixelData PixelDigiMatrix::GetPixel(int x, int y)
@@ -149,45 +180,43 @@ PixelData PixelDigiMatrix::GetPixel(int x, int y)
         return { 0, 0, PixelStatus::out_of_bounds };
     }
 
-    LinearPosition lpos = l_locate(x, y);
-    auto pstat = calc_status(lpos);
+    PixelCell* cell = p_store.Find(x, y);
+    auto pstat = calc_status(cell);
 
     PixelData result { 0, 0, pstat };
 
     if (pstat != PixelStatus::off)
     {
-        result.time = init_time + pixels[lpos].t_begin * clock_step;
+        result.time = init_time + cell->t_begin * clock_step;
     }
     if  (pstat == PixelStatus::ready)
     {
-        result.charge = (pixels[lpos].t_end - pixels[lpos].t_begin) * delta_c;
+        result.charge = (cell->t_end - cell->t_begin) * delta_c;
     }
     return result;
 }
 
 bool PixelDigiMatrix::IsActive()
 {
-    return pixels.size() > 0;
+    return p_store.Size() > 0;
 }
 
 bool PixelDigiMatrix::CheckStatus(int x, int y, PixelStatus pstat)
 {
     if (!check(x, y)) return pstat == PixelStatus::out_of_bounds;
 
-    return pstat == calc_status(l_locate(x, y));
+    return pstat == calc_status(p_store.Find(x, y));
 }
 
 bool PixelDigiMatrix::CheckStatusOnSensor(int seg_x, int seg_y, PixelStatus pstat)
 {
-    if (pstat == PixelStatus::ready and expir_table.find(clock_cnt) != expir_table.end())
+    if (pstat == PixelStatus::ready)
     {
-        auto d_range = expir_table[clock_cnt].equal_range(s_locate(seg_x, seg_y));
-        return d_range.first != d_range.second;
+        return !ready_lists[s_locate(seg_x, seg_y)].empty();
     }
     if (pstat == PixelStatus::start)
     {
-        auto d_range = start_table.equal_range(s_locate(seg_x, seg_y));
-        return d_range.first != d_range.second;
+        return !start_lists[s_locate(seg_x, seg_y)].empty();
     }
 
     return false;
@@ -197,49 +226,33 @@ vector<LocatedPixel> PixelDigiMatrix::GetPixelsFromSensor(int seg_x, int seg_y,
 {
     vector<LocatedPixel> result;
 
-    if (pstat == PixelStatus::ready and expir_table.find(clock_cnt) != expir_table.end())
-    {
-        auto d_range = expir_table[clock_cnt].equal_range(s_locate(seg_x, seg_y));
-        for (auto it = d_range.first; it != d_range.second; it++)
-        {
-            GridCoordinate g_pos = l_locate(it->second);
-            LocatedPixel l_pix
-            {
-                LadderRowToSensorRow(g_pos.row, seg_x),
-                LadderColToSensorCol(g_pos.col, seg_y),
-                GetPixel(g_pos.row, g_pos.col)
-            };
-            result.push_back(l_pix);
-        }
-    }
+    vector<GridCoordinate>* p_list = nullptr;
+    if (pstat == PixelStatus::ready) p_list = &ready_lists[s_locate(seg_x, seg_y)];
+    if (pstat == PixelStatus::start) p_list = &start_lists[s_locate(seg_x, seg_y)];
+    if (p_list == nullptr) return result;
 
-    if (pstat == PixelStatus::start)
+    result.reserve(p_list->size());
+    for (GridCoordinate g_pos : *p_list)
     {
-        auto d_range = start_table.equal_range(s_locate(seg_x, seg_y));
-        for (auto it = d_range.first; it != d_range.second; it++)
+        LocatedPixel l_pix
         {
-            GridCoordinate g_pos = l_locate(it->second);
-            LocatedPixel l_pix
-            {
-                LadderRowToSensorRow(g_pos.row, seg_x),
-                LadderColToSensorCol(g_pos.col, seg_y),
-                GetPixel(g_pos.row, g_pos.col)
-            };
-            result.push_back(l_pix);
-        }
+            LadderRowToSensorRow(g_pos.row, seg_x),
+            LadderColToSensorCol(g_pos.col, seg_y),
+            GetPixel(g_pos.row, g_pos.col)
+        };
+        result.push_back(l_pix);
     }
 
     return result;
 }
 
-PixelStatus PixelDigiMatrix::calc_status(LinearPosition lpos)
+PixelStatus PixelDigiMatrix::calc_status(const PixelCell* cell)
 {
-    auto pix = pixels.find(lpos);
-    if ( pix == pixels.end()) return PixelStatus::off;
+    if (cell == nullptr) return PixelStatus::off;
 
-    if ((pix->second).t_begin == clock_cnt) return PixelStatus::start;
+    if (cell->t_begin == clock_cnt) return PixelStatus::start;
 
-    if ((pix->second).t_end == clock_cnt) return PixelStatus::ready;
+    if (cell->t_end == clock_cnt) return PixelStatus::ready;
 
     return PixelStatus::on;
 }
@@ -252,7 +265,12 @@ ClockTicks PixelDigiMatrix::calc_end_clock(float charge)
     return std::ceil((charge - _thr_level) / delta_c);
 }
 
-LinearPosition PixelDigiMatrix::sensor_for_pixel(LinearPosition pos)
+const vector<GridCoordinate>& PixelDigiMatrix::GetStartPixels(int seg_x, int seg_y)
+{
+    return start_lists[s_locate(seg_x, seg_y)];
+}
+
+LinearPosition PixelDigiMatrix::sensor_for_pixel(int row, int col)
 {
-    return s_locate((pos / l_columns) / s_rows, (pos % l_columns) / s_colums);
+    return s_locate(row / s_rows, col / s_colums);
 }
@@ -0,0 +1,49 @@
+#include "PixelNoiseGenerator.h"
+
+#include "gsl/gsl_sf_erf.h"
+#include "gsl/gsl_cdf.h"
+
+#include <cmath>
+#include <limits>
+
+namespace
+{
+    // Upper bound of a skip, far beyond any run and safe from overflows of the sums
+    const double MAX_SKIP = double(std::numeric_limits<int64_t>::max() / 4);
+}
+
+PixelNoiseGenerator::PixelNoiseGenerator(double noise, double threshold) :
+    n_noise(noise),
+    n_prob(0.),
+    n_logq(0.),
+    n_step(1),
+    n_next(0),
+    n_engine(nullptr)
+{
+    // Without noise, or with a non positive threshold, there is nothing to sample
+    if (noise > 0. && threshold > 0.)
+    {
+        n_prob = gsl_sf_erf_Q(threshold / noise);
+        n_logq = std::log1p(-n_prob);
+    }
+}
+
+void PixelNoiseGenerator::Start(CLHEP::HepRandomEngine* engine, int64_t n_pixels)
+{
+    n_engine = engine;
+    n_step = n_pixels > 0 ? n_pixels : 1;
+    n_next = Enabled() ? NextSkip() : 0;
+}
+
+int64_t PixelNoiseGenerator::NextSkip()
+{
+    // Number of failures before a success, the flat numbers of CLHEP are in (0, 1)
+    double skip = std::floor(std::log(n_engine->flat()) / n_logq);
+    return skip < MAX_SKIP ? int64_t(skip) : int64_t(MAX_SKIP);
+}
+
+float PixelNoiseGenerator::NextCharge()
+{
+    // Inversion of the gaussian tail: P(q > x) is uniform in (0, p)
+    return float(n_noise * gsl_cdf_ugaussian_Qinv(n_engine->flat() * n_prob));
+}
@@ -0,0 +1,200 @@
+#include "PixelOffloadKernel.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+#ifdef OFFLOAD_ENABLED
+#pragma omp declare target
+#endif
+    // The box of an item of a flat loop, the offsets are increasing with the boxes not empty
+    inline int FindBox(const int* offsets, int n_boxes, int pos)
+    {
+        int lo = 0;
+        int hi = n_boxes;
+        while (hi - lo > 1)
+        {
+            int mid = (lo + hi) / 2;
+            if (offsets[mid] <= pos) lo = mid;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    inline double NormalCDF(double x)
+    {
+        return 0.5 * std::erfc(-x * M_SQRT1_2);
+    }
+#ifdef OFFLOAD_ENABLED
+#pragma omp end declare target
+#endif
+}
+
+PixelOffloadKernel::PixelOffloadKernel() :
+    boxes(),
+    x_offsets(),
+    y_offsets(),
+    q_offsets(),
+    cdf_x(),
+    cdf_y(),
+    q_buffer(),
+    m_regions(),
+    mapped(false)
+{}
+
+PixelOffloadKernel::~PixelOffloadKernel()
+{
+    UnmapBuffers();
+}
+
+template<class T>
+void PixelOffloadKernel::Grow(std::vector<T>& buffer, std::size_t n)
+{
+    // Doubled capacity, the mapping of the device follows the capacity of the buffers
+    if (n > buffer.capacity()) buffer.reserve(std::max(n, 2 * buffer.capacity()));
+    buffer.resize(n);
+}
+
+void PixelOffloadKernel::GetRegions(MappedRegion* regions) const
+{
+    regions[0] = { boxes.data(), boxes.capacity() * sizeof(OffloadBox) };
+    regions[1] = { x_offsets.data(), x_offsets.capacity() * sizeof(int) };
+    regions[2] = { y_offsets.data(), y_offsets.capacity() * sizeof(int) };
+    regions[3] = { q_offsets.data(), q_offsets.capacity() * sizeof(int) };
+    regions[4] = { cdf_x.data(), cdf_x.capacity() * sizeof(double) };
+    regions[5] = { cdf_y.data(), cdf_y.capacity() * sizeof(double) };
+    regions[6] = { q_buffer.data(), q_buffer.capacity() * sizeof(float) };
+}
+
+bool PixelOffloadKernel::MappingChanged() const
+{
+    if (!mapped) return true;
+
+    MappedRegion c_regions[N_REGIONS];
+    GetRegions(c_regions);
+    for (int r = 0; r < N_REGIONS; r++)
+    {
+        if (c_regions[r].data != m_regions[r].data || c_regions[r].capacity != m_regions[r].capacity) return true;
+    }
+    return false;
+}
+
+void PixelOffloadKernel::MapBuffers()
+{
+    GetRegions(m_regions);
+#ifdef OFFLOAD_ENABLED
+    for (const MappedRegion& region : m_regions)
+    {
+        const char* r_data = static_cast<const char*>(region.data);
+        std::size_t r_bytes = region.capacity;
+        if (r_data == nullptr) continue;
+#pragma omp target enter data map(alloc: r_data[0:r_bytes])
+    }
+#endif
+    mapped = true;
+}
+
+void PixelOffloadKernel::UnmapBuffers()
+{
+    if (!mapped) return;
+#ifdef OFFLOAD_ENABLED
+    for (const MappedRegion& region : m_regions)
+    {
+        const char* r_data = static_cast<const char*>(region.data);
+        std::size_t r_bytes = region.capacity;
+        if (r_data == nullptr) continue;
+#pragma omp target exit data map(delete: r_data[0:r_bytes])
+    }
+#endif
+    mapped = false;
+}
+
+void PixelOffloadKernel::Clear()
+{
+    boxes.clear();
+}
+
+void PixelOffloadKernel::Deposit(double pitch_x, double pitch_y)
+{
+    int n_boxes = int(boxes.size());
+    if (n_boxes == 0) return;
+
+    // The edges of a box are one more than its rows and columns
+    Grow(x_offsets, n_boxes + 1);
+    Grow(y_offsets, n_boxes + 1);
+    Grow(q_offsets, n_boxes + 1);
+    x_offsets[0] = 0;
+    y_offsets[0] = 0;
+    q_offsets[0] = 0;
+    for (int b = 0; b < n_boxes; b++)
+    {
+        x_offsets[b + 1] = x_offsets[b] + boxes[b].nx + 1;
+        y_offsets[b + 1] = y_offsets[b] + boxes[b].ny + 1;
+        q_offsets[b + 1] = q_offsets[b] + boxes[b].nx * boxes[b].ny;
+    }
+
+    int n_x = x_offsets[n_boxes];
+    int n_y = y_offsets[n_boxes];
+    int n_q = q_offsets[n_boxes];
+    Grow(cdf_x, n_x);
+    Grow(cdf_y, n_y);
+    Grow(q_buffer, n_q);
+
+    // The buffers stay on the device across the calls while they do not move on the host
+    if (MappingChanged())
+    {
+        UnmapBuffers();
+        MapBuffers();
+    }
+
+    const OffloadBox* b_data = boxes.data();
+    const int* xo = x_offsets.data();
+    const int* yo = y_offsets.data();
+    const int* qo = q_offsets.data();
+    double* cx = cdf_x.data();
+    double* cy = cdf_y.data();
+    float* q = q_buffer.data();
+
+    // The edge CDFs stay on the device, only the boxes are copied in and the charges back
+#ifdef OFFLOAD_ENABLED
+#pragma omp target update to(b_data[0:n_boxes], xo[0:n_boxes + 1], yo[0:n_boxes + 1], qo[0:n_boxes + 1])
+#pragma omp target teams distribute parallel for map(alloc: b_data[0:n_boxes], xo[0:n_boxes + 1], cx[0:n_x])
+#endif
+    for (int e = 0; e < n_x; e++)
+    {
+        int b = FindBox(xo, n_boxes, e);
+        const OffloadBox& box = b_data[b];
+        cx[e] = NormalCDF((box.x_edge + (e - xo[b]) * pitch_x - box.x) / box.sigma_x);
+    }
+
+#ifdef OFFLOAD_ENABLED
+#pragma omp target teams distribute parallel for map(alloc: b_data[0:n_boxes], yo[0:n_boxes + 1], cy[0:n_y])
+#endif
+    for (int e = 0; e < n_y; e++)
+    {
+        int b = FindBox(yo, n_boxes, e);
+        const OffloadBox& box = b_data[b];
+        cy[e] = NormalCDF((box.y_edge + (e - yo[b]) * pitch_y - box.y) / box.sigma_y);
+    }
+
+#ifdef OFFLOAD_ENABLED
+#pragma omp target teams distribute parallel for \
+    map(alloc: b_data[0:n_boxes], xo[0:n_boxes + 1], yo[0:n_boxes + 1], qo[0:n_boxes + 1], \
+               cx[0:n_x], cy[0:n_y], q[0:n_q])
+#endif
+    for (int p = 0; p < n_q; p++)
+    {
+        int b = FindBox(qo, n_boxes, p);
+        const OffloadBox& box = b_data[b];
+        int i = (p - qo[b]) / box.ny;
+        int j = (p - qo[b]) % box.ny;
+        const double* bx = cx + xo[b];
+        const double* by = cy + yo[b];
+        q[p] = float(box.charge * (bx[i + 1] - bx[i]) * (by[j + 1] - by[j]));
+    }
+
+#ifdef OFFLOAD_ENABLED
+#pragma omp target update from(q[0:n_q])
+#endif
+}
@@ -0,0 +1,179 @@
+#include "PixelTileStore.h"
+
+PixelTileStore::PixelTileStore(int rows, int cols) :
+    t_cols((cols + TILE_MASK) >> TILE_SHIFT),
+    n_pixels(0),
+    tile_index(((rows + TILE_MASK) >> TILE_SHIFT) * ((cols + TILE_MASK) >> TILE_SHIFT), -1),
+    tile_pool(),
+    free_tiles(),
+    dirty_tiles(),
+    marked_tiles()
+{}
+
+PixelTileStore::~PixelTileStore()
+{}
+
+void PixelTileStore::Clear()
+{
+    for (std::size_t t_idx = 0; t_idx < tile_pool.size(); t_idx++)
+    {
+        PixelTile& tile = tile_pool[t_idx];
+        if (tile.tile_id < 0) continue;
+        tile_index[tile.tile_id] = -1;
+        tile.tile_id = -1;
+        tile.occupied = 0;
+        tile.buffered = 0;
+        tile.marked = 0;
+        free_tiles.push_back(t_idx);
+    }
+    dirty_tiles.clear();
+    marked_tiles.clear();
+    n_pixels = 0;
+}
+
+PixelCell* PixelTileStore::Find(int row, int col)
+{
+    int t_idx = tile_index[tile_for(row, col)];
+    if (t_idx < 0) return nullptr;
+
+    int bit = bit_for(row, col);
+    PixelTile& tile = tile_pool[t_idx];
+    if ((tile.occupied >> bit & 1) == 0) return nullptr;
+    return tile.cells + bit;
+}
+
+PixelCell& PixelTileStore::Insert(int row, int col)
+{
+    PixelTile& tile = tile_pool[get_tile(row, col)];
+    int bit = bit_for(row, col);
+    if ((tile.occupied >> bit & 1) == 0)
+    {
+        tile.occupied |= uint64_t(1) << bit;
+        tile.cells[bit] = { 0, 0, 0 };
+        n_pixels++;
+    }
+    return tile.cells[bit];
+}
+
+void PixelTileStore::Erase(int row, int col)
+{
+    int t_idx = tile_index[tile_for(row, col)];
+    if (t_idx < 0) return;
+
+    int bit = bit_for(row, col);
+    PixelTile& tile = tile_pool[t_idx];
+    if ((tile.occupied >> bit & 1) == 0) return;
+
+    tile.occupied &= ~(uint64_t(1) << bit);
+    n_pixels--;
+
+    if (tile.occupied == 0 && tile.buffered == 0 && tile.marked == 0) release_tile(t_idx);
+}
+
+void PixelTileStore::Accumulate(int row, int col, float chrg)
+{
+    int t_idx = get_tile(row, col);
+    PixelTile& tile = tile_pool[t_idx];
+    int bit = bit_for(row, col);
+
+    if (tile.buffered == 0) dirty_tiles.push_back(t_idx);
+
+    if ((tile.buffered >> bit & 1) == 0)
+    {
+        tile.buffered |= uint64_t(1) << bit;
+        tile.buffer[bit] = chrg;
+    }
+    else
+    {
+        tile.buffer[bit] += chrg;
+    }
+}
+
+void PixelTileStore::ClearBuffer()
+{
+    for (int t_idx : dirty_tiles)
+    {
+        PixelTile& tile = tile_pool[t_idx];
+        tile.buffered = 0;
+        if (tile.occupied == 0 && tile.marked == 0) release_tile(t_idx);
+    }
+    dirty_tiles.clear();
+}
+
+bool PixelTileStore::Mark(int row, int col)
+{
+    int t_idx = tile_index[tile_for(row, col)];
+    if (t_idx < 0) return false;
+
+    int bit = bit_for(row, col);
+    PixelTile& tile = tile_pool[t_idx];
+    if ((tile.occupied >> bit & 1) == 0 || (tile.marked >> bit & 1) == 1) return false;
+
+    if (tile.marked == 0) marked_tiles.push_back(t_idx);
+    tile.marked |= uint64_t(1) << bit;
+    return true;
+}
+
+void PixelTileStore::ClearMarks()
+{
+    for (int t_idx : marked_tiles)
+    {
+        PixelTile& tile = tile_pool[t_idx];
+        tile.marked = 0;
+        if (tile.occupied == 0 && tile.buffered == 0) release_tile(t_idx);
+    }
+    marked_tiles.clear();
+}
+
+int PixelTileStore::get_tile(int row, int col)
+{
+    int tile_id = tile_for(row, col);
+    int t_idx = tile_index[tile_id];
+    if (t_idx >= 0) return t_idx;
+
+    if (free_tiles.empty())
+    {
+        t_idx = tile_pool.size();
+        tile_pool.emplace_back();
+    }
+    else
+    {
+        t_idx = free_tiles.back();
+        free_tiles.pop_back();
+    }
+
+    PixelTile& tile = tile_pool[t_idx];
+    tile.occupied = 0;
+    tile.buffered = 0;
+    tile.marked = 0;
+    tile.tile_id = tile_id;
+    tile_index[tile_id] = t_idx;
+    return t_idx;
+}
+
+void PixelTileStore::release_tile(int t_idx)
+{
+    PixelTile& tile = tile_pool[t_idx];
+    if (tile.tile_id < 0) return;
+    tile_index[tile.tile_id] = -1;
+    tile.tile_id = -1;
+    free_tiles.push_back(t_idx);
+}
+
+ExpiryWheel::ExpiryWheel(int size) :
+    w_mask(0),
+    buckets()
+{
+    int w_size = 1;
+    while (w_size < size) w_size <<= 1;
+    w_mask = w_size - 1;
+    buckets.resize(w_size);
+}
+
+ExpiryWheel::~ExpiryWheel()
+{}
+
+void ExpiryWheel::Clear()
+{
+    for (vector<Entry>& bucket : buckets) bucket.clear();
+}
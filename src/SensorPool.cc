@@ -0,0 +1,35 @@
+#include "SensorPool.h"
+
+SensorPool::SensorPool() :
+    s_layer(-1),
+    sensor()
+{}
+
+SensorPool::~SensorPool()
+{}
+
+void SensorPool::SetSensor(int layer, AbstractSensor* l_sensor)
+{
+    if (layer < 0)
+    {
+        delete l_sensor;
+        return;
+    }
+    sensor.reset(l_sensor);
+    s_layer = layer;
+}
+
+AbstractSensor* SensorPool::GetSensor(int layer, int ladder, float starttime, const std::string& enc_str)
+{
+    if (layer < 0 || layer != s_layer || !sensor) return nullptr;
+
+    if (sensor->GetCellIDFormatStr() != enc_str) sensor->SetCellIDFormatStr(enc_str);
+    sensor->Rebind(ladder, starttime);
+    return sensor.get();
+}
+
+void SensorPool::Clear()
+{
+    sensor.reset();
+    s_layer = -1;
+}
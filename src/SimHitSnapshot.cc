@@ -0,0 +1,110 @@
+#include "SimHitSnapshot.h"
+
+#include <algorithm>
+#include <EVENT/LCIO.h>
+#include <EVENT/MCParticle.h>
+#include <UTIL/CellIDDecoder.h>
+#include "DD4hep/DD4hepUnits.h"
+
+using std::max;
+using std::string;
+using UTIL::CellIDDecoder;
+
+SimHitSnapshot::SimHitSnapshot(const LCCollection* STHcol, bool parallel_build,
+                               const vector<char>* h_mask) :
+    h_ptr(),
+    h_time(),
+    h_pos_x(),
+    h_pos_y(),
+    h_pos_z(),
+    h_mom_x(),
+    h_mom_y(),
+    h_mom_z(),
+    h_mass(),
+    h_edep(),
+    h_cell_id(),
+    h_layer(),
+    h_ladder(),
+    h_sensor(),
+    h_side(),
+    h_overlay(),
+    max_layer(-1),
+    max_ladder(-1)
+{
+    int n_hits = STHcol->getNumberOfElements();
+    string enc_str { STHcol->getParameters().getStringVal(EVENT::LCIO::CellIDEncoding) };
+
+    h_ptr.assign(n_hits, nullptr);
+    h_time.assign(n_hits, 0.f);
+    h_pos_x.assign(n_hits, 0.);
+    h_pos_y.assign(n_hits, 0.);
+    h_pos_z.assign(n_hits, 0.);
+    h_mom_x.assign(n_hits, 0.);
+    h_mom_y.assign(n_hits, 0.);
+    h_mom_z.assign(n_hits, 0.);
+    h_mass.assign(n_hits, 0.);
+    h_edep.assign(n_hits, 0.f);
+    h_cell_id.assign(n_hits, 0);
+    h_layer.assign(n_hits, -1);
+    h_ladder.assign(n_hits, -1);
+    h_sensor.assign(n_hits, 0);
+    h_side.assign(n_hits, 0);
+    h_overlay.assign(n_hits, 0);
+
+    int m_layer = -1;
+    int m_ladder = -1;
+
+#pragma omp parallel if(parallel_build) reduction(max:m_layer,m_ladder)
+    {
+        // The decoder keeps the last decoded value, one decoder for each thread
+        CellIDDecoder<SimTrackerHit> cellid_decoder { enc_str };
+
+#pragma omp for schedule(static)
+        for (int i = 0; i < n_hits; ++i)
+        {
+            SimTrackerHit* hit = static_cast<SimTrackerHit*>(STHcol->getElementAt(i));
+            h_ptr[i] = hit;
+            if (h_mask != nullptr && (*h_mask)[i] == 0) continue;
+
+            h_time[i] = hit->getTime();
+            h_pos_x[i] = hit->getPosition()[0];
+            h_pos_y[i] = hit->getPosition()[1];
+            h_pos_z[i] = hit->getPosition()[2];
+            h_edep[i] = hit->getEDep();
+            h_cell_id[i] = hit->getCellID0();
+            h_overlay[i] = hit->isOverlay() ? 1 : 0;
+
+            // See DetElemSlidingWindow::StoreSignalPoints, as default the mass of the electron
+            const EVENT::MCParticle* mcp = hit->getMCParticle();
+            double mass = 0.510e-3 * dd4hep::GeV;
+            if (mcp != nullptr)
+            {
+                h_mom_x[i] = mcp->getMomentum()[0] * dd4hep::GeV;
+                h_mom_y[i] = mcp->getMomentum()[1] * dd4hep::GeV;
+                h_mom_z[i] = mcp->getMomentum()[2] * dd4hep::GeV;
+                mass = max(mcp->getMass() * dd4hep::GeV, mass);
+            }
+            else
+            {
+                h_mom_x[i] = hit->getMomentum()[0];
+                h_mom_y[i] = hit->getMomentum()[1];
+                h_mom_z[i] = hit->getMomentum()[2];
+            }
+            h_mass[i] = mass;
+
+            auto& cell_id = cellid_decoder(hit);
+            h_layer[i] = cell_id["layer"];
+            h_ladder[i] = cell_id["module"];
+            h_sensor[i] = cell_id["sensor"];
+            h_side[i] = cell_id["side"];
+            m_layer = max(m_layer, h_layer[i]);
+            m_ladder = max(m_ladder, h_ladder[i]);
+        }
+    }
+
+    max_layer = m_layer;
+    max_ladder = m_ladder;
+}
+
+SimHitSnapshot::~SimHitSnapshot()
+{}
@@ -0,0 +1,130 @@
+#include "SparseFindUnion.h"
+
+#include <algorithm>
+
+SparseFindUnion::SparseFindUnion(int n_row, int n_col, bool hk8_on) :
+    rows(n_row),
+    columns(n_col),
+    HK8_enabled(hk8_on),
+    locate(n_row, n_col),
+    f_pixels(),
+    parent(),
+    c_index(),
+    clusters()
+{}
+
+void SparseFindUnion::init()
+{
+    f_pixels.clear();
+    clusters.clear();
+}
+
+void SparseFindUnion::add(int x, int y)
+{
+    if (x < 0 || x >= rows || y < 0 || y >= columns) return;
+    f_pixels.push_back(locate(x, y));
+}
+
+int SparseFindUnion::find(int idx)
+{
+    int res = idx;
+    while (parent[res] != res) res = parent[res];
+
+    while (parent[idx] != res)
+    {
+        int curr = parent[idx];
+        parent[idx] = res;
+        idx = curr;
+    }
+    return res;
+}
+
+void SparseFindUnion::merge(int idx1, int idx2)
+{
+    int pset1 = find(idx1);
+    int pset2 = find(idx2);
+    if (pset1 == pset2) return;
+
+    // the root is always the first pixel of the cluster
+    if (pset1 < pset2)
+    {
+        parent[pset2] = pset1;
+    }
+    else
+    {
+        parent[pset1] = pset2;
+    }
+}
+
+void SparseFindUnion::close()
+{
+    std::sort(f_pixels.begin(), f_pixels.end());
+    f_pixels.erase(std::unique(f_pixels.begin(), f_pixels.end()), f_pixels.end());
+
+    int n_pix = f_pixels.size();
+    parent.resize(n_pix);
+    for (int k = 0; k < n_pix; k++) parent[k] = k;
+
+    int curr_row = -2;
+    int row_first = 0;
+    int prev_first = 0;
+    int prev_last = 0;
+    int cursor = 0;
+
+    for (int k = 0; k < n_pix; k++)
+    {
+        int row = f_pixels[k] / columns;
+        int col = f_pixels[k] % columns;
+
+        if (row != curr_row)
+        {
+            // range of indexes of the previous row, empty if the row has no fired pixels
+            prev_first = (row == curr_row + 1) ? row_first : k;
+            prev_last = k;
+            cursor = prev_first;
+            curr_row = row;
+            row_first = k;
+        }
+
+        if (k > row_first && f_pixels[k - 1] == f_pixels[k] - 1)
+        {
+            merge(k - 1, k);
+        }
+
+        while (cursor < prev_last && f_pixels[cursor] % columns < col - 1) cursor++;
+
+        for (int q = cursor; q < prev_last && f_pixels[q] % columns <= col + 1; q++)
+        {
+            if (HK8_enabled || f_pixels[q] % columns == col) merge(q, k);
+        }
+    }
+
+    c_index.assign(n_pix, -1);
+    for (int k = 0; k < n_pix; k++)
+    {
+        int root = find(k);
+        if (c_index[root] < 0)
+        {
+            c_index[root] = clusters.size();
+            clusters.emplace_back();
+        }
+        clusters[c_index[root]].push_back(f_pixels[k]);
+    }
+}
+
+vector<ClusterOfCoordinate> SparseFindUnion::list_clusters()
+{
+    vector<ClusterOfCoordinate> result;
+    result.reserve(clusters.size());
+    for (const ClusterOfPixel& c_item : clusters)
+    {
+        ClusterOfCoordinate tmp_item;
+        tmp_item.reserve(c_item.size());
+        for (LinearPosition curr_pos : c_item)
+        {
+            tmp_item.push_back(locate(curr_pos));
+        }
+        result.push_back(std::move(tmp_item));
+    }
+    return result;
+}
@@ -0,0 +1,182 @@
+#include "StageProfiler.h"
+
+#include <iomanip>
+
+namespace
+{
+    const char* STAGE_NAMES[N_PROFILE_STAGES] = {
+        "index_build",
+        "signal_points",
+        "pixel_update",
+        "clock_step",
+        "clustering",
+        "lcio_creation",
+        "output_merge"
+    };
+
+    const char* COUNTER_NAMES[N_PROFILE_COUNTERS] = {
+        "sim_hits",
+        "clock_steps",
+        "skipped_steps",
+        "signal_points",
+        "fired_pixels",
+        "clusters",
+        "noise_pixels"
+    };
+}
+
+void LadderProfile::Reset(int l_layer, int l_ladder, int l_thread)
+{
+    layer = l_layer;
+    ladder = l_ladder;
+    thread = l_thread;
+    t_begin = ProfileClock();
+    t_end = t_begin;
+    for (int k = 0; k < N_PROFILE_STAGES; k++)
+    {
+        stage_begin[k] = 0.;
+        stage_time[k] = 0.;
+    }
+    for (int k = 0; k < N_PROFILE_COUNTERS; k++) counters[k] = 0;
+}
+
+StageProfiler::StageProfiler(TDirectory* out_dir, const std::string& trace_file) :
+    b_run(0),
+    b_event(0),
+    b_profile(),
+    e_profile(),
+    l_tree(nullptr),
+    e_tree(nullptr),
+    trace_out(),
+    trace_first(true)
+{
+    // The trees are owned by the directory, they are deleted when the file is closed
+    if (out_dir != nullptr)
+    {
+        l_tree = new TTree("LadderProfile", "Stages and counters of each ladder");
+        e_tree = new TTree("EventProfile", "Stages and counters of each event");
+        l_tree->SetDirectory(out_dir);
+        e_tree->SetDirectory(out_dir);
+        SetBranches(l_tree);
+        SetBranches(e_tree);
+    }
+
+    if (!trace_file.empty())
+    {
+        trace_out.open(trace_file, std::ios::out | std::ios::trunc);
+        if (trace_out) trace_out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+    }
+}
+
+StageProfiler::~StageProfiler()
+{
+    if (trace_out.is_open())
+    {
+        trace_out << std::endl << "]}" << std::endl;
+        trace_out.close();
+    }
+}
+
+void StageProfiler::Write()
+{
+    if (l_tree != nullptr) l_tree->Write();
+    if (e_tree != nullptr) e_tree->Write();
+}
+
+void StageProfiler::SetBranches(TTree* tree)
+{
+    tree->Branch("run", &b_run, "run/I");
+    tree->Branch("event", &b_event, "event/I");
+    tree->Branch("layer", &b_profile.layer, "layer/I");
+    tree->Branch("ladder", &b_profile.ladder, "ladder/I");
+    tree->Branch("thread", &b_profile.thread, "thread/I");
+    tree->Branch("t_begin", &b_profile.t_begin, "t_begin/D");
+    tree->Branch("t_end", &b_profile.t_end, "t_end/D");
+    for (int k = 0; k < N_PROFILE_STAGES; k++)
+    {
+        std::string b_name = std::string("t_") + STAGE_NAMES[k];
+        tree->Branch(b_name.c_str(), &b_profile.stage_time[k], (b_name + "/D").c_str());
+    }
+    for (int k = 0; k < N_PROFILE_COUNTERS; k++)
+    {
+        std::string b_name = std::string("n_") + COUNTER_NAMES[k];
+        tree->Branch(b_name.c_str(), &b_profile.counters[k], (b_name + "/L").c_str());
+    }
+}
+
+void StageProfiler::BeginEvent(int run, int event)
+{
+    b_run = run;
+    b_event = event;
+    e_profile.Reset(-1, -1, -1);
+}
+
+void StageProfiler::AddLadder(const LadderProfile& l_profile)
+{
+    b_profile = l_profile;
+    if (l_tree != nullptr) l_tree->Fill();
+
+    // The times of the ladders are summed over the threads
+    for (int k = 0; k < N_PROFILE_STAGES; k++) e_profile.stage_time[k] += l_profile.stage_time[k];
+    for (int k = 0; k < N_PROFILE_COUNTERS; k++) e_profile.counters[k] += l_profile.counters[k];
+
+    if (trace_out.is_open())
+    {
+        std::string name = "ladder " + std::to_string(l_profile.layer) + ":" + std::to_string(l_profile.ladder);
+        WriteTraceEvent(name, l_profile.thread, l_profile.t_begin, l_profile.t_end, &l_profile);
+    }
+}
+
+void StageProfiler::EndEvent()
+{
+    e_profile.t_end = ProfileClock();
+    b_profile = e_profile;
+    if (e_tree != nullptr) e_tree->Fill();
+
+    if (trace_out.is_open())
+    {
+        WriteTraceEvent("event " + std::to_string(b_event), -1, e_profile.t_begin, e_profile.t_end, nullptr);
+        for (int k : { int(ProfileStage::index_build), int(ProfileStage::output_merge) })
+        {
+            if (e_profile.stage_begin[k] == 0.) continue;
+            WriteTraceEvent(STAGE_NAMES[k], -1, e_profile.stage_begin[k],
+                            e_profile.stage_begin[k] + e_profile.stage_time[k], nullptr);
+        }
+        trace_out.flush();
+    }
+}
+
+void StageProfiler::WriteTraceEvent(const std::string& name, int tid, double t_begin, double t_end,
+                                    const LadderProfile* l_profile)
+{
+    trace_out << (trace_first ? "" : ",\n") << std::fixed << std::setprecision(3)
+              << "{\"name\":\"" << name << "\",\"cat\":\"" << (l_profile != nullptr ? "ladder" : "event")
+              << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << tid
+              << ",\"ts\":" << t_begin << ",\"dur\":" << t_end - t_begin;
+    trace_first = false;
+
+    if (l_profile != nullptr)
+    {
+        trace_out << ",\"args\":{\"event\":" << b_event;
+        for (int k = 0; k < N_PROFILE_STAGES; k++)
+        {
+            if (l_profile->stage_time[k] > 0.) trace_out << ",\"t_" << STAGE_NAMES[k] << "\":" << l_profile->stage_time[k];
+        }
+        for (int k = 0; k < N_PROFILE_COUNTERS; k++)
+        {
+            trace_out << ",\"n_" << COUNTER_NAMES[k] << "\":" << l_profile->counters[k];
+        }
+        trace_out << "}";
+    }
+    trace_out << "}";
+}
+
+const char* StageProfiler::StageName(int stage)
+{
+    return stage >= 0 && stage < N_PROFILE_STAGES ? STAGE_NAMES[stage] : "";
+}
+
+const char* StageProfiler::CounterName(int counter)
+{
+    return counter >= 0 && counter < N_PROFILE_COUNTERS ? COUNTER_NAMES[counter] : "";
+}
@@ -0,0 +1,130 @@
+#include "SurfaceCache.h"
+
+#include <UTIL/BitField64.h>
+#include <UTIL/LCTrackerConf.h>
+
+#include <algorithm>
+#include <limits>
+
+using UTIL::BitField64;
+using int_limits = std::numeric_limits<int>;
+
+SurfaceCache::SurfaceCache() :
+    f_side(),
+    f_layer(),
+    f_module(),
+    f_sensor(),
+    s_index(),
+    s_keys(),
+    surfaces()
+{}
+
+SurfaceCache::~SurfaceCache()
+{}
+
+void SurfaceCache::Clear()
+{
+    s_index.clear();
+    s_keys.clear();
+    surfaces.clear();
+}
+
+void SurfaceCache::Build(const SurfaceMap* s_map, const std::string& enc_str)
+{
+    Clear();
+    if (s_map == nullptr) return;
+
+    BitField64 bf_decoder { enc_str };
+    FieldCoder* coders[4] = { &f_side, &f_layer, &f_module, &f_sensor };
+    const std::string* f_names[4] = {
+        &lcio::LCTrackerCellID::side(),
+        &lcio::LCTrackerCellID::layer(),
+        &lcio::LCTrackerCellID::module(),
+        &lcio::LCTrackerCellID::sensor()
+    };
+
+    for (int k = 0; k < 4; k++)
+    {
+        coders[k]->offset = bf_decoder[*f_names[k]].offset();
+        coders[k]->width = bf_decoder[*f_names[k]].width();
+        coders[k]->is_signed = bf_decoder[*f_names[k]].isSigned();
+        coders[k]->min_value = int_limits::max();
+        coders[k]->n_values = 0;
+    }
+
+    // The range of each field is taken from the surfaces themselves
+    int max_values[4] = { int_limits::min(), int_limits::min(), int_limits::min(), int_limits::min() };
+    for (auto s_item : *s_map)
+    {
+        for (int k = 0; k < 4; k++)
+        {
+            int value = coders[k]->decode(s_item.first);
+            coders[k]->min_value = std::min(coders[k]->min_value, value);
+            max_values[k] = std::max(max_values[k], value);
+        }
+    }
+    if (s_map->empty()) return;
+
+    for (int k = 0; k < 4; k++) coders[k]->n_values = max_values[k] - coders[k]->min_value + 1;
+
+    s_index.assign(f_side.n_values * f_layer.n_values * f_module.n_values * f_sensor.n_values, -1);
+
+    for (auto s_item : *s_map)
+    {
+        int d_index = DenseIndex(s_item.first);
+        if (s_index[d_index] >= 0) continue;
+
+        const ISurface* surf = s_item.second;
+        CachedSurface c_surf;
+        c_surf.surface = surf;
+        c_surf.planar = surf->type().isPlane();
+        c_surf.u = surf->u();
+        c_surf.v = surf->v();
+        c_surf.normal = surf->normal();
+        c_surf.origin = surf->origin();
+
+        // See dd4hep::rec::Surface::globalToLocal
+        double uv = c_surf.u * c_surf.v;
+        c_surf.u_prime = (c_surf.u - uv * c_surf.v).unit();
+        c_surf.v_prime = (c_surf.v - uv * c_surf.u).unit();
+        c_surf.uup = c_surf.u * c_surf.u_prime;
+        c_surf.vvp = c_surf.v * c_surf.v_prime;
+
+        c_surf.u_direction[0] = c_surf.u.theta();
+        c_surf.u_direction[1] = c_surf.u.phi();
+        c_surf.v_direction[0] = c_surf.v.theta();
+        c_surf.v_direction[1] = c_surf.v.phi();
+
+        s_index[d_index] = surfaces.size();
+        surfaces.push_back(c_surf);
+        s_keys.push_back(s_item.first);
+    }
+}
+
+int SurfaceCache::DenseIndex(unsigned long cellID) const
+{
+    int side = f_side.decode(cellID) - f_side.min_value;
+    int layer = f_layer.decode(cellID) - f_layer.min_value;
+    int module = f_module.decode(cellID) - f_module.min_value;
+    int sensor = f_sensor.decode(cellID) - f_sensor.min_value;
+
+    if (side < 0 || side >= f_side.n_values) return -1;
+    if (layer < 0 || layer >= f_layer.n_values) return -1;
+    if (module < 0 || module >= f_module.n_values) return -1;
+    if (sensor < 0 || sensor >= f_sensor.n_values) return -1;
+
+    return ((side * f_layer.n_values + layer) * f_module.n_values + module) * f_sensor.n_values + sensor;
+}
+
+const CachedSurface* SurfaceCache::Find(unsigned long cellID) const
+{
+    if (surfaces.empty()) return nullptr;
+
+    int d_index = DenseIndex(cellID);
+    if (d_index < 0 || s_index[d_index] < 0) return nullptr;
+
+    // The fields not included in the index (e.g. the system) must match as well
+    int c_index = s_index[d_index];
+    if (s_keys[c_index] != cellID) return nullptr;
+    return &surfaces[c_index];
+}
@@ -1,5 +1,9 @@
 #include "TrivialSensor.h"
-#include "FindUnionAlgorithm.h"
+
+#include <algorithm>
+#include <limits>
+
+using int_limits = std::numeric_limits<int>;
 
 TrivialSensor::TrivialSensor(int layer,
                             int ladder,
@@ -15,7 +19,8 @@ TrivialSensor::TrivialSensor(int layer,
                             double thr,
                             float starttime,
                             float t_step,
-                            bool hk8_on) :
+                            bool hk8_on,
+                            bool sparse_on) :
     AbstractSensor(layer,
                    ladder,
                    xsegmentNumber,
@@ -31,21 +36,39 @@ TrivialSensor::TrivialSensor(int layer,
                    starttime,
                    t_step),
     pixels(),
+    touched_pix(),
     charged_pix(0),
     charged_on_sensor(),
+    fired_on_sensor(),
     clock_cnt(0),
-    HK8_enabled(hk8_on)
+    HK8_enabled(hk8_on),
+    sparse_enabled(sparse_on),
+    fu_algo(s_rows, s_colums),
+    sf_algo(s_rows, s_colums, hk8_on),
+    seg_algos(),
+    seg_lists()
 {
+    pixels.assign(l_rows * l_columns, 0);
     Reset();
 }
 
 TrivialSensor::~TrivialSensor() {}
 
+void TrivialSensor::Rebind(int ladder, float starttime)
+{
+    AbstractSensor::Rebind(ladder, starttime);
+    clock_cnt = 0;
+}
+
 void TrivialSensor::Reset()
 {
-    pixels.assign(l_rows * l_columns, 0);
+    // Only the pixels with some charge are cleared
+    for (LinearPosition lpos : touched_pix) pixels[lpos] = 0;
+    touched_pix.clear();
     charged_pix = 0;
     charged_on_sensor.assign(x_segnum * y_segnum, 0);
+    fired_on_sensor.resize(x_segnum * y_segnum);
+    for (auto& f_list : fired_on_sensor) f_list.clear();
 }
 
 void TrivialSensor::BeginClockStep()
@@ -59,6 +82,7 @@ void TrivialSensor::BeginClockStep()
 void TrivialSensor::UpdatePixel(int x, int y, float chrg)
 {
     LinearPosition lpos = l_locate(x, y);
+    if (pixels[lpos] == 0) touched_pix.push_back(lpos);
     float new_charge = pixels[lpos] + chrg;
 
     if (pixels[lpos] < _thr_level and new_charge >= _thr_level)
@@ -67,6 +91,7 @@ void TrivialSensor::UpdatePixel(int x, int y, float chrg)
         int m_row = x / GetSensorRows();
         int m_col = y / GetSensorCols();
         charged_on_sensor[s_locate(m_row, m_col)] += 1;
+        fired_on_sensor[s_locate(m_row, m_col)].push_back({ x, y });
     }
     pixels[lpos] = new_charge;
 }
@@ -76,6 +101,20 @@ void TrivialSensor::EndClockStep()
     clock_cnt += 1;
 }
 
+int TrivialSensor::GetIdleClockSteps()
+{
+    // The charged pixels are cleared by the next step
+    return charged_pix > 0 ? 0 : std::numeric_limits<int>::max();
+}
+
+void TrivialSensor::SkipClockSteps(int n)
+{
+    if (n <= 0) return;
+
+    if (charged_pix > 0) Reset();
+    clock_cnt += n;
+}
+
 PixelData TrivialSensor::GetPixel(int x, int y)
 {
     PixelData result { 0, 0, PixelStatus::off };
@@ -108,105 +147,167 @@ bool TrivialSensor::CheckStatus(int x, int y, PixelStatus pstat)
 
 void TrivialSensor::buildHits(SegmentDigiHitList& output)
 {
-    FindUnionAlgorithm  fu_algo { s_rows, s_colums };
     BitField64 bf_encoder = getBFEncoder();
 
     if (!IsActive()) return;
 
+    int n_segments = GetSegNumX() * GetSegNumY();
+    if (segment_tasks && sparse_enabled && n_segments > 1)
+    {
+        // See HKBaseSensor::buildHits, only the labelling runs in the tasks
+        if (int(seg_algos.size()) < n_segments)
+        {
+            seg_algos.resize(n_segments, sf_algo);
+            seg_lists.resize(n_segments);
+        }
+
+#pragma omp taskloop grainsize(1) default(shared)
+        for (int s_idx = 0; s_idx < n_segments; s_idx++)
+        {
+            LabelSegment(s_idx / GetSegNumY(), s_idx % GetSegNumY(), seg_algos[s_idx], seg_lists[s_idx]);
+        }
+
+        for (int s_idx = 0; s_idx < n_segments; s_idx++)
+        {
+            EmitClusters(s_idx / GetSegNumY(), s_idx % GetSegNumY(), bf_encoder, seg_lists[s_idx], output);
+        }
+        return;
+    }
+
+    vector<ClusterOfCoordinate> c_list;
     for (int h = 0; h < GetSegNumX(); h++)
     {
         for (int k = 0; k < GetSegNumY(); k++)
         {
-            if (charged_on_sensor[s_locate(h, k)] == 0) continue;
+            LabelSegment(h, k, sf_algo, c_list);
+            EmitClusters(h, k, bf_encoder, c_list, output);
+        }
+    }
+}
 
-            //Sensor segments ordered row first
-            LinearPosition sens_id = s_locate(h, k);
-            bf_encoder[LCTrackerCellID::sensor()] = sens_id;
+void TrivialSensor::LabelSegment(int h, int k, SparseFindUnion& s_algo, vector<ClusterOfCoordinate>& c_list)
+{
+    c_list.clear();
+    if (charged_on_sensor[s_locate(h, k)] == 0) return;
 
-            fu_algo.init();
+    LinearPosition sens_id = s_locate(h, k);
 
-            for (int i = 0; i < GetSensorRows(); i++)
+    if (sparse_enabled)
+    {
+        // Only the pixels over threshold are visited
+        s_algo.init();
+        for (const GridCoordinate& g_pos : fired_on_sensor[sens_id])
+        {
+            if (!CheckStatus(g_pos.row, g_pos.col, PixelStatus::on)) continue;
+            s_algo.add(LadderRowToSensorRow(g_pos.row, h), LadderColToSensorCol(g_pos.col, k));
+        }
+        s_algo.close();
+        c_list = s_algo.list_clusters();
+    }
+    else
+    {
+        fu_algo.init();
+
+        for (int i = 0; i < GetSensorRows(); i++)
+        {
+            for (int j = 0; j < GetSensorCols(); j++)
             {
-                for (int j = 0; j < GetSensorCols(); j++)
+                if (!checkStatus(h, k, i, j, PixelStatus::on))
                 {
-                    if (!checkStatus(h, k, i, j, PixelStatus::on))
-                    {
-                        fu_algo.invalidate(i, j);
-                        continue;
-                    }
-
-                    bool N_is_on = checkStatus(h, k, i - 1, j, PixelStatus::on);
-                    bool W_is_on = checkStatus(h, k, i, j - 1, PixelStatus::on);
-                    bool NW_is_on = HK8_enabled ? checkStatus(h, k, i - 1, j - 1, PixelStatus::on) : false;
-                    bool NE_is_on = HK8_enabled ? checkStatus(h, k, i - 1, j + 1, PixelStatus::on) : false;
-
-                    if (N_is_on and W_is_on)
-                    {
-                        fu_algo.merge(i - 1, j, i, j - 1);
-                        fu_algo.merge(i, j - 1, i, j);
-                    }
-                    else if (W_is_on and NE_is_on)
-                    {
-                        fu_algo.merge(i, j - 1, i - 1, j + 1);
-                        fu_algo.merge(i - 1, j + 1, i, j);
-                    }
-                    else if (NW_is_on and NE_is_on)
-                    {
-                        fu_algo.merge(i - 1, j - 1, i - 1, j + 1);
-                        fu_algo.merge(i - 1, j + 1, i, j);
-                    }
-                    else if (W_is_on)
-                    {
-                        fu_algo.merge(i, j - 1, i, j);
-                    }
-                    else if (N_is_on)
-                    {
-                        fu_algo.merge(i - 1, j, i, j);
-                    }
-                    else if (NW_is_on)
-                    {
-                        fu_algo.merge(i - 1, j - 1, i, j);
-                    }
-                    else if (NE_is_on)
-                    {
-                        fu_algo.merge(i - 1, j + 1, i, j);
-                    }
+                    fu_algo.invalidate(i, j);
+                    continue;
                 }
-            }
 
-            fu_algo.close();
+                bool N_is_on = checkStatus(h, k, i - 1, j, PixelStatus::on);
+                bool W_is_on = checkStatus(h, k, i, j - 1, PixelStatus::on);
+                bool NW_is_on = HK8_enabled ? checkStatus(h, k, i - 1, j - 1, PixelStatus::on) : false;
+                bool NE_is_on = HK8_enabled ? checkStatus(h, k, i - 1, j + 1, PixelStatus::on) : false;
 
-            for (ClusterOfCoordinate c_item : fu_algo.list_clusters())
-            {
-                // Very simple implementation: geometric mean
-                SegmentDigiHit digiHit = {
-                    0., 0., 0.,
-                    init_time + clock_cnt * clock_step,
-                    bf_encoder.lowWord(),
-                    {}
-                };
-                for (GridCoordinate gcoor : c_item)
+                if (N_is_on and W_is_on)
+                {
+                    fu_algo.merge(i - 1, j, i, j - 1);
+                    fu_algo.merge(i, j - 1, i, j);
+                }
+                else if (W_is_on and NE_is_on)
+                {
+                    fu_algo.merge(i, j - 1, i - 1, j + 1);
+                    fu_algo.merge(i - 1, j + 1, i, j);
+                }
+                else if (NW_is_on and NE_is_on)
+                {
+                    fu_algo.merge(i - 1, j - 1, i - 1, j + 1);
+                    fu_algo.merge(i - 1, j + 1, i, j);
+                }
+                else if (W_is_on)
+                {
+                    fu_algo.merge(i, j - 1, i, j);
+                }
+                else if (N_is_on)
+                {
+                    fu_algo.merge(i - 1, j, i, j);
+                }
+                else if (NW_is_on)
                 {
-                    int global_row = SensorRowToLadderRow(h, gcoor.row);
-                    int global_col = SensorColToLadderCol(k, gcoor.col);
+                    fu_algo.merge(i - 1, j - 1, i, j);
+                }
+                else if (NE_is_on)
+                {
+                    fu_algo.merge(i - 1, j + 1, i, j);
+                }
+            }
+        }
 
-                    digiHit.x += PixelRowToX(global_row);
-                    digiHit.y += PixelColToY(global_col);
+        fu_algo.close();
+        c_list = fu_algo.list_clusters();
+    }
+}
 
-                    PixelData p_data = GetPixel(global_row, global_col);
-                    digiHit.charge += p_data.charge;
+void TrivialSensor::EmitClusters(int h, int k, BitField64& bf_encoder, const vector<ClusterOfCoordinate>& c_list,
+                                 SegmentDigiHitList& output)
+{
+    //Sensor segments ordered row first
+    LinearPosition sens_id = s_locate(h, k);
+    bf_encoder[LCTrackerCellID::sensor()] = sens_id;
 
-                    fillInHitRelation(digiHit.sim_hits, l_locate(global_row, global_col));
-                }
+    for (const ClusterOfCoordinate& c_item : c_list)
+    {
+        // Very simple implementation: geometric mean
+        SegmentDigiHit digiHit = {
+            0., 0., 0.,
+            init_time + clock_cnt * clock_step,
+            bf_encoder.lowWord(),
+            {}
+        };
+        int row_min = int_limits::max();
+        int row_max = -1;
+        int col_min = int_limits::max();
+        int col_max = -1;
+        for (GridCoordinate gcoor : c_item)
+        {
+            int global_row = SensorRowToLadderRow(h, gcoor.row);
+            int global_col = SensorColToLadderCol(k, gcoor.col);
+            row_min = std::min(row_min, global_row);
+            row_max = std::max(row_max, global_row);
+            col_min = std::min(col_min, global_col);
+            col_max = std::max(col_max, global_col);
 
-                digiHit.x /= c_item.size();
-                digiHit.y /= c_item.size();
+            digiHit.x += PixelRowToX(global_row);
+            digiHit.y += PixelColToY(global_col);
 
-                digiHit.size = c_item.size();
+            PixelData p_data = GetPixel(global_row, global_col);
+            digiHit.charge += p_data.charge;
 
-                output.push_back(std::move(digiHit));
-            }
+            fillInHitRelation(digiHit.sim_hits, l_locate(global_row, global_col));
         }
+
+        digiHit.x /= c_item.size();
+        digiHit.y /= c_item.size();
+
+        digiHit.size = c_item.size();
+        digiHit.size_x = row_max - row_min + 1;
+        digiHit.size_y = col_max - col_min + 1;
+
+        output.push_back(std::move(digiHit));
     }
 }
 